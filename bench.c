@@ -0,0 +1,372 @@
+// Deterministic renderer benchmark. Build with build-bench.sh and run from the repository root so the textures load.
+// Each maze is generated from a fixed seed and every camera path is a pure function of the maze and frame number,
+// so two runs of the same build render exactly the same frames and their timings can be compared.
+//
+// maze-bench [-sizes 5,10,25,50,100,150] [-paths grid,free,ai] [-frames 300] [-warmup 30] [-seed 1] [-resolution 320x240] [-o results.csv] [-trace trace.json] [-perf]
+//
+// Writes one CSV row per maze size and camera path: the average milliseconds per frame spent in each profiler zone of a frame,
+// the median, 99th percentile and worst frame, and per frame averages of the pipeline counters: faces reaching, culled and clipped at each stage,
+// spans and pixels tested and written by the rasterizer, and pixels covered.
+// -perf adds instructions per cycle and L1D, LLC and branch misses per pixel tested for each zone and the whole frame, from hardware counters.
+#define MAZE_BENCH
+#include "main.c"
+
+enum
+{
+    BENCH_PATH_GRID,
+    BENCH_PATH_FREE,
+    BENCH_PATH_AI,
+    NUM_BENCH_PATHS
+};
+const char *bench_path_names[NUM_BENCH_PATHS] = {"grid", "free", "ai"};
+
+#define MAX_BENCH_SIZES 32
+
+typedef struct
+{
+    int num_cells;
+    int *cells; // Cell indices in the order they are visited
+} bench_route_t;
+
+// Shortest route from start to end, found by walking back down the weights from the end cell
+void BenchSolutionRoute(bench_route_t *route)
+{
+    unsigned int *weights;
+    MazeFindSolution(&maze, &weights);
+    int cell = maze.end.x + maze.end.y * maze.w;
+    route->num_cells = weights[cell] + 1;
+    route->cells = malloc(sizeof(int) * route->num_cells);
+    for (int i = route->num_cells - 1; i >= 0; --i)
+    {
+        route->cells[i] = cell;
+        if (i == 0)
+            break;
+        int x = cell % maze.w, z = cell / maze.w;
+        uint8_t directions = MazeCell(&maze, x, z);
+        if (x < maze.w - 1 && directions & MAZE_RIGHT && weights[cell + 1] == i - 1)
+            cell += 1;
+        else if (x > 0 && directions & MAZE_LEFT && weights[cell - 1] == i - 1)
+            cell -= 1;
+        else if (z < maze.h - 1 && directions & MAZE_UP && weights[cell + maze.w] == i - 1)
+            cell += maze.w;
+        else if (z > 0 && directions & MAZE_DOWN && weights[cell - maze.w] == i - 1)
+            cell -= maze.w;
+    }
+    free(weights);
+}
+
+// Every cell the AI visits, including backtracking, on its way from start to end
+void BenchAIRoute(bench_route_t *route)
+{
+    uint64_t *visited = MazeBitsCreate(maze.w * maze.h);
+    int *maze_stack = malloc(sizeof(int) * maze.w * maze.h);
+    int maze_stack_top = 0;
+    target_pos.x = maze.start.x;
+    target_pos.z = maze.start.y;
+    turn_target = 0;
+    maze_stack[0] = target_pos.x + target_pos.z * maze.w;
+    MazeBitSet(visited, maze_stack[0]);
+    // A depth first walk enters and leaves each cell at most once
+    int capacity = maze.w * maze.h * 2;
+    route->cells = malloc(sizeof(int) * capacity);
+    route->num_cells = 0;
+    route->cells[route->num_cells++] = maze_stack[0];
+    while (route->num_cells < capacity && (target_pos.x != maze.end.x || target_pos.z != maze.end.y))
+    {
+        AIStep(maze_stack, &maze_stack_top, visited);
+        route->cells[route->num_cells++] = target_pos.x + target_pos.z * maze.w;
+    }
+    free(maze_stack);
+    free(visited);
+}
+
+// Yaw that looks from one cell to a neighbouring one, matching the AI's turn_target * HALFPI
+float BenchYaw(int from, int to)
+{
+    if (to == from + 1)
+        return 0.f;
+    if (to == from - maze.w)
+        return HALFPI;
+    if (to == from - 1)
+        return PI;
+    return 3.f * HALFPI;
+}
+
+// Place cam the given fraction of the way along route
+void BenchCamera(bench_route_t *route, int path, float t, int frame)
+{
+    float position = t * (route->num_cells - 1);
+    int i = Min((int)position, Max(0, route->num_cells - 2));
+    int from = route->cells[i];
+    int to = route->num_cells > 1 ? route->cells[i + 1] : from;
+    float f = Min(1.f, position - i);
+    cam.pos.x = Lerp((from % maze.w) * maze.cell_size, (to % maze.w) * maze.cell_size, f) + maze.cell_size / 2.f;
+    cam.pos.z = Lerp((from / maze.w) * maze.cell_size, (to / maze.w) * maze.cell_size, f) + maze.cell_size / 2.f;
+    cam.pos.y = 2.5f;
+    cam.yaw = from == to ? 0.f : BenchYaw(from, to);
+    cam.pitch = HALFPI;
+    cam.roll = 0.f;
+    if (path == BENCH_PATH_FREE)
+    {
+        // Turn around fully every 4 seconds at 60fps and nod up and down, so every wall and the floor and ceiling get drawn
+        cam.yaw += (float)frame * TWOPI / 240.f;
+        cam.pitch += sin((float)frame * TWOPI / 150.f) * 1.2f;
+    }
+}
+
+// Parse a comma separated list of sizes
+int BenchParseSizes(char *text, int *sizes)
+{
+    int num_sizes = 0;
+    for (char *size = strtok(text, ","); size && num_sizes < MAX_BENCH_SIZES; size = strtok(NULL, ","))
+    {
+        sizes[num_sizes] = atoi(size);
+        if (sizes[num_sizes] < 5 || sizes[num_sizes] > MAX_MAZE_SIZE)
+        {
+            fprintf(stderr, "Skipping maze size %s, sizes must be 5 to %d\n", size, MAX_MAZE_SIZE);
+            continue;
+        }
+        ++num_sizes;
+    }
+    return num_sizes;
+}
+
+int main(int argc, char *argv[])
+{
+    int sizes[MAX_BENCH_SIZES] = {5, 10, 25, 50, 100, 150};
+    int num_sizes = 6;
+    bool run_path[NUM_BENCH_PATHS] = {true, true, true};
+    int num_frames = 300;
+    int num_warmup_frames = 30;
+    unsigned int seed = 1;
+    const char *output_path = 0;
+    internal_resolution_width = internal_resolutions[0][0];
+    internal_resolution_height = internal_resolutions[0][1];
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-sizes") && i + 1 < argc)
+        {
+            num_sizes = BenchParseSizes(argv[++i], sizes);
+        }
+        else if (!strcmp(argv[i], "-paths") && i + 1 < argc)
+        {
+            for (int path = 0; path < NUM_BENCH_PATHS; ++path)
+            {
+                run_path[path] = strstr(argv[i + 1], bench_path_names[path]) != NULL;
+            }
+            ++i;
+        }
+        else if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+        {
+            num_frames = atoi(argv[++i]);
+            num_frames = Max(1, num_frames);
+        }
+        else if (!strcmp(argv[i], "-warmup") && i + 1 < argc)
+        {
+            num_warmup_frames = atoi(argv[++i]);
+            num_warmup_frames = Max(0, num_warmup_frames);
+        }
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+        {
+            seed = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "-resolution") && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &internal_resolution_width, &internal_resolution_height) != 2 || internal_resolution_width < 1 || internal_resolution_height < 1)
+            {
+                fprintf(stderr, "Resolution must be given as WIDTHxHEIGHT\n");
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+            KPROF_CaptureStart();
+            atexit(SaveTrace);
+        }
+        else if (!strcmp(argv[i], "-perf"))
+        {
+            perf_counters = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    FILE *output = stdout;
+    if (output_path && !(output = fopen(output_path, "w")))
+    {
+        fprintf(stderr, "Failed to open %s\n", output_path);
+        return -1;
+    }
+
+    // Nothing is shown, so never open a window
+    setenv("KP_HEADLESS", "1", 0);
+    KPROF_ThreadName("Main");
+    KPROF_StatsAttach(&frame_stats);
+    if (perf_counters && !KPROF_PerfStart())
+    {
+        fprintf(stderr, "Hardware counters are unavailable, leaving out the -perf columns\n");
+        perf_counters = false;
+    }
+    KP_Init(&platform, internal_resolution_width, internal_resolution_height, "Maze95 bench");
+    KS_ThreadsInit(0);
+
+    render_frame_capacity = internal_resolution_width * internal_resolution_height;
+    render_frame.pixels = (uint32_t *)malloc(sizeof(uint32_t) * render_frame_capacity);
+    render_frame.w = internal_resolution_width;
+    render_frame.h = internal_resolution_height;
+    aspect_ratio = (float)internal_resolution_width / (float)internal_resolution_height;
+    depth_buffer = (float *)malloc(render_frame_capacity * sizeof(float));
+    if (!LoadAssets())
+    {
+        fprintf(stderr, "Failed to load textures. Run from the repository root.\n");
+        return -1;
+    }
+    K3D_CreateDodecahedron(dodecahedron, 0.5f);
+
+    bool header_written = false;
+    for (int size_it = 0; size_it < num_sizes; ++size_it)
+    {
+        maze_size = sizes[size_it];
+        srand(seed);
+        RestartMaze();
+
+        for (int path = 0; path < NUM_BENCH_PATHS; ++path)
+        {
+            if (!run_path[path])
+                continue;
+            bench_route_t route;
+            if (path == BENCH_PATH_AI)
+            {
+                BenchAIRoute(&route);
+            }
+            else
+            {
+                BenchSolutionRoute(&route);
+            }
+            // Dodecahedrons start from the same rotation on every path
+            for (int i = 0; i < num_dodecahedrons; ++i)
+            {
+                dodecahedrons[i].active = true;
+                dodecahedrons[i].rot = Vec3Make(0, 0, 0);
+            }
+
+            kprof_frame_t profile;
+            double stage_times[KERO_PROFILE_MAX_FRAME_ZONES] = {0};
+            double frame_time = 0;
+            uint64_t stage_counters[KERO_PROFILE_MAX_FRAME_ZONES][KPROF_NUM_COUNTERS] = {0}, frame_counters[KPROF_NUM_COUNTERS] = {0};
+            uint64_t world_faces = 0, cam_faces = 0, view_faces = 0, pixels = 0;
+            uint64_t backface_culled = 0, near_culled = 0, near_clipped_1 = 0, near_clipped_2 = 0, offscreen = 0;
+            k3d_stats_t raster = {0};
+            for (int frame = -num_warmup_frames; frame < num_frames; ++frame)
+            {
+                int path_frame = Max(0, frame);
+                if (frame == 0)
+                {
+                    memset(&frame_stats, 0, sizeof(frame_stats));
+                }
+                KPROF_Begin("Frame");
+                BenchCamera(&route, path, num_frames > 1 ? (float)path_frame / (float)(num_frames - 1) : 0.f, path_frame);
+                for (int i = 0; i < num_dodecahedrons; ++i)
+                {
+                    dodecahedrons[i].rot.V[i % 3] += 1.f / 60.f;
+                }
+                KPROF_Begin("Clear buffers");
+                memset(depth_buffer, 0, internal_resolution_width * internal_resolution_height * sizeof(float));
+                KPROF_End();
+                RenderWorld();
+                KPROF_End();
+                if (frame < 0)
+                    continue;
+
+                KPROF_LastFrame(&profile);
+                for (int stage = 0; stage < profile.num_zones; ++stage)
+                {
+                    stage_times[stage] += (profile.zones[stage].end - profile.zones[stage].start) / 1e6;
+                }
+                frame_time += (profile.zone.end - profile.zone.start) / 1e6;
+                for (int counter = 0; counter < KPROF_NUM_COUNTERS; ++counter)
+                {
+                    for (int stage = 0; stage < profile.num_zones; ++stage)
+                    {
+                        stage_counters[stage][counter] += profile.zones[stage].counters[counter];
+                    }
+                    frame_counters[counter] += profile.zone.counters[counter];
+                }
+                world_faces += num_world_faces;
+                cam_faces += num_cam_faces;
+                view_faces += num_view_faces;
+                backface_culled += pipeline_counters.backface_culled;
+                near_culled += pipeline_counters.near_culled;
+                near_clipped_1 += pipeline_counters.near_clipped_1;
+                near_clipped_2 += pipeline_counters.near_clipped_2;
+                offscreen += pipeline_counters.offscreen;
+                raster.spans += k3d_stats.spans;
+                raster.pixels_tested += k3d_stats.pixels_tested;
+                raster.pixels_written += k3d_stats.pixels_written;
+                for (int i = 0; i < internal_resolution_width * internal_resolution_height; ++i)
+                {
+                    pixels += depth_buffer[i] != 0;
+                }
+            }
+
+            if (!header_written)
+            {
+                fprintf(output, "size,seed,path,frames,width,height,maze_faces,world_faces,backface_culled,near_culled,near_clipped_1,near_clipped_2,cam_faces,view_faces,offscreen_faces,spans,pixels_tested,pixels_written,pixels");
+                for (int stage = 0; stage < profile.num_zones; ++stage)
+                {
+                    fprintf(output, ",%s ms", profile.zones[stage].name);
+                }
+                fprintf(output, ",frame ms,frame p50 ms,frame p99 ms,frame max ms");
+                if (perf_counters)
+                {
+                    for (int stage = 0; stage <= profile.num_zones; ++stage)
+                    {
+                        const char *name = stage < profile.num_zones ? profile.zones[stage].name : "frame";
+                        fprintf(output, ",%s IPC", name);
+                        fprintf(output, ",%s %s/px,%s %s/px,%s %s/px", name, kprof_counter_names[KPROF_COUNTER_L1D_MISSES], name, kprof_counter_names[KPROF_COUNTER_LLC_MISSES], name, kprof_counter_names[KPROF_COUNTER_BRANCH_MISSES]);
+                    }
+                }
+                fprintf(output, "\n");
+                header_written = true;
+            }
+            fprintf(output, "%d,%u,%s,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f", maze_size, seed, bench_path_names[path], num_frames, internal_resolution_width, internal_resolution_height, num_maze_faces,
+                    (double)world_faces / num_frames, (double)backface_culled / num_frames, (double)near_culled / num_frames, (double)near_clipped_1 / num_frames, (double)near_clipped_2 / num_frames,
+                    (double)cam_faces / num_frames, (double)view_faces / num_frames, (double)offscreen / num_frames, (double)raster.spans / num_frames, (double)raster.pixels_tested / num_frames,
+                    (double)raster.pixels_written / num_frames, (double)pixels / num_frames);
+            for (int stage = 0; stage < profile.num_zones; ++stage)
+            {
+                fprintf(output, ",%.4f", stage_times[stage] / num_frames);
+            }
+            kprof_series_t *frame_series = KPROF_StatsSeries(&frame_stats, "Frame");
+            fprintf(output, ",%.4f,%.4f,%.4f,%.4f", frame_time / num_frames, KPROF_HistogramPercentile(&frame_series->session, 50) / 1e6, KPROF_HistogramPercentile(&frame_series->session, 99) / 1e6, frame_series->session.max / 1e6);
+            if (perf_counters)
+            {
+                for (int stage = 0; stage <= profile.num_zones; ++stage)
+                {
+                    uint64_t *counters = stage < profile.num_zones ? stage_counters[stage] : frame_counters;
+                    double pixels_tested = Max(1, raster.pixels_tested);
+                    fprintf(output, ",%.3f,%.4f,%.4f,%.4f", counters[KPROF_COUNTER_CYCLES] ? (double)counters[KPROF_COUNTER_INSTRUCTIONS] / counters[KPROF_COUNTER_CYCLES] : 0.0, counters[KPROF_COUNTER_L1D_MISSES] / pixels_tested,
+                            counters[KPROF_COUNTER_LLC_MISSES] / pixels_tested, counters[KPROF_COUNTER_BRANCH_MISSES] / pixels_tested);
+                }
+            }
+            fprintf(output, "\n");
+            fflush(output);
+            free(route.cells);
+        }
+    }
+
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    return 0;
+}
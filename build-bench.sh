@@ -0,0 +1 @@
+gcc -no-pie -std=gnu99 -I. -I croaking-kero-c-libraries/include -I stb bench.c -lX11 -lXext -lXrender -lm -lpthread -o maze-bench -O3
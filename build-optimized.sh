@@ -1 +1,8 @@
-gcc -no-pie -std=gnu99 -I. -I croaking-kero-c-libraries/include -I stb main.c -lX11 -lm -lpthread -o maze95 -O3
+# Raw mouse motion for free look needs the XInput 2 headers (libxi-dev). Without them KP_SetRawMouse() fails and the game warps the pointer instead.
+if echo '#include <X11/extensions/XInput2.h>' | gcc -E - >/dev/null 2>&1; then
+    XINPUT2_FLAGS=-DKERO_PLATFORM_XINPUT2
+    XINPUT2_LIBS=-lXi
+else
+    echo "XInput 2 headers not found, building without raw mouse motion" >&2
+fi
+gcc -no-pie -std=gnu99 -I. -I croaking-kero-c-libraries/include -I stb $XINPUT2_FLAGS main.c $XINPUT2_LIBS -lX11 -lXext -lXrender -lm -lpthread -o maze95 -O3
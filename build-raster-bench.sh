@@ -0,0 +1 @@
+gcc -no-pie -std=gnu99 -I. -I croaking-kero-c-libraries/include -I stb rasterbench.c -lX11 -lXext -lXrender -lm -lpthread -o raster-bench -O3
@@ -0,0 +1,251 @@
+/*
+Kero Capture records frames to a video file without slowing the program down.
+
+Frames are copied into a fixed pool of buffers when submitted. A writer thread converts them to YUV 4:2:0 (BT.601, limited range) and writes them to a .y4m file, or to raw planar YUV when the file name ends in .yuv. Frames that arrive while every buffer is still waiting to be written are dropped and counted instead of blocking the caller.
+
+Link with -lpthread.
+*/
+
+#ifndef KERO_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+    
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+    
+#ifndef KERO_CAPTURE_MAX_BUFFERS
+#define KERO_CAPTURE_MAX_BUFFERS 16
+#endif
+    
+#define KERO_CAPTURE_MIN(a, b) ((a)<(b)?(a):(b))
+    
+    typedef struct {
+        uint32_t* pixels; // 0x00RRGGBB
+        unsigned int w, h;
+    } kcap_buffer_t;
+    
+    typedef struct {
+        FILE* file;
+        bool raw; // No Y4M headers
+        unsigned int w, h; // Size of the video. Frames of other sizes are scaled to it.
+        unsigned int capacity; // Pixels per buffer
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        bool running;
+        int num_buffers;
+        kcap_buffer_t buffers[KERO_CAPTURE_MAX_BUFFERS];
+        int queue[KERO_CAPTURE_MAX_BUFFERS]; // Filled buffers in submission order
+        int queue_start, queue_count;
+        int free_buffers[KERO_CAPTURE_MAX_BUFFERS];
+        int num_free;
+        uint8_t* yuv; // Writer thread's conversion buffer
+        unsigned int frames_submitted, frames_written, frames_dropped;
+        bool write_failed;
+    } kcapture_t;
+    
+    //------------------------------------------------------------
+    
+    /*
+     Usage
+    
+    kcapture_t capture;
+    KCAP_Start(&capture, "gameplay.y4m", 320, 240, 60, 320*240, 8);
+    while(running) {
+        ...draw frame...
+        KCAP_Submit(&capture, frame.pixels, frame.w, frame.h);
+    }
+    KCAP_Stop(&capture);
+    */
+    
+    bool KCAP_Start(kcapture_t* capture, const char* const path, unsigned int w, unsigned int h, unsigned int fps, unsigned int capacity, int num_buffers);
+    /*
+    Open path and start the writer thread. The video is w*h at fps frames per second.
+    capacity is the largest number of pixels a submitted frame can have, num_buffers (2 to KERO_CAPTURE_MAX_BUFFERS) how many frames can wait to be written. Memory use is fixed at num_buffers*capacity pixels.
+    Returns false if the file or thread can't be created.
+    */
+    
+    bool KCAP_Submit(kcapture_t* capture, const uint32_t* pixels, unsigned int w, unsigned int h);
+    /*
+    Copy a frame to be written. Only waits for the copy.
+    Returns false and counts a dropped frame when every buffer is still queued, or the frame is larger than capacity.
+    */
+    
+    void KCAP_Stop(kcapture_t* capture);
+    /*
+    Write the frames still queued, stop the writer thread and close the file.
+    */
+    
+    //------------------------------------------------------------
+    
+    static inline uint8_t KCAP_Luma(uint32_t pixel) {
+        int r = (pixel >> 16) & 0xff, g = (pixel >> 8) & 0xff, b = pixel & 0xff;
+        return ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+    }
+    
+    // Scale (nearest neighbour) and convert one frame to planar YUV 4:2:0. Chroma is the average of each 2x2 block.
+    static void KCAP_ConvertFrame(kcapture_t* capture, const kcap_buffer_t* frame) {
+        unsigned int w = capture->w, h = capture->h;
+        unsigned int chroma_w = (w + 1)/2, chroma_h = (h + 1)/2;
+        uint8_t* y_plane = capture->yuv;
+        uint8_t* u_plane = y_plane + w*h;
+        uint8_t* v_plane = u_plane + chroma_w*chroma_h;
+        uint32_t step_x = (uint32_t)(((uint64_t)frame->w << 16)/w);
+        uint32_t step_y = (uint32_t)(((uint64_t)frame->h << 16)/h);
+        for(unsigned int cy = 0; cy < chroma_h; ++cy) {
+            const uint32_t* rows[2];
+            for(int i = 0; i < 2; ++i) {
+                unsigned int y = KERO_CAPTURE_MIN(cy*2 + i, h - 1);
+                rows[i] = frame->pixels + ((y*step_y + step_y/2) >> 16)*frame->w;
+            }
+            for(unsigned int cx = 0; cx < chroma_w; ++cx) {
+                int r = 0, g = 0, b = 0;
+                for(int i = 0; i < 4; ++i) {
+                    unsigned int x = KERO_CAPTURE_MIN(cx*2 + (i & 1), w - 1);
+                    unsigned int y = cy*2 + (i >> 1);
+                    uint32_t pixel = rows[i >> 1][(x*step_x + step_x/2) >> 16];
+                    if(y < h) {
+                        y_plane[y*w + x] = KCAP_Luma(pixel);
+                    }
+                    r += (pixel >> 16) & 0xff;
+                    g += (pixel >> 8) & 0xff;
+                    b += pixel & 0xff;
+                }
+                r = (r + 2)/4;
+                g = (g + 2)/4;
+                b = (b + 2)/4;
+                u_plane[cy*chroma_w + cx] = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+                v_plane[cy*chroma_w + cx] = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
+            }
+        }
+    }
+    
+    static void* KCAP_WriterMain(void* data) {
+        kcapture_t* capture = (kcapture_t*)data;
+        size_t frame_size = capture->w*capture->h + 2*((capture->w + 1)/2)*((capture->h + 1)/2);
+        pthread_mutex_lock(&capture->mutex);
+        while(true) {
+            while(capture->running && !capture->queue_count) {
+                pthread_cond_wait(&capture->cond, &capture->mutex);
+            }
+            if(!capture->queue_count) break;
+            int buffer = capture->queue[capture->queue_start];
+            bool write_failed = capture->write_failed;
+            pthread_mutex_unlock(&capture->mutex);
+            
+            if(!write_failed) {
+                KCAP_ConvertFrame(capture, &capture->buffers[buffer]);
+                if((!capture->raw && fputs("FRAME\n", capture->file) == EOF) || fwrite(capture->yuv, 1, frame_size, capture->file) != frame_size) {
+                    fprintf(stderr, "Failed to write captured frame, stopping capture\n");
+                    write_failed = true;
+                }
+            }
+            
+            pthread_mutex_lock(&capture->mutex);
+            // The buffer only goes back to the pool once it has been converted
+            capture->queue_start = (capture->queue_start + 1)%capture->num_buffers;
+            --capture->queue_count;
+            capture->free_buffers[capture->num_free++] = buffer;
+            capture->write_failed = write_failed;
+            if(!write_failed) {
+                ++capture->frames_written;
+            }
+        }
+        pthread_mutex_unlock(&capture->mutex);
+        return NULL;
+    }
+    
+    bool KCAP_Start(kcapture_t* capture, const char* const path, unsigned int w, unsigned int h, unsigned int fps, unsigned int capacity, int num_buffers) {
+        if(w == 0 || h == 0 || capacity == 0) return false;
+        if(num_buffers < 2) num_buffers = 2;
+        if(num_buffers > KERO_CAPTURE_MAX_BUFFERS) num_buffers = KERO_CAPTURE_MAX_BUFFERS;
+        capture->file = fopen(path, "wb");
+        if(!capture->file) {
+            fprintf(stderr, "Failed to open capture file %s\n", path);
+            return false;
+        }
+        size_t length = strlen(path);
+        capture->raw = length > 4 && !strcmp(path + length - 4, ".yuv");
+        if(!capture->raw) {
+            fprintf(capture->file, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", w, h, fps);
+        }
+        capture->w = w;
+        capture->h = h;
+        capture->capacity = capacity;
+        capture->num_buffers = num_buffers;
+        capture->queue_start = capture->queue_count = 0;
+        capture->num_free = num_buffers;
+        for(int i = 0; i < num_buffers; ++i) {
+            capture->buffers[i].pixels = (uint32_t*)malloc(sizeof(uint32_t)*capacity);
+            capture->free_buffers[i] = i;
+        }
+        capture->yuv = (uint8_t*)malloc(w*h + 2*((w + 1)/2)*((h + 1)/2));
+        capture->frames_submitted = capture->frames_written = capture->frames_dropped = 0;
+        capture->write_failed = false;
+        pthread_mutex_init(&capture->mutex, NULL);
+        pthread_cond_init(&capture->cond, NULL);
+        capture->running = true;
+        if(pthread_create(&capture->thread, NULL, KCAP_WriterMain, capture)) {
+            fprintf(stderr, "Failed to start capture thread\n");
+            capture->running = false;
+            for(int i = 0; i < num_buffers; ++i) {
+                free(capture->buffers[i].pixels);
+            }
+            free(capture->yuv);
+            fclose(capture->file);
+            return false;
+        }
+        return true;
+    }
+    
+    bool KCAP_Submit(kcapture_t* capture, const uint32_t* pixels, unsigned int w, unsigned int h) {
+        pthread_mutex_lock(&capture->mutex);
+        ++capture->frames_submitted;
+        if(!capture->num_free || w*h > capture->capacity || w == 0 || h == 0 || capture->write_failed) {
+            ++capture->frames_dropped;
+            pthread_mutex_unlock(&capture->mutex);
+            return false;
+        }
+        int buffer = capture->free_buffers[--capture->num_free];
+        pthread_mutex_unlock(&capture->mutex);
+    
+        memcpy(capture->buffers[buffer].pixels, pixels, sizeof(uint32_t)*w*h);
+        capture->buffers[buffer].w = w;
+        capture->buffers[buffer].h = h;
+    
+        pthread_mutex_lock(&capture->mutex);
+        capture->queue[(capture->queue_start + capture->queue_count)%capture->num_buffers] = buffer;
+        ++capture->queue_count;
+        pthread_cond_signal(&capture->cond);
+        pthread_mutex_unlock(&capture->mutex);
+        return true;
+    }
+    
+    void KCAP_Stop(kcapture_t* capture) {
+        if(!capture->running) return;
+        pthread_mutex_lock(&capture->mutex);
+        capture->running = false;
+        pthread_cond_signal(&capture->cond);
+        pthread_mutex_unlock(&capture->mutex);
+        pthread_join(capture->thread, NULL);
+        fclose(capture->file);
+        for(int i = 0; i < capture->num_buffers; ++i) {
+            free(capture->buffers[i].pixels);
+        }
+        free(capture->yuv);
+        pthread_mutex_destroy(&capture->mutex);
+        pthread_cond_destroy(&capture->cond);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define KERO_CAPTURE_H
+#endif
@@ -36,6 +36,7 @@ extern "C"{
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "stretchy_buffer.h"
 #include "kero_sprite.h"
 #include "kero_vec2.h"
@@ -43,9 +44,10 @@ extern "C"{
     typedef struct {
         int w, h, cell_size;
         vec2i_t start, end;
-        uint8_t* cells;
+        uint8_t* passages;
     } maze_t;
-    // cells must be initialized to 0 or calling MazeFree() or any Generate() functions will segfault as they try to free() cells.
+    // passages must be initialized to 0 or calling MazeFree() or any Generate() functions will segfault as they try to free() passages.
+    // passages holds 2 bits per cell, 4 cells to a byte: whether the cell opens to the right and whether it opens up. Left and down are the right and up bits of the neighbours. Read cells with MazeCell() and open them with MazeConnect().
     
     typedef struct{
         vec2_t a, b;
@@ -58,7 +60,6 @@ extern "C"{
         MAZE_DOWN = 0b1000,
         MAZE_DIRECTION_COUNT = 4
     } MAZE_DIRECTION;
-    const uint8_t MAZE_CELL_VISITED = 0b10000000;
     
     
     
@@ -75,6 +76,18 @@ extern "C"{
  Persistence = 2 seems to be a sweet spot for modest corridors with plenty of forking and an off-radial texture.
     */
     
+    bool MazeGeneratePersistentWalkSeeded(maze_t* maze, wall_t** walls, int w, int h, int cell_size, float persistence, uint32_t seed, ksprite_t* frame_buffer, kero_platform_t *platform);
+    /*
+    MazeGeneratePersistentWalk() from its own seed instead of rand(), so several can run on different threads at once. platform may be NULL when frame_buffer is.
+    */
+    
+    bool MazeGenerateTiled(maze_t* maze, wall_t** walls, int w, int h, int cell_size, float persistence, int tile_size, int num_threads);
+    /*
+    Splits the maze into tile_size square tiles, generates each one as its own persistent walk, then opens one door along each edge of a spanning tree over the tiles, so the result is still a perfect maze. The doors are the only openings between tiles, so tile_size should be large enough that the seams don't show, such as 256.
+ With KERO_MAZE_THREADS defined the tiles are shared between num_threads threads, counting the calling thread. 0 uses one thread per online CPU. Otherwise they're generated on the calling thread.
+ Each tile's seed comes from a single rand() call and the tile's position, so srand() decides the maze whichever thread generates each tile.
+    */
+    
     bool MazeGenerateShortWalk(maze_t* maze, wall_t** walls, int w, int h, int cell_size, ksprite_t* frame_buffer, kero_platform_t *platform);
     /*
          Similar in texture to Prim's or Aldous-Broder.
@@ -109,40 +122,187 @@ extern "C"{
     
     void MazeFree(maze_t* maze);
     /*
-    Free memory used by maze.cells and set to NULL. Called automatically by each generate() function so does not need to be called to generate a new maze.
+    Free memory used by maze.passages and set to NULL. Called automatically by each generate() function so does not need to be called to generate a new maze.
+    */
+    
+    static inline uint8_t MazeCell(maze_t* maze, int x, int y);
+    /*
+    The directions cell x, y opens in, as MAZE_LEFT | MAZE_UP | MAZE_RIGHT | MAZE_DOWN bits. Only reads the maze, so any number of threads can call it at once.
+    */
+    
+    static inline void MazeConnect(maze_t* maze, int x, int y, MAZE_DIRECTION direction);
+    /*
+    Open a passage from cell x, y in one direction. Opening left or down sets the neighbour's right or up bit.
+    */
+    
+    static inline uint64_t* MazeBitsCreate(int count);
+    static inline bool MazeBitGet(uint64_t* bits, int i);
+    static inline void MazeBitSet(uint64_t* bits, int i);
+    /*
+    Cleared bitsets for an algorithm's own per cell state, such as which cells it has visited, so nothing is stored in the maze itself. Free with free().
     */
     
-#define KMazeFMod(numerator, denominator) ((numerator) - (int)((numerator)/(denominator))*(denominator))
+#define MAZE_PERSISTENCE_ONE 256
     /*
-    Just used internally to avoid depending on an external math lib
+    Persistence is carried between walk steps in 1/256ths of an attempt, so it's integer work rather than a float fmod on every step
+    */
+    
+    typedef struct {
+        int* cells;
+        int* index; // Position of each maze cell in cells, or -1
+        int count;
+        uint64_t* visited;
+    } maze_frontier_t;
+    /*
+    Used internally by the generators that restart from a random visited cell. Holds exactly the visited cells that still have an unvisited neighbour, so a random pick never has to be rejected, and cells are swap-removed in constant time.
     */
     
     
     
     // Function definitions
     
+    static inline uint8_t MazeCell(maze_t* maze, int x, int y) {
+        int cell = x + y*maze->w;
+        int bits = maze->passages[cell >> 2] >> (cell & 3)*2;
+        uint8_t directions = (bits & 1 ? MAZE_RIGHT : 0) | (bits & 2 ? MAZE_UP : 0);
+        if(x > 0 && maze->passages[(cell-1) >> 2] >> ((cell-1) & 3)*2 & 1) directions |= MAZE_LEFT;
+        if(y > 0 && maze->passages[(cell-maze->w) >> 2] >> ((cell-maze->w) & 3)*2 & 2) directions |= MAZE_DOWN;
+        return directions;
+    }
+    
+    static inline void MazeConnect(maze_t* maze, int x, int y, MAZE_DIRECTION direction) {
+        int cell = x + y*maze->w;
+        switch(direction) {
+            case MAZE_LEFT: --cell; // Fall through to the right bit of the cell on the left
+            case MAZE_RIGHT: maze->passages[cell >> 2] |= 1 << (cell & 3)*2; break;
+            case MAZE_DOWN: cell -= maze->w; // Fall through to the up bit of the cell below
+            case MAZE_UP: maze->passages[cell >> 2] |= 2 << (cell & 3)*2; break;
+            default: break;
+        }
+    }
+    
+    static inline uint64_t* MazeBitsCreate(int count) {
+        return (uint64_t*)calloc((count + 63)/64, sizeof(uint64_t));
+    }
+    
+    static inline bool MazeBitGet(uint64_t* bits, int i) {
+        return bits[i >> 6] >> (i & 63) & 1;
+    }
+    
+    static inline void MazeBitSet(uint64_t* bits, int i) {
+        bits[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+    
+    // The passages of a w by h maze, rounded up to whole bytes
+    static inline uint8_t* MazePassagesCreate(int w, int h) {
+        return (uint8_t*)calloc((w*h + 3)/4, 1);
+    }
+    
+    // xorshift32 seeded from rand(), so srand() still decides the maze. rand() takes a lock on every call, which was most of the time spent generating big mazes.
+    static inline uint32_t MazeRandom(uint32_t* state) {
+        uint32_t x = *state;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return *state = x;
+    }
+    
+    // Uniform in [0, n) without a division
+    static inline int MazeRandomBelow(uint32_t* state, int n) {
+        return (int)(((uint64_t)MazeRandom(state)*(uint32_t)n) >> 32);
+    }
+    
+    // The directions out of visited cell x, y that lead to unvisited cells, as MAZE_DIRECTION bits. Off the edge it looks at the cell itself instead, which is visited, so there's no branch per side.
+    static inline uint8_t MazeUnvisitedNeighbours(maze_t* maze, uint64_t* visited, int x, int y) {
+        int cell = x + y*maze->w;
+        return (MazeBitGet(visited, x > 0 ? cell-1 : cell) ? 0 : MAZE_LEFT)
+            | (MazeBitGet(visited, y < maze->h-1 ? cell+maze->w : cell) ? 0 : MAZE_UP)
+            | (MazeBitGet(visited, x < maze->w-1 ? cell+1 : cell) ? 0 : MAZE_RIGHT)
+            | (MazeBitGet(visited, y > 0 ? cell-maze->w : cell) ? 0 : MAZE_DOWN);
+    }
+    
+    static void MazeFrontierCreate(maze_frontier_t* frontier, maze_t* maze) {
+        frontier->cells = (int*)malloc(sizeof(int)*maze->w*maze->h);
+        frontier->index = (int*)malloc(sizeof(int)*maze->w*maze->h);
+        for(int i = 0; i < maze->w*maze->h; ++i) {
+            frontier->index[i] = -1;
+        }
+        frontier->count = 0;
+        frontier->visited = MazeBitsCreate(maze->w*maze->h);
+    }
+    
+    static void MazeFrontierFree(maze_frontier_t* frontier) {
+        free(frontier->cells);
+        free(frontier->index);
+        free(frontier->visited);
+    }
+    
+    // Remove a visited cell if it's in the frontier but has no unvisited neighbours left, drawing it grey if a frame buffer is given
+    static inline void MazeFrontierPrune(maze_frontier_t* frontier, maze_t* maze, int x, int y, ksprite_t* frame_buffer) {
+        int cell = x + y*maze->w;
+        int i = frontier->index[cell];
+        if(i < 0 || MazeUnvisitedNeighbours(maze, frontier->visited, x, y)) return;
+        int last = frontier->cells[--frontier->count];
+        frontier->cells[i] = last;
+        frontier->index[last] = i;
+        frontier->index[cell] = -1;
+        if(frame_buffer) {
+            MazeDrawCell(maze, x, y, frame_buffer, 0xffbbbbbb);
+        }
+    }
+    
+    // Mark a cell visited, add it to the frontier unless it's already a dead end and drop any neighbours that visiting it left with nowhere to go. Returns the cell's unvisited neighbours.
+    static uint8_t MazeFrontierVisit(maze_frontier_t* frontier, maze_t* maze, int x, int y, ksprite_t* frame_buffer) {
+        int cell = x + y*maze->w;
+        MazeBitSet(frontier->visited, cell);
+        uint8_t unvisited = MazeUnvisitedNeighbours(maze, frontier->visited, x, y);
+        if(unvisited) {
+            frontier->index[cell] = frontier->count;
+            frontier->cells[frontier->count++] = cell;
+        }
+        else if(frame_buffer) {
+            MazeDrawCell(maze, x, y, frame_buffer, 0xffbbbbbb);
+        }
+        // Unvisited neighbours can't be in the frontier
+        if(x > 0 && !(unvisited & MAZE_LEFT)) MazeFrontierPrune(frontier, maze, x-1, y, frame_buffer);
+        if(x < maze->w-1 && !(unvisited & MAZE_RIGHT)) MazeFrontierPrune(frontier, maze, x+1, y, frame_buffer);
+        if(y > 0 && !(unvisited & MAZE_DOWN)) MazeFrontierPrune(frontier, maze, x, y-1, frame_buffer);
+        if(y < maze->h-1 && !(unvisited & MAZE_UP)) MazeFrontierPrune(frontier, maze, x, y+1, frame_buffer);
+        return unvisited;
+    }
+    
     bool MazeGeneratePersistentWalk(maze_t* maze, wall_t** walls, int w, int h, int cell_size, float persistence, ksprite_t* frame_buffer, kero_platform_t *platform) {
+        return MazeGeneratePersistentWalkSeeded(maze, walls, w, h, cell_size, persistence, (uint32_t)rand() + 1, frame_buffer, platform);
+    }
+    
+    bool MazeGeneratePersistentWalkSeeded(maze_t* maze, wall_t** walls, int w, int h, int cell_size, float persistence, uint32_t seed, ksprite_t* frame_buffer, kero_platform_t *platform) {
         MazeFree(maze);
         maze->w = w;
         maze->h = h;
         maze->cell_size = cell_size;
-        maze->cells = (uint8_t*)calloc(sizeof(uint8_t), maze->w*maze->h);
-        int *visited_cells = (int*)malloc(sizeof(int)*maze->w*maze->h);
-        int num_visited_cells = 1;
-        typedef enum {
-            ALeft, AUp, ARight, ADown
-        } ALGO_DIRECTION;
-        ALGO_DIRECTION dir;
-        int x = rand()%maze->w;
-        int y = rand()%maze->h;
-        visited_cells[0] = x+y*maze->w;
+        maze->passages = MazePassagesCreate(maze->w, maze->h);
+        maze_frontier_t frontier;
+        MazeFrontierCreate(&frontier, maze);
+        // Indexed by the bit number of a MAZE_DIRECTION, so a step is a lookup rather than a branch on a random number
+        static const int step_x[MAZE_DIRECTION_COUNT] = {-1, 0, 1, 0};
+        static const int step_y[MAZE_DIRECTION_COUNT] = {0, 1, 0, -1};
+        uint32_t random = seed ? seed : 1; // xorshift never leaves 0
+        int x = MazeRandomBelow(&random, maze->w);
+        int y = MazeRandomBelow(&random, maze->h);
         maze->start.x = x;
         maze->start.y = y;
-        maze->cells[y*maze->w + x] = MAZE_CELL_VISITED;
+        uint8_t unvisited = MazeFrontierVisit(&frontier, maze, x, y, NULL);
         int px, py;
-        float current_persistence = 0;
-        while(num_visited_cells > 0) {
-            while(KP_EventsQueued(platform)) {
+        // A budget past one attempt per direction walks the same as infinity, and converting anything much bigger to int is undefined
+        if(!(persistence < MAZE_DIRECTION_COUNT + 1)) persistence = MAZE_DIRECTION_COUNT + 1;
+        int persistence_step = (int)(persistence*MAZE_PERSISTENCE_ONE);
+        int current_persistence = 0;
+        bool restarted = false;
+        int steps = 0;
+        while(frontier.count > 0) {
+            // Without drawing there's no frame to wait on, so only look for events now and then
+            bool poll_events = platform && (frame_buffer || (++steps & 1023) == 0);
+            while(poll_events && KP_EventsQueued(platform)) {
                 kp_event_t* e = KP_NextEvent(platform);
                 switch(e->type) {
                     case KP_EVENT_KEY_PRESS:{
@@ -169,103 +329,195 @@ extern "C"{
             px = x;
             py = y;
             bool did_visit = false;
-            int directions[MAZE_DIRECTION_COUNT];
-            if ((x > 0 && !(maze->cells[x-1+y*maze->w] & MAZE_CELL_VISITED)) || (x < maze->w-1 && !(maze->cells[x+1+y*maze->w] & MAZE_CELL_VISITED)) || (y > 0 && !(maze->cells[x+(y-1)*maze->w] & MAZE_CELL_VISITED)) || (y < maze->h-1 && !(maze->cells[x+(y+1)*maze->w] & MAZE_CELL_VISITED))) {
-                current_persistence += persistence;
-                directions[0] = rand()%MAZE_DIRECTION_COUNT;
-                for(int i = 1; i < MAZE_DIRECTION_COUNT; ++i) {
-                    bool already_did_that_direction = false;
-                    do {
-                        directions[i] = rand()%MAZE_DIRECTION_COUNT;
-                        for(int j = 0; j < i && !already_did_that_direction; ++j) {
-                            if(directions[i] == directions[j]) {
-                                already_did_that_direction = true;
-                            }
-                        }
-                    } while(!already_did_that_direction);
+            if(unvisited) {
+                current_persistence += persistence_step;
+                // Every attempt goes the same way. The shuffle this replaced redrew each entry until it repeated an earlier one, so it only ever held one direction, and persistence's texture comes from that.
+                int dir;
+                if(restarted) {
+                    // After a restart, draw only from the open directions. Drawing from all four and restarting again on a blocked one favoured cells with more ways out, but the texture is within a few percent either way and the extra restarts were a quarter of the time on big mazes.
+                    int n = MazeRandomBelow(&random, __builtin_popcount(unvisited));
+                    for(dir = 0; !(unvisited & 1 << dir) || n-- > 0; ++dir);
                 }
-                for(int i = 0; i < MAZE_DIRECTION_COUNT && current_persistence-- >= 1 && !did_visit; ++i) {
-                    dir = directions[i];
-                    switch(dir){
-                        case ALeft:{
-                            if(x > 0 && !(maze->cells[y*maze->w + x-1] & MAZE_CELL_VISITED)) {
-                                maze->cells[y*maze->w + x] |= MAZE_LEFT;
-                                --x;
-                                maze->cells[y*maze->w + x] |= MAZE_RIGHT;
-                                did_visit = true;
-                            }
-                        }break;
-                        case ARight:{
-                            if(x < maze->w-1 && !(maze->cells[y*maze->w + x+1] & MAZE_CELL_VISITED)){
-                                maze->cells[y*maze->w + x] |= MAZE_RIGHT;
-                                ++x;
-                                maze->cells[y*maze->w + x] |= MAZE_LEFT;
-                                did_visit = true;
-                            }
-                        }break;
-                        case AUp:{
-                            if(y < maze->h-1 && !(maze->cells[(y+1)*maze->w + x] & MAZE_CELL_VISITED)){
-                                maze->cells[y*maze->w + x] |= MAZE_UP;
-                                ++y;
-                                maze->cells[y*maze->w + x] |= MAZE_DOWN;
-                                did_visit = true;
-                            }
-                        }break;
-                        case ADown:{
-                            if(y > 0 && !(maze->cells[(y-1)*maze->w + x] & MAZE_CELL_VISITED)){
-                                maze->cells[y*maze->w + x] |= MAZE_DOWN;
-                                --y;
-                                maze->cells[y*maze->w + x] |= MAZE_UP;
-                                did_visit = true;
-                            }
-                        }break;
+                else dir = MazeRandomBelow(&random, MAZE_DIRECTION_COUNT);
+                restarted = false;
+                int attempts = 1; // The one that finds the budget spent counts too
+                if(current_persistence >= MAZE_PERSISTENCE_ONE) {
+                    if(unvisited & 1 << dir) {
+                        MazeConnect(maze, x, y, (MAZE_DIRECTION)(1 << dir));
+                        x += step_x[dir];
+                        y += step_y[dir];
+                        did_visit = true;
                     }
+                    // Retrying a blocked direction can't get through, so charge every attempt the budget covers at once
+                    attempts = did_visit ? 2 : current_persistence/MAZE_PERSISTENCE_ONE + 1;
+                    if(attempts > MAZE_DIRECTION_COUNT) attempts = MAZE_DIRECTION_COUNT;
                 }
-                current_persistence = KMazeFMod(current_persistence, 1);
+                current_persistence = (current_persistence - attempts*MAZE_PERSISTENCE_ONE) % MAZE_PERSISTENCE_ONE;
             }
             if(did_visit){
-                visited_cells[num_visited_cells++] = x + y*maze->w;
                 if(frame_buffer) {
                     MazeDrawCell(maze, px, py, frame_buffer, 0xffffffff);
                     MazeDrawCell(maze, x, y, frame_buffer, 0xffffffff);
+                }
+                unvisited = MazeFrontierVisit(&frontier, maze, x, y, frame_buffer);
+                if(frame_buffer) {
                     KP_Flip(platform);
+                    frame_buffer->pixels = platform->frame_buffer.pixels; // Moves when presenting from a thread
                 }
-                int new_cell = y*maze->w + x;
-                maze->cells[new_cell] |= MAZE_CELL_VISITED;
             }
-            else {
-                for(;;) {
-                    int cell = rand()%num_visited_cells;
-                    x = visited_cells[cell]%maze->w;
-                    y = visited_cells[cell]/maze->w;
-                    if (!(x == 0 || maze->cells[x-1+y*maze->w] & MAZE_CELL_VISITED) || !(x == maze->w-1 || maze->cells[x+1+y*maze->w] & MAZE_CELL_VISITED) || !(y == 0 || maze->cells[x+(y-1)*maze->w] & MAZE_CELL_VISITED) || !(y == maze->h-1 || maze->cells[x+(y+1)*maze->w] & MAZE_CELL_VISITED)) {
-                        break;
-                    }
-                    else {
-                        if(--num_visited_cells == 0) {
-                            break;
-                        }
-                        if(frame_buffer) {
-                            MazeDrawCell(maze, x, y, frame_buffer, 0xffbbbbbb);
-                        }
-                        for(int i = cell; i < num_visited_cells; ++i) {
-                            visited_cells[i] = visited_cells[i+1];
-                        }
-                    }
-                }
+            else if(frontier.count > 0) {
+                int cell = frontier.cells[MazeRandomBelow(&random, frontier.count)];
+                x = cell%maze->w;
+                y = cell/maze->w;
+                unvisited = MazeUnvisitedNeighbours(maze, frontier.visited, x, y);
+                restarted = true;
             }
         }
         maze->end.y = 0;
         maze->end.x = 0;
-        for(unsigned int y = 0; y < maze->h; ++y){
-            for(unsigned int x = 0; x < maze->w; ++x){
-                if(maze->cells[y*maze->w+x] & MAZE_CELL_VISITED){
-                    maze->cells[y*maze->w+x] &= ~MAZE_CELL_VISITED;
+        MazeFrontierFree(&frontier);
+        if(walls) MazeGenerateWalls(maze, walls);
+        return true;
+    }
+    
+    // Hash a tile's index into its own seed, so neighbouring tiles don't start from related xorshift states
+    static inline uint32_t MazeTileSeed(uint32_t seed, int tile) {
+        uint32_t x = seed + (uint32_t)tile*0x9e3779b9u;
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+    
+    typedef struct {
+        maze_t* maze;
+        float persistence;
+        int tile_size, tiles_x, num_tiles;
+        uint32_t seed;
+        int next_tile; // Claimed with an atomic add by whichever thread is free
+    } maze_tiles_t;
+    
+    // Copy a generated tile's passages into the maze. A byte holding cells of a neighbouring tile too is ORed in atomically, as that tile's thread may be writing it at the same time.
+    static void MazeTileMerge(maze_t* maze, maze_t* tile, int x0, int y0) {
+        for(int y = 0; y < tile->h; ++y) {
+            int first = x0 + (y0 + y)*maze->w;
+            int end = first + tile->w;
+            if(!(first & 3) && !(tile->w & 3)) {
+                // The row starts and ends on byte boundaries in both, so no other tile shares its bytes
+                memcpy(maze->passages + (first >> 2), tile->passages + (y*tile->w >> 2), tile->w >> 2);
+                continue;
+            }
+            for(int byte = first >> 2; byte <= (end - 1) >> 2; ++byte) {
+                int from = byte*4 < first ? first : byte*4;
+                int to = byte*4 + 4 > end ? end : byte*4 + 4;
+                uint8_t bits = 0;
+                for(int cell = from; cell < to; ++cell) {
+                    int tile_cell = cell - first + y*tile->w;
+                    bits |= (tile->passages[tile_cell >> 2] >> (tile_cell & 3)*2 & 3) << (cell & 3)*2;
+                }
+                if(to - from == 4) {
+                    maze->passages[byte] = bits;
+                }
+                else {
+                    __atomic_fetch_or(&maze->passages[byte], bits, __ATOMIC_RELAXED);
                 }
             }
         }
-        free(visited_cells);
-        MazeGenerateWalls(maze, walls);
+    }
+    
+    static void MazeTilesWork(maze_tiles_t* tiles) {
+        maze_t* maze = tiles->maze;
+        maze_t tile = {0};
+        for(;;) {
+            int t = __atomic_fetch_add(&tiles->next_tile, 1, __ATOMIC_RELAXED);
+            if(t >= tiles->num_tiles) break;
+            int x0 = t%tiles->tiles_x*tiles->tile_size;
+            int y0 = t/tiles->tiles_x*tiles->tile_size;
+            int w = maze->w - x0 < tiles->tile_size ? maze->w - x0 : tiles->tile_size;
+            int h = maze->h - y0 < tiles->tile_size ? maze->h - y0 : tiles->tile_size;
+            MazeGeneratePersistentWalkSeeded(&tile, NULL, w, h, maze->cell_size, tiles->persistence, MazeTileSeed(tiles->seed, t), NULL, NULL);
+            MazeTileMerge(maze, &tile, x0, y0);
+        }
+        MazeFree(&tile);
+    }
+    
+#ifdef KERO_MAZE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#ifndef KERO_MAZE_MAX_THREADS
+#define KERO_MAZE_MAX_THREADS 64
+#endif
+    static void* MazeTilesThreadMain(void* data) {
+        MazeTilesWork((maze_tiles_t*)data);
+        return NULL;
+    }
+#endif
+    
+    bool MazeGenerateTiled(maze_t* maze, wall_t** walls, int w, int h, int cell_size, float persistence, int tile_size, int num_threads) {
+        MazeFree(maze);
+        maze->w = w;
+        maze->h = h;
+        maze->cell_size = cell_size;
+        maze->passages = MazePassagesCreate(maze->w, maze->h);
+        if(tile_size < 1) tile_size = 1;
+        maze_tiles_t tiles = {0};
+        tiles.maze = maze;
+        tiles.persistence = persistence;
+        tiles.tile_size = tile_size;
+        tiles.tiles_x = (w + tile_size - 1)/tile_size;
+        int tiles_y = (h + tile_size - 1)/tile_size;
+        tiles.num_tiles = tiles.tiles_x*tiles_y;
+        tiles.seed = (uint32_t)rand();
+#ifdef KERO_MAZE_THREADS
+        if(num_threads <= 0) {
+            num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        if(num_threads > tiles.num_tiles) num_threads = tiles.num_tiles;
+        if(num_threads > KERO_MAZE_MAX_THREADS + 1) num_threads = KERO_MAZE_MAX_THREADS + 1;
+        pthread_t threads[KERO_MAZE_MAX_THREADS];
+        int num_started = 0;
+        for(int i = 1; i < num_threads; ++i) {
+            if(pthread_create(&threads[num_started], NULL, MazeTilesThreadMain, &tiles) != 0) {
+                fprintf(stderr, "Failed to create maze worker thread\n");
+                break;
+            }
+            ++num_started;
+        }
+        MazeTilesWork(&tiles);
+        for(int i = 0; i < num_started; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+#else
+        MazeTilesWork(&tiles);
+#endif
+        // A perfect maze with a cell per tile is a spanning tree over the tiles. Each of its passages becomes one door at a random point along that tile edge.
+        maze_t tree = {0};
+        MazeGeneratePersistentWalkSeeded(&tree, NULL, tiles.tiles_x, tiles_y, 1, persistence, MazeTileSeed(tiles.seed, tiles.num_tiles), NULL, NULL);
+        uint32_t random = MazeTileSeed(tiles.seed, tiles.num_tiles + 1);
+        if(!random) random = 1;
+        for(int ty = 0; ty < tiles_y; ++ty) {
+            for(int tx = 0; tx < tiles.tiles_x; ++tx) {
+                uint8_t doors = MazeCell(&tree, tx, ty);
+                int x0 = tx*tile_size;
+                int y0 = ty*tile_size;
+                int x1 = x0 + tile_size < w ? x0 + tile_size : w;
+                int y1 = y0 + tile_size < h ? y0 + tile_size : h;
+                if(doors & MAZE_RIGHT) {
+                    MazeConnect(maze, x1 - 1, y0 + MazeRandomBelow(&random, y1 - y0), MAZE_RIGHT);
+                }
+                if(doors & MAZE_UP) {
+                    MazeConnect(maze, x0 + MazeRandomBelow(&random, x1 - x0), y1 - 1, MAZE_UP);
+                }
+            }
+        }
+        MazeFree(&tree);
+        maze->start.x = MazeRandomBelow(&random, w);
+        maze->start.y = MazeRandomBelow(&random, h);
+        maze->end.y = 0;
+        maze->end.x = 0;
+        if(walls) MazeGenerateWalls(maze, walls);
         return true;
     }
     
@@ -274,23 +526,25 @@ extern "C"{
         maze->w = w;
         maze->h = h;
         maze->cell_size = cell_size;
-        maze->cells = (uint8_t*)calloc(sizeof(uint8_t), maze->w*maze->h);
-        int *visited_cells = (int*)malloc(sizeof(int)*maze->w*maze->h);
-        int num_visited_cells = 1;
+        maze->passages = MazePassagesCreate(maze->w, maze->h);
+        maze_frontier_t frontier;
+        MazeFrontierCreate(&frontier, maze);
         typedef enum {
             ALeft, AUp, ARight, ADown
         } ALGO_DIRECTION;
         ALGO_DIRECTION dir;
-        int x = rand()%maze->w;
-        int y = rand()%maze->h;
-        visited_cells[0] = x+y*maze->w;
+        uint32_t random = (uint32_t)rand() + 1;
+        int x = MazeRandomBelow(&random, maze->w);
+        int y = MazeRandomBelow(&random, maze->h);
         maze->start.x = x;
         maze->start.y = y;
-        uint8_t MAZE_CELL_VISITED = 0b10000000;
-        maze->cells[y*maze->w + x] = MAZE_CELL_VISITED;
+        MazeFrontierVisit(&frontier, maze, x, y, NULL);
         int px, py;
-        while(num_visited_cells > 0) {
-            while(KP_EventsQueued(platform)) {
+        int steps = 0;
+        while(frontier.count > 0) {
+            // Without drawing there's no frame to wait on, so only look for events now and then
+            bool poll_events = frame_buffer || (++steps & 1023) == 0;
+            while(poll_events && KP_EventsQueued(platform)) {
                 kp_event_t* e = KP_NextEvent(platform);
                 switch(e->type) {
                     case KP_EVENT_KEY_PRESS:{
@@ -316,82 +570,57 @@ extern "C"{
             }
             px = x;
             py = y;
-            dir = rand()%4;
+            dir = MazeRandomBelow(&random, 4);
             bool did_visit = false;
             switch(dir){
                 case ALeft:{
-                    if(x > 0 && !(maze->cells[y*maze->w + x-1] & MAZE_CELL_VISITED)) {
-                        maze->cells[y*maze->w + x] |= MAZE_LEFT;
+                    if(x > 0 && !MazeBitGet(frontier.visited, y*maze->w + x-1)) {
+                        MazeConnect(maze, x, y, MAZE_LEFT);
                         --x;
-                        maze->cells[y*maze->w + x] |= MAZE_RIGHT;
                         did_visit = true;
                     }
                 }break;
                 case ARight:{
-                    if(x < maze->w-1 && !(maze->cells[y*maze->w + x+1] & MAZE_CELL_VISITED)){
-                        maze->cells[y*maze->w + x] |= MAZE_RIGHT;
+                    if(x < maze->w-1 && !MazeBitGet(frontier.visited, y*maze->w + x+1)){
+                        MazeConnect(maze, x, y, MAZE_RIGHT);
                         ++x;
-                        maze->cells[y*maze->w + x] |= MAZE_LEFT;
                         did_visit = true;
                     }
                 }break;
                 case AUp:{
-                    if(y < maze->h-1 && !(maze->cells[(y+1)*maze->w + x] & MAZE_CELL_VISITED)){
-                        maze->cells[y*maze->w + x] |= MAZE_UP;
+                    if(y < maze->h-1 && !MazeBitGet(frontier.visited, (y+1)*maze->w + x)){
+                        MazeConnect(maze, x, y, MAZE_UP);
                         ++y;
-                        maze->cells[y*maze->w + x] |= MAZE_DOWN;
                         did_visit = true;
                     }
                 }break;
                 case ADown:{
-                    if(y > 0 && !(maze->cells[(y-1)*maze->w + x] & MAZE_CELL_VISITED)){
-                        maze->cells[y*maze->w + x] |= MAZE_DOWN;
+                    if(y > 0 && !MazeBitGet(frontier.visited, (y-1)*maze->w + x)){
+                        MazeConnect(maze, x, y, MAZE_DOWN);
                         --y;
-                        maze->cells[y*maze->w + x] |= MAZE_UP;
                         did_visit = true;
                     }
                 }break;
             }
             if(did_visit){
-                visited_cells[num_visited_cells++] = x + y*maze->w;
+                MazeFrontierVisit(&frontier, maze, x, y, NULL);
                 if(frame_buffer) {
                     MazeDrawCell(maze, px, py, frame_buffer, 0xffffffff);
                     MazeDrawCell(maze, x, y, frame_buffer, 0xffffffff);
                     KP_Flip(platform);
+                    frame_buffer->pixels = platform->frame_buffer.pixels; // Moves when presenting from a thread
                 }
-                int new_cell = y*maze->w + x;
-                maze->cells[new_cell] |= MAZE_CELL_VISITED;
             }
-            else {
-                for(;;) {
-                    int cell = rand()%num_visited_cells;
-                    x = visited_cells[cell]%maze->w;
-                    y = visited_cells[cell]/maze->w;
-                    if (!(x == 0 || maze->cells[x-1+y*maze->w] & MAZE_CELL_VISITED) || !(x == maze->w-1 || maze->cells[x+1+y*maze->w] & MAZE_CELL_VISITED) || !(y == 0 || maze->cells[x+(y-1)*maze->w] & MAZE_CELL_VISITED) || !(y == maze->h-1 || maze->cells[x+(y+1)*maze->w] & MAZE_CELL_VISITED)) {
-                        break;
-                    }
-                    else {
-                        if(--num_visited_cells == 0) {
-                            break;
-                        }
-                        for(int i = cell; i < num_visited_cells; ++i) {
-                            visited_cells[i] = visited_cells[i+1];
-                        }
-                    }
-                }
+            else if(frontier.count > 0) {
+                int cell = frontier.cells[MazeRandomBelow(&random, frontier.count)];
+                x = cell%maze->w;
+                y = cell/maze->w;
             }
         }
         maze->end.y = 0;
         maze->end.x = 0;
-        for(unsigned int y = 0; y < maze->h; ++y){
-            for(unsigned int x = 0; x < maze->w; ++x){
-                if(maze->cells[y*maze->w+x] & MAZE_CELL_VISITED){
-                    maze->cells[y*maze->w+x] &= ~MAZE_CELL_VISITED;
-                }
-            }
-        }
-        free(visited_cells);
-        MazeGenerateWalls(maze, walls);
+        MazeFrontierFree(&frontier);
+        if(walls) MazeGenerateWalls(maze, walls);
         return true;
     }
     
@@ -400,7 +629,7 @@ extern "C"{
         maze->w = w;
         maze->h = h;
         maze->cell_size = cell_size;
-        maze->cells = (uint8_t*)calloc(sizeof(uint8_t), maze->w*maze->h);
+        maze->passages = MazePassagesCreate(maze->w, maze->h);
         int *maze_stack = (int*)malloc(sizeof(int)*maze->w*maze->h);
         int maze_stack_top = 0;
         int num_cells_to_visit = maze->w*maze->h-1;
@@ -413,8 +642,8 @@ extern "C"{
         maze->start.x = x;
         maze->start.y = y;
         maze_stack[0] = y*maze->w + x;
-        uint8_t MAZE_CELL_VISITED = 0b10000000;
-        maze->cells[y*maze->w + x] = MAZE_CELL_VISITED;
+        uint64_t* visited = MazeBitsCreate(maze->w*maze->h);
+        MazeBitSet(visited, y*maze->w + x);
         int deepest_cell = 0;
         int deepest_cell_depth = 0;
         do {
@@ -424,15 +653,16 @@ extern "C"{
                 KS_DrawRectFilled(frame_buffer, x*maze->cell_size, y*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff00ff00);
                 for(int y = 0; y < maze->h; ++y) {
                     for(int x = 0; x < maze->w; ++x) {
-                        if( !(maze->cells[x + y*maze->w] & MAZE_UP) ) {
+                        if( !(MazeCell(maze, x, y) & MAZE_UP) ) {
                             KS_DrawLine(frame_buffer, x*maze->cell_size, (y+1)*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff000000);
                         }
-                        if( !(maze->cells[x + y*maze->w] & MAZE_RIGHT) ) {
+                        if( !(MazeCell(maze, x, y) & MAZE_RIGHT) ) {
                             KS_DrawLine(frame_buffer, (x+1)*maze->cell_size, y*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff000000);
                         }
                     }
                 }
                 KP_Flip(platform);
+                frame_buffer->pixels = platform->frame_buffer.pixels; // Moves when presenting from a thread
             }
             dir = rand();
             bool did_visit = false;
@@ -440,38 +670,34 @@ extern "C"{
                 dir = (dir+1)%4;
                 switch(dir){
                     case ALeft:{
-                        if(x == 0 || maze->cells[y*maze->w + x-1] & MAZE_CELL_VISITED){
+                        if(x == 0 || MazeBitGet(visited, y*maze->w + x-1)){
                         }else{
-                            maze->cells[y*maze->w + x] |= MAZE_LEFT;
+                            MazeConnect(maze, x, y, MAZE_LEFT);
                             --x;
-                            maze->cells[y*maze->w + x] |= MAZE_RIGHT;
                             did_visit = true;
                         }
                     }break;
                     case ARight:{
-                        if(x == maze->w-1 || maze->cells[y*maze->w + x+1] & MAZE_CELL_VISITED){
+                        if(x == maze->w-1 || MazeBitGet(visited, y*maze->w + x+1)){
                         }else{
-                            maze->cells[y*maze->w + x] |= MAZE_RIGHT;
+                            MazeConnect(maze, x, y, MAZE_RIGHT);
                             ++x;
-                            maze->cells[y*maze->w + x] |= MAZE_LEFT;
                             did_visit = true;
                         }
                     }break;
                     case AUp:{
-                        if(y == maze->h-1 || maze->cells[(y+1)*maze->w + x] & MAZE_CELL_VISITED){
+                        if(y == maze->h-1 || MazeBitGet(visited, (y+1)*maze->w + x)){
                         }else{
-                            maze->cells[y*maze->w + x] |= MAZE_UP;
+                            MazeConnect(maze, x, y, MAZE_UP);
                             ++y;
-                            maze->cells[y*maze->w + x] |= MAZE_DOWN;
                             did_visit = true;
                         }
                     }break;
                     case ADown:{
-                        if(y == 0 || maze->cells[(y-1)*maze->w + x] & MAZE_CELL_VISITED){
+                        if(y == 0 || MazeBitGet(visited, (y-1)*maze->w + x)){
                         }else{
-                            maze->cells[y*maze->w + x] |= MAZE_DOWN;
+                            MazeConnect(maze, x, y, MAZE_DOWN);
                             --y;
-                            maze->cells[y*maze->w + x] |= MAZE_UP;
                             did_visit = true;
                         }
                     }break;
@@ -480,7 +706,7 @@ extern "C"{
             if(did_visit){
                 --num_cells_to_visit;
                 int new_cell = y*maze->w + x;
-                maze->cells[new_cell] |= MAZE_CELL_VISITED;
+                MazeBitSet(visited, new_cell);
                 maze_stack[++maze_stack_top] = new_cell;
                 if(maze_stack_top > deepest_cell_depth){
                     deepest_cell_depth = maze_stack_top;
@@ -494,15 +720,9 @@ extern "C"{
         } while (num_cells_to_visit);
         maze->end.y = deepest_cell / maze->w;
         maze->end.x = deepest_cell - maze->end.y*maze->w;
-        for(unsigned int y = 0; y < maze->h; ++y){
-            for(unsigned int x = 0; x < maze->w; ++x){
-                if(maze->cells[y*maze->w+x] & MAZE_CELL_VISITED){
-                    maze->cells[y*maze->w+x] &= ~MAZE_CELL_VISITED;
-                }
-            }
-        }
+        free(visited);
         free(maze_stack);
-        MazeGenerateWalls(maze, walls);
+        if(walls) MazeGenerateWalls(maze, walls);
         return true;
     }
     
@@ -512,100 +732,87 @@ extern "C"{
         maze->w = w;
         maze->h = h;
         maze->cell_size = cell_size;
-        maze->cells = (uint8_t*)calloc(sizeof(uint8_t), maze->w * maze->h);
-        int* visited_cells = (int*)malloc(maze->w * maze->h * sizeof(int));
-        int num_visited_cells = 1;
-        // Step 1: Select a random point, mark as visited and add it to the list of visited cells.
-        visited_cells[0] = rand() % (maze->w*maze->h);
-        maze->cells[visited_cells[0]] |= MAZE_CELL_VISITED;
-        // Step 2: Until the list of visited cells is empty. . .
-        while(num_visited_cells > 0) {
-            // Step 3: Select a random cell from the list of visited cells.
-            int selected = rand()%num_visited_cells;
-            int cell = visited_cells[selected];
+        maze->passages = MazePassagesCreate(maze->w, maze->h);
+        maze_frontier_t frontier;
+        MazeFrontierCreate(&frontier, maze);
+        // Step 1: Select a random point, mark as visited and add it to the frontier.
+        uint32_t random = (uint32_t)rand() + 1;
+        int start = MazeRandomBelow(&random, maze->w*maze->h);
+        MazeFrontierVisit(&frontier, maze, start%maze->w, start/maze->w, NULL);
+        // Step 2: Until the frontier is empty. . .
+        while(frontier.count > 0) {
+            // Step 3: Select a random cell from the frontier. Cells leave it as soon as their last unvisited neighbour is visited, so it always has one.
+            int cell = frontier.cells[MazeRandomBelow(&random, frontier.count)];
             int x = cell%maze->w;
             int y = cell/maze->w;
-            // Step 4: If the current cell has no unvisited neighbours, remove it from the list. Go to (2)
-            if(!(y < maze->h-1 && !(maze->cells[x + (y+1)*maze->w] & MAZE_CELL_VISITED) ) && !(y > 0 && !(maze->cells[x + (y-1)*maze->w] & MAZE_CELL_VISITED) ) && !(x < maze->w-1 && !(maze->cells[x+1 + y*maze->w] & MAZE_CELL_VISITED) ) && !(x > 0 && !(maze->cells[x-1 + y*maze->w] & MAZE_CELL_VISITED) )) {
-                --num_visited_cells;
-                for(int i = selected; i < num_visited_cells; ++i) {
-                    visited_cells[i] = visited_cells[i+1];
+            // Step 4: Connect to a random unvisited neighbour of the current cell, mark that neighbour as visited and add it to the frontier. Go to (2)
+            int direction = MazeRandomBelow(&random, 4);
+            bool connected = false;
+            for(int neighbour_checks = 0; neighbour_checks < MAZE_DIRECTION_COUNT && !connected; ++neighbour_checks) {
+                direction = (direction+1)%4;
+                switch(direction) {
+                    case 0: { // Up
+                        if( y < maze->h-1 && !MazeBitGet(frontier.visited, x + (y+1)*maze->w) ) {
+                            MazeConnect(maze, x, y, MAZE_UP);
+                            ++y;
+                            connected = true;
+                        }
+                    }break;
+                    case 1: { // Down
+                        if( y > 0 && !MazeBitGet(frontier.visited, x + (y-1)*maze->w) ) {
+                            MazeConnect(maze, x, y, MAZE_DOWN);
+                            --y;
+                            connected = true;
+                        }
+                    }break;
+                    case 2: { // Right
+                        if( x < maze->w-1 && !MazeBitGet(frontier.visited, x+1 + y*maze->w) ) {
+                            MazeConnect(maze, x, y, MAZE_RIGHT);
+                            ++x;
+                            connected = true;
+                        }
+                    }break;
+                    case 3: { // Left
+                        if( x > 0 && !MazeBitGet(frontier.visited, x-1 + y*maze->w) ) {
+                            MazeConnect(maze, x, y, MAZE_LEFT);
+                            --x;
+                            connected = true;
+                        }
+                    }break;
                 }
             }
-            // Step 5: Connect to a random unvisited neighbour of the current cell, mark that neighbour as visited and add it to the list. Go to (2)
-            else {
-                int direction = rand();
-                bool connected = false;
-                for(int neighbour_checks = 0; neighbour_checks < MAZE_DIRECTION_COUNT && !connected; ++neighbour_checks) {
-                    direction = (direction+1)%4;
-                    switch(direction) {
-                        case 0: { // Up
-                            if( y < maze->h-1 && !(maze->cells[x + (y+1)*maze->w] & MAZE_CELL_VISITED) ) {
-                                maze->cells[x + y*maze->w] |= MAZE_UP;
-                                ++y;
-                                maze->cells[x + y*maze->w] |= MAZE_DOWN;
-                                connected = true;
-                            }
-                        }break;
-                        case 1: { // Down
-                            if( y > 0 && !(maze->cells[x + (y-1)*maze->w] & MAZE_CELL_VISITED) ) {
-                                maze->cells[x + y*maze->w] |= MAZE_DOWN;
-                                --y;
-                                maze->cells[x + y*maze->w] |= MAZE_UP;
-                                connected = true;
-                            }
-                        }break;
-                        case 2: { // Right
-                            if( x < maze->w-1 && !(maze->cells[x+1 + y*maze->w] & MAZE_CELL_VISITED) ) {
-                                maze->cells[x + y*maze->w] |= MAZE_RIGHT;
-                                ++x;
-                                maze->cells[x + y*maze->w] |= MAZE_LEFT;
-                                connected = true;
-                            }
-                        }break;
-                        case 3: { // Left
-                            if( x > 0 && !(maze->cells[x-1 + y*maze->w] & MAZE_CELL_VISITED) ) {
-                                maze->cells[x + y*maze->w] |= MAZE_LEFT;
-                                --x;
-                                maze->cells[x + y*maze->w] |= MAZE_RIGHT;
-                                connected = true;
-                            }
-                        }break;
-                    }
+            MazeFrontierVisit(&frontier, maze, x, y, NULL);
+            // Draw the maze
+            if(frame_buffer){
+                KS_SetAllPixels(frame_buffer, 0xffffffff);
+                for(int i = 0; i < frontier.count; ++i) {
+                    int x = frontier.cells[i]%maze->w;
+                    int y = frontier.cells[i]/maze->w;
+                    KS_DrawRectFilled(frame_buffer, x*maze->cell_size, y*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff888888);
                 }
-                visited_cells[num_visited_cells++] = x + y*maze->w;
-                maze->cells[x + y*maze->w] |= MAZE_CELL_VISITED;
-                // Draw the maze
-                if(frame_buffer){
-                    KS_SetAllPixels(frame_buffer, 0xffffffff);
-                    for(int i = 0; i < num_visited_cells; ++i) {
-                        int x = visited_cells[i]%maze->w;
-                        int y = visited_cells[i]/maze->w;
-                        KS_DrawRectFilled(frame_buffer, x*maze->cell_size, y*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff888888);
-                    }
-                    for(int y = 0; y < maze->h; ++y) {
-                        for(int x = 0; x < maze->w; ++x) {
-                            if( !(maze->cells[x + y*maze->w] & MAZE_UP) ) {
-                                KS_DrawLine(frame_buffer, x*maze->cell_size, (y+1)*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff000000);
-                            }
-                            if( !(maze->cells[x + y*maze->w] & MAZE_RIGHT) ) {
-                                KS_DrawLine(frame_buffer, (x+1)*maze->cell_size, y*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff000000);
-                            }
+                for(int y = 0; y < maze->h; ++y) {
+                    for(int x = 0; x < maze->w; ++x) {
+                        if( !(MazeCell(maze, x, y) & MAZE_UP) ) {
+                            KS_DrawLine(frame_buffer, x*maze->cell_size, (y+1)*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff000000);
+                        }
+                        if( !(MazeCell(maze, x, y) & MAZE_RIGHT) ) {
+                            KS_DrawLine(frame_buffer, (x+1)*maze->cell_size, y*maze->cell_size, (x+1)*maze->cell_size, (y+1)*maze->cell_size, 0xff000000);
                         }
                     }
-                    KP_Flip(platform);
                 }
+                KP_Flip(platform);
+                frame_buffer->pixels = platform->frame_buffer.pixels; // Moves when presenting from a thread
             }
         }
-        free(visited_cells);
-        MazeGenerateWalls(maze, walls);
+        MazeFrontierFree(&frontier);
+        if(walls) MazeGenerateWalls(maze, walls);
         return true;
     }
     
     void MazeFree(maze_t* maze) {
-        if(maze->cells){
-            free(maze->cells);
-            maze->cells = NULL;
+        if(maze->passages){
+            free(maze->passages);
+            maze->passages = NULL;
         }
     }
     
@@ -631,25 +838,26 @@ extern "C"{
                 maze->end.x = x;
                 maze->end.y = y;
             }
-            if(x < maze->w-1 && w[x+1+y*maze->w] > weight+1 && maze->cells[x+y*maze->w] & MAZE_RIGHT) {
+            uint8_t cell = MazeCell(maze, x, y);
+            if(x < maze->w-1 && w[x+1+y*maze->w] > weight+1 && cell & MAZE_RIGHT) {
                 ++x;
                 w[x+y*maze->w] = weight+1;
                 maze_stack[++maze_stack_top] = x+y*maze->w;
                 continue;
             }
-            if(x > 0 && w[x-1+y*maze->w] > weight+1 && maze->cells[x+y*maze->w] & MAZE_LEFT) {
+            if(x > 0 && w[x-1+y*maze->w] > weight+1 && cell & MAZE_LEFT) {
                 --x;
                 w[x+y*maze->w] = weight+1;
                 maze_stack[++maze_stack_top] = x+y*maze->w;
                 continue;
             }
-            if(y < maze->h-1 && w[x+(y+1)*maze->w] > weight+1 && maze->cells[x+y*maze->w] & MAZE_UP) {
+            if(y < maze->h-1 && w[x+(y+1)*maze->w] > weight+1 && cell & MAZE_UP) {
                 ++y;
                 w[x+y*maze->w] = weight+1;
                 maze_stack[++maze_stack_top] = x+y*maze->w;
                 continue;
             }
-            if(y > 0 && w[x+(y-1)*maze->w] > weight+1 && maze->cells[x+y*maze->w] & MAZE_DOWN) {
+            if(y > 0 && w[x+(y-1)*maze->w] > weight+1 && cell & MAZE_DOWN) {
                 --y;
                 w[x+y*maze->w] = weight+1;
                 maze_stack[++maze_stack_top] = x+y*maze->w;
@@ -666,7 +874,7 @@ extern "C"{
     void MazeDrawCell(maze_t* maze, int x, int y, ksprite_t* dest, uint32_t color) {
         if(x < 0 || x > maze->w-1 || y < 0 || y > maze->h-1) return;
         KS_DrawRectFilledSafe(dest, x*maze->cell_size, y*maze->cell_size, (x+1)*maze->cell_size-1, (y+1)*maze->cell_size-1, color);
-        uint8_t cell = maze->cells[y*maze->w + x];
+        uint8_t cell = MazeCell(maze, x, y);
         if(!(cell & MAZE_LEFT)){KS_DrawLineSafe(dest, x*maze->cell_size, y*maze->cell_size, x*maze->cell_size, (y+1)*maze->cell_size, 0xff000000);
         }
         if(!(cell & MAZE_DOWN)){
@@ -681,19 +889,19 @@ extern "C"{
         }
         wall_t* hwalls = NULL;
         wall_t* vwalls = NULL;
-        uint8_t MAZE_CELL_WALLED_BOTTOM = 0b01000000;
-        uint8_t MAZE_CELL_WALLED_LEFT = 0b00100000;
+        uint64_t* walled_bottom = MazeBitsCreate(maze->w*maze->h);
+        uint64_t* walled_left = MazeBitsCreate(maze->w*maze->h);
         wall_t new_wall = {0};
         for(unsigned int y = 0; y < maze->h; ++y){
             for(unsigned int x = 0; x < maze->w; ++x){
-                if(!(maze->cells[y*maze->w+x] & MAZE_DOWN) && !(maze->cells[y*maze->w+x] & MAZE_CELL_WALLED_BOTTOM)){
-                    maze->cells[y*maze->w+x] |= MAZE_CELL_WALLED_BOTTOM;
+                if(!(MazeCell(maze, x, y) & MAZE_DOWN) && !MazeBitGet(walled_bottom, y*maze->w+x)){
+                    MazeBitSet(walled_bottom, y*maze->w+x);
                     new_wall.a.x = x;
                     new_wall.a.y = y;
                     new_wall.b.y = y;
                     for(new_wall.b.x = x+1; new_wall.b.x < maze->w; ++new_wall.b.x){
-                        maze->cells[(int)(y*maze->w+new_wall.b.x)] |= MAZE_CELL_WALLED_BOTTOM;
-                        if(maze->cells[(int)(y*maze->w+new_wall.b.x)] & MAZE_DOWN){
+                        MazeBitSet(walled_bottom, (int)(y*maze->w+new_wall.b.x));
+                        if(MazeCell(maze, (int)new_wall.b.x, y) & MAZE_DOWN){
                             break;
                         }
                     }
@@ -703,14 +911,14 @@ extern "C"{
                     new_wall.b.y *= maze->cell_size;
                     sb_push(hwalls, new_wall);
                 }
-                if(!(maze->cells[y*maze->w+x] & MAZE_LEFT) && !(maze->cells[y*maze->w+x] & MAZE_CELL_WALLED_LEFT)){
-                    maze->cells[y*maze->w+x] |= MAZE_CELL_WALLED_LEFT;
+                if(!(MazeCell(maze, x, y) & MAZE_LEFT) && !MazeBitGet(walled_left, y*maze->w+x)){
+                    MazeBitSet(walled_left, y*maze->w+x);
                     new_wall.a.x = x;
                     new_wall.a.y = y;
                     new_wall.b.x = x;
                     for(new_wall.b.y = y+1; new_wall.b.y < maze->h; ++new_wall.b.y){
-                        maze->cells[(int)(new_wall.b.y*maze->w+x)] |= MAZE_CELL_WALLED_LEFT;
-                        if(maze->cells[(int)(new_wall.b.y*maze->w+x)] & MAZE_LEFT){
+                        MazeBitSet(walled_left, (int)(new_wall.b.y*maze->w+x));
+                        if(MazeCell(maze, x, (int)new_wall.b.y) & MAZE_LEFT){
                             break;
                         }
                     }
@@ -763,10 +971,8 @@ extern "C"{
         }
         sb_free(hwalls);
         sb_free(vwalls);
-        for(unsigned int m = 0; m < maze->w*maze->h; ++m){
-            maze->cells[m] &= ~MAZE_CELL_WALLED_BOTTOM;
-            maze->cells[m] &= ~MAZE_CELL_WALLED_LEFT;
-        }
+        free(walled_bottom);
+        free(walled_left);
         return true;
     }
     
@@ -777,19 +983,19 @@ extern "C"{
         }
         wall_t* hwalls = NULL;
         wall_t* vwalls = NULL;
-        uint8_t MAZE_CELL_WALLED_BOTTOM = 0b01000000;
-        uint8_t MAZE_CELL_WALLED_LEFT = 0b00100000;
+        uint64_t* walled_bottom = MazeBitsCreate(maze->w*maze->h);
+        uint64_t* walled_left = MazeBitsCreate(maze->w*maze->h);
         wall_t new_wall = {0};
         for(unsigned int y = 0; y < maze->h; ++y){
             for(unsigned int x = 0; x < maze->w; ++x){
-                if(!(maze->cells[y*maze->w+x] & MAZE_DOWN) && !(maze->cells[y*maze->w+x] & MAZE_CELL_WALLED_BOTTOM)){
-                    maze->cells[y*maze->w+x] |= MAZE_CELL_WALLED_BOTTOM;
+                if(!(MazeCell(maze, x, y) & MAZE_DOWN) && !MazeBitGet(walled_bottom, y*maze->w+x)){
+                    MazeBitSet(walled_bottom, y*maze->w+x);
                     new_wall.a.x = x;
                     new_wall.a.y = y;
                     new_wall.b.y = y;
                     for(new_wall.b.x = x+1; new_wall.b.x < maze->w; ++new_wall.b.x){
-                        maze->cells[(int)(y*maze->w+new_wall.b.x)] |= MAZE_CELL_WALLED_BOTTOM;
-                        if(maze->cells[(int)(y*maze->w+new_wall.b.x)] & MAZE_DOWN){
+                        MazeBitSet(walled_bottom, (int)(y*maze->w+new_wall.b.x));
+                        if(MazeCell(maze, (int)new_wall.b.x, y) & MAZE_DOWN){
                             break;
                         }
                     }
@@ -799,14 +1005,14 @@ extern "C"{
                     new_wall.b.y *= maze->cell_size;
                     sb_push(hwalls, new_wall);
                 }
-                if(!(maze->cells[y*maze->w+x] & MAZE_LEFT) && !(maze->cells[y*maze->w+x] & MAZE_CELL_WALLED_LEFT)){
-                    maze->cells[y*maze->w+x] |= MAZE_CELL_WALLED_LEFT;
+                if(!(MazeCell(maze, x, y) & MAZE_LEFT) && !MazeBitGet(walled_left, y*maze->w+x)){
+                    MazeBitSet(walled_left, y*maze->w+x);
                     new_wall.a.x = x;
                     new_wall.a.y = y;
                     new_wall.b.x = x;
                     for(new_wall.b.y = y+1; new_wall.b.y < maze->h; ++new_wall.b.y){
-                        maze->cells[(int)(new_wall.b.y*maze->w+x)] |= MAZE_CELL_WALLED_LEFT;
-                        if(maze->cells[(int)(new_wall.b.y*maze->w+x)] & MAZE_LEFT){
+                        MazeBitSet(walled_left, (int)(new_wall.b.y*maze->w+x));
+                        if(MazeCell(maze, x, (int)new_wall.b.y) & MAZE_LEFT){
                             break;
                         }
                     }
@@ -820,11 +1026,11 @@ extern "C"{
         }
         new_wall.a.x = new_wall.b.x = maze->w*maze->cell_size;
         for(int y = 0; y < maze->h; ++y) {
-            if(!(maze->cells[y*maze->w+maze->w-1] & MAZE_RIGHT)) {
+            if(!(MazeCell(maze, maze->w-1, y) & MAZE_RIGHT)) {
                 new_wall.a.y = y;
                 new_wall.b.y = y+1;
                 for(; y < maze->h; ++y) {
-                    if(maze->cells[y*maze->w+maze->w-1] & MAZE_RIGHT) break;
+                    if(MazeCell(maze, maze->w-1, y) & MAZE_RIGHT) break;
                     new_wall.b.y = y+1;
                 }
                 new_wall.a.y *= maze->cell_size;
@@ -834,11 +1040,11 @@ extern "C"{
         }
         new_wall.a.y = new_wall.b.y = maze->h*maze->cell_size;
         for(int x = 0; x < maze->w; ++x) {
-            if(!(maze->cells[(maze->h-1)*maze->w+x] & MAZE_UP)) {
+            if(!(MazeCell(maze, x, maze->h-1) & MAZE_UP)) {
                 new_wall.a.x = x;
                 new_wall.b.x = x+1;
                 for(; x < maze->w; ++x) {
-                    if(maze->cells[x + (maze->h-1)*maze->w] & MAZE_UP) break;
+                    if(MazeCell(maze, x, maze->h-1) & MAZE_UP) break;
                     new_wall.b.x = x+1;
                 }
                 new_wall.a.x *= maze->cell_size;
@@ -875,10 +1081,8 @@ extern "C"{
         }
         sb_free(hwalls);
         sb_free(vwalls);
-        for(unsigned int m = 0; m < maze->w*maze->h; ++m){
-            maze->cells[m] &= ~MAZE_CELL_WALLED_BOTTOM;
-            maze->cells[m] &= ~MAZE_CELL_WALLED_LEFT;
-        }
+        free(walled_bottom);
+        free(walled_left);
         return true;
     }
     
@@ -886,8 +1090,8 @@ extern "C"{
         int directions[MAZE_DIRECTION_COUNT];
         for(int y = 0; y < maze->h; ++y) {
             for(int x = 0; x < maze->w; ++x) {
-                int m = y*maze->w+x;
-                if((maze->cells[m] & MAZE_LEFT ? 1:0) + (maze->cells[m] & MAZE_UP ? 1:0) + (maze->cells[m] & MAZE_RIGHT ? 1:0) + (maze->cells[m] & MAZE_DOWN ? 1:0) == 1) {
+                uint8_t cell = MazeCell(maze, x, y);
+                if((cell & MAZE_LEFT ? 1:0) + (cell & MAZE_UP ? 1:0) + (cell & MAZE_RIGHT ? 1:0) + (cell & MAZE_DOWN ? 1:0) == 1) {
                     int the_directions[MAZE_DIRECTION_COUNT] = {
                         MAZE_LEFT, MAZE_UP, MAZE_RIGHT, MAZE_DOWN
                     };
@@ -903,33 +1107,29 @@ extern "C"{
                     directions[MAZE_DIRECTION_COUNT-1] = the_directions[0];
                     bool connected = false;
                     for(int i = 0; i < MAZE_DIRECTION_COUNT && !connected; ++i) {
-                        if(maze->cells[m] & directions[i]) continue;
+                        if(cell & directions[i]) continue;
                         switch(directions[i]) {
                             case MAZE_LEFT:{
                                 if(x > 0) {
-                                    maze->cells[m] |= MAZE_LEFT;
-                                    maze->cells[y*maze->w + x-1] |= MAZE_RIGHT;
+                                    MazeConnect(maze, x, y, MAZE_LEFT);
                                     connected = true;
                                 }
                             }break;
                             case MAZE_RIGHT:{
                                 if(x < maze->w-1) {
-                                    maze->cells[m] |= MAZE_RIGHT;
-                                    maze->cells[y*maze->w + x+1] |= MAZE_LEFT;
+                                    MazeConnect(maze, x, y, MAZE_RIGHT);
                                     connected = true;
                                 }
                             }break;
                             case MAZE_DOWN:{
                                 if(y > 0) {
-                                    maze->cells[m] |= MAZE_DOWN;
-                                    maze->cells[(y-1)*maze->w + x] |= MAZE_UP;
+                                    MazeConnect(maze, x, y, MAZE_DOWN);
                                     connected = true;
                                 }
                             }break;
                             case MAZE_UP:{
                                 if(y < maze->h-1) {
-                                    maze->cells[m] |= MAZE_UP;
-                                    maze->cells[(y+1)*maze->w + x] |= MAZE_DOWN;
+                                    MazeConnect(maze, x, y, MAZE_UP);
                                     connected = true;
                                 }
                             }break;
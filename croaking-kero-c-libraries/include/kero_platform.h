@@ -15,6 +15,7 @@ extern "C"{
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <math.h>
     
 #if __linux__
     
@@ -27,14 +28,74 @@ extern "C"{
 #include <stdlib.h>
 #include <string.h>
 #include <X11/XKBlib.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/Xrender.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <time.h>
+#include <errno.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef KERO_PLATFORM_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
     typedef struct timespec timespec;
+    
+#ifndef KERO_PLATFORM_MAX_PRESENT_BUFFERS
+#define KERO_PLATFORM_MAX_PRESENT_BUFFERS 3
+#endif
+    
+    typedef struct {
+        XImage* ximage;
+        XShmSegmentInfo shm_info;
+        bool shm; // Pixels live in a MIT-SHM segment shared with the X server
+        uint32_t* pixels;
+    } kp_image_t;
+    
+    // An event read from the X server or a headless script, before it is applied to the platform
+    typedef struct {
+        uint64_t time; // When it was read, from KP_ClockNs(). Headless: nanoseconds after KP_Init().
+        int type; // kp_event_type_t or KP_INPUT_*
+        int key_or_button;
+        int x, y; // Mouse position, or width and height for resizes
+    } kp_input_event_t;
+    
+    // Input event types that only change platform state
+#define KP_INPUT_RAW_MOTION (KP_EVENT_NONE + 1) // x, y is the motion
+#define KP_INPUT_MAP (KP_EVENT_NONE + 2) // key_or_button is 1 when mapped, 0 when unmapped
+#define KP_INPUT_OBSCURED (KP_EVENT_NONE + 3) // key_or_button is 1 when fully obscured
+    
+#ifndef KERO_PLATFORM_INPUT_QUEUE_SIZE
+#define KERO_PLATFORM_INPUT_QUEUE_SIZE 256 // Power of two
+#endif
 #else
 #include <SDL2/SDL.h>
 #endif
     
+#ifndef KERO_PLATFORM_EVENT_QUEUE_SIZE
+#define KERO_PLATFORM_EVENT_QUEUE_SIZE 256
+#endif
+    
+    typedef enum {
+        KP_EVENT_KEY_PRESS, KP_EVENT_KEY_RELEASE, KP_EVENT_QUIT, KP_EVENT_RESIZE, KP_EVENT_FOCUS_OUT, KP_EVENT_FOCUS_IN, KP_EVENT_MOUSE_BUTTON_PRESS, KP_EVENT_MOUSE_BUTTON_RELEASE, KP_EVENT_MOUSE_MOVE, KP_EVENT_EXPOSE, KP_EVENT_HIDE, KP_EVENT_SHOW, KP_EVENT_NONE
+    } kp_event_type_t;
+    typedef struct {
+        kp_event_type_t type;
+        union {
+            uint8_t key;
+            struct {
+                uint8_t button;
+                uint16_t x, y;
+            };
+            struct {
+                uint16_t width, height;
+            };
+        };
+    } kp_event_t;
+    
     typedef struct{
         unsigned int w, h;
         uint32_t* pixels;
@@ -48,6 +109,9 @@ extern "C"{
         float delta;
         bool reset_keyboard_on_focus_out;
         bool fullscreen;
+        bool focused; // The window has keyboard focus
+        bool mapped; // The window is mapped, i.e. not minimised or hidden
+        bool visible; // Mapped and not completely covered by other windows. Nothing drawn can be seen while this is false.
         unsigned int windowed_width, windowed_height;
         int windowed_x, windowed_y;
         struct{
@@ -55,7 +119,36 @@ extern "C"{
             bool invertx, inverty;
             uint32_t buttons;
         } mouse;
+        struct {
+            bool enabled;
+            double dx, dy; // Motion since the last KP_RawMouseDelta()
+        } raw_mouse;
         unsigned long target_frame_time; // Linux: In nano seconds. Other platforms: In milliseconds.
+        double present_time; // Milliseconds KP_Present() took. With a present thread this is only the wait for a free buffer.
+        int present_queue_depth; // Frames handed to the present thread but not yet on screen
+        double present_latency; // Milliseconds from KP_Present() until that frame reached the display
+        unsigned long pacer_spin_time; // Linux: Nanoseconds before each frame deadline to busy-wait instead of sleeping. 0 by default.
+        struct {
+            double last; // Milliseconds the last frame was off the target frame time. Negative when early.
+            double average; // Mean of the absolute jitter in milliseconds
+            double deviation; // Root mean square of the jitter in milliseconds
+            double max; // Largest absolute jitter in milliseconds
+            unsigned int frames;
+            unsigned int missed; // Frames that ended after their deadline
+            double sum, sum_squares;
+        } jitter; // Zero this to restart the statistics
+        struct {
+            double last; // Milliseconds from reading the last key or button press to the end of presenting the first frame drawn after it
+            double average, max;
+            unsigned int count;
+            double sum;
+            bool pending; // A press has been applied that no presented frame reflects yet
+            uint64_t pending_time; // Read time of the earliest such press
+        } input_latency; // Linux only. Zero this to restart the statistics.
+        struct {
+            kp_event_t ring[KERO_PLATFORM_EVENT_QUEUE_SIZE];
+            int start, count;
+        } event_queue; // Translated events waiting for KP_NextEvent()
 #if __linux__
         Display* display;
         unsigned long root_window;
@@ -63,11 +156,69 @@ extern "C"{
         XVisualInfo visual_info;
         XSetWindowAttributes window_attributes;
         Window xwindow;
-        XImage* ximage;
+        kp_image_t image;
+        bool shm; // Frames are presented through MIT-SHM
+        struct {
+            bool running, preserve_contents; // The thread reads running under the mutex and exits once it is cleared and the queue is empty
+            pthread_t thread;
+            Display* display; // Output only connection owned by the present thread
+            GC graphics_context;
+            pthread_mutex_t mutex;
+            pthread_cond_t cond;
+            int num_buffers;
+            kp_image_t buffers[KERO_PLATFORM_MAX_PRESENT_BUFFERS];
+            double submit_time[KERO_PLATFORM_MAX_PRESENT_BUFFERS];
+            uint64_t input_time[KERO_PLATFORM_MAX_PRESENT_BUFFERS]; // Earliest press the frame reflects, 0 for none
+            int queue[KERO_PLATFORM_MAX_PRESENT_BUFFERS]; // Buffer indices in submission order
+            int queue_start, queue_count;
+            int drawing; // Buffer the frame buffer currently points to
+            int presenting; // -1 when idle
+            // Written by the thread under the mutex and moved into present_latency and input_latency on the main thread, so those are never written while the program reads them
+            double latency;
+            uint64_t shown_input_time[KERO_PLATFORM_MAX_PRESENT_BUFFERS], shown_time[KERO_PLATFORM_MAX_PRESENT_BUFFERS];
+            int num_shown;
+        } present;
+        struct {
+            bool initialized, available;
+            Picture window_picture;
+            Pixmap pixmap; // Holds the unscaled frame on the server
+            Picture picture;
+            unsigned int w, h;
+            XImage image;
+        } xrender;
         Atom WM_DELETE_WINDOW;
         GC graphics_context;
-        timespec frame_start;
-        timespec frame_finish;
+        bool fully_obscured; // Last VisibilityNotify state
+        unsigned long warp_serial; // Request number of the last XWarpPointer. Motion events from before it are stale.
+        int xinput_opcode; // 0 until XInput 2 has been looked for, -1 if the server doesn't have it
+        bool pointer_grabbed; // Confined to the window while raw mouse motion is on
+        Cursor blank_cursor; // Made the first time the cursor is hidden and kept, so hiding it again costs no server round trips or allocations
+        struct {
+            bool running;
+            pthread_t thread;
+            Display* display; // Read only connection owned by the input thread
+            kp_input_event_t ring[KERO_PLATFORM_INPUT_QUEUE_SIZE]; // Single producer, single consumer
+            uint32_t head; // Written by the input thread
+            uint32_t tail; // Written by the main thread
+            int wake_pipe[2]; // The input thread writes a byte after queueing events, to wake KP_WaitForEvents()
+            int stop_pipe[2]; // KP_StopInputThread() writes a byte to wake the input thread from waiting on its connection
+            unsigned int dropped; // Events lost because the queue was full
+        } input;
+        struct {
+            bool enabled; // No X connection. The frame buffer lives in memory and events come from a script.
+            bool virtual_time; // Every frame takes exactly the target frame time and nothing sleeps
+            uint64_t start; // KP_ClockNs() at KP_Init()
+            uint64_t time; // Virtual nanoseconds since KP_Init()
+            kp_input_event_t* events; // Sorted by time
+            int num_events, next_event;
+            bool quit; // Send a quit event next
+            unsigned int frames; // Frames presented
+            unsigned int max_frames; // Quit after this many frames. 0 for no limit.
+            const char* dump_path; // printf pattern given the frame number, NULL to not save frames
+            unsigned int dump_interval;
+        } headless;
+        uint64_t frame_start; // CLOCK_MONOTONIC nanoseconds
+        uint64_t frame_deadline; // When the current frame should end. 0 to schedule from the start of the next frame.
         bool keyboard[256];
         Atom _NET_WM_STATE_ATOM;
 #else
@@ -79,29 +230,13 @@ extern "C"{
 #endif
     } kero_platform_t;
     
-    typedef enum {
-        KP_EVENT_KEY_PRESS, KP_EVENT_KEY_RELEASE, KP_EVENT_QUIT, KP_EVENT_RESIZE, KP_EVENT_FOCUS_OUT, KP_EVENT_FOCUS_IN, KP_EVENT_MOUSE_BUTTON_PRESS, KP_EVENT_MOUSE_BUTTON_RELEASE, KP_EVENT_NONE
-    } kp_event_type_t;
-    typedef struct {
-        kp_event_type_t type;
-        union {
-            uint8_t key;
-            struct {
-                uint8_t button;
-                uint16_t x, y;
-            };
-            struct {
-                uint16_t width, height;
-            };
-        };
-    } kp_event_t;
-    
     //------------------------------------------------------------
     
     /*
      Usage
      
-    Include this file. Currently this single header contains the entire Kero_Platform library. On Linux link against X11 (-lX11). On Windows/Mac link against SDL2 (-lSDL2)
+    Include this file. Currently this single header contains the entire Kero_Platform library. On Linux link against X11, Xext and Xrender (-lX11 -lXext -lXrender). On Windows/Mac link against SDL2 (-lSDL2)
+    Define KERO_PLATFORM_XINPUT2 before including this file and link -lXi for raw mouse motion on Linux, see KP_SetRawMouse().
     */
     
     
@@ -111,6 +246,24 @@ extern "C"{
 Initialize Kero Platform
 width and height are the internal size of the frame, not the total size of the window. The actual frame may be smaller if it cannot fit on the screen.
     This sets a target framerate of 60fps and disables key repeat.
+    
+    On Linux this runs headless when the environment variable KP_HEADLESS is set, or when KERO_PLATFORM_HEADLESS is defined before including this file. Otherwise failing to open the X display exits the program. Programs run unchanged: the frame buffer is plain memory, presenting only counts (and optionally saves) frames, and events come from a script. Headless runs are configured with environment variables:
+    KP_HEADLESS_EVENTS    Event script. One event per line: time in milliseconds since KP_Init(), then one of
+                            key_press KEY, key_release KEY, key KEY (press and release), mouse_move X Y,
+                            button_press BUTTON X Y, button_release BUTTON X Y, click BUTTON X Y, raw_move DX DY, resize W H,
+                            focus_out, focus_in, hide, show, expose, quit
+                          KEY is a single character or escape, enter, space, tab, up, down, left, right, lshift, rshift, lalt, ralt, lctrl, rctrl, f1 to f12. BUTTON is left, middle or right. Lines starting with # are ignored.
+    KP_HEADLESS_TIME      "virtual" (default): frames take exactly the target frame time (1/60s when unlimited) without sleeping, so runs are fast and repeatable. "real": frames are paced by the real clock like a window.
+    KP_HEADLESS_FRAMES    Send a quit event after this many presented frames.
+    KP_HEADLESS_DUMP      Save presented frames as PPM images. printf pattern given the frame number, e.g. frames/%05u.ppm
+    KP_HEADLESS_DUMP_INTERVAL  Only save every Nth frame.
+    Waiting for events with no timeout after the script has run out sends a quit event, so headless runs always end.
+    KERO_PLATFORM_HEADLESS still needs the X libraries to link.
+    */
+    
+    void KP_Shutdown(kero_platform_t *platform);
+    /*
+    Stop the present and input threads and free the cursor KP_ShowCursor() made. Call before exiting, e.g. from atexit().
     */
     
     void KP_Flip(kero_platform_t *platform);
@@ -118,23 +271,93 @@ width and height are the internal size of the frame, not the total size of the w
     Send frame buffer to screen.
     Sleep until time since last flip = target frame time (1/fps).
     Sets kp_delta variable to the number of seconds from the end of the last frame to the end of this one, including sleep time. DO NOT MANUALLY CHANGE THE VALUE OF kp_delta!
+    Same as KP_Present() followed by KP_LimitFramerate().
+    */
+    
+    void KP_Present(kero_platform_t *platform);
+    /*
+    Send frame buffer to screen and wait until the display has it. Does not sleep.
+    On Linux the frame buffer is shared with the X server through MIT-SHM when possible, otherwise it is sent with XPutImage. Set the environment variable KP_NO_SHM to force XPutImage.
+    Sets platform->present_time to the milliseconds it took.
+    */
+    
+    bool KP_StartPresentThread(kero_platform_t *platform, int num_buffers, bool preserve_contents);
+    /*
+    Present from a separate thread so the next frame can be drawn while the last one is being sent to the display.
+    The frame buffer becomes a ring of num_buffers (2 to KERO_PLATFORM_MAX_PRESENT_BUFFERS) buffers. KP_Present() queues the current one and only waits if every other buffer is still queued or on screen.
+    platform->frame_buffer.pixels moves to a different buffer after every KP_Present()/KP_Flip(), so re-read it each frame.
+    With preserve_contents the new buffer starts as a copy of the frame just presented, for programs that don't redraw the whole frame buffer every frame.
+    platform->present_queue_depth and platform->present_latency track the thread. Don't mix with KP_PresentScaled().
+    Returns false and keeps presenting on the calling thread if the thread or its display connection can't be created.
+    */
+    
+    void KP_StopPresentThread(kero_platform_t *platform);
+    /*
+    Let the present thread finish the frames already queued, wait for it to exit, close its connection and go back to presenting on the calling thread with a single frame buffer holding the frame being drawn. Does nothing if the thread isn't running.
+    */
+    
+    bool KP_StartInputThread(kero_platform_t *platform);
+    /*
+    Read events on a separate thread with its own X connection, so they are timestamped when they arrive rather than when the next frame asks for them. Events are still handed out by KP_EventsQueued()/KP_NextEvent() on the calling thread, through a lock free queue.
+    platform->input_latency measures from a key or button press being read to the end of presenting the first frame drawn after it, with or without the thread.
+    Returns false and keeps reading events on the calling thread if the thread or its connection can't be created.
+    */
+    
+    void KP_StopInputThread(kero_platform_t *platform);
+    /*
+    Wake the input thread, wait for it to finish and go back to reading events on the calling thread. Events it read that haven't been taken with KP_NextEvent() yet are dropped. Does nothing if the thread isn't running.
+    */
+    
+    bool KP_PresentScaled(kero_platform_t *platform, uint32_t* pixels, unsigned int w, unsigned int h, bool bilinear);
+    /*
+    Send a w*h image to the screen and let the display scale it up to fill the window, keeping its aspect ratio and centring it. Only the small image is transferred and the frame buffer is not touched. Does not sleep.
+    bilinear = false gives nearest neighbour filtering.
+    On Linux this needs the XRender extension (link -lXrender). Returns false without presenting anything when it is not available, in which case scale into the frame buffer and call KP_Present() instead.
+    Sets platform->present_time to the milliseconds it took.
+    */
+    
+    void KP_PresentRect(kero_platform_t *platform, int x, int y, unsigned int w, unsigned int h);
+    /*
+    Like KP_Present() but only sends the w*h rectangle at x, y of the frame buffer. The rest of the window keeps what was last presented.
+    With a present thread running this presents the whole frame buffer.
+    */
+    
+    void KP_LimitFramerate(kero_platform_t *platform);
+    /*
+    Sleep until the end of the current frame and update kp_delta.
+    On Linux frames end on fixed deadlines one target frame time apart, waited for with absolute CLOCK_MONOTONIC sleeps so sleep error doesn't add up over frames. Set platform->pacer_spin_time to busy-wait the last part of each frame for tighter timing at the cost of CPU time. A frame more than a whole frame late starts a new schedule instead of rushing the next frames out to catch up.
+    Updates the platform->jitter statistics.
+    */
+    
+    void KP_ResetFrameTimer(kero_platform_t *platform);
+    /*
+    Start timing a new frame now. Call after deliberately not presenting for a while, e.g. after KP_WaitForEvents(), so the idle time isn't counted as a long frame by KP_LimitFramerate().
     */
     
     int KP_EventsQueued(kero_platform_t *platform);
     /*
     Returns number of events queued.
-    Updates mouse position and button state.
+    When the queue is empty, everything the window system has already sent is translated into it in one batch, without blocking or waiting on a reply. Runs of mouse moves are merged into the last one.
+    platform->mouse is kept up to date from the events, so it reflects the last batch.
+    */
+    
+    bool KP_WaitForEvents(kero_platform_t *platform, int timeout_ms);
+    /*
+    Block until an event is queued or timeout_ms milliseconds pass. A negative timeout waits forever.
+    Returns true if events are queued. Use this instead of spinning on KP_EventsQueued() when there is nothing to draw until the user does something.
     */
     
     kp_event_t* KP_NextEvent(kero_platform_t *platform);
     /*
     Returns pointer to next event in queue and removes that event from the queue.
+    The event lives in a fixed ring inside the platform, nothing is allocated. It stays valid until the next KP_EventsQueued() or KP_NextEvent() call.
     The event may have type KP_EVENT_NONE in which case it should be ignored.
+    KP_EVENT_HIDE and KP_EVENT_SHOW are sent when platform->visible changes. Focus events also update platform->focused.
     */
     
     void KP_FreeEvent(kp_event_t* e);
     /*
-    Frees the event. Should be called for every event retrieved by KP_NextEvent to avoid a memory leak.
+    Does nothing. Events no longer need freeing, kept so older code still compiles.
     */
     
     /*
@@ -154,7 +377,6 @@ width and height are the internal size of the frame, not the total size of the w
                 game_running = false;
             }break;
         }
-        KP_FreeEvent(e);
     }
     
     See enum kp_event_type_t for all event types.
@@ -168,7 +390,7 @@ width and height are the internal size of the frame, not the total size of the w
     
     void KP_UpdateMouse(kero_platform_t *platform);
     /*
-    Updates the mouse position and buttons.
+    Asks the window system where the mouse is right now. On Linux this is a round trip to the X server, so prefer the position KP_EventsQueued() keeps.
     Mouse x/y are kp_mouse.x/y
     Buttons are kp_mouse.buttons & MOUSE_LEFT/MOUSE_RIGHT/MOUSE_OTHER
     */
@@ -196,7 +418,12 @@ Key repeats (holding key down) are ignored automatically.
     
     double KP_Clock();
     /*
-    Returns current wall-clock time in milliseconds.
+    Returns current time in milliseconds from a monotonic clock. Only useful for measuring durations.
+    */
+    
+    uint64_t KP_ClockNs();
+    /*
+    Returns current time in nanoseconds from a monotonic clock.
     */
     
     void KP_SetCursorPos(kero_platform_t *platform, int x, int y, int* dx, int* dy);
@@ -204,6 +431,20 @@ Key repeats (holding key down) are ignored automatically.
     Sets mouse cursor to x,y which are offsets from the top-left corner of the window.
     dx and dy are set to the distance the cursor was moved.
     dx/dy can be NULL.
+    Warping is a round trip through the window system and the motion it causes arrives late, so prefer KP_SetRawMouse() for mouse look.
+    */
+    
+    bool KP_SetRawMouse(kero_platform_t *platform, bool enable);
+    /*
+    Report mouse movement as unaccelerated relative motion, for mouse look. The pointer is confined to the window while the window is focused instead of being warped back every frame.
+    Motion is added up while events are translated, read it with KP_RawMouseDelta().
+    On Linux this uses XInput 2 raw motion, which needs KERO_PLATFORM_XINPUT2 (link -lXi). Synthetic input from XTest, e.g. xdotool mousemove_relative under Xvfb, arrives as raw motion too. Headless, raw_move DX DY script lines provide it. SDL uses relative mouse mode.
+    Returns false if raw motion isn't available, in which case it stays off.
+    */
+    
+    void KP_RawMouseDelta(kero_platform_t *platform, double* dx, double* dy);
+    /*
+    Raw mouse motion since the last call, in device units. Either pointer can be NULL to throw the motion away, e.g. after a pause.
     */
     
     void KP_Fullscreen(kero_platform_t *platform, bool full);
@@ -234,6 +475,65 @@ Key repeats (holding key down) are ignored automatically.
     
     //------------------------------------------------------------
     
+    // jitter in milliseconds
+    static void KP_UpdateJitter(kero_platform_t *platform, double jitter) {
+        double magnitude = jitter < 0 ? -jitter : jitter;
+        ++platform->jitter.frames;
+        platform->jitter.last = jitter;
+        platform->jitter.sum += magnitude;
+        platform->jitter.sum_squares += jitter*jitter;
+        platform->jitter.average = platform->jitter.sum/platform->jitter.frames;
+        platform->jitter.deviation = sqrt(platform->jitter.sum_squares/platform->jitter.frames);
+        if(magnitude > platform->jitter.max) {
+            platform->jitter.max = magnitude;
+        }
+    }
+    
+    // input_time and presented in nanoseconds
+    static void KP_UpdateInputLatency(kero_platform_t *platform, uint64_t input_time, uint64_t presented) {
+        double latency = (presented > input_time ? presented - input_time : 0)/1000000.0;
+        ++platform->input_latency.count;
+        platform->input_latency.last = latency;
+        platform->input_latency.sum += latency;
+        platform->input_latency.average = platform->input_latency.sum/platform->input_latency.count;
+        if(latency > platform->input_latency.max) {
+            platform->input_latency.max = latency;
+        }
+    }
+    
+    // Adds a translated event to the ring. Consecutive mouse moves are merged into the newest one and KP_EVENT_NONE is dropped. The caller makes sure there is room.
+    static void KP_QueueEvent(kero_platform_t *platform, const kp_event_t* event) {
+        if(event->type == KP_EVENT_NONE) return;
+        int start = platform->event_queue.start, count = platform->event_queue.count;
+        if(count && event->type == KP_EVENT_MOUSE_MOVE) {
+            kp_event_t* last = &platform->event_queue.ring[(start + count - 1)%KERO_PLATFORM_EVENT_QUEUE_SIZE];
+            if(last->type == KP_EVENT_MOUSE_MOVE) {
+                *last = *event;
+                return;
+            }
+        }
+        platform->event_queue.ring[(start + count)%KERO_PLATFORM_EVENT_QUEUE_SIZE] = *event;
+        ++platform->event_queue.count;
+    }
+    
+    // Returns a KP_EVENT_NONE event in the free slot when the ring is empty
+    static kp_event_t* KP_DequeueEvent(kero_platform_t *platform) {
+        kp_event_t* event = &platform->event_queue.ring[platform->event_queue.start];
+        if(!platform->event_queue.count) {
+            event->type = KP_EVENT_NONE;
+            return event;
+        }
+        platform->event_queue.start = (platform->event_queue.start + 1)%KERO_PLATFORM_EVENT_QUEUE_SIZE;
+        --platform->event_queue.count;
+        return event;
+    }
+    
+    void KP_RawMouseDelta(kero_platform_t *platform, double* dx, double* dy) {
+        if(dx) *dx = platform->raw_mouse.dx;
+        if(dy) *dy = platform->raw_mouse.dy;
+        platform->raw_mouse.dx = platform->raw_mouse.dy = 0;
+    }
+    
 #define KEY_ENTER KEY_RETURN
     
 #if __linux__
@@ -313,39 +613,693 @@ Key repeats (holding key down) are ignored automatically.
     
     // KP_SetWindowTitle on Linux is very slow and inconsistent. Don't call every frame.
     void KP_SetWindowTitle(kero_platform_t *platform, const char* const title) {
+        if(platform->headless.enabled) return;
         XStoreName(platform->display, platform->xwindow, title);
     }
     
-    // fps = 0 to disable frame limiting
-    void KP_SetTargetFramerate(kero_platform_t *platform, const unsigned int fps) {
-        if(fps) {
-            platform->target_frame_time = 1000000000/fps;
-        }
-        else{
-            platform->target_frame_time = 0;
+    // fps = 0 to disable frame limiting
+    void KP_SetTargetFramerate(kero_platform_t *platform, const unsigned int fps) {
+        if(fps) {
+            platform->target_frame_time = 1000000000/fps;
+        }
+        else{
+            platform->target_frame_time = 0;
+        }
+        platform->frame_deadline = 0;
+    }
+    
+    // Every event KP_ApplyInput handles, for both KP_Init and KPGL_Init
+    static const long kp_event_mask = StructureNotifyMask | KeyPressMask | KeyReleaseMask | FocusChangeMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ExposureMask | VisibilityChangeMask;
+    
+    // Installed once by KP_Init, before the present and input threads exist, since XSetErrorHandler is process wide.
+    // Only a failed XShmAttach from KP_CreateImage is swallowed. Everything else goes to the handler that was there before.
+    static XErrorHandler kp_previous_error_handler;
+    static Display* kp_shm_attach_display;
+    static unsigned long kp_shm_attach_serial;
+    static bool kp_shm_error;
+    static int KP_ErrorHandler(Display* display, XErrorEvent* error) {
+        if(display == __atomic_load_n(&kp_shm_attach_display, __ATOMIC_ACQUIRE) && error->serial == kp_shm_attach_serial) {
+            __atomic_store_n(&kp_shm_error, true, __ATOMIC_RELEASE);
+            return 0;
+        }
+        return kp_previous_error_handler ? kp_previous_error_handler(display, error) : 0;
+    }
+    
+    // Tries a MIT-SHM image first. Falls back to a client side image sent with XPutImage. Pixels start black.
+    void KP_CreateImage(kero_platform_t *platform, Display* display, kp_image_t* image) {
+        image->shm = false;
+        if(platform->headless.enabled) {
+            image->ximage = NULL;
+            image->pixels = (uint32_t*)calloc(platform->window.w*platform->window.h, sizeof(uint32_t));
+            return;
+        }
+        if(!getenv("KP_NO_SHM") && XShmQueryExtension(display)) {
+            image->ximage = XShmCreateImage(display, platform->visual_info.visual, platform->visual_info.depth, ZPixmap, NULL, &image->shm_info, platform->window.w, platform->window.h);
+            if(image->ximage) {
+                image->shm_info.shmid = shmget(IPC_PRIVATE, image->ximage->bytes_per_line*image->ximage->height, IPC_CREAT | 0600);
+                if(image->shm_info.shmid >= 0) {
+                    image->shm_info.shmaddr = image->ximage->data = (char*)shmat(image->shm_info.shmid, 0, 0);
+                    if(image->shm_info.shmaddr != (char*)-1) {
+                        image->shm_info.readOnly = False;
+                        // XShmAttach fails asynchronously, e.g. on a remote display. KP_ErrorHandler picks the error out by its serial.
+                        kp_shm_error = false;
+                        kp_shm_attach_serial = NextRequest(display);
+                        __atomic_store_n(&kp_shm_attach_display, display, __ATOMIC_RELEASE);
+                        XShmAttach(display, &image->shm_info);
+                        XSync(display, False);
+                        __atomic_store_n(&kp_shm_attach_display, NULL, __ATOMIC_RELEASE);
+                        if(__atomic_load_n(&kp_shm_error, __ATOMIC_ACQUIRE)) {
+                            shmdt(image->shm_info.shmaddr);
+                        }
+                        else {
+                            image->shm = true;
+                        }
+                    }
+                    // The segment is freed once both the X server and this process detach
+                    shmctl(image->shm_info.shmid, IPC_RMID, 0);
+                }
+                if(!image->shm) {
+                    image->ximage->data = NULL;
+                    XDestroyImage(image->ximage);
+                }
+            }
+        }
+        if(image->shm) {
+            image->pixels = (uint32_t*)image->ximage->data;
+        }
+        else {
+            image->pixels = (uint32_t*)calloc(platform->window.w*platform->window.h, sizeof(uint32_t));
+            image->ximage = XCreateImage(display, platform->visual_info.visual, platform->visual_info.depth, ZPixmap, 0, (char*)image->pixels, platform->window.w, platform->window.h, 32, 0);
+        }
+    }
+    
+    void KP_DestroyImage(Display* display, kp_image_t* image) {
+        if(image->ximage) {
+            image->ximage->data = NULL;
+            XDestroyImage(image->ximage);
+        }
+        if(image->shm) {
+            XShmDetach(display, &image->shm_info);
+            XSync(display, False);
+            shmdt(image->shm_info.shmaddr);
+        }
+        else {
+            free(image->pixels);
+        }
+        image->pixels = NULL;
+    }
+    
+    // Returns once the X server has finished with the image
+    static inline void KP_PutImageRect(kero_platform_t *platform, Display* display, GC graphics_context, kp_image_t* image, int x, int y, unsigned int w, unsigned int h) {
+        if(image->shm) {
+            XShmPutImage(display, platform->xwindow, graphics_context, image->ximage, x, y, x, y, w, h, False);
+        }
+        else {
+            XPutImage(display, platform->xwindow, graphics_context, image->ximage, x, y, x, y, w, h);
+        }
+        XSync(display, False);
+    }
+    
+    // The image's own size, since a queued frame can be older than the last resize
+    static inline void KP_PutImage(kero_platform_t *platform, Display* display, GC graphics_context, kp_image_t* image) {
+        KP_PutImageRect(platform, display, graphics_context, image, 0, 0, image->ximage->width, image->ximage->height);
+    }
+    
+    void KP_CreateFrameBuffer(kero_platform_t *platform) {
+        if(platform->present.running) {
+            for(int i = 0; i < platform->present.num_buffers; ++i) {
+                KP_CreateImage(platform, platform->present.display, &platform->present.buffers[i]);
+            }
+            platform->shm = platform->present.buffers[0].shm;
+            platform->frame_buffer.pixels = platform->present.buffers[platform->present.drawing].pixels;
+        }
+        else {
+            KP_CreateImage(platform, platform->display, &platform->image);
+            platform->shm = platform->image.shm;
+            platform->frame_buffer.pixels = platform->image.pixels;
+        }
+        platform->frame_buffer.w = platform->window.w;
+        platform->frame_buffer.h = platform->window.h;
+    }
+    
+    void KP_DestroyFrameBuffer(kero_platform_t *platform) {
+        if(platform->present.running) {
+            // Wait for the present thread to let go of every buffer
+            pthread_mutex_lock(&platform->present.mutex);
+            while(platform->present.queue_count > 0 || platform->present.presenting >= 0) {
+                pthread_cond_wait(&platform->present.cond, &platform->present.mutex);
+            }
+            for(int i = 0; i < platform->present.num_buffers; ++i) {
+                KP_DestroyImage(platform->present.display, &platform->present.buffers[i]);
+            }
+            pthread_mutex_unlock(&platform->present.mutex);
+        }
+        else {
+            KP_DestroyImage(platform->display, &platform->image);
+        }
+        platform->frame_buffer.pixels = NULL;
+    }
+    
+    // The frame that just reached the display reflects every press applied before it
+    static void KP_InputPresented(kero_platform_t *platform, uint64_t presented) {
+        if(platform->input_latency.pending) {
+            KP_UpdateInputLatency(platform, platform->input_latency.pending_time, presented);
+            platform->input_latency.pending = false;
+        }
+    }
+    
+    void* KP_PresentThreadMain(void* data) {
+        kero_platform_t *platform = (kero_platform_t*)data;
+        pthread_mutex_lock(&platform->present.mutex);
+        for(;;) {
+            while(platform->present.queue_count == 0 && platform->present.running) {
+                pthread_cond_wait(&platform->present.cond, &platform->present.mutex);
+            }
+            if(platform->present.queue_count == 0) break; // Stopped, and every queued frame has been presented
+            int buffer = platform->present.queue[platform->present.queue_start];
+            platform->present.queue_start = (platform->present.queue_start + 1) % KERO_PLATFORM_MAX_PRESENT_BUFFERS;
+            --platform->present.queue_count;
+            platform->present.presenting = buffer;
+            pthread_mutex_unlock(&platform->present.mutex);
+            
+            KP_PutImage(platform, platform->present.display, platform->present.graphics_context, &platform->present.buffers[buffer]);
+            double presented = KP_Clock();
+            uint64_t presented_ns = KP_ClockNs();
+            
+            pthread_mutex_lock(&platform->present.mutex);
+            platform->present.presenting = -1;
+            platform->present.latency = presented - platform->present.submit_time[buffer];
+            if(platform->present.input_time[buffer] && platform->present.num_shown < KERO_PLATFORM_MAX_PRESENT_BUFFERS) {
+                platform->present.shown_input_time[platform->present.num_shown] = platform->present.input_time[buffer];
+                platform->present.shown_time[platform->present.num_shown] = presented_ns;
+                ++platform->present.num_shown;
+            }
+            pthread_cond_broadcast(&platform->present.cond);
+        }
+        pthread_mutex_unlock(&platform->present.mutex);
+        return NULL;
+    }
+    
+    // Main thread, with the present mutex held. Takes in what the thread has presented since the last call.
+    static void KP_PresentThreadCollect(kero_platform_t *platform) {
+        platform->present_latency = platform->present.latency;
+        for(int i = 0; i < platform->present.num_shown; ++i) {
+            KP_UpdateInputLatency(platform, platform->present.shown_input_time[i], platform->present.shown_time[i]);
+        }
+        platform->present.num_shown = 0;
+    }
+    
+    bool KP_StartPresentThread(kero_platform_t *platform, int num_buffers, bool preserve_contents) {
+        if(platform->present.running) return true;
+        if(platform->headless.enabled) return false;
+        if(num_buffers < 2) num_buffers = 2;
+        if(num_buffers > KERO_PLATFORM_MAX_PRESENT_BUFFERS) num_buffers = KERO_PLATFORM_MAX_PRESENT_BUFFERS;
+        platform->present.display = XOpenDisplay(0);
+        if(!platform->present.display) {
+            fprintf(stderr, "Failed to open display for the present thread\n");
+            return false;
+        }
+        platform->present.graphics_context = DefaultGC(platform->present.display, DefaultScreen(platform->present.display));
+        pthread_mutex_init(&platform->present.mutex, NULL);
+        pthread_cond_init(&platform->present.cond, NULL);
+        platform->present.preserve_contents = preserve_contents;
+        platform->present.num_buffers = num_buffers;
+        platform->present.queue_start = platform->present.queue_count = 0;
+        platform->present.presenting = -1;
+        platform->present.drawing = 0;
+        platform->present.latency = 0;
+        platform->present.num_shown = 0;
+        
+        // Swap the single frame buffer for the ring, keeping what has been drawn so far
+        uint32_t* previous_pixels = (uint32_t*)malloc(sizeof(uint32_t)*platform->window.w*platform->window.h);
+        if(previous_pixels) memcpy(previous_pixels, platform->frame_buffer.pixels, sizeof(uint32_t)*platform->window.w*platform->window.h);
+        KP_DestroyFrameBuffer(platform);
+        platform->present.running = true;
+        KP_CreateFrameBuffer(platform);
+        if(previous_pixels) {
+            memcpy(platform->frame_buffer.pixels, previous_pixels, sizeof(uint32_t)*platform->window.w*platform->window.h);
+            free(previous_pixels);
+        }
+        if(pthread_create(&platform->present.thread, NULL, KP_PresentThreadMain, platform) != 0) {
+            fprintf(stderr, "Failed to create present thread\n");
+            KP_DestroyFrameBuffer(platform);
+            platform->present.running = false;
+            KP_CreateFrameBuffer(platform);
+            XCloseDisplay(platform->present.display);
+            return false;
+        }
+        return true;
+    }
+    
+    void KP_StopPresentThread(kero_platform_t *platform) {
+        if(!platform->present.running) return;
+        pthread_mutex_lock(&platform->present.mutex);
+        platform->present.running = false;
+        pthread_cond_broadcast(&platform->present.cond);
+        pthread_mutex_unlock(&platform->present.mutex);
+        pthread_join(platform->present.thread, NULL);
+        KP_PresentThreadCollect(platform);
+        platform->present_queue_depth = 0;
+        
+        // Swap the ring back for a single frame buffer on the main connection, keeping the frame being drawn
+        kp_image_t* drawing = &platform->present.buffers[platform->present.drawing];
+        uint32_t* previous_pixels = (uint32_t*)malloc(sizeof(uint32_t)*platform->window.w*platform->window.h);
+        if(previous_pixels) memcpy(previous_pixels, drawing->pixels, sizeof(uint32_t)*platform->window.w*platform->window.h);
+        for(int i = 0; i < platform->present.num_buffers; ++i) {
+            KP_DestroyImage(platform->present.display, &platform->present.buffers[i]);
+        }
+        XCloseDisplay(platform->present.display);
+        platform->present.display = NULL;
+        pthread_mutex_destroy(&platform->present.mutex);
+        pthread_cond_destroy(&platform->present.cond);
+        KP_CreateFrameBuffer(platform);
+        if(previous_pixels) {
+            memcpy(platform->frame_buffer.pixels, previous_pixels, sizeof(uint32_t)*platform->window.w*platform->window.h);
+            free(previous_pixels);
+        }
+    }
+    
+    // Hands the current buffer to the present thread and moves the frame buffer to a free one
+    static void KP_PresentQueued(kero_platform_t *platform) {
+        pthread_mutex_lock(&platform->present.mutex);
+        int submitted = platform->present.drawing;
+        platform->present.submit_time[submitted] = KP_Clock();
+        platform->present.input_time[submitted] = platform->input_latency.pending ? platform->input_latency.pending_time : 0;
+        platform->input_latency.pending = false;
+        platform->present.queue[(platform->present.queue_start + platform->present.queue_count) % KERO_PLATFORM_MAX_PRESENT_BUFFERS] = submitted;
+        ++platform->present.queue_count;
+        platform->present_queue_depth = platform->present.queue_count;
+        pthread_cond_broadcast(&platform->present.cond);
+        int next;
+        for(;;) {
+            next = -1;
+            for(int i = 0; i < platform->present.num_buffers && next < 0; ++i) {
+                bool busy = i == submitted || i == platform->present.presenting;
+                for(int q = 0; q < platform->present.queue_count; ++q) {
+                    busy |= platform->present.queue[(platform->present.queue_start + q) % KERO_PLATFORM_MAX_PRESENT_BUFFERS] == i;
+                }
+                if(!busy) next = i;
+            }
+            if(next >= 0) break;
+            pthread_cond_wait(&platform->present.cond, &platform->present.mutex);
+        }
+        platform->present.drawing = next;
+        KP_PresentThreadCollect(platform);
+        pthread_mutex_unlock(&platform->present.mutex);
+        // The submitted buffer is only read by the present thread, so copying from it is safe
+        if(platform->present.preserve_contents) {
+            memcpy(platform->present.buffers[next].pixels, platform->present.buffers[submitted].pixels, sizeof(uint32_t)*platform->window.w*platform->window.h);
+        }
+        platform->frame_buffer.pixels = platform->present.buffers[next].pixels;
+    }
+    
+    void KP_Sleep(unsigned long nanoseconds) {
+        timespec sleep_time = { nanoseconds/1000000000, nanoseconds%1000000000 };
+        nanosleep(&sleep_time, 0);
+    }
+    
+    uint64_t KP_ClockNs() {
+        timespec clock_time;
+        clock_gettime(CLOCK_MONOTONIC, &clock_time);
+        return (uint64_t)clock_time.tv_sec*1000000000 + clock_time.tv_nsec;
+    }
+    
+    static void KP_SleepUntil(uint64_t deadline) {
+        timespec wake = { deadline/1000000000, deadline%1000000000 };
+        // An absolute wake time can simply be retried after a signal
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+    }
+    
+    static int KP_HeadlessParseKey(const char* name) {
+        static const struct {
+            const char* name;
+            uint8_t key;
+        } names[] = {
+            {"escape", KEY_ESCAPE}, {"enter", KEY_RETURN}, {"return", KEY_RETURN}, {"space", KEY_SPACE}, {"tab", (uint8_t)XK_Tab},
+            {"up", KEY_UP}, {"down", KEY_DOWN}, {"left", KEY_LEFT}, {"right", KEY_RIGHT},
+            {"lshift", KEY_LSHIFT}, {"rshift", KEY_RSHIFT}, {"lalt", KEY_LALT}, {"ralt", KEY_RALT}, {"lctrl", KEY_LCTRL}, {"rctrl", KEY_RCTRL},
+            {"f1", KEY_F1}, {"f2", KEY_F2}, {"f3", KEY_F3}, {"f4", KEY_F4}, {"f5", KEY_F5}, {"f6", KEY_F6},
+            {"f7", KEY_F7}, {"f8", KEY_F8}, {"f9", KEY_F9}, {"f10", KEY_F10}, {"f11", KEY_F11}, {"f12", KEY_F12},
+        };
+        for(unsigned int i = 0; i < sizeof(names)/sizeof(names[0]); ++i) {
+            if(!strcmp(name, names[i].name)) return names[i].key;
+        }
+        // Latin-1 keysyms are the characters themselves
+        if(name[0] && !name[1]) {
+            return (name[0] >= 'A' && name[0] <= 'Z') ? name[0] - 'A' + 'a' : (uint8_t)name[0];
+        }
+        return -1;
+    }
+    
+    static int KP_HeadlessParseButton(const char* name) {
+        if(!strcmp(name, "left")) return MOUSE_LEFT;
+        if(!strcmp(name, "middle")) return MOUSE_MIDDLE;
+        if(!strcmp(name, "right")) return MOUSE_RIGHT;
+        return -1;
+    }
+    
+    static void KP_HeadlessAddEvent(kero_platform_t *platform, int* capacity, double time_ms, int type, int key_or_button, int x, int y) {
+        if(platform->headless.num_events == *capacity) {
+            *capacity = *capacity ? *capacity*2 : 64;
+            platform->headless.events = (kp_input_event_t*)realloc(platform->headless.events, sizeof(kp_input_event_t)**capacity);
+        }
+        kp_input_event_t* e = &platform->headless.events[platform->headless.num_events++];
+        e->time = time_ms*1000000.0;
+        e->type = type;
+        e->key_or_button = key_or_button;
+        e->x = x;
+        e->y = y;
+    }
+    
+    static bool KP_HeadlessLoadEvents(kero_platform_t *platform, const char* path) {
+        FILE* file = fopen(path, "r");
+        if(!file) {
+            fprintf(stderr, "Failed to open headless event script %s\n", path);
+            return false;
+        }
+        int capacity = 0;
+        char line[256];
+        for(int line_number = 1; fgets(line, sizeof(line), file); ++line_number) {
+            double time;
+            char name[32], arg[32] = "";
+            int x = 0, y = 0;
+            if(line[0] == '#' || sscanf(line, "%lf %31s", &time, name) < 2) continue;
+            int num_args = sscanf(line, "%*f %*s %31s %d %d", arg, &x, &y);
+            int key = KP_HeadlessParseKey(arg);
+            int button = KP_HeadlessParseButton(arg);
+            bool is_key = !strcmp(name, "key") || !strcmp(name, "key_press") || !strcmp(name, "key_release");
+            if(is_key && num_args >= 1 && key >= 0) {
+                if(strcmp(name, "key_release")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_KEY_PRESS, key, 0, 0);
+                if(strcmp(name, "key_press")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_KEY_RELEASE, key, 0, 0);
+            }
+            else if((!strcmp(name, "button_press") || !strcmp(name, "click")) && num_args == 3 && button >= 0) {
+                KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_MOUSE_BUTTON_PRESS, button, x, y);
+                if(name[0] == 'c') KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_MOUSE_BUTTON_RELEASE, button, x, y);
+            }
+            else if(!strcmp(name, "button_release") && num_args == 3 && button >= 0) {
+                KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_MOUSE_BUTTON_RELEASE, button, x, y);
+            }
+            else if((!strcmp(name, "mouse_move") || !strcmp(name, "resize")) && sscanf(line, "%*f %*s %d %d", &x, &y) == 2) {
+                KP_HeadlessAddEvent(platform, &capacity, time, name[0] == 'm' ? KP_EVENT_MOUSE_MOVE : KP_EVENT_RESIZE, 0, x, y);
+            }
+            else if(!strcmp(name, "raw_move") && sscanf(line, "%*f %*s %d %d", &x, &y) == 2) {
+                KP_HeadlessAddEvent(platform, &capacity, time, KP_INPUT_RAW_MOTION, 0, x, y);
+            }
+            else if(!strcmp(name, "focus_out")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_FOCUS_OUT, 0, 0, 0);
+            else if(!strcmp(name, "focus_in")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_FOCUS_IN, 0, 0, 0);
+            else if(!strcmp(name, "hide")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_HIDE, 0, 0, 0);
+            else if(!strcmp(name, "show")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_SHOW, 0, 0, 0);
+            else if(!strcmp(name, "expose")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_EXPOSE, 0, 0, 0);
+            else if(!strcmp(name, "quit")) KP_HeadlessAddEvent(platform, &capacity, time, KP_EVENT_QUIT, 0, 0, 0);
+            else {
+                fprintf(stderr, "%s:%d: Can't parse headless event\n", path, line_number);
+            }
+        }
+        fclose(file);
+        // Insertion sort keeps events with the same time in script order, e.g. the press and release of "key"
+        for(int i = 1; i < platform->headless.num_events; ++i) {
+            kp_input_event_t e = platform->headless.events[i];
+            int j = i;
+            for(; j > 0 && platform->headless.events[j - 1].time > e.time; --j) {
+                platform->headless.events[j] = platform->headless.events[j - 1];
+            }
+            platform->headless.events[j] = e;
+        }
+        return true;
+    }
+    
+    static void KP_HeadlessInit(kero_platform_t *platform) {
+        platform->shm = false;
+        platform->headless.start = KP_ClockNs();
+        platform->headless.time = 0;
+        const char* env = getenv("KP_HEADLESS_TIME");
+        platform->headless.virtual_time = !env || strcmp(env, "real");
+        platform->headless.events = NULL;
+        platform->headless.num_events = platform->headless.next_event = 0;
+        platform->headless.quit = false;
+        platform->headless.frames = 0;
+        env = getenv("KP_HEADLESS_FRAMES");
+        platform->headless.max_frames = env ? strtoul(env, NULL, 10) : 0;
+        platform->headless.dump_path = getenv("KP_HEADLESS_DUMP");
+        env = getenv("KP_HEADLESS_DUMP_INTERVAL");
+        platform->headless.dump_interval = env && strtoul(env, NULL, 10) ? strtoul(env, NULL, 10) : 1;
+        env = getenv("KP_HEADLESS_EVENTS");
+        if(env) {
+            KP_HeadlessLoadEvents(platform, env);
+        }
+    }
+    
+    static inline uint64_t KP_HeadlessTime(kero_platform_t *platform) {
+        return platform->headless.virtual_time ? platform->headless.time : KP_ClockNs() - platform->headless.start;
+    }
+    
+    static int KP_HeadlessEventsDue(kero_platform_t *platform) {
+        uint64_t now = KP_HeadlessTime(platform);
+        int due = platform->headless.quit;
+        for(int i = platform->headless.next_event; i < platform->headless.num_events && platform->headless.events[i].time <= now; ++i) {
+            ++due;
+        }
+        return due;
+    }
+    
+    static bool KP_HeadlessWait(kero_platform_t *platform, int timeout_ms) {
+        if(KP_HeadlessEventsDue(platform)) return true;
+        bool script_finished = platform->headless.next_event == platform->headless.num_events;
+        if(script_finished && timeout_ms < 0) {
+            // Nothing will ever arrive
+            platform->headless.quit = true;
+            return true;
+        }
+        uint64_t now = KP_HeadlessTime(platform);
+        uint64_t wake = timeout_ms < 0 ? UINT64_MAX : now + (uint64_t)timeout_ms*1000000;
+        if(!script_finished && platform->headless.events[platform->headless.next_event].time < wake) {
+            wake = platform->headless.events[platform->headless.next_event].time;
+        }
+        if(platform->headless.virtual_time) {
+            platform->headless.time = wake;
+        }
+        else {
+            KP_SleepUntil(platform->headless.start + wake);
+        }
+        return KP_HeadlessEventsDue(platform) > 0;
+    }
+    
+    static void KP_HeadlessSaveFrame(kero_platform_t *platform) {
+        char path[1024];
+        snprintf(path, sizeof(path), platform->headless.dump_path, platform->headless.frames);
+        FILE* file = fopen(path, "wb");
+        if(!file) {
+            fprintf(stderr, "Failed to save frame %s\n", path);
+            return;
+        }
+        fprintf(file, "P6\n%u %u\n255\n", platform->frame_buffer.w, platform->frame_buffer.h);
+        uint8_t* row = (uint8_t*)malloc(platform->frame_buffer.w*3);
+        for(unsigned int y = 0; y < platform->frame_buffer.h; ++y) {
+            uint32_t* pixel = platform->frame_buffer.pixels + y*platform->frame_buffer.w;
+            for(unsigned int x = 0; x < platform->frame_buffer.w; ++x) {
+                row[x*3] = pixel[x] >> 16;
+                row[x*3 + 1] = pixel[x] >> 8;
+                row[x*3 + 2] = pixel[x];
+            }
+            fwrite(row, 3, platform->frame_buffer.w, file);
+        }
+        free(row);
+        fclose(file);
+    }
+    
+    static void KP_HeadlessPresent(kero_platform_t *platform) {
+        KP_InputPresented(platform, KP_HeadlessTime(platform));
+        if(platform->headless.dump_path && platform->headless.frames % platform->headless.dump_interval == 0) {
+            KP_HeadlessSaveFrame(platform);
+        }
+        ++platform->headless.frames;
+        if(platform->headless.max_frames && platform->headless.frames >= platform->headless.max_frames) {
+            platform->headless.quit = true;
+        }
+    }
+    
+    // Turns a change in mapping or obscurity into a show/hide event
+    static inline void KP_UpdateVisible(kero_platform_t *platform, kp_event_t* event) {
+        bool visible = platform->mapped && !platform->fully_obscured;
+        if(visible != platform->visible) {
+            platform->visible = visible;
+            event->type = visible ? KP_EVENT_SHOW : KP_EVENT_HIDE;
+        }
+    }
+    
+#ifdef KERO_PLATFORM_XINPUT2
+    static void KP_GrabPointer(kero_platform_t *platform, bool grab) {
+        if(grab == platform->pointer_grabbed || platform->headless.enabled) return;
+        if(grab) {
+            platform->pointer_grabbed = XGrabPointer(platform->display, platform->xwindow, True, ButtonPressMask | ButtonReleaseMask | PointerMotionMask, GrabModeAsync, GrabModeAsync, platform->xwindow, None, CurrentTime) == GrabSuccess;
+        }
+        else {
+            XUngrabPointer(platform->display, CurrentTime);
+            platform->pointer_grabbed = false;
+        }
+    }
+#endif
+    
+    // Applies an X or scripted event to the platform state and turns it into the event the program sees
+    static void KP_ApplyInput(kero_platform_t *platform, const kp_input_event_t* e, kp_event_t* event) {
+        event->type = (kp_event_type_t)e->type;
+        switch(e->type) {
+            case KP_EVENT_KEY_PRESS:
+            case KP_EVENT_KEY_RELEASE:{
+                event->key = e->key_or_button;
+                platform->keyboard[event->key] = e->type == KP_EVENT_KEY_PRESS;
+            }break;
+            case KP_EVENT_MOUSE_BUTTON_PRESS:
+            case KP_EVENT_MOUSE_BUTTON_RELEASE:{
+                event->button = e->key_or_button;
+                if(e->type == KP_EVENT_MOUSE_BUTTON_PRESS) {
+                    platform->mouse.buttons |= e->key_or_button;
+                }
+                else {
+                    platform->mouse.buttons &= ~e->key_or_button;
+                }
+                event->x = platform->mouse.invertx ? platform->window.w - e->x : e->x;
+                event->y = platform->mouse.inverty ? platform->window.h - e->y : e->y;
+            }break;
+            case KP_EVENT_MOUSE_MOVE:{
+                platform->mouse.x = event->x = platform->mouse.invertx ? platform->window.w - e->x : e->x;
+                platform->mouse.y = event->y = platform->mouse.inverty ? platform->window.h - e->y : e->y;
+            }break;
+            case KP_INPUT_RAW_MOTION:{
+                event->type = KP_EVENT_NONE;
+                if(platform->raw_mouse.enabled) {
+                    platform->raw_mouse.dx += platform->mouse.invertx ? -e->x : e->x;
+                    platform->raw_mouse.dy += platform->mouse.inverty ? -e->y : e->y;
+                }
+            }break;
+            case KP_EVENT_RESIZE:{
+                if(e->x <= 0 || e->y <= 0 || ((unsigned int)e->x == platform->window.w && (unsigned int)e->y == platform->window.h)) {
+                    event->type = KP_EVENT_NONE;
+                    break;
+                }
+                if(!platform->fullscreen) {
+                    platform->windowed_width = e->x;
+                    platform->windowed_height = e->y;
+                }
+                // Frames still queued for the present thread are the old size, so they drain first
+                KP_DestroyFrameBuffer(platform);
+                platform->window.w = event->width = e->x;
+                platform->window.h = event->height = e->y;
+                KP_CreateFrameBuffer(platform);
+            }break;
+            case KP_EVENT_FOCUS_OUT:{
+                if(platform->reset_keyboard_on_focus_out) {
+                    memset(platform->keyboard, 0, sizeof(platform->keyboard));
+                }
+                platform->mouse.buttons = 0;
+                platform->focused = false;
+#ifdef KERO_PLATFORM_XINPUT2
+                KP_GrabPointer(platform, false);
+#endif
+            }break;
+            case KP_EVENT_FOCUS_IN:{
+                platform->focused = true;
+#ifdef KERO_PLATFORM_XINPUT2
+                KP_GrabPointer(platform, platform->raw_mouse.enabled);
+#endif
+            }break;
+            case KP_EVENT_HIDE:
+            case KP_EVENT_SHOW:{
+                platform->mapped = platform->visible = e->type == KP_EVENT_SHOW;
+            }break;
+            case KP_INPUT_MAP:{
+                event->type = KP_EVENT_NONE;
+                platform->mapped = e->key_or_button;
+                KP_UpdateVisible(platform, event);
+            }break;
+            case KP_INPUT_OBSCURED:{
+                event->type = KP_EVENT_NONE;
+                platform->fully_obscured = e->key_or_button;
+                KP_UpdateVisible(platform, event);
+            }break;
+        }
+        // The first frame presented from now on reflects the press
+        if((event->type == KP_EVENT_KEY_PRESS || event->type == KP_EVENT_MOUSE_BUTTON_PRESS) && (!platform->input_latency.pending || e->time < platform->input_latency.pending_time)) {
+            platform->input_latency.pending = true;
+            platform->input_latency.pending_time = e->time;
+        }
+    }
+    
+    static void KP_HeadlessNextEvent(kero_platform_t *platform, kp_event_t* event) {
+        if(platform->headless.quit) {
+            platform->headless.quit = false;
+            event->type = KP_EVENT_QUIT;
+            return;
         }
+        if(!KP_HeadlessEventsDue(platform)) return;
+        KP_ApplyInput(platform, &platform->headless.events[platform->headless.next_event++], event);
     }
     
     void KP_Init(kero_platform_t *platform, const unsigned int width, const unsigned int height, const char* const title) {
         platform->delta = 0;
         platform->reset_keyboard_on_focus_out = true;
         platform->fullscreen = false;
+        // Assume the window shows up as soon as it's created. Map, visibility and focus events correct this.
+        platform->focused = true;
+        platform->mapped = true;
+        platform->visible = true;
         platform->windowed_width = 0;
         platform->windowed_height = 0;
         platform->windowed_x = 0;
         platform->windowed_y = 0;
         platform->target_frame_time = 0;
+        platform->pacer_spin_time = 0;
+        memset(&platform->jitter, 0, sizeof(platform->jitter));
+        platform->present_time = 0;
+        platform->present_queue_depth = 0;
+        platform->present_latency = 0;
+        platform->present.running = false;
+        platform->fully_obscured = false;
         platform->windowed_width = width;
         platform->windowed_height = height;
         platform->window.w = width;
         platform->window.h = height;
-        platform->display = XOpenDisplay(0);
+        platform->xrender.initialized = false;
+        memset(platform->keyboard, 0, sizeof(platform->keyboard));
+        platform->event_queue.start = platform->event_queue.count = 0;
+        platform->raw_mouse.enabled = false;
+        platform->raw_mouse.dx = platform->raw_mouse.dy = 0;
+        memset(&platform->input_latency, 0, sizeof(platform->input_latency));
+        platform->input.running = false;
+        platform->warp_serial = 0;
+        platform->xinput_opcode = 0;
+        platform->pointer_grabbed = false;
+        platform->blank_cursor = None;
+        platform->display = NULL;
+#ifdef KERO_PLATFORM_HEADLESS
+        platform->headless.enabled = true;
+#else
+        platform->headless.enabled = getenv("KP_HEADLESS") != NULL;
+        if(!platform->headless.enabled) {
+            platform->display = XOpenDisplay(0);
+            if(!platform->display) {
+                // Only run headless when asked to, so a missing $DISPLAY doesn't leave an invisible game running
+                fprintf(stderr, "Failed to open X display. Set KP_HEADLESS to run without one.\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+#endif
+        if(platform->headless.enabled) {
+            KP_HeadlessInit(platform);
+            KP_CreateFrameBuffer(platform);
+            KP_SetTargetFramerate(platform, 60);
+            platform->frame_start = KP_ClockNs();
+            return;
+        }
+        if(!kp_previous_error_handler) {
+            kp_previous_error_handler = XSetErrorHandler(KP_ErrorHandler);
+        }
         platform->root_window = XDefaultRootWindow(platform->display);
         platform->screen = XDefaultScreen(platform->display);
         XMatchVisualInfo(platform->display, platform->screen, 24, TrueColor, &platform->visual_info);
         platform->window_attributes.background_pixel = 0;
         platform->window_attributes.colormap = XCreateColormap(platform->display, platform->root_window, platform->visual_info.visual, AllocNone);
-        platform->window_attributes.event_mask = StructureNotifyMask | KeyPressMask | KeyReleaseMask | FocusChangeMask | ButtonPressMask | ButtonReleaseMask;
+        platform->window_attributes.event_mask = kp_event_mask;
         platform->xwindow = XCreateWindow(platform->display, platform->root_window, 0, 0, platform->window.w, platform->window.h, 0, platform->visual_info.depth, 0, platform->visual_info.visual, CWBackPixel | CWColormap | CWEventMask, &platform->window_attributes);
         XMapWindow(platform->display, platform->xwindow);
         XFlush(platform->display);
@@ -353,14 +1307,11 @@ Key repeats (holding key down) are ignored automatically.
         XSetWMProtocols(platform->display, platform->xwindow, &platform->WM_DELETE_WINDOW, 1);
         XkbSetDetectableAutoRepeat(platform->display, True, 0);
         KP_SetWindowTitle(platform, title);
-        platform->frame_buffer.pixels = (uint32_t*)malloc(sizeof(uint32_t)*platform->window.w*platform->window.h);
-        platform->frame_buffer.w = platform->window.w;
-        platform->frame_buffer.h = platform->window.h;
-        platform->ximage = XCreateImage(platform->display, platform->visual_info.visual, platform->visual_info.depth, ZPixmap, 0, (char*)platform->frame_buffer.pixels, platform->window.w, platform->window.h, 32, 0);
+        KP_CreateFrameBuffer(platform);
         platform->graphics_context = DefaultGC(platform->display, platform->screen);
         KP_SetTargetFramerate(platform, 60);
         platform->_NET_WM_STATE_ATOM = XInternAtom(platform->display, "_NET_WM_STATE", False);
-        clock_gettime(CLOCK_REALTIME, &platform->frame_start);
+        platform->frame_start = KP_ClockNs();
     }
     
 #ifdef KERO_PLATFORM_GL
@@ -379,12 +1330,13 @@ Key repeats (holding key down) are ignored automatically.
         platform->windowed_height = height;
         platform->window.w = width;
         platform->window.h = height;
+        platform->blank_cursor = None;
         platform->display = XOpenDisplay(0);
         platform->root_window = XDefaultRootWindow(platform->display);
         platform->screen = XDefaultScreen(platform->display);
         platform->visual_info = *glXChooseVisual(platform->display, 0, gl_attributes);
         platform->window_attributes.colormap = XCreateColormap(platform->display, platform->root_window, platform->visual_info.visual, AllocNone);
-        platform->window_attributes.event_mask = StructureNotifyMask | KeyPressMask | KeyReleaseMask | FocusChangeMask | ButtonPressMask | ButtonReleaseMask;
+        platform->window_attributes.event_mask = kp_event_mask;
         platform->xwindow = XCreateWindow(platform->display, platform->root_window, 0, 0, platform->window.w, platform->window.h, 0, platform->visual_info.depth, 0, platform->visual_info.visual, CWColormap | CWEventMask, &platform->window_attributes);
         XMapWindow(platform->display, platform->xwindow);
         XFlush(platform->display);
@@ -411,40 +1363,189 @@ Key repeats (holding key down) are ignored automatically.
         glXSwapIntervalEXT(platform->display, gl_drawable, 1);
         KP_SetTargetFramerate(platform, 60);
         platform->_NET_WM_STATE_ATOM = XInternAtom(platform->display, "_NET_WM_STATE", False);
-        clock_gettime(CLOCK_REALTIME, &platform->frame_start);
+        platform->frame_start = KP_ClockNs();
     }
     
     void KPGL_Flip(kero_platform_t *platform) {
         glXSwapBuffers(platform->display, platform->xwindow);
         //glFinish();
-        clock_gettime(CLOCK_REALTIME, &platform->frame_finish);
-        platform->delta = (platform->frame_finish.tv_sec - platform->frame_start.tv_sec) +(platform->frame_finish.tv_nsec - platform->frame_start.tv_nsec)/1000000000.f;
-        platform->frame_start = platform->frame_finish;
+        uint64_t frame_finish = KP_ClockNs();
+        platform->delta = (frame_finish - platform->frame_start)/1000000000.f;
+        platform->frame_start = frame_finish;
     }
 #endif // KERO_PLATFORM_GL
     
-    void KP_Sleep(unsigned long nanoseconds) {
-        timespec sleep_time = { 0, nanoseconds };
-        nanosleep(&sleep_time, 0);
+    void KP_Present(kero_platform_t *platform) {
+        double present_start = KP_Clock();
+        if(platform->headless.enabled) {
+            KP_HeadlessPresent(platform);
+        }
+        else if(platform->present.running) {
+            KP_PresentQueued(platform);
+        }
+        else {
+            // With MIT-SHM the server reads straight from the frame buffer, so it has to finish before the next frame is drawn
+            KP_PutImage(platform, platform->display, platform->graphics_context, &platform->image);
+            platform->present_latency = KP_Clock() - present_start;
+            KP_InputPresented(platform, KP_ClockNs());
+        }
+        platform->present_time = KP_Clock() - present_start;
     }
     
-    void KP_Flip(kero_platform_t *platform) {
-        XPutImage(platform->display, platform->xwindow, platform->graphics_context, platform->ximage, 0, 0, 0, 0, platform->window.w, platform->window.h);
+    static bool KP_XRenderInit(kero_platform_t *platform) {
+        platform->xrender.initialized = true;
+        platform->xrender.available = false;
+        int event_base, error_base;
+        if(!XRenderQueryExtension(platform->display, &event_base, &error_base)) {
+            fprintf(stderr, "XRender is not available\n");
+            return false;
+        }
+        XRenderPictFormat* window_format = XRenderFindVisualFormat(platform->display, platform->visual_info.visual);
+        if(!window_format) {
+            fprintf(stderr, "No XRender format for the window visual\n");
+            return false;
+        }
+        platform->xrender.window_picture = XRenderCreatePicture(platform->display, platform->xwindow, window_format, 0, NULL);
+        platform->xrender.pixmap = None;
+        platform->xrender.picture = None;
+        platform->xrender.w = platform->xrender.h = 0;
+        platform->xrender.available = true;
+        return true;
+    }
+    
+    bool KP_PresentScaled(kero_platform_t *platform, uint32_t* pixels, unsigned int w, unsigned int h, bool bilinear) {
+        if(platform->headless.enabled) {
+            return false;
+        }
+        if(!platform->xrender.initialized) {
+            KP_XRenderInit(platform);
+        }
+        if(!platform->xrender.available || w == 0 || h == 0) {
+            return false;
+        }
+        double present_start = KP_Clock();
+        if(w != platform->xrender.w || h != platform->xrender.h) {
+            if(platform->xrender.picture != None) {
+                XRenderFreePicture(platform->display, platform->xrender.picture);
+                XFreePixmap(platform->display, platform->xrender.pixmap);
+            }
+            platform->xrender.pixmap = XCreatePixmap(platform->display, platform->xwindow, w, h, platform->visual_info.depth);
+            platform->xrender.picture = XRenderCreatePicture(platform->display, platform->xrender.pixmap, XRenderFindVisualFormat(platform->display, platform->visual_info.visual), 0, NULL);
+            platform->xrender.w = w;
+            platform->xrender.h = h;
+            // Describes the caller's pixels in place, so no image is allocated per frame
+            memset(&platform->xrender.image, 0, sizeof(XImage));
+            platform->xrender.image.width = w;
+            platform->xrender.image.height = h;
+            platform->xrender.image.format = ZPixmap;
+            platform->xrender.image.byte_order = ImageByteOrder(platform->display);
+            platform->xrender.image.bitmap_unit = 32;
+            platform->xrender.image.bitmap_bit_order = BitmapBitOrder(platform->display);
+            platform->xrender.image.bitmap_pad = 32;
+            platform->xrender.image.depth = platform->visual_info.depth;
+            platform->xrender.image.bytes_per_line = w*sizeof(uint32_t);
+            platform->xrender.image.bits_per_pixel = 32;
+            platform->xrender.image.red_mask = platform->visual_info.red_mask;
+            platform->xrender.image.green_mask = platform->visual_info.green_mask;
+            platform->xrender.image.blue_mask = platform->visual_info.blue_mask;
+            XInitImage(&platform->xrender.image);
+        }
+        platform->xrender.image.data = (char*)pixels;
+        XPutImage(platform->display, platform->xrender.pixmap, platform->graphics_context, &platform->xrender.image, 0, 0, 0, 0, w, h);
+        
+        double scale = (double)platform->window.w/w < (double)platform->window.h/h ? (double)platform->window.w/w : (double)platform->window.h/h;
+        unsigned int scaled_w = w*scale, scaled_h = h*scale;
+        int left = (platform->window.w - scaled_w)/2, top = (platform->window.h - scaled_h)/2;
+        // The transform maps window pixels back to source pixels
+        XTransform transform = {{
+                {XDoubleToFixed(1.0/scale), XDoubleToFixed(0), XDoubleToFixed(0)},
+                {XDoubleToFixed(0), XDoubleToFixed(1.0/scale), XDoubleToFixed(0)},
+                {XDoubleToFixed(0), XDoubleToFixed(0), XDoubleToFixed(1)}
+            }};
+        XRenderSetPictureTransform(platform->display, platform->xrender.picture, &transform);
+        XRenderSetPictureFilter(platform->display, platform->xrender.picture, bilinear ? FilterBilinear : FilterNearest, NULL, 0);
+        XRenderComposite(platform->display, PictOpSrc, platform->xrender.picture, None, platform->xrender.window_picture, 0, 0, 0, 0, left, top, scaled_w, scaled_h);
+        
+        // Black bars around the frame
+        XRenderColor black = {0, 0, 0, 0xffff};
+        XRectangle bars[4] = {
+            {0, 0, platform->window.w, top},
+            {0, top + scaled_h, platform->window.w, platform->window.h - top - scaled_h},
+            {0, top, left, scaled_h},
+            {left + scaled_w, top, platform->window.w - left - scaled_w, scaled_h},
+        };
+        XRenderFillRectangles(platform->display, PictOpSrc, platform->xrender.window_picture, &black, bars, 4);
+        XSync(platform->display, False);
+        platform->present_time = KP_Clock() - present_start;
+        KP_InputPresented(platform, KP_ClockNs());
+        return true;
+    }
+    
+    void KP_PresentRect(kero_platform_t *platform, int x, int y, unsigned int w, unsigned int h) {
+        if(platform->present.running || platform->headless.enabled) {
+            KP_Present(platform);
+            return;
+        }
+        double present_start = KP_Clock();
+        int right = x + (int)w < (int)platform->window.w ? x + (int)w : (int)platform->window.w;
+        int bottom = y + (int)h < (int)platform->window.h ? y + (int)h : (int)platform->window.h;
+        x = x > 0 ? x : 0;
+        y = y > 0 ? y : 0;
+        if(x < right && y < bottom) {
+            KP_PutImageRect(platform, platform->display, platform->graphics_context, &platform->image, x, y, right - x, bottom - y);
+        }
+        platform->present_time = platform->present_latency = KP_Clock() - present_start;
+        KP_InputPresented(platform, KP_ClockNs());
+    }
+    
+    void KP_ResetFrameTimer(kero_platform_t *platform) {
+        platform->frame_start = KP_ClockNs();
+        platform->frame_deadline = 0;
+    }
+    
+    void KP_LimitFramerate(kero_platform_t *platform) {
+        if(platform->headless.enabled && platform->headless.virtual_time) {
+            uint64_t frame_time = platform->target_frame_time ? platform->target_frame_time : 1000000000/60;
+            platform->headless.time += frame_time;
+            platform->delta = frame_time/1000000000.f;
+            platform->frame_start = KP_ClockNs();
+            return;
+        }
         if(platform->target_frame_time) {
-            // Delay until we take up the full frame time
-            clock_gettime(CLOCK_REALTIME, &platform->frame_finish);
-            long unsigned frame_time = (platform->frame_finish.tv_sec - platform->frame_start.tv_sec)*1000000000 + (platform->frame_finish.tv_nsec - platform->frame_start.tv_nsec);
-            timespec sleep_time;
-            sleep_time.tv_sec = 0;
-            sleep_time.tv_nsec = platform->target_frame_time - frame_time;
-            nanosleep(&sleep_time, 0);
-        }
-        clock_gettime(CLOCK_REALTIME, &platform->frame_finish);
-        platform->delta = (platform->frame_finish.tv_sec - platform->frame_start.tv_sec) +(platform->frame_finish.tv_nsec - platform->frame_start.tv_nsec)/1000000000.f;
-        platform->frame_start = platform->frame_finish;
+            if(!platform->frame_deadline) {
+                platform->frame_deadline = platform->frame_start + platform->target_frame_time;
+            }
+            uint64_t deadline = platform->frame_deadline;
+            uint64_t now = KP_ClockNs();
+            if(now < deadline) {
+                if(deadline - now > platform->pacer_spin_time) {
+                    KP_SleepUntil(deadline - platform->pacer_spin_time);
+                }
+                while(KP_ClockNs() < deadline);
+                platform->frame_deadline = deadline + platform->target_frame_time;
+            }
+            else {
+                ++platform->jitter.missed;
+                // Keep the schedule after a small miss, start a new one after a big one
+                platform->frame_deadline = now - deadline < platform->target_frame_time ? deadline + platform->target_frame_time : now + platform->target_frame_time;
+            }
+        }
+        uint64_t frame_finish = KP_ClockNs();
+        platform->delta = (frame_finish - platform->frame_start)/1000000000.f;
+        if(platform->target_frame_time) {
+            KP_UpdateJitter(platform, ((double)(frame_finish - platform->frame_start) - platform->target_frame_time)/1000000.0);
+        }
+        platform->frame_start = frame_finish;
+    }
+    
+    void KP_Flip(kero_platform_t *platform) {
+        KP_Present(platform);
+        KP_LimitFramerate(platform);
     }
     
     void KP_UpdateMouse(kero_platform_t *platform) {
+        // Headless, the mouse only moves with scripted events
+        if(platform->headless.enabled) return;
         Window window_returned;
         int display_x, display_y;
         unsigned int mask_return;
@@ -460,144 +1561,363 @@ Key repeats (holding key down) are ignored automatically.
         }
     }
     
-    int KP_EventsQueued(kero_platform_t *platform) {
-        KP_UpdateMouse(platform);
-        return XEventsQueued(platform->display, QueuedAfterFlush);
-    }
-    
-    kp_event_t* KP_NextEvent(kero_platform_t *platform) {
-        kp_event_t* event = (kp_event_t*)malloc(sizeof(kp_event_t));
-        event->type = KP_EVENT_NONE;
-        XEvent e;
-        XNextEvent(platform->display, &e);
-        switch(e.type) {
-            case KeyPress:{
-                event->type = KP_EVENT_KEY_PRESS;
-                uint8_t symbol = (uint8_t)XLookupKeysym(&e.xkey, 0);
-                platform->keyboard[symbol] = true;
-                event->key = symbol;
-            }break;
+    // Turns an X event into an input event without touching the platform, so the input thread can call it. Returns false for events that don't matter.
+    static bool KP_TranslateXEvent(kero_platform_t *platform, XEvent* e, kp_input_event_t* input) {
+        input->time = KP_ClockNs();
+        input->key_or_button = input->x = input->y = 0;
+        switch(e->type) {
+            case KeyPress:
             case KeyRelease:{
-                event->type = KP_EVENT_KEY_RELEASE;
-                uint8_t symbol = (uint8_t)XLookupKeysym(&e.xkey, 0);
-                platform->keyboard[symbol] = false;
-                event->key = symbol;
-            }break;
-            case ButtonPress:{
-                event->type = KP_EVENT_MOUSE_BUTTON_PRESS;
-                event->x = platform->mouse.invertx ? platform->window.w - e.xbutton.x : e.xbutton.x;
-                event->y = platform->mouse.inverty ? platform->window.h - e.xbutton.y : e.xbutton.y;
-                event->button = MOUSE_OTHER;
-                switch(e.xbutton.button) {
-                    case Button1:{
-                        event->button = MOUSE_LEFT;
-                        platform->mouse.buttons |= MOUSE_LEFT;
-                    }break;
-                    case Button2:{
-                        event->button = MOUSE_MIDDLE;
-                        platform->mouse.buttons |= MOUSE_MIDDLE;
-                    }break;
-                    case Button3:{
-                        event->button = MOUSE_RIGHT;
-                        platform->mouse.buttons |= MOUSE_RIGHT;
-                    }break;
-                }
+                input->type = e->type == KeyPress ? KP_EVENT_KEY_PRESS : KP_EVENT_KEY_RELEASE;
+                input->key_or_button = (uint8_t)XLookupKeysym(&e->xkey, 0);
             }break;
+            case ButtonPress:
             case ButtonRelease:{
-                event->type = KP_EVENT_MOUSE_BUTTON_RELEASE;
-                event->x = platform->mouse.invertx ? platform->window.w - e.xbutton.x : e.xbutton.x;
-                event->y = platform->mouse.inverty ? platform->window.h - e.xbutton.y : e.xbutton.y;
-                event->button = MOUSE_OTHER;
-                switch(e.xbutton.button) {
-                    case Button1:{
-                        event->button = MOUSE_LEFT;
-                        platform->mouse.buttons &= ~MOUSE_LEFT;
-                    }break;
-                    case Button2:{
-                        event->button = MOUSE_MIDDLE;
-                        platform->mouse.buttons &= ~MOUSE_MIDDLE;
-                    }break;
-                    case Button3:{
-                        event->button = MOUSE_RIGHT;
-                        platform->mouse.buttons &= ~MOUSE_RIGHT;
-                    }break;
+                input->type = e->type == ButtonPress ? KP_EVENT_MOUSE_BUTTON_PRESS : KP_EVENT_MOUSE_BUTTON_RELEASE;
+                input->x = e->xbutton.x;
+                input->y = e->xbutton.y;
+                switch(e->xbutton.button) {
+                    case Button1: input->key_or_button = MOUSE_LEFT; break;
+                    case Button2: input->key_or_button = MOUSE_MIDDLE; break;
+                    case Button3: input->key_or_button = MOUSE_RIGHT; break;
+                    default: input->key_or_button = MOUSE_OTHER; break;
                 }
             }break;
+            case MotionNotify:{
+                // Sent before the server moved the pointer for KP_SetCursorPos(), mouse already holds the new position. Serials are per connection, so this only works for the main one.
+                if(e->xany.display == platform->display && (long)(e->xmotion.serial - platform->warp_serial) < 0) return false;
+                input->type = KP_EVENT_MOUSE_MOVE;
+                input->x = e->xmotion.x;
+                input->y = e->xmotion.y;
+            }break;
+            case Expose:{
+                // Only report the last of a series of exposed rectangles
+                if(e->xexpose.count) return false;
+                input->type = KP_EVENT_EXPOSE;
+            }break;
             case ClientMessage:{
-                XClientMessageEvent* ev = (XClientMessageEvent*)&e;
-                if((Atom)ev->data.l[0] == platform->WM_DELETE_WINDOW) {
-                    event->type = KP_EVENT_QUIT;
-                }
+                if((Atom)e->xclient.data.l[0] != platform->WM_DELETE_WINDOW) return false;
+                input->type = KP_EVENT_QUIT;
             }break;
             case ConfigureNotify:{
-                XConfigureEvent* ev = (XConfigureEvent*)&e;
-                if(ev->width != platform->window.w || ev->height != platform->window.h) {
-                    event->type = KP_EVENT_RESIZE;
-                    if(!platform->fullscreen) {
-                        platform->windowed_width = ev->width;
-                        platform->windowed_height = ev->height;
-                    }
-                    platform->window.w = ev->width;
-                    platform->window.h = ev->height;
-                    event->width = platform->window.w;
-                    event->height = platform->window.h;
-                    platform->frame_buffer.pixels = (uint32_t*)realloc(platform->frame_buffer.pixels, sizeof(uint32_t)*platform->window.w*platform->window.h);
-                    platform->frame_buffer.w = platform->window.w;
-                    platform->frame_buffer.h = platform->window.h;
-                    platform->ximage = XCreateImage(platform->display, platform->visual_info.visual, platform->visual_info.depth, ZPixmap, 0, (char*)platform->frame_buffer.pixels, platform->window.w, platform->window.h, 32, 0);
-                }
+                input->type = KP_EVENT_RESIZE;
+                input->x = e->xconfigure.width;
+                input->y = e->xconfigure.height;
             }break;
             case DestroyNotify:{
-                event->type = KP_EVENT_QUIT;
+                input->type = KP_EVENT_QUIT;
             }break;
             case FocusOut:{
-                if(platform->reset_keyboard_on_focus_out) {
-                    memset(platform->keyboard, 0, sizeof(platform->keyboard));
-                }
-                platform->mouse.buttons = 0;
-                event->type = KP_EVENT_FOCUS_OUT;
+                input->type = KP_EVENT_FOCUS_OUT;
             }break;
             case FocusIn:{
-                event->type = KP_EVENT_FOCUS_IN;
+                input->type = KP_EVENT_FOCUS_IN;
+            }break;
+            case MapNotify:
+            case UnmapNotify:{
+                input->type = KP_INPUT_MAP;
+                input->key_or_button = e->type == MapNotify;
+            }break;
+            case VisibilityNotify:{
+                input->type = KP_INPUT_OBSCURED;
+                input->key_or_button = e->xvisibility.state == VisibilityFullyObscured;
             }break;
+            default: return false;
         }
-        return event;
+        return true;
+    }
+    
+#ifdef KERO_PLATFORM_XINPUT2
+    static void KP_ReadRawMotion(kero_platform_t *platform, XEvent* e) {
+        // Raw motion is selected on the root window, so it arrives even when another window has focus
+        if(e->xcookie.extension != platform->xinput_opcode || !XGetEventData(platform->display, &e->xcookie)) return;
+        if(e->xcookie.evtype == XI_RawMotion && platform->raw_mouse.enabled && platform->focused) {
+            XIRawEvent* raw = (XIRawEvent*)e->xcookie.data;
+            // raw_values only holds the valuators set in the mask, in axis order. Axes 0 and 1 are x and y.
+            double* value = raw->raw_values;
+            for(int axis = 0; axis < 2 && axis < raw->valuators.mask_len*8; ++axis) {
+                if(!XIMaskIsSet(raw->valuators.mask, axis)) continue;
+                if(axis == 0) {
+                    platform->raw_mouse.dx += platform->mouse.invertx ? -*value : *value;
+                }
+                else {
+                    platform->raw_mouse.dy += platform->mouse.inverty ? -*value : *value;
+                }
+                ++value;
+            }
+        }
+        XFreeEventData(platform->display, &e->xcookie);
+    }
+#endif
+    
+    static void* KP_InputThreadMain(void* data) {
+        kero_platform_t *platform = (kero_platform_t*)data;
+        struct pollfd fds[2] = {
+            { ConnectionNumber(platform->input.display), POLLIN, 0 },
+            { platform->input.stop_pipe[0], POLLIN, 0 },
+        };
+        while(__atomic_load_n(&platform->input.running, __ATOMIC_ACQUIRE)) {
+            // Wait outside Xlib, so KP_StopInputThread() can wake the thread through the pipe
+            if(!XPending(platform->input.display)) {
+                poll(fds, 2, -1);
+                continue;
+            }
+            XEvent e;
+            XNextEvent(platform->input.display, &e);
+            kp_input_event_t input;
+            if(!KP_TranslateXEvent(platform, &e, &input)) continue;
+            uint32_t head = platform->input.head;
+            if(head - __atomic_load_n(&platform->input.tail, __ATOMIC_ACQUIRE) == KERO_PLATFORM_INPUT_QUEUE_SIZE) {
+                ++platform->input.dropped;
+                continue;
+            }
+            platform->input.ring[head%KERO_PLATFORM_INPUT_QUEUE_SIZE] = input;
+            __atomic_store_n(&platform->input.head, head + 1, __ATOMIC_RELEASE);
+            if(!XPending(platform->input.display)) {
+                // The pipe doesn't block, and when it is full the main thread is already due to wake
+                char wake = 0;
+                ssize_t written = write(platform->input.wake_pipe[1], &wake, 1);
+                (void)written;
+            }
+        }
+        return NULL;
+    }
+    
+    bool KP_StartInputThread(kero_platform_t *platform) {
+        if(platform->input.running) return true;
+        if(platform->headless.enabled) return false;
+        platform->input.display = XOpenDisplay(0);
+        if(!platform->input.display) {
+            fprintf(stderr, "Failed to open display for the input thread\n");
+            return false;
+        }
+        if(pipe(platform->input.wake_pipe)) {
+            fprintf(stderr, "Failed to create the input thread's pipe\n");
+            XCloseDisplay(platform->input.display);
+            return false;
+        }
+        if(pipe(platform->input.stop_pipe)) {
+            fprintf(stderr, "Failed to create the input thread's pipe\n");
+            XCloseDisplay(platform->input.display);
+            close(platform->input.wake_pipe[0]);
+            close(platform->input.wake_pipe[1]);
+            return false;
+        }
+        fcntl(platform->input.wake_pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(platform->input.wake_pipe[1], F_SETFL, O_NONBLOCK);
+        platform->input.head = platform->input.tail = 0;
+        platform->input.dropped = 0;
+        XkbSetDetectableAutoRepeat(platform->input.display, True, 0);
+        // X sends events to every connection that selected them, so they move from the main connection to the input one. The main connection still gets what is only sent to the window's creator, like WM_DELETE_WINDOW, and pointer events while it has the pointer grabbed.
+        XSelectInput(platform->display, platform->xwindow, NoEventMask);
+        XSync(platform->display, False);
+        XSelectInput(platform->input.display, platform->xwindow, platform->window_attributes.event_mask);
+        XSync(platform->input.display, False);
+        platform->input.running = true;
+        if(pthread_create(&platform->input.thread, NULL, KP_InputThreadMain, platform) != 0) {
+            fprintf(stderr, "Failed to create input thread\n");
+            platform->input.running = false;
+            XCloseDisplay(platform->input.display);
+            close(platform->input.wake_pipe[0]);
+            close(platform->input.wake_pipe[1]);
+            close(platform->input.stop_pipe[0]);
+            close(platform->input.stop_pipe[1]);
+            XSelectInput(platform->display, platform->xwindow, platform->window_attributes.event_mask);
+            XFlush(platform->display);
+            return false;
+        }
+        return true;
+    }
+    
+    void KP_StopInputThread(kero_platform_t *platform) {
+        if(!platform->input.running) return;
+        __atomic_store_n(&platform->input.running, false, __ATOMIC_RELEASE);
+        char stop = 0;
+        ssize_t written = write(platform->input.stop_pipe[1], &stop, 1);
+        (void)written;
+        pthread_join(platform->input.thread, NULL);
+        XCloseDisplay(platform->input.display);
+        close(platform->input.wake_pipe[0]);
+        close(platform->input.wake_pipe[1]);
+        close(platform->input.stop_pipe[0]);
+        close(platform->input.stop_pipe[1]);
+        // Events go back to the main connection
+        XSelectInput(platform->display, platform->xwindow, platform->window_attributes.event_mask);
+        XFlush(platform->display);
+    }
+    
+    void KP_Shutdown(kero_platform_t *platform) {
+        if(platform->headless.enabled) return;
+        KP_StopPresentThread(platform);
+        KP_StopInputThread(platform);
+        if(platform->blank_cursor != None) {
+            XUndefineCursor(platform->display, platform->xwindow);
+            XFreeCursor(platform->display, platform->blank_cursor);
+            platform->blank_cursor = None;
+        }
+        XFlush(platform->display);
+    }
+    
+    static inline bool KP_InputThreadQueued(kero_platform_t *platform) {
+        return platform->input.running && __atomic_load_n(&platform->input.head, __ATOMIC_ACQUIRE) != platform->input.tail;
+    }
+    
+    // Translates what has already arrived into the ring. XEventsQueued(QueuedAfterFlush) only reads what is waiting on the socket, it never waits for a reply.
+    static void KP_DrainEvents(kero_platform_t *platform) {
+        if(platform->headless.enabled) {
+            while(platform->event_queue.count < KERO_PLATFORM_EVENT_QUEUE_SIZE && KP_HeadlessEventsDue(platform)) {
+                kp_event_t event = { KP_EVENT_NONE };
+                KP_HeadlessNextEvent(platform, &event);
+                KP_QueueEvent(platform, &event);
+            }
+            return;
+        }
+        if(platform->input.running) {
+            char wake[64];
+            while(read(platform->input.wake_pipe[0], wake, sizeof(wake)) > 0);
+            uint32_t head = __atomic_load_n(&platform->input.head, __ATOMIC_ACQUIRE);
+            uint32_t tail = platform->input.tail;
+            for(; tail != head && platform->event_queue.count < KERO_PLATFORM_EVENT_QUEUE_SIZE; ++tail) {
+                kp_event_t event = { KP_EVENT_NONE };
+                KP_ApplyInput(platform, &platform->input.ring[tail%KERO_PLATFORM_INPUT_QUEUE_SIZE], &event);
+                KP_QueueEvent(platform, &event);
+            }
+            __atomic_store_n(&platform->input.tail, tail, __ATOMIC_RELEASE);
+        }
+        int pending = XEventsQueued(platform->display, QueuedAfterFlush);
+        for(; pending > 0 && platform->event_queue.count < KERO_PLATFORM_EVENT_QUEUE_SIZE; --pending) {
+            XEvent e;
+            XNextEvent(platform->display, &e);
+#ifdef KERO_PLATFORM_XINPUT2
+            if(e.type == GenericEvent) {
+                KP_ReadRawMotion(platform, &e);
+                continue;
+            }
+#endif
+            kp_input_event_t input;
+            if(!KP_TranslateXEvent(platform, &e, &input)) continue;
+            kp_event_t event = { KP_EVENT_NONE };
+            KP_ApplyInput(platform, &input, &event);
+            KP_QueueEvent(platform, &event);
+        }
+    }
+    
+    int KP_EventsQueued(kero_platform_t *platform) {
+        if(!platform->event_queue.count) {
+            KP_DrainEvents(platform);
+        }
+        return platform->event_queue.count;
+    }
+    
+    bool KP_WaitForEvents(kero_platform_t *platform, int timeout_ms) {
+        if(platform->event_queue.count) {
+            return true;
+        }
+        if(platform->headless.enabled) {
+            return KP_HeadlessWait(platform, timeout_ms);
+        }
+        if(XEventsQueued(platform->display, QueuedAfterFlush) || KP_InputThreadQueued(platform)) {
+            return true;
+        }
+        // poll() skips negative file descriptors
+        struct pollfd connections[2] = {
+            { ConnectionNumber(platform->display), POLLIN, 0 },
+            { platform->input.running ? platform->input.wake_pipe[0] : -1, POLLIN, 0 },
+        };
+        while(poll(connections, 2, timeout_ms) < 0 && errno == EINTR);
+        return XEventsQueued(platform->display, QueuedAfterReading) > 0 || KP_InputThreadQueued(platform);
+    }
+    
+    kp_event_t* KP_NextEvent(kero_platform_t *platform) {
+        if(!platform->event_queue.count) {
+            KP_DrainEvents(platform);
+            // Nothing has arrived yet. Block like XNextEvent() always did.
+            while(!platform->event_queue.count && !platform->headless.enabled) {
+                KP_WaitForEvents(platform, -1);
+                KP_DrainEvents(platform);
+            }
+        }
+        return KP_DequeueEvent(platform);
     }
     
     void KP_FreeEvent(kp_event_t* e) {
-        free(e);
     }
     
     void KP_ShowCursor(kero_platform_t *platform, const bool show) {
+        if(platform->headless.enabled) return;
         if(show) {
             XUndefineCursor(platform->display, platform->xwindow);
         }
         else{
-            XColor color;
-            const char data[1] = {0};
-            Pixmap pixmap = XCreateBitmapFromData(platform->display, platform->xwindow, data, 1, 1);
-            Cursor cursor = XCreatePixmapCursor(platform->display, pixmap, pixmap, &color, &color, 0, 0);
-            XFreePixmap(platform->display, pixmap);
-            XDefineCursor(platform->display, platform->xwindow, cursor);
-            XFreeCursor(platform->display, cursor);
+            if(platform->blank_cursor == None) {
+                XColor color = {0};
+                const char data[1] = {0};
+                Pixmap pixmap = XCreateBitmapFromData(platform->display, platform->xwindow, data, 1, 1);
+                platform->blank_cursor = XCreatePixmapCursor(platform->display, pixmap, pixmap, &color, &color, 0, 0);
+                XFreePixmap(platform->display, pixmap);
+            }
+            XDefineCursor(platform->display, platform->xwindow, platform->blank_cursor);
         }
     }
     
     double KP_Clock() {
         timespec clock_time;
-        clock_gettime(CLOCK_REALTIME, &clock_time);
+        clock_gettime(CLOCK_MONOTONIC, &clock_time);
         return clock_time.tv_sec*1000.0 + clock_time.tv_nsec/1000000.0;
     }
     
     void KP_SetCursorPos(kero_platform_t *platform, int x, int y, int* dx, int* dy) {
         if(dx) *dx = x - platform->mouse.x;
         if(dy) *dy = y - platform->mouse.y;
+        if(platform->headless.enabled) {
+            platform->mouse.x = x;
+            platform->mouse.y = y;
+            return;
+        }
+        platform->warp_serial = NextRequest(platform->display);
         XWarpPointer(platform->display, platform->xwindow, platform->xwindow, 0, 0, 0, 0, platform->mouse.invertx ? platform->window.w - x : x, platform->mouse.inverty ? platform->window.h - y : y);
         XFlush(platform->display);
+        platform->mouse.x = x;
+        platform->mouse.y = y;
+    }
+    
+    bool KP_SetRawMouse(kero_platform_t *platform, bool enable) {
+        platform->raw_mouse.dx = platform->raw_mouse.dy = 0;
+        platform->raw_mouse.enabled = false;
+        if(platform->headless.enabled) {
+            platform->raw_mouse.enabled = enable;
+            return true;
+        }
+#ifdef KERO_PLATFORM_XINPUT2
+        if(!platform->xinput_opcode) {
+            int opcode, first_event, first_error, major = 2, minor = 0;
+            platform->xinput_opcode = -1;
+            if(XQueryExtension(platform->display, "XInputExtension", &opcode, &first_event, &first_error) && XIQueryVersion(platform->display, &major, &minor) == Success) {
+                platform->xinput_opcode = opcode;
+            }
+            else {
+                fprintf(stderr, "XInput 2 unavailable, no raw mouse motion\n");
+            }
+        }
+        if(platform->xinput_opcode < 0) return !enable;
+        unsigned char bits[XIMaskLen(XI_LASTEVENT)] = {0};
+        XIEventMask mask = { XIAllMasterDevices, sizeof(bits), bits };
+        if(enable) {
+            XISetMask(bits, XI_RawMotion);
+        }
+        XISelectEvents(platform->display, platform->root_window, &mask, 1);
+        platform->raw_mouse.enabled = enable;
+        KP_GrabPointer(platform, enable && platform->focused);
+        XFlush(platform->display);
+        return true;
+#else
+        return !enable;
+#endif
     }
     
     void KP_Fullscreen(kero_platform_t *platform, bool full) {
         platform->fullscreen = full;
+        if(platform->headless.enabled) return;
         XEvent xev = {0};
         xev.type = ClientMessage;
         xev.xclient.window = platform->xwindow;
@@ -713,12 +2033,24 @@ Key repeats (holding key down) are ignored automatically.
         platform->delta = 0;
         platform->reset_keyboard_on_focus_out = true;
         platform->fullscreen = false;
+        // Assume the window shows up as soon as it's created. Map, visibility and focus events correct this.
+        platform->focused = true;
+        platform->mapped = true;
+        platform->visible = true;
         platform->windowed_width = 0;
         platform->windowed_height = 0;
         platform->windowed_x = 0;
         platform->windowed_y = 0;
         platform->target_frame_time = 0;
+        platform->pacer_spin_time = 0;
+        memset(&platform->jitter, 0, sizeof(platform->jitter));
+        platform->present_time = 0;
+        platform->present_queue_depth = 0;
+        platform->present_latency = 0;
         SDL_Init(SDL_INIT_VIDEO);
+        platform->event_queue.start = platform->event_queue.count = 0;
+        platform->raw_mouse.enabled = false;
+        platform->raw_mouse.dx = platform->raw_mouse.dy = 0;
         platform->windowed_width = width;
         platform->windowed_height = height;
         platform->window.w = width;
@@ -737,8 +2069,46 @@ Key repeats (holding key down) are ignored automatically.
         SDL_Delay(nanoseconds / 1000000);
     }
     
-    void KP_Flip(kero_platform_t *platform) {
+    void KP_Present(kero_platform_t *platform) {
+        double present_start = KP_Clock();
         SDL_UpdateWindowSurface(platform->sdlwindow);
+        platform->present_time = platform->present_latency = KP_Clock() - present_start;
+    }
+    
+    void KP_PresentRect(kero_platform_t *platform, int x, int y, unsigned int w, unsigned int h) {
+        double present_start = KP_Clock();
+        SDL_Rect rect = { x, y, (int)w, (int)h };
+        SDL_UpdateWindowSurfaceRects(platform->sdlwindow, &rect, 1);
+        platform->present_time = platform->present_latency = KP_Clock() - present_start;
+    }
+    
+    void KP_ResetFrameTimer(kero_platform_t *platform) {
+        platform->frame_start = SDL_GetTicks();
+    }
+    
+    bool KP_StartPresentThread(kero_platform_t *platform, int num_buffers, bool preserve_contents) {
+        return false;
+    }
+    
+    void KP_StopPresentThread(kero_platform_t *platform) {
+    }
+    
+    // SDL only lets the main thread pump events
+    bool KP_StartInputThread(kero_platform_t *platform) {
+        return false;
+    }
+    
+    void KP_StopInputThread(kero_platform_t *platform) {
+    }
+    
+    void KP_Shutdown(kero_platform_t *platform) {
+    }
+    
+    bool KP_PresentScaled(kero_platform_t *platform, uint32_t* pixels, unsigned int w, unsigned int h, bool bilinear) {
+        return false;
+    }
+    
+    void KP_LimitFramerate(kero_platform_t *platform) {
         if(platform->target_frame_time) {
             // Delay until we take up the full frame time
             platform->frame_finish = SDL_GetTicks();
@@ -748,9 +2118,21 @@ Key repeats (holding key down) are ignored automatically.
         }
         platform->frame_finish = SDL_GetTicks();
         platform->delta = (platform->frame_finish - platform->frame_start) / 1000.f;
+        if(platform->target_frame_time) {
+            int32_t frame_time = platform->frame_finish - platform->frame_start;
+            if(frame_time > (int32_t)platform->target_frame_time) {
+                ++platform->jitter.missed;
+            }
+            KP_UpdateJitter(platform, frame_time - (double)platform->target_frame_time);
+        }
         platform->frame_start = platform->frame_finish;
     }
     
+    void KP_Flip(kero_platform_t *platform) {
+        KP_Present(platform);
+        KP_LimitFramerate(platform);
+    }
+    
     void KP_UpdateMouse(kero_platform_t *platform) {
         platform->mouse.buttons = SDL_GetMouseState(&platform->mouse.x, &platform->mouse.y);
         if(platform->mouse.invertx) {
@@ -761,98 +2143,142 @@ Key repeats (holding key down) are ignored automatically.
         }
     }
     
+    static void KP_TranslateEvent(kero_platform_t *platform, SDL_Event* e, kp_event_t* event);
+    
+    static void KP_DrainEvents(kero_platform_t *platform) {
+        SDL_Event e;
+        while(platform->event_queue.count < KERO_PLATFORM_EVENT_QUEUE_SIZE && SDL_PollEvent(&e)) {
+            kp_event_t event = { KP_EVENT_NONE };
+            KP_TranslateEvent(platform, &e, &event);
+            KP_QueueEvent(platform, &event);
+        }
+    }
+    
     int KP_EventsQueued(kero_platform_t *platform) {
-        KP_UpdateMouse(platform);
-        return SDL_PollEvent(0);
+        if(!platform->event_queue.count) {
+            KP_DrainEvents(platform);
+        }
+        return platform->event_queue.count;
+    }
+    
+    bool KP_WaitForEvents(kero_platform_t *platform, int timeout_ms) {
+        if(platform->event_queue.count) {
+            return true;
+        }
+        // Waiting with a NULL event leaves the event queued
+        return timeout_ms < 0 ? SDL_WaitEvent(NULL) : SDL_WaitEventTimeout(NULL, timeout_ms);
     }
     
     kp_event_t* KP_NextEvent(kero_platform_t *platform) {
-        kp_event_t* event = (kp_event_t*)malloc(sizeof(kp_event_t));
-        event->type = KP_EVENT_NONE;
-        SDL_Event e;
-        if(SDL_PollEvent(&e)) {
-            switch(e.type) {
-                case SDL_KEYDOWN:{
-                    event->type = KP_EVENT_KEY_PRESS;
-                    int unsigned symbol = SDL_GetScancodeFromKey(e.key.keysym.sym);
+        if(!platform->event_queue.count) {
+            KP_DrainEvents(platform);
+        }
+        return KP_DequeueEvent(platform);
+    }
+    
+    static void KP_TranslateEvent(kero_platform_t *platform, SDL_Event* e, kp_event_t* event) {
+        switch(e->type) {
+            case SDL_KEYDOWN:{
+                event->type = KP_EVENT_KEY_PRESS;
+                int unsigned symbol = SDL_GetScancodeFromKey(e->key.keysym.sym);
+                event->key = symbol;
+            }break;
+            case SDL_KEYUP:{
+                if(!e->key.repeat) {
+                    event->type = KP_EVENT_KEY_RELEASE;
+                    int unsigned symbol = SDL_GetScancodeFromKey(e->key.keysym.sym);
                     event->key = symbol;
-                }break;
-                case SDL_KEYUP:{
-                    if(!e.key.repeat) {
-                        event->type = KP_EVENT_KEY_RELEASE;
-                        int unsigned symbol = SDL_GetScancodeFromKey(e.key.keysym.sym);
-                        event->key = symbol;
-                    }
-                }break;
-                case SDL_MOUSEBUTTONDOWN:{
-                    event->type = KP_EVENT_MOUSE_BUTTON_PRESS;
-                    event->x = platform->mouse.invertx ? platform->window.w - e.button.x : e.button.x;
-                    event->y = platform->mouse.inverty ? platform->window.h - e.button.y : e.button.y;
-                    event->button = MOUSE_OTHER;
-                    switch(e.button.button) {
-                        case SDL_BUTTON_LEFT:{
-                            event->button = MOUSE_LEFT;
-                            platform->mouse.buttons |= MOUSE_LEFT;
-                        }break;
-                        case SDL_BUTTON_RIGHT:{
-                            event->button = MOUSE_RIGHT;
-                            platform->mouse.buttons |= MOUSE_RIGHT;
-                        }break;
-                    }
-                }break;
-                case SDL_MOUSEBUTTONUP:{
-                    event->type = KP_EVENT_MOUSE_BUTTON_RELEASE;
-                    event->x = platform->mouse.invertx ? platform->window.w - e.button.x : e.button.x;
-                    event->y = platform->mouse.inverty ? platform->window.h - e.button.y : e.button.y;
-                    event->button = MOUSE_OTHER;
-                    switch(e.button.button) {
-                        case SDL_BUTTON_LEFT:{
-                            event->button = MOUSE_LEFT;
-                            platform->mouse.buttons &= ~MOUSE_LEFT;
-                        }break;
-                        case SDL_BUTTON_RIGHT:{
-                            event->button = MOUSE_RIGHT;
-                            platform->mouse.buttons &= ~MOUSE_RIGHT;
-                        }break;
-                    }
-                }break;
-                case SDL_QUIT:{
-                    event->type = KP_EVENT_QUIT;
-                }break;
-                case SDL_WINDOWEVENT:{
-                    switch(e.window.event) {
-                        case SDL_WINDOWEVENT_SIZE_CHANGED:{
-                            event->type = KP_EVENT_RESIZE;
-                            if(!platform->fullscreen) {
-                                platform->windowed_width = e.window.data1;
-                                platform->windowed_height = e.window.data2;
-                            }
-                            platform->window.w = e.window.data1;
-                            platform->window.h = e.window.data2;
-                            event->width = platform->window.w;
-                            event->height = platform->window.h;
-                            SDL_FreeSurface(platform->canvas);
-                            platform->canvas = SDL_GetWindowSurface(platform->sdlwindow);
-                            platform->frame_buffer.pixels = platform->canvas->pixels;
-                            platform->frame_buffer.w = platform->window.w;
-                            platform->frame_buffer.h = platform->window.h;
-                        }break;
-                        case SDL_WINDOWEVENT_FOCUS_LOST:{
-                            event->type = KP_EVENT_FOCUS_OUT;
-                        }break;
-                        case SDL_WINDOWEVENT_FOCUS_GAINED:{
-                            event->type = KP_EVENT_FOCUS_IN;
-                        }break;
-                    }
-                }break;
-            }
+                }
+            }break;
+            case SDL_MOUSEBUTTONDOWN:{
+                event->type = KP_EVENT_MOUSE_BUTTON_PRESS;
+                event->x = platform->mouse.invertx ? platform->window.w - e->button.x : e->button.x;
+                event->y = platform->mouse.inverty ? platform->window.h - e->button.y : e->button.y;
+                event->button = MOUSE_OTHER;
+                switch(e->button.button) {
+                    case SDL_BUTTON_LEFT:{
+                        event->button = MOUSE_LEFT;
+                        platform->mouse.buttons |= MOUSE_LEFT;
+                    }break;
+                    case SDL_BUTTON_RIGHT:{
+                        event->button = MOUSE_RIGHT;
+                        platform->mouse.buttons |= MOUSE_RIGHT;
+                    }break;
+                }
+            }break;
+            case SDL_MOUSEMOTION:{
+                event->type = KP_EVENT_MOUSE_MOVE;
+                platform->mouse.x = event->x = platform->mouse.invertx ? platform->window.w - e->motion.x : e->motion.x;
+                platform->mouse.y = event->y = platform->mouse.inverty ? platform->window.h - e->motion.y : e->motion.y;
+                if(platform->raw_mouse.enabled) {
+                    platform->raw_mouse.dx += platform->mouse.invertx ? -e->motion.xrel : e->motion.xrel;
+                    platform->raw_mouse.dy += platform->mouse.inverty ? -e->motion.yrel : e->motion.yrel;
+                }
+            }break;
+            case SDL_MOUSEBUTTONUP:{
+                event->type = KP_EVENT_MOUSE_BUTTON_RELEASE;
+                event->x = platform->mouse.invertx ? platform->window.w - e->button.x : e->button.x;
+                event->y = platform->mouse.inverty ? platform->window.h - e->button.y : e->button.y;
+                event->button = MOUSE_OTHER;
+                switch(e->button.button) {
+                    case SDL_BUTTON_LEFT:{
+                        event->button = MOUSE_LEFT;
+                        platform->mouse.buttons &= ~MOUSE_LEFT;
+                    }break;
+                    case SDL_BUTTON_RIGHT:{
+                        event->button = MOUSE_RIGHT;
+                        platform->mouse.buttons &= ~MOUSE_RIGHT;
+                    }break;
+                }
+            }break;
+            case SDL_QUIT:{
+                event->type = KP_EVENT_QUIT;
+            }break;
+            case SDL_WINDOWEVENT:{
+                switch(e->window.event) {
+                    case SDL_WINDOWEVENT_SIZE_CHANGED:{
+                        event->type = KP_EVENT_RESIZE;
+                        if(!platform->fullscreen) {
+                            platform->windowed_width = e->window.data1;
+                            platform->windowed_height = e->window.data2;
+                        }
+                        platform->window.w = e->window.data1;
+                        platform->window.h = e->window.data2;
+                        event->width = platform->window.w;
+                        event->height = platform->window.h;
+                        SDL_FreeSurface(platform->canvas);
+                        platform->canvas = SDL_GetWindowSurface(platform->sdlwindow);
+                        platform->frame_buffer.pixels = platform->canvas->pixels;
+                        platform->frame_buffer.w = platform->window.w;
+                        platform->frame_buffer.h = platform->window.h;
+                    }break;
+                    case SDL_WINDOWEVENT_EXPOSED:{
+                        event->type = KP_EVENT_EXPOSE;
+                    }break;
+                    case SDL_WINDOWEVENT_FOCUS_LOST:{
+                        platform->focused = false;
+                        event->type = KP_EVENT_FOCUS_OUT;
+                    }break;
+                    case SDL_WINDOWEVENT_FOCUS_GAINED:{
+                        platform->focused = true;
+                        event->type = KP_EVENT_FOCUS_IN;
+                    }break;
+                    case SDL_WINDOWEVENT_HIDDEN:
+                    case SDL_WINDOWEVENT_MINIMIZED:{
+                        platform->mapped = platform->visible = false;
+                        event->type = KP_EVENT_HIDE;
+                    }break;
+                    case SDL_WINDOWEVENT_SHOWN:
+                    case SDL_WINDOWEVENT_RESTORED:{
+                        platform->mapped = platform->visible = true;
+                        event->type = KP_EVENT_SHOW;
+                    }break;
+                }
+            }break;
         }
-        
-        return event;
     }
     
     void KP_FreeEvent(kp_event_t* e) {
-        free(e);
     }
     
     void KP_ShowCursor(kero_platform_t *platform, const bool show) {
@@ -863,10 +2289,22 @@ Key repeats (holding key down) are ignored automatically.
         return SDL_GetTicks();
     }
     
+    uint64_t KP_ClockNs() {
+        return (uint64_t)(SDL_GetPerformanceCounter()*(1000000000.0/SDL_GetPerformanceFrequency()));
+    }
+    
     void KP_SetCursorPos(kero_platform_t *platform, int x, int y, int* dx, int* dy) {
         if(dx) *dx = x - platform->mouse.x;
         if(dy) *dy = y - platform->mouse.y;
         SDL_WarpMouseInWindow(platform->sdlwindow, platform->mouse.invertx ? platform->window.w - x : x, platform->mouse.inverty ? platform->window.h - y : y);
+        platform->mouse.x = x;
+        platform->mouse.y = y;
+    }
+    
+    bool KP_SetRawMouse(kero_platform_t *platform, bool enable) {
+        platform->raw_mouse.dx = platform->raw_mouse.dy = 0;
+        platform->raw_mouse.enabled = SDL_SetRelativeMouseMode(enable ? SDL_TRUE : SDL_FALSE) == 0 && enable;
+        return platform->raw_mouse.enabled == enable;
     }
     
     void KP_Fullscreen(kero_platform_t *platform, bool full) {
@@ -0,0 +1,717 @@
+/*
+Kero Profile times nested zones of code on any number of threads and saves them as a Chrome trace.
+
+Each thread writes zone begin and end events with nanosecond timestamps into its own ring buffer, so recording takes no locks and threads never wait for each other. A capture window can be written out as Chrome trace JSON at any time from any thread, then opened in chrome://tracing or https://ui.perfetto.dev. The rings keep the most recent KERO_PROFILE_RING_SIZE events per thread, so a capture can only reach back that far.
+
+The last completed top level zone of each thread and the zones directly inside it are also kept, for drawing a per-frame breakdown on screen.
+
+Zone durations can also be collected into log-linear (HDR style) histograms, one per zone name, over the whole session and over a rolling window of recent zones, to read percentiles and write them to CSV.
+
+On Linux a thread can also count CPU cycles, instructions, cache misses and branch misses per zone with perf_event_open, to tell whether a zone is limited by computation or by memory. Counting costs a system call at every zone boundary, so it is off until KPROF_PerfStart() is called.
+
+Define KERO_PROFILE_ALLOCATIONS before including to count heap allocations per zone. malloc, calloc and realloc are then replaced for the whole program, libraries included, and forward to glibc, which still does the freeing. The memalign family isn't counted. A guard can report or abort on any allocation inside a zone, to hold steady state frames at zero allocations. Only include it with this defined in one file.
+
+Define KERO_PROFILE_DISABLE before including to compile every call away.
+
+Link with -lpthread.
+*/
+
+#ifndef KERO_PROFILE_H
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#ifndef KERO_PROFILE_MAX_THREADS
+#define KERO_PROFILE_MAX_THREADS 16
+#endif
+#ifndef KERO_PROFILE_RING_SIZE
+#define KERO_PROFILE_RING_SIZE 65536 // Events per thread. Must be a power of 2.
+#endif
+#ifndef KERO_PROFILE_MAX_DEPTH
+#define KERO_PROFILE_MAX_DEPTH 32
+#endif
+#ifndef KERO_PROFILE_MAX_FRAME_ZONES
+#define KERO_PROFILE_MAX_FRAME_ZONES 32
+#endif
+#ifndef KERO_PROFILE_HISTOGRAM_BITS
+#define KERO_PROFILE_HISTOGRAM_BITS 6 // Histogram buckets are at most 1/2^(bits-1) of their value wide, about 3%
+#endif
+#ifndef KERO_PROFILE_STATS_WINDOW
+#define KERO_PROFILE_STATS_WINDOW 600 // Zones in the rolling window. 10 seconds of frames at 60fps.
+#endif
+#ifndef KERO_PROFILE_MAX_SERIES
+#define KERO_PROFILE_MAX_SERIES 32
+#endif
+#define KERO_PROFILE_HISTOGRAM_MAX_BITS 40 // Values are clamped to 2^40ns, about 18 minutes
+#define KERO_PROFILE_HISTOGRAM_SIZE ((KERO_PROFILE_HISTOGRAM_MAX_BITS - KERO_PROFILE_HISTOGRAM_BITS + 2) << (KERO_PROFILE_HISTOGRAM_BITS - 1))
+
+    typedef enum {
+        KPROF_EVENT_BEGIN, KPROF_EVENT_END
+    } kprof_event_type_t;
+
+    typedef struct {
+        uint64_t time;
+        const char* name;
+        kprof_event_type_t type;
+    } kprof_event_t;
+
+    typedef enum {
+        KPROF_COUNTER_CYCLES,
+        KPROF_COUNTER_INSTRUCTIONS,
+        KPROF_COUNTER_L1D_MISSES, // Level 1 data cache read misses
+        KPROF_COUNTER_LLC_MISSES, // Last level cache misses, usually going to memory
+        KPROF_COUNTER_BRANCH_MISSES,
+        KPROF_NUM_COUNTERS
+    } kprof_counter_t;
+
+    static const char* kprof_counter_names[KPROF_NUM_COUNTERS] = { "cycles", "instructions", "L1D misses", "LLC misses", "branch misses" };
+
+    typedef struct {
+        const char* name;
+        uint64_t start, end; // Nanoseconds from KPROF_Now()
+        uint64_t counters[KPROF_NUM_COUNTERS]; // Counted during the zone when its thread was counting, otherwise 0
+        uint64_t allocations, allocated_bytes; // Made by its thread during the zone. Only counted with KERO_PROFILE_ALLOCATIONS.
+    } kprof_zone_t;
+
+    typedef struct {
+        kprof_zone_t zone; // The top level zone
+        int num_zones;
+        kprof_zone_t zones[KERO_PROFILE_MAX_FRAME_ZONES]; // Zones directly inside it, in the order they ended
+    } kprof_frame_t;
+
+    typedef struct {
+        uint64_t count;
+        uint64_t total;
+        uint64_t max; // Only kept by KPROF_HistogramAdd()
+        uint32_t buckets[KERO_PROFILE_HISTOGRAM_SIZE];
+    } kprof_histogram_t;
+
+    typedef struct {
+        const char* name;
+        kprof_histogram_t window, session;
+        uint64_t recent[KERO_PROFILE_STATS_WINDOW]; // The values in window, oldest first from next_recent once full
+        int num_recent, next_recent;
+    } kprof_series_t;
+
+    typedef struct {
+        int num_series;
+        kprof_series_t series[KERO_PROFILE_MAX_SERIES];
+    } kprof_stats_t;
+
+    typedef struct {
+        bool ready; // Set once ring is allocated. Other threads only read threads that are ready.
+        char name[32];
+        kprof_event_t* ring;
+        uint64_t head; // Events written. Only the owning thread writes it.
+        // Only touched by the owning thread
+        int depth;
+        kprof_zone_t stack[KERO_PROFILE_MAX_DEPTH];
+        kprof_frame_t building, last_frame;
+        kprof_stats_t* stats;
+        bool perf; // Counting with perf_event_open
+        int perf_depth; // Zones started below this depth began before counting did
+        int perf_fds[KPROF_NUM_COUNTERS]; // The first opened is the group leader
+        int perf_slots[KPROF_NUM_COUNTERS]; // Position in a group read, -1 when the counter couldn't be opened
+    } kprof_thread_t;
+
+    //------------------------------------------------------------
+
+    /*
+     Usage
+
+    KPROF_ThreadName("Main");
+    while(running) {
+        KPROF_Begin("Frame");
+        KPROF_Begin("Update");
+        ...
+        KPROF_End();
+        KPROF_Begin("Draw");
+        ...
+        KPROF_End();
+        KPROF_End();
+        if(key pressed) {
+            if(KPROF_Capturing()) KPROF_CaptureWrite("trace.json");
+            else KPROF_CaptureStart();
+        }
+    }
+    */
+
+    uint64_t KPROF_Now();
+    /*
+    Nanoseconds from a monotonic clock.
+    */
+
+    void KPROF_Begin(const char* name);
+    /*
+    Start a zone on the calling thread. Zones nest up to KERO_PROFILE_MAX_DEPTH deep. name is kept as a pointer so it must stay valid, e.g. a string literal.
+    */
+
+    void KPROF_End();
+    /*
+    End the calling thread's innermost zone.
+    */
+
+    void KPROF_ThreadName(const char* name);
+    /*
+    Name the calling thread in traces. Threads are called "Thread N" otherwise.
+    */
+
+    bool KPROF_LastFrame(kprof_frame_t* frame);
+    /*
+    Copy the calling thread's most recently ended top level zone and the zones directly inside it. Returns false if none has ended yet.
+    */
+
+    void KPROF_CaptureStart();
+    /*
+    Start a capture window now.
+    */
+
+    bool KPROF_Capturing();
+
+    bool KPROF_CaptureWrite(const char* path);
+    /*
+    Write every event since KPROF_CaptureStart() to path as Chrome trace JSON and end the capture window. Zones that began before KPROF_CaptureStart() are left out, and zones still open at the end are closed there. Returns false if nothing was being captured or the file can't be written.
+    */
+
+    bool KPROF_PerfStart();
+    /*
+    Open hardware counters for the calling thread. Every zone it begins from now on gets the counts made while it was open. Counters the CPU or kernel don't offer stay 0.
+    Returns false when none could be opened, e.g. not Linux, no PMU in a virtual machine or /proc/sys/kernel/perf_event_paranoid above 2.
+    */
+
+    void KPROF_PerfStop();
+
+    unsigned int KPROF_PerfCounters();
+    /*
+    Bit mask of the kprof_counter_t counters the calling thread is counting. 0 when it isn't.
+    */
+
+    typedef enum {
+        KPROF_GUARD_OFF,
+        KPROF_GUARD_REPORT, // Print each allocation and the zone it was made in
+        KPROF_GUARD_ABORT, // abort() at the first, so a debugger stops on it
+    } kprof_guard_t;
+
+    bool KPROF_AllocGuard(kprof_guard_t guard);
+    /*
+    Watch every allocation the calling thread makes inside a zone from now on. Returns false without KERO_PROFILE_ALLOCATIONS, when nothing can be watched.
+    */
+
+    void KPROF_StatsAttach(kprof_stats_t* stats);
+    /*
+    Add the duration of every zone the calling thread ends from now on to the series of the same name in stats. NULL stops. stats must only be read from the same thread.
+    */
+
+    kprof_series_t* KPROF_StatsSeries(kprof_stats_t* stats, const char* name);
+    /*
+    Find the series called name, adding it if there's room. Returns NULL when stats is full.
+    */
+
+    void KPROF_SeriesAdd(kprof_series_t* series, uint64_t value);
+    /*
+    Add a value to the session histogram and the rolling window, dropping the window's oldest value once full.
+    */
+
+    uint64_t KPROF_SeriesWindowMax(const kprof_series_t* series);
+
+    bool KPROF_StatsWriteCSV(const kprof_stats_t* stats, const char* path);
+    /*
+    Write one row per series of session count, mean, p50, p90, p99, p99.9 and max in milliseconds, then every non-empty histogram bucket as upper bound:count. Returns false if the file can't be written.
+    */
+
+    void KPROF_HistogramAdd(kprof_histogram_t* histogram, uint64_t value);
+    void KPROF_HistogramRemove(kprof_histogram_t* histogram, uint64_t value);
+
+    uint64_t KPROF_HistogramPercentile(const kprof_histogram_t* histogram, double percentile);
+    /*
+    Value that percentile (0 to 100) percent of values are at or below, accurate to the width of its bucket. 0 when empty.
+    */
+
+    //------------------------------------------------------------
+
+    // Quoted for JSON and CSV
+    static void KPROF_WriteName(FILE* file, const char* name) {
+        fputc('"', file);
+        for(; *name; ++name) {
+            if(*name == '"' || *name == '\\') fputc('\\', file);
+            if((unsigned char)*name >= ' ') fputc(*name, file);
+        }
+        fputc('"', file);
+    }
+
+#ifdef KERO_PROFILE_DISABLE
+
+    uint64_t KPROF_Now() { return 0; }
+    void KPROF_Begin(const char* name) {}
+    void KPROF_End() {}
+    void KPROF_ThreadName(const char* name) {}
+    bool KPROF_LastFrame(kprof_frame_t* frame) { return false; }
+    void KPROF_CaptureStart() {}
+    bool KPROF_Capturing() { return false; }
+    bool KPROF_CaptureWrite(const char* path) { return false; }
+    bool KPROF_PerfStart() { return false; }
+    void KPROF_PerfStop() {}
+    unsigned int KPROF_PerfCounters() { return 0; }
+    bool KPROF_AllocGuard(kprof_guard_t guard) { return false; }
+    void KPROF_StatsAttach(kprof_stats_t* stats) {}
+
+#else
+
+    static kprof_thread_t kprof_threads[KERO_PROFILE_MAX_THREADS];
+    static int kprof_num_threads;
+    static uint64_t kprof_capture_start; // 0 when not capturing
+    static __thread kprof_thread_t* kprof_thread;
+    static __thread bool kprof_thread_full; // No free slot was left for this thread
+#ifdef KERO_PROFILE_ALLOCATIONS
+    static __thread uint64_t kprof_allocations, kprof_allocated_bytes; // Running totals for the thread
+    static __thread kprof_guard_t kprof_alloc_guard;
+    static __thread bool kprof_in_guard; // Reporting may allocate too
+#endif
+
+    uint64_t KPROF_Now() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec*1000000000ull + now.tv_nsec;
+    }
+
+    static kprof_thread_t* KPROF_Thread() {
+        if(kprof_thread || kprof_thread_full) return kprof_thread;
+        int index = __atomic_fetch_add(&kprof_num_threads, 1, __ATOMIC_RELAXED);
+        if(index >= KERO_PROFILE_MAX_THREADS) {
+            fprintf(stderr, "Kero Profile: more than %d threads, not profiling the rest\n", KERO_PROFILE_MAX_THREADS);
+            kprof_thread_full = true;
+            return NULL;
+        }
+        kprof_thread_t* thread = &kprof_threads[index];
+        thread->ring = (kprof_event_t*)malloc(sizeof(kprof_event_t)*KERO_PROFILE_RING_SIZE);
+        if(!thread->ring) {
+            kprof_thread_full = true;
+            return NULL;
+        }
+        if(!thread->name[0]) {
+            snprintf(thread->name, sizeof(thread->name), "Thread %d", index);
+        }
+        __atomic_store_n(&thread->ready, true, __ATOMIC_RELEASE);
+        return kprof_thread = thread;
+    }
+
+    static inline void KPROF_Push(kprof_thread_t* thread, uint64_t time, const char* name, kprof_event_type_t type) {
+        kprof_event_t* event = &thread->ring[thread->head & (KERO_PROFILE_RING_SIZE - 1)];
+        event->time = time;
+        event->name = name;
+        event->type = type;
+        __atomic_store_n(&thread->head, thread->head + 1, __ATOMIC_RELEASE);
+    }
+
+    // One read gets the whole group: the number of counters, then their values in the order they were opened
+    static void KPROF_PerfRead(kprof_thread_t* thread, uint64_t counters[KPROF_NUM_COUNTERS]) {
+        memset(counters, 0, sizeof(uint64_t)*KPROF_NUM_COUNTERS);
+#ifdef __linux__
+        uint64_t values[1 + KPROF_NUM_COUNTERS];
+        if(read(thread->perf_fds[0], values, sizeof(values)) < (ssize_t)sizeof(uint64_t)) return;
+        for(int counter = 0; counter < KPROF_NUM_COUNTERS; ++counter) {
+            int slot = thread->perf_slots[counter];
+            if(slot >= 0 && slot < (int)values[0]) counters[counter] = values[1 + slot];
+        }
+#endif
+    }
+
+    void KPROF_Begin(const char* name) {
+        kprof_thread_t* thread = KPROF_Thread();
+        if(!thread) return;
+        uint64_t now = KPROF_Now();
+        if(thread->depth < KERO_PROFILE_MAX_DEPTH) {
+            thread->stack[thread->depth].name = name;
+            thread->stack[thread->depth].start = now;
+            if(thread->depth == 0) {
+                thread->building.num_zones = 0;
+            }
+            KPROF_Push(thread, now, name, KPROF_EVENT_BEGIN);
+#ifdef KERO_PROFILE_ALLOCATIONS
+            thread->stack[thread->depth].allocations = kprof_allocations;
+            thread->stack[thread->depth].allocated_bytes = kprof_allocated_bytes;
+#endif
+            // Read last so the zone counts as little of the profiler as possible
+            if(thread->perf) KPROF_PerfRead(thread, thread->stack[thread->depth].counters);
+        }
+        ++thread->depth;
+    }
+
+    void KPROF_End() {
+        kprof_thread_t* thread = kprof_thread;
+        if(!thread || thread->depth == 0) return;
+        uint64_t counters[KPROF_NUM_COUNTERS];
+        if(thread->perf) KPROF_PerfRead(thread, counters);
+        uint64_t now = KPROF_Now();
+        --thread->depth;
+        if(thread->depth >= KERO_PROFILE_MAX_DEPTH) return; // Its begin was dropped too
+        kprof_zone_t* zone = &thread->stack[thread->depth];
+        zone->end = now;
+        for(int counter = 0; counter < KPROF_NUM_COUNTERS; ++counter) {
+            zone->counters[counter] = thread->perf && thread->depth >= thread->perf_depth ? counters[counter] - zone->counters[counter] : 0;
+        }
+#ifdef KERO_PROFILE_ALLOCATIONS
+        zone->allocations = kprof_allocations - zone->allocations;
+        zone->allocated_bytes = kprof_allocated_bytes - zone->allocated_bytes;
+#endif
+        KPROF_Push(thread, now, zone->name, KPROF_EVENT_END);
+        if(thread->stats) {
+            kprof_series_t* series = KPROF_StatsSeries(thread->stats, zone->name);
+            if(series) KPROF_SeriesAdd(series, zone->end - zone->start);
+        }
+        if(thread->depth == 0) {
+            thread->building.zone = *zone;
+            thread->last_frame = thread->building;
+        }
+        else if(thread->depth == 1 && thread->building.num_zones < KERO_PROFILE_MAX_FRAME_ZONES) {
+            thread->building.zones[thread->building.num_zones++] = *zone;
+        }
+    }
+
+    void KPROF_ThreadName(const char* name) {
+        kprof_thread_t* thread = KPROF_Thread();
+        if(!thread) return;
+        snprintf(thread->name, sizeof(thread->name), "%s", name);
+    }
+
+    bool KPROF_LastFrame(kprof_frame_t* frame) {
+        if(!kprof_thread || !kprof_thread->last_frame.zone.end) return false;
+        *frame = kprof_thread->last_frame;
+        return true;
+    }
+
+    void KPROF_CaptureStart() {
+        __atomic_store_n(&kprof_capture_start, KPROF_Now(), __ATOMIC_RELAXED);
+    }
+
+    bool KPROF_Capturing() {
+        return __atomic_load_n(&kprof_capture_start, __ATOMIC_RELAXED) != 0;
+    }
+
+    static void KPROF_WriteEvent(FILE* file, bool* first, const char* name, char phase, uint64_t time, uint64_t start, int tid) {
+        fprintf(file, "%s\n{\"name\":", *first ? "" : ",");
+        KPROF_WriteName(file, name);
+        fprintf(file, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", phase, (double)(time - start)/1000.0, tid);
+        *first = false;
+    }
+
+    bool KPROF_CaptureWrite(const char* path) {
+        uint64_t start = __atomic_exchange_n(&kprof_capture_start, 0, __ATOMIC_RELAXED);
+        uint64_t end = KPROF_Now();
+        if(!start) return false;
+        FILE* file = fopen(path, "w");
+        if(!file) {
+            fprintf(stderr, "Failed to open trace file %s\n", path);
+            return false;
+        }
+        kprof_event_t* events = (kprof_event_t*)malloc(sizeof(kprof_event_t)*KERO_PROFILE_RING_SIZE);
+        if(!events) {
+            fclose(file);
+            return false;
+        }
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+        bool first = true;
+        int num_threads = __atomic_load_n(&kprof_num_threads, __ATOMIC_RELAXED);
+        if(num_threads > KERO_PROFILE_MAX_THREADS) num_threads = KERO_PROFILE_MAX_THREADS;
+        for(int t = 0; t < num_threads; ++t) {
+            kprof_thread_t* thread = &kprof_threads[t];
+            if(!__atomic_load_n(&thread->ready, __ATOMIC_ACQUIRE)) continue;
+            fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", t);
+            KPROF_WriteName(file, thread->name);
+            fprintf(file, "}}");
+            first = false;
+
+            // Copy the ring while its thread keeps writing, then throw away anything that may have been overwritten during the copy
+            uint64_t head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+            uint64_t tail = head > KERO_PROFILE_RING_SIZE ? head - KERO_PROFILE_RING_SIZE : 0;
+            for(uint64_t i = tail; i < head; ++i) {
+                events[i - tail] = thread->ring[i & (KERO_PROFILE_RING_SIZE - 1)];
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            uint64_t overwritten = __atomic_load_n(&thread->head, __ATOMIC_RELAXED);
+            overwritten = overwritten > KERO_PROFILE_RING_SIZE ? overwritten - KERO_PROFILE_RING_SIZE : 0;
+            uint64_t first_valid = overwritten > tail ? overwritten : tail;
+            if(first_valid < head && events[first_valid - tail].time > start && first_valid > 0) {
+                fprintf(stderr, "Kero Profile: %s lost the start of the capture, ring buffer too small\n", thread->name);
+            }
+
+            // Only write ends that have a matching begin inside the window
+            const char* open[KERO_PROFILE_MAX_DEPTH];
+            int depth = 0;
+            for(uint64_t i = first_valid; i < head; ++i) {
+                kprof_event_t* event = &events[i - tail];
+                if(event->time < start || event->time > end) continue;
+                if(event->type == KPROF_EVENT_BEGIN) {
+                    if(depth < KERO_PROFILE_MAX_DEPTH) open[depth] = event->name;
+                    ++depth;
+                    KPROF_WriteEvent(file, &first, event->name, 'B', event->time, start, t);
+                }
+                else if(depth > 0) {
+                    --depth;
+                    KPROF_WriteEvent(file, &first, event->name, 'E', event->time, start, t);
+                }
+            }
+            while(depth > 0) {
+                --depth;
+                KPROF_WriteEvent(file, &first, depth < KERO_PROFILE_MAX_DEPTH ? open[depth] : "", 'E', end, start, t);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        free(events);
+        bool written = !ferror(file);
+        if(fclose(file) || !written) {
+            fprintf(stderr, "Failed to write trace file %s\n", path);
+            return false;
+        }
+        return true;
+    }
+
+    void KPROF_StatsAttach(kprof_stats_t* stats) {
+        kprof_thread_t* thread = KPROF_Thread();
+        if(thread) thread->stats = stats;
+    }
+
+#ifdef __linux__
+    static int KPROF_PerfOpen(uint32_t type, uint64_t config, int group) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group == -1; // The leader starts the whole group once it's complete
+        attr.exclude_kernel = 1; // Allowed at perf_event_paranoid 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+#endif
+
+    bool KPROF_PerfStart() {
+        kprof_thread_t* thread = KPROF_Thread();
+        if(!thread) return false;
+        if(thread->perf) return true;
+#ifdef __linux__
+        const uint32_t types[KPROF_NUM_COUNTERS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE };
+        const uint64_t configs[KPROF_NUM_COUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        int num_open = 0;
+        for(int counter = 0; counter < KPROF_NUM_COUNTERS; ++counter) {
+            int fd = KPROF_PerfOpen(types[counter], configs[counter], num_open ? thread->perf_fds[0] : -1);
+            thread->perf_slots[counter] = fd >= 0 ? num_open : -1;
+            if(fd >= 0) thread->perf_fds[num_open++] = fd;
+        }
+        if(!num_open) {
+            fprintf(stderr, "Kero Profile: no hardware counters for %s, check /proc/sys/kernel/perf_event_paranoid\n", thread->name);
+            return false;
+        }
+        for(int i = num_open; i < KPROF_NUM_COUNTERS; ++i) {
+            thread->perf_fds[i] = -1;
+        }
+        ioctl(thread->perf_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(thread->perf_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        thread->perf_depth = thread->depth;
+        thread->perf = true;
+        return true;
+#else
+        fprintf(stderr, "Kero Profile: hardware counters need Linux\n");
+        return false;
+#endif
+    }
+
+    void KPROF_PerfStop() {
+        kprof_thread_t* thread = kprof_thread;
+        if(!thread || !thread->perf) return;
+        thread->perf = false;
+#ifdef __linux__
+        for(int i = 0; i < KPROF_NUM_COUNTERS && thread->perf_fds[i] >= 0; ++i) {
+            close(thread->perf_fds[i]);
+        }
+#endif
+    }
+
+    unsigned int KPROF_PerfCounters() {
+        kprof_thread_t* thread = kprof_thread;
+        if(!thread || !thread->perf) return 0;
+        unsigned int mask = 0;
+        for(int counter = 0; counter < KPROF_NUM_COUNTERS; ++counter) {
+            if(thread->perf_slots[counter] >= 0) mask |= 1u << counter;
+        }
+        return mask;
+    }
+
+#ifdef KERO_PROFILE_ALLOCATIONS
+    bool KPROF_AllocGuard(kprof_guard_t guard) {
+        kprof_alloc_guard = guard;
+        return true;
+    }
+
+    static void KPROF_CountAllocation(size_t size) {
+        ++kprof_allocations;
+        kprof_allocated_bytes += size;
+        kprof_thread_t* thread = kprof_thread;
+        if(!kprof_alloc_guard || kprof_in_guard || !thread || thread->depth == 0) return;
+        kprof_in_guard = true;
+        int depth = thread->depth < KERO_PROFILE_MAX_DEPTH ? thread->depth : KERO_PROFILE_MAX_DEPTH;
+        fprintf(stderr, "Kero Profile: %s allocated %zu bytes in %s\n", thread->name, size, thread->stack[depth - 1].name);
+        if(kprof_alloc_guard == KPROF_GUARD_ABORT) abort();
+        kprof_in_guard = false;
+    }
+
+    // glibc's own allocator, which the replacements below forward to
+    extern void* __libc_malloc(size_t size);
+    extern void* __libc_calloc(size_t count, size_t size);
+    extern void* __libc_realloc(void* pointer, size_t size);
+
+    void* malloc(size_t size) {
+        KPROF_CountAllocation(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size) {
+        KPROF_CountAllocation(count*size);
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* pointer, size_t size) {
+        if(size) KPROF_CountAllocation(size); // realloc(pointer, 0) only frees
+        return __libc_realloc(pointer, size);
+    }
+#else
+    bool KPROF_AllocGuard(kprof_guard_t guard) {
+        return false;
+    }
+#endif
+
+#endif
+
+    // Values below 2^bits have a bucket each. Above that each power of 2 is split into 2^(bits-1) buckets.
+    static inline int KPROF_HistogramBucket(uint64_t value) {
+        if(value >= (1ull << KERO_PROFILE_HISTOGRAM_MAX_BITS)) value = (1ull << KERO_PROFILE_HISTOGRAM_MAX_BITS) - 1;
+        if(value < (1ull << KERO_PROFILE_HISTOGRAM_BITS)) return (int)value;
+        int shift = 63 - __builtin_clzll(value) - KERO_PROFILE_HISTOGRAM_BITS + 1;
+        return (shift << (KERO_PROFILE_HISTOGRAM_BITS - 1)) + (int)(value >> shift);
+    }
+
+    // Largest value that falls in bucket
+    static inline uint64_t KPROF_HistogramBucketMax(int bucket) {
+        if(bucket < (1 << KERO_PROFILE_HISTOGRAM_BITS)) return bucket;
+        int shift = (bucket >> (KERO_PROFILE_HISTOGRAM_BITS - 1)) - 1;
+        uint64_t mantissa = (bucket & ((1 << (KERO_PROFILE_HISTOGRAM_BITS - 1)) - 1)) + (1 << (KERO_PROFILE_HISTOGRAM_BITS - 1));
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    void KPROF_HistogramAdd(kprof_histogram_t* histogram, uint64_t value) {
+        ++histogram->buckets[KPROF_HistogramBucket(value)];
+        ++histogram->count;
+        histogram->total += value;
+        if(value > histogram->max) histogram->max = value;
+    }
+
+    void KPROF_HistogramRemove(kprof_histogram_t* histogram, uint64_t value) {
+        --histogram->buckets[KPROF_HistogramBucket(value)];
+        --histogram->count;
+        histogram->total -= value;
+    }
+
+    uint64_t KPROF_HistogramPercentile(const kprof_histogram_t* histogram, double percentile) {
+        if(!histogram->count) return 0;
+        uint64_t rank = (uint64_t)(percentile/100.0*histogram->count + 0.5);
+        if(rank < 1) rank = 1;
+        if(rank > histogram->count) rank = histogram->count;
+        uint64_t seen = 0;
+        for(int bucket = 0; bucket < KERO_PROFILE_HISTOGRAM_SIZE; ++bucket) {
+            seen += histogram->buckets[bucket];
+            if(seen >= rank) {
+                uint64_t value = KPROF_HistogramBucketMax(bucket);
+                // The largest value added is a tighter bound for the top bucket
+                return histogram->max && value > histogram->max ? histogram->max : value;
+            }
+        }
+        return histogram->max;
+    }
+
+    kprof_series_t* KPROF_StatsSeries(kprof_stats_t* stats, const char* name) {
+        for(int i = 0; i < stats->num_series; ++i) {
+            if(stats->series[i].name == name || !strcmp(stats->series[i].name, name)) return &stats->series[i];
+        }
+        if(stats->num_series == KERO_PROFILE_MAX_SERIES) return NULL;
+        kprof_series_t* series = &stats->series[stats->num_series++];
+        memset(series, 0, sizeof(*series));
+        series->name = name;
+        return series;
+    }
+
+    void KPROF_SeriesAdd(kprof_series_t* series, uint64_t value) {
+        KPROF_HistogramAdd(&series->session, value);
+        if(series->num_recent == KERO_PROFILE_STATS_WINDOW) {
+            KPROF_HistogramRemove(&series->window, series->recent[series->next_recent]);
+        }
+        else {
+            ++series->num_recent;
+        }
+        KPROF_HistogramAdd(&series->window, value);
+        series->recent[series->next_recent] = value;
+        series->next_recent = (series->next_recent + 1)%KERO_PROFILE_STATS_WINDOW;
+    }
+
+    uint64_t KPROF_SeriesWindowMax(const kprof_series_t* series) {
+        uint64_t max = 0;
+        for(int i = 0; i < series->num_recent; ++i) {
+            if(series->recent[i] > max) max = series->recent[i];
+        }
+        return max;
+    }
+
+    bool KPROF_StatsWriteCSV(const kprof_stats_t* stats, const char* path) {
+        FILE* file = fopen(path, "w");
+        if(!file) {
+            fprintf(stderr, "Failed to open stats file %s\n", path);
+            return false;
+        }
+        fprintf(file, "zone,count,mean_ms,p50_ms,p90_ms,p99_ms,p99.9_ms,max_ms,histogram_ms\n");
+        for(int i = 0; i < stats->num_series; ++i) {
+            const kprof_histogram_t* histogram = &stats->series[i].session;
+            KPROF_WriteName(file, stats->series[i].name);
+            fprintf(file, ",%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,\"", (unsigned long long)histogram->count, histogram->count ? histogram->total/1e6/histogram->count : 0.0,
+                    KPROF_HistogramPercentile(histogram, 50)/1e6, KPROF_HistogramPercentile(histogram, 90)/1e6, KPROF_HistogramPercentile(histogram, 99)/1e6, KPROF_HistogramPercentile(histogram, 99.9)/1e6, histogram->max/1e6);
+            bool first = true;
+            for(int bucket = 0; bucket < KERO_PROFILE_HISTOGRAM_SIZE; ++bucket) {
+                if(!histogram->buckets[bucket]) continue;
+                fprintf(file, "%s%.6f:%u", first ? "" : " ", KPROF_HistogramBucketMax(bucket)/1e6, histogram->buckets[bucket]);
+                first = false;
+            }
+            fprintf(file, "\"\n");
+        }
+        bool written = !ferror(file);
+        if(fclose(file) || !written) {
+            fprintf(stderr, "Failed to write stats file %s\n", path);
+            return false;
+        }
+        return true;
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define KERO_PROFILE_H
+#endif
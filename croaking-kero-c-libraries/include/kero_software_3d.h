@@ -23,18 +23,146 @@ extern "C"{
         uint8_t texture_index;
     } face_t;
     
-    static inline void K3D_SetPixel(ksprite_t* target, float* depth_buffer, int x, int y, float depth, uint32_t color){
+#ifdef KERO_3D_DEBUG_OVERDRAW
+    /*
+    Overdraw debugging. While counting, the pixel functions count per pixel how many depth tests they make, how many pass and how many texels are fetched for them.
+    Without KERO_3D_DEBUG_OVERDRAW none of this is compiled and the pixel functions are unchanged.
+    
+    K3D_OverdrawStart(render_frame.w, render_frame.h);
+    ...draw triangles to render_frame...
+    K3D_OverdrawStop();
+    K3D_OverdrawHeatmap(&render_frame, K3D_OVERDRAW_PASSES);
+    */
+    
+    enum {
+        K3D_OVERDRAW_TESTS, // Depth complexity: every depth test, passed or not
+        K3D_OVERDRAW_PASSES, // Overdraw: pixels written
+        K3D_OVERDRAW_FETCHES, // Texels sampled, including ones discarded by the alpha test
+        K3D_NUM_OVERDRAW_COUNTERS
+    };
+    
+    typedef struct {
+        uint16_t counts[K3D_NUM_OVERDRAW_COUNTERS];
+    } k3d_overdraw_pixel_t;
+    
+    typedef struct {
+        k3d_overdraw_pixel_t* pixels; // Only set while counting
+        k3d_overdraw_pixel_t* buffer;
+        int w, h, capacity;
+    } k3d_overdraw_t;
+    
+    typedef struct {
+        float average[K3D_NUM_OVERDRAW_COUNTERS]; // Per pixel
+        int max[K3D_NUM_OVERDRAW_COUNTERS];
+    } k3d_overdraw_summary_t;
+    
+    k3d_overdraw_t k3d_overdraw;
+    
+    // Counts saturate rather than wrap so a pathological pixel still shows as hot
+#define K3D_OVERDRAW_COUNT(target, x, y, counter) do { \
+        if(k3d_overdraw.pixels) { \
+            uint16_t* count = &k3d_overdraw.pixels[(x) + (y)*(target)->w].counts[counter]; \
+            if(*count < UINT16_MAX) ++*count; \
+        } \
+    } while(0)
+    
+    // Start counting into cleared counters for a w*h target. The target's w is used as the row stride, as it is for its pixels.
+    void K3D_OverdrawStart(int w, int h) {
+        if(w*h > k3d_overdraw.capacity) {
+            free(k3d_overdraw.buffer);
+            k3d_overdraw.buffer = (k3d_overdraw_pixel_t*)malloc(sizeof(k3d_overdraw_pixel_t)*w*h);
+            k3d_overdraw.capacity = k3d_overdraw.buffer ? w*h : 0;
+            if(!k3d_overdraw.buffer) {
+                fprintf(stderr, "Failed to allocate overdraw counters\n");
+                return;
+            }
+        }
+        memset(k3d_overdraw.buffer, 0, sizeof(k3d_overdraw_pixel_t)*w*h);
+        k3d_overdraw.w = w;
+        k3d_overdraw.h = h;
+        k3d_overdraw.pixels = k3d_overdraw.buffer;
+    }
+    
+    static inline void K3D_OverdrawStop() {
+        k3d_overdraw.pixels = 0;
+    }
+    
+    // Averages and maximums of the last counts
+    void K3D_OverdrawSummarise(k3d_overdraw_summary_t* summary) {
+        uint64_t totals[K3D_NUM_OVERDRAW_COUNTERS] = {0};
+        memset(summary, 0, sizeof(*summary));
+        int num_pixels = k3d_overdraw.w*k3d_overdraw.h;
+        if(!k3d_overdraw.buffer || !num_pixels) return;
+        for(int i = 0; i < num_pixels; ++i) {
+            for(int counter = 0; counter < K3D_NUM_OVERDRAW_COUNTERS; ++counter) {
+                int count = k3d_overdraw.buffer[i].counts[counter];
+                totals[counter] += count;
+                summary->max[counter] = KS_Max(summary->max[counter], count);
+            }
+        }
+        for(int counter = 0; counter < K3D_NUM_OVERDRAW_COUNTERS; ++counter) {
+            summary->average[counter] = (float)totals[counter]/num_pixels;
+        }
+    }
+    
+    // Black for 0, then blue, cyan, green, yellow, orange, red and magenta, white for 8 or more
+    static inline uint32_t K3D_OverdrawColour(int count) {
+        static const uint32_t colours[] = { 0xff000000, 0xff0000c0, 0xff00c0c0, 0xff00c000, 0xffc0c000, 0xffff8000, 0xffff0000, 0xffff00ff, 0xffffffff };
+        return colours[KS_Min(count, 8)];
+    }
+    
+    // Replace dest's pixels with one counter of the last counts. dest must be the size counted.
+    void K3D_OverdrawHeatmap(ksprite_t* dest, int counter) {
+        if(!k3d_overdraw.buffer || dest->w != k3d_overdraw.w || dest->h != k3d_overdraw.h) return;
+        for(int i = 0; i < dest->w*dest->h; ++i) {
+            dest->pixels[i] = K3D_OverdrawColour(k3d_overdraw.buffer[i].counts[counter]);
+        }
+    }
+#else
+#define K3D_OVERDRAW_COUNT(target, x, y, counter)
+#endif
+    
+    // Running totals from the scan line functions. They're only ever added to, so zero them before the work to be measured.
+    typedef struct {
+        uint64_t spans; // Scan lines with at least one pixel on the target
+        uint64_t pixels_tested; // Pixels visited by those scan lines
+        uint64_t pixels_written; // Pixels that passed the alpha and depth tests
+    } k3d_stats_t;
+    
+    k3d_stats_t k3d_stats;
+    
+    // Returns whether the pixel was written
+    static inline bool K3D_SetPixel(ksprite_t* target, float* depth_buffer, int x, int y, float depth, uint32_t color){
+        K3D_OVERDRAW_COUNT(target, x, y, K3D_OVERDRAW_TESTS);
         if(depth > depth_buffer[x + y*target->w]){
+            K3D_OVERDRAW_COUNT(target, x, y, K3D_OVERDRAW_PASSES);
             KS_SetPixel(target, x, y, color);
             depth_buffer[x + y*target->w] = depth;
+            return true;
         }
+        return false;
     }
     
-    static inline void K3D_SetPixelAlpha10(ksprite_t* target, float* depth_buffer, int x, int y, float depth, uint32_t color){
-        if((color>>24) > 0 && depth > depth_buffer[x + y*target->w]){
-            KS_SetPixel(target, x, y, color);
-            depth_buffer[x + y*target->w] = depth;
+    // color has already been fetched from a texture. Returns whether the pixel was written.
+    static inline bool K3D_SetPixelAlpha10(ksprite_t* target, float* depth_buffer, int x, int y, float depth, uint32_t color){
+        K3D_OVERDRAW_COUNT(target, x, y, K3D_OVERDRAW_FETCHES);
+        if((color>>24) > 0) {
+            K3D_OVERDRAW_COUNT(target, x, y, K3D_OVERDRAW_TESTS);
+            if(depth > depth_buffer[x + y*target->w]){
+                K3D_OVERDRAW_COUNT(target, x, y, K3D_OVERDRAW_PASSES);
+                KS_SetPixel(target, x, y, color);
+                depth_buffer[x + y*target->w] = depth;
+                return true;
+            }
         }
+        return false;
+    }
+    
+    static inline void K3D_CountSpan(int left, int right, unsigned int written) {
+        if(right < left) return;
+        ++k3d_stats.spans;
+        k3d_stats.pixels_tested += right - left + 1;
+        k3d_stats.pixels_written += written;
     }
     
     static inline void K3D_ScanLine(ksprite_t* dest, float* depth_buffer, int y, int x0, float z0, int x1, float z1, uint32_t pixel){
@@ -45,10 +173,12 @@ extern "C"{
         if(x1 < 0 || x0 > dest->w-1)return;
         int left = Max(0, x0);
         int right = Min(dest->w-1, x1);
+        unsigned int written = 0;
         for(int x = left; x <= right; ++x){
             float z = z0 + (z1-z0) * (((float)x-x0) / (x1-x0+0.0001f));
-            K3D_SetPixel( dest, depth_buffer, x, y, z, pixel );
+            written += K3D_SetPixel( dest, depth_buffer, x, y, z, pixel );
         }
+        K3D_CountSpan(left, right, written);
     }
     
     static inline void K3D_ScanLineTextured(ksprite_t* dest, float* depth_buffer, ksprite_t* texture, int y, int x0, float z0, int x1, float z1, float u0, float u1, float v0, float v1){
@@ -71,12 +201,14 @@ extern "C"{
         float z = z0 + zstep*skip;
         float u = u0 + ustep*skip;
         float v = v0 + vstep*skip;
+        unsigned int written = 0;
         for(int x = left; x <= right; ++x){
-            K3D_SetPixelAlpha10( dest, depth_buffer, x, y, z, KS_SampleWrapped(texture, u/z, v/z) );
+            written += K3D_SetPixelAlpha10( dest, depth_buffer, x, y, z, KS_SampleWrapped(texture, u/z, v/z) );
             z += zstep;
             u += ustep;
             v += vstep;
         }
+        K3D_CountSpan(left, right, written);
     }
     
     static inline void K3D_ScanLineSafe(ksprite_t* dest, float* depth_buffer, int y, int x0, float z0, int x1, float z1, uint32_t pixel){
@@ -6,6 +6,8 @@ extern "C"{
     
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <math.h>
     
 #define KS_Max(a, b) ((a)>(b)?(a):(b))
@@ -176,37 +178,196 @@ extern "C"{
         }
     }
     
-    static inline void KS_BlitScaled(ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy){
-        int left = x - originx*scalex;
-        int top = y - originy*scaley;
-        for(int sy = 0; sy < sprite->h; sy++){
-            for(int sx = 0; sx < sprite->w; sx++){
-                uint32_t source_pixel = KS_GetPixel(sprite, sx, sy);
-                int scaled_sourcex = sx*scalex;
-                int scaled_sourcey = sy*scaley;
-                for(int oy = KS_Min(0,scaley); oy < KS_Max(scaley,0); oy++){
-                    for(int ox = KS_Min(0,scalex); ox < KS_Max(scalex,0); ox++){
-                        KS_SetPixel(target, left + scaled_sourcex + ox, top + scaled_sourcey + oy, source_pixel);
-                    }
+    // Nearest neighbour scaled blits are destination driven: every target pixel inside the clip
+    // rectangle is visited once and mapped back to the source with 16.16 fixed point steps.
+    // Target rows that land on the same source row as the row above are copied with memcpy.
+    typedef struct {
+        ksprite_t* sprite;
+        ksprite_t* target;
+        int left, top; // Target position of the sprite's top left corner
+        int x0, x1, y0, y1; // Clipped target rectangle, x1/y1 exclusive
+        uint32_t u0, v0; // Source coordinates at target pixel (x0, y0), 16.16 fixed point
+        uint32_t step_u, step_v;
+        bool alpha10;
+    } ks_scaled_blit_t;
+    
+    static inline bool KS_ScaledBlitInit(ks_scaled_blit_t* blit, ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy, int clip_left, int clip_top, int clip_right, int clip_bottom, bool alpha10) {
+        // Mirrored (negative) scales are not supported
+        if(scalex <= 0 || scaley <= 0 || sprite->w <= 0 || sprite->h <= 0) return false;
+        blit->sprite = sprite;
+        blit->target = target;
+        blit->alpha10 = alpha10;
+        blit->left = x - originx*scalex;
+        blit->top = y - originy*scaley;
+        int width = sprite->w*scalex;
+        int height = sprite->h*scaley;
+        blit->x0 = KS_Max(KS_Max(blit->left, clip_left), 0);
+        blit->y0 = KS_Max(KS_Max(blit->top, clip_top), 0);
+        blit->x1 = KS_Min(KS_Min(blit->left + width, clip_right), target->w);
+        blit->y1 = KS_Min(KS_Min(blit->top + height, clip_bottom), target->h);
+        if(blit->x0 >= blit->x1 || blit->y0 >= blit->y1) return false;
+        blit->step_u = (uint32_t)(65536.0/scalex);
+        blit->step_v = (uint32_t)(65536.0/scaley);
+        // Sample at target pixel centres
+        blit->u0 = (uint32_t)(((uint64_t)(blit->x0 - blit->left)*2 + 1)*blit->step_u/2);
+        blit->v0 = (uint32_t)(((uint64_t)(blit->y0 - blit->top)*2 + 1)*blit->step_v/2);
+        return true;
+    }
+    
+    static inline void KS_ScaledBlitRows(ks_scaled_blit_t* blit, int row_begin, int row_end) {
+        ksprite_t* sprite = blit->sprite;
+        ksprite_t* target = blit->target;
+        int width = blit->x1 - blit->x0;
+        int previous_sy = -1;
+        uint32_t v = blit->v0 + (uint32_t)(row_begin - blit->y0)*blit->step_v;
+        for(int y = row_begin; y < row_end; ++y, v += blit->step_v) {
+            int sy = v >> 16;
+            uint32_t* dest = target->pixels + y*target->w + blit->x0;
+            if(sy == previous_sy && !blit->alpha10) {
+                memcpy(dest, dest - target->w, width*sizeof(uint32_t));
+                continue;
+            }
+            previous_sy = sy;
+            const uint32_t* source = sprite->pixels + sy*sprite->w;
+            uint32_t u = blit->u0;
+            if(blit->alpha10) {
+                for(int x = 0; x < width; ++x, u += blit->step_u) {
+                    uint32_t pixel = source[u >> 16];
+                    dest[x] = pixel>>24 ? pixel : dest[x];
+                }
+            }
+            else {
+                for(int x = 0; x < width; ++x, u += blit->step_u) {
+                    dest[x] = source[u >> 16];
                 }
             }
         }
     }
     
-    static inline void KS_BlitScaledAlpha10(ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy){
-        int left = x - originx*scalex;
-        int top = y - originy*scaley;
-        for(int sy = 0; sy < sprite->h; sy++){
-            for(int sx = 0; sx < sprite->w; sx++){
-                uint32_t source_pixel = KS_GetPixel(sprite, sx, sy);
-                int scaled_sourcex = sx*scalex;
-                int scaled_sourcey = sy*scaley;
-                for(int oy = KS_Min(0,scaley); oy < KS_Max(scaley,0); oy++){
-                    for(int ox = KS_Min(0,scalex); ox < KS_Max(scalex,0); ox++){
-                        KS_SetPixelAlpha10(target, left + scaled_sourcex + ox, top + scaled_sourcey + oy, source_pixel);
-                    }
-                }
+#ifdef KERO_SPRITE_THREADS
+    // Large scaled blits are split into bands of target rows and shared with a small worker pool.
+    // Call KS_ThreadsInit() once to start the workers; without it blits run on the calling thread.
+#include <pthread.h>
+#include <unistd.h>
+#ifndef KERO_SPRITE_MAX_THREADS
+#define KERO_SPRITE_MAX_THREADS 8
+#endif
+#ifndef KERO_SPRITE_MIN_ROWS_PER_THREAD
+#define KERO_SPRITE_MIN_ROWS_PER_THREAD 64
+#endif
+    struct {
+        pthread_t threads[KERO_SPRITE_MAX_THREADS];
+        int num_threads;
+        pthread_mutex_t mutex;
+        pthread_cond_t start, done;
+        unsigned int generation;
+        int pending;
+        int num_bands;
+        ks_scaled_blit_t blit;
+    } ks_threads = {0};
+    
+    static inline void KS_ScaledBlitBand(ks_scaled_blit_t* blit, int band, int num_bands) {
+        int rows = blit->y1 - blit->y0;
+        KS_ScaledBlitRows(blit, blit->y0 + rows*band/num_bands, blit->y0 + rows*(band + 1)/num_bands);
+    }
+    
+    void* KS_ThreadMain(void* data) {
+        int band = (int)(intptr_t)data;
+        unsigned int generation = 0;
+        for(;;) {
+            pthread_mutex_lock(&ks_threads.mutex);
+            while(ks_threads.generation == generation) {
+                pthread_cond_wait(&ks_threads.start, &ks_threads.mutex);
+            }
+            generation = ks_threads.generation;
+            ks_scaled_blit_t blit = ks_threads.blit;
+            int num_bands = ks_threads.num_bands;
+            pthread_mutex_unlock(&ks_threads.mutex);
+            if(band < num_bands) {
+                KS_ScaledBlitBand(&blit, band, num_bands);
+            }
+            pthread_mutex_lock(&ks_threads.mutex);
+            if(--ks_threads.pending == 0) {
+                pthread_cond_signal(&ks_threads.done);
+            }
+            pthread_mutex_unlock(&ks_threads.mutex);
+        }
+        return NULL;
+    }
+    
+    // num_threads counts the calling thread too. 0 uses one thread per online CPU.
+    bool KS_ThreadsInit(int num_threads) {
+        if(ks_threads.num_threads) return true;
+        if(num_threads <= 0) {
+            num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        }
+        num_threads = KS_Min(num_threads, KERO_SPRITE_MAX_THREADS + 1);
+        pthread_mutex_init(&ks_threads.mutex, NULL);
+        pthread_cond_init(&ks_threads.start, NULL);
+        pthread_cond_init(&ks_threads.done, NULL);
+        for(int i = 1; i < num_threads; ++i) {
+            if(pthread_create(&ks_threads.threads[ks_threads.num_threads], NULL, KS_ThreadMain, (void*)(intptr_t)i) != 0) {
+                fprintf(stderr, "Failed to create sprite worker thread\n");
+                break;
             }
+            ++ks_threads.num_threads;
+        }
+        return ks_threads.num_threads > 0;
+    }
+    
+    static inline void KS_ScaledBlitRun(ks_scaled_blit_t* blit) {
+        int num_bands = KS_Min(ks_threads.num_threads + 1, (blit->y1 - blit->y0)/KERO_SPRITE_MIN_ROWS_PER_THREAD);
+        if(num_bands < 2) {
+            KS_ScaledBlitRows(blit, blit->y0, blit->y1);
+            return;
+        }
+        pthread_mutex_lock(&ks_threads.mutex);
+        ks_threads.blit = *blit;
+        ks_threads.num_bands = num_bands;
+        ks_threads.pending = ks_threads.num_threads;
+        ++ks_threads.generation;
+        pthread_cond_broadcast(&ks_threads.start);
+        pthread_mutex_unlock(&ks_threads.mutex);
+        KS_ScaledBlitBand(blit, 0, num_bands);
+        pthread_mutex_lock(&ks_threads.mutex);
+        while(ks_threads.pending > 0) {
+            pthread_cond_wait(&ks_threads.done, &ks_threads.mutex);
+        }
+        pthread_mutex_unlock(&ks_threads.mutex);
+    }
+#else
+    static inline void KS_ScaledBlitRun(ks_scaled_blit_t* blit) {
+        KS_ScaledBlitRows(blit, blit->y0, blit->y1);
+    }
+#endif
+    
+    static inline void KS_BlitScaled(ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy){
+        ks_scaled_blit_t blit;
+        if(KS_ScaledBlitInit(&blit, sprite, target, x, y, scalex, scaley, originx, originy, 0, 0, target->w, target->h, false)) {
+            KS_ScaledBlitRun(&blit);
+        }
+    }
+    
+    static inline void KS_BlitScaledAlpha10(ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy){
+        ks_scaled_blit_t blit;
+        if(KS_ScaledBlitInit(&blit, sprite, target, x, y, scalex, scaley, originx, originy, 0, 0, target->w, target->h, true)) {
+            KS_ScaledBlitRun(&blit);
+        }
+    }
+    
+    // Only pixels inside the target rectangle left <= x < right, top <= y < bottom are written.
+    // They come out exactly as KS_BlitScaled would draw them, so a damaged area can be redrawn on its own.
+    static inline void KS_BlitScaledClipped(ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy, int left, int top, int right, int bottom){
+        ks_scaled_blit_t blit;
+        if(KS_ScaledBlitInit(&blit, sprite, target, x, y, scalex, scaley, originx, originy, left, top, right, bottom, false)) {
+            KS_ScaledBlitRun(&blit);
+        }
+    }
+    
+    static inline void KS_BlitScaledAlpha10Clipped(ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy, int left, int top, int right, int bottom){
+        ks_scaled_blit_t blit;
+        if(KS_ScaledBlitInit(&blit, sprite, target, x, y, scalex, scaley, originx, originy, left, top, right, bottom, true)) {
+            KS_ScaledBlitRun(&blit);
         }
     }
     
@@ -244,21 +405,9 @@ extern "C"{
         }
     }
     
+    // KS_BlitScaled clips to the target, so it is already safe
     void KS_BlitScaledSafe(ksprite_t* sprite, ksprite_t* target, int x, int y, float scalex, float scaley, int originx, int originy){
-        int left = x - originx*scalex;
-        int top = y - originy*scaley;
-        for(int sy = 0; sy < sprite->h; sy++){
-            for(int sx = 0; sx < sprite->w; sx++){
-                uint32_t source_pixel = KS_GetPixel(sprite, sx, sy);
-                int scaled_sourcex = sx*scalex;
-                int scaled_sourcey = sy*scaley;
-                for(int oy = KS_Min(0,scaley); oy < KS_Max(scaley,0); oy++){
-                    for(int ox = KS_Min(0,scalex); ox < KS_Max(scalex,0); ox++){
-                        KS_SetPixelSafe(target, left + scaled_sourcex + ox, top + scaled_sourcey + oy, source_pixel);
-                    }
-                }
-            }
-        }
+        KS_BlitScaled(sprite, target, x, y, scalex, scaley, originx, originy);
     }
     
     void KS_BlitRotatedOriginBlend(ksprite_t* sprite, ksprite_t* target, int x, int y, float angle, int originx, int originy){
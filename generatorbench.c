@@ -0,0 +1,579 @@
+// Maze generator scaling benchmark. Build with build-generator-bench.sh.
+// Runs every kero_maze.h generator from a fixed seed at sizes from 16x16 to 4096x4096, and times generation, wall extraction
+// and solving separately, so an algorithm whose cost grows faster than the number of cells shows up in the exponent column.
+//
+// generator-bench [-generators persistent-walk,short-walk,backtracker,prims,tiled,reference-walk] [-stages generate,walls,solve]
+//                 [-sizes 16x16,32x32,...] [-seed 1] [-time 0.1] [-budget 5] [-tile 256] [-threads 0,...] [-o results.csv] [-texture] [-tolerance 1]
+//
+// Writes one CSV row per generator, size and stage. Each stage repeats for at least -time seconds and reports its fastest pass.
+// peak KB is the most heap memory the stage had allocated at once beyond what was allocated before it started, from the allocator hooks below.
+// exponent is how the time grew against the previous larger size: 1 for linear, 2 for quadratic.
+// result is the number of walls for the walls stage and the length of the longest path from the start for the solve stage.
+// speedup is the persistent walk's generate time at the same size over this generator's, when the persistent walk ran too.
+// tiled is MazeGenerateTiled() with -tile cells per side, run once for each of the -threads counts, 0 for one per online CPU.
+// threads is how many threads the tiled generator ran on, at most one per tile, so -threads 1,2,4,8 gives its scaling against the persistent walk in the speedup column.
+// reference-walk is the persistent walk as it was before a restart drew only from the open directions, defined below.
+//
+// -texture generates each maze once instead of timing it and writes the share of cells that are dead ends, straights, turns, junctions
+// and crossings, and the largest difference in percentage points from reference-walk's maze at the same size and seed.
+// It fails if the persistent walk or the tiled generator, which is built from it, differs by more than -tolerance points
+// plus three standard errors of a share near a half, so a small maze's noise doesn't fail it.
+//
+// A stage is skipped, with a message on stderr, when its previous time scaled by its exponent predicts a pass longer than -budget seconds.
+#define KERO_PLATFORM_HEADLESS
+#define KERO_MAZE_THREADS
+#include "kero_math.h"
+#include "kero_platform.h"
+#include "kero_maze.h"
+#include <math.h>
+#include <malloc.h>
+#include <unistd.h>
+
+enum
+{
+    GENERATOR_PERSISTENT_WALK,
+    GENERATOR_SHORT_WALK,
+    GENERATOR_BACKTRACKER,
+    GENERATOR_PRIMS,
+    GENERATOR_TILED,
+    GENERATOR_REFERENCE_WALK,
+    NUM_GENERATORS
+};
+const char *generator_names[NUM_GENERATORS] = {"persistent-walk", "short-walk", "backtracker", "prims", "tiled", "reference-walk"};
+
+enum
+{
+    STAGE_GENERATE,
+    STAGE_WALLS,
+    STAGE_SOLVE,
+    NUM_STAGES
+};
+const char *stage_names[NUM_STAGES] = {"generate", "walls", "solve"};
+
+#define MAX_GENERATOR_SIZES 32
+#define MAX_THREAD_COUNTS 16
+
+int default_sizes[][2] = {
+    {16, 16},
+    {32, 32},
+    {64, 64},
+    {128, 128},
+    {256, 256},
+    {512, 512},
+    {1024, 1024},
+    {2048, 2048},
+    {4096, 4096},
+    {256, 16},
+    {16, 256},
+    {4096, 64},
+    {64, 4096},
+};
+int num_default_sizes = 13;
+
+kero_platform_t platform;
+int tile_size = 256, num_threads = 0;
+
+// ----- Heap tracking -----
+// The allocator is replaced with glibc's own plus a count of the bytes live right now and the most there have been.
+// The memalign family is not replaced. Nothing here uses it.
+// The counts are atomic because the tiled generator allocates from its worker threads.
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+int64_t heap_live, heap_peak;
+
+void HeapAdd(int64_t bytes)
+{
+    int64_t live = __atomic_add_fetch(&heap_live, bytes, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&heap_peak, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void *malloc(size_t size)
+{
+    void *pointer = __libc_malloc(size);
+    if (pointer)
+        HeapAdd(malloc_usable_size(pointer));
+    return pointer;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *pointer = __libc_calloc(count, size);
+    if (pointer)
+        HeapAdd(malloc_usable_size(pointer));
+    return pointer;
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    int64_t old_size = pointer ? malloc_usable_size(pointer) : 0;
+    void *new_pointer = __libc_realloc(pointer, size);
+    if (new_pointer)
+        HeapAdd((int64_t)malloc_usable_size(new_pointer) - old_size);
+    else if (!size)
+        HeapAdd(-old_size); // realloc(pointer, 0) only frees
+    return new_pointer;
+}
+
+void free(void *pointer)
+{
+    if (pointer)
+        HeapAdd(-(int64_t)malloc_usable_size(pointer));
+    __libc_free(pointer);
+}
+
+// ----- Reference walk -----
+// MazeGeneratePersistentWalkSeeded() without the drawing and events, drawing from all four directions after a restart as well
+// and restarting again when that one is blocked. -texture checks the library's walk still makes the same kind of maze as this.
+
+void ReferenceWalk(maze_t *maze, int w, int h, float persistence, uint32_t seed)
+{
+    MazeFree(maze);
+    maze->w = w;
+    maze->h = h;
+    maze->cell_size = 5;
+    maze->passages = MazePassagesCreate(w, h);
+    maze_frontier_t frontier;
+    MazeFrontierCreate(&frontier, maze);
+    static const int step_x[MAZE_DIRECTION_COUNT] = {-1, 0, 1, 0};
+    static const int step_y[MAZE_DIRECTION_COUNT] = {0, 1, 0, -1};
+    uint32_t random = seed ? seed : 1;
+    int x = MazeRandomBelow(&random, w);
+    int y = MazeRandomBelow(&random, h);
+    maze->start.x = x;
+    maze->start.y = y;
+    uint8_t unvisited = MazeFrontierVisit(&frontier, maze, x, y, NULL);
+    int persistence_step = (int)(persistence * MAZE_PERSISTENCE_ONE);
+    int current_persistence = 0;
+    while (frontier.count > 0)
+    {
+        bool did_visit = false;
+        if (unvisited)
+        {
+            current_persistence += persistence_step;
+            int dir = MazeRandomBelow(&random, MAZE_DIRECTION_COUNT);
+            int attempts = 1;
+            if (current_persistence >= MAZE_PERSISTENCE_ONE)
+            {
+                if (unvisited & 1 << dir)
+                {
+                    MazeConnect(maze, x, y, (MAZE_DIRECTION)(1 << dir));
+                    x += step_x[dir];
+                    y += step_y[dir];
+                    did_visit = true;
+                }
+                attempts = Min(did_visit ? 2 : current_persistence / MAZE_PERSISTENCE_ONE + 1, MAZE_DIRECTION_COUNT);
+            }
+            current_persistence = (current_persistence - attempts * MAZE_PERSISTENCE_ONE) % MAZE_PERSISTENCE_ONE;
+        }
+        if (did_visit)
+            unvisited = MazeFrontierVisit(&frontier, maze, x, y, NULL);
+        else if (frontier.count > 0)
+        {
+            int cell = frontier.cells[MazeRandomBelow(&random, frontier.count)];
+            x = cell % w;
+            y = cell / w;
+            unvisited = MazeUnvisitedNeighbours(maze, frontier.visited, x, y);
+        }
+    }
+    MazeFrontierFree(&frontier);
+}
+
+// ----- Texture -----
+
+enum
+{
+    SHAPE_DEAD_END,
+    SHAPE_STRAIGHT,
+    SHAPE_TURN,
+    SHAPE_JUNCTION,
+    SHAPE_CROSSING,
+    NUM_SHAPES
+};
+
+// Percentage of the maze's cells of each shape
+void MazeTexture(maze_t *maze, double *shares)
+{
+    int64_t counts[NUM_SHAPES] = {0};
+    for (int y = 0; y < maze->h; ++y)
+    {
+        for (int x = 0; x < maze->w; ++x)
+        {
+            uint8_t directions = MazeCell(maze, x, y);
+            switch (__builtin_popcount(directions))
+            {
+            case 1:
+                ++counts[SHAPE_DEAD_END];
+                break;
+            case 2:
+                ++counts[directions == (MAZE_LEFT | MAZE_RIGHT) || directions == (MAZE_UP | MAZE_DOWN) ? SHAPE_STRAIGHT : SHAPE_TURN];
+                break;
+            case 3:
+                ++counts[SHAPE_JUNCTION];
+                break;
+            case 4:
+                ++counts[SHAPE_CROSSING];
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < NUM_SHAPES; ++i)
+        shares[i] = 100.0 * counts[i] / ((double)maze->w * maze->h);
+}
+
+// ----- Stages -----
+
+typedef struct
+{
+    maze_t maze;
+    wall_t *walls;
+    unsigned int *weights;
+} generator_run_t;
+
+void GeneratorFree(generator_run_t *run)
+{
+    MazeFree(&run->maze);
+    if (run->walls)
+        sb_free(run->walls);
+    run->walls = NULL;
+    free(run->weights);
+    run->weights = NULL;
+}
+
+void GeneratorGenerate(int generator, maze_t *maze, int w, int h)
+{
+    // Prim's never sets the start
+    maze->start.x = maze->start.y = 0;
+    switch (generator)
+    {
+    case GENERATOR_PERSISTENT_WALK:
+        MazeGeneratePersistentWalk(maze, NULL, w, h, 5, 2, NULL, &platform); // The game's persistence
+        break;
+    case GENERATOR_SHORT_WALK:
+        MazeGenerateShortWalk(maze, NULL, w, h, 5, NULL, &platform);
+        break;
+    case GENERATOR_BACKTRACKER:
+        MazeGenerateRecursiveBacktracker(maze, NULL, w, h, 5, NULL, &platform);
+        break;
+    case GENERATOR_PRIMS:
+        MazeGeneratePrims(maze, NULL, w, h, 5, NULL, &platform);
+        break;
+    case GENERATOR_TILED:
+        MazeGenerateTiled(maze, NULL, w, h, 5, 2, tile_size, num_threads);
+        break;
+    case GENERATOR_REFERENCE_WALK:
+        ReferenceWalk(maze, w, h, 2, (uint32_t)rand() + 1);
+        break;
+    }
+}
+
+// One pass of a stage on a maze that has already been generated, except for the generate stage. Returns the stage's result
+int GeneratorStage(int stage, int generator, generator_run_t *run, int w, int h, unsigned int seed)
+{
+    switch (stage)
+    {
+    case STAGE_GENERATE:
+        srand(seed);
+        GeneratorGenerate(generator, &run->maze, w, h);
+        return 0;
+    case STAGE_WALLS:
+        MazeGenerateWalls(&run->maze, &run->walls);
+        return sb_count(run->walls);
+    case STAGE_SOLVE:
+        free(run->weights);
+        return MazeDijkstra(&run->maze, &run->weights);
+    }
+    return 0;
+}
+
+// Undo a pass so the next one starts from the same state, outside the timed region
+void GeneratorResetStage(int stage, generator_run_t *run)
+{
+    if (stage == STAGE_GENERATE)
+        MazeFree(&run->maze);
+    else if (stage == STAGE_WALLS && run->walls)
+    {
+        sb_free(run->walls);
+        run->walls = NULL;
+    }
+    else if (stage == STAGE_SOLVE)
+    {
+        free(run->weights);
+        run->weights = NULL;
+    }
+}
+
+bool GeneratorParseNames(char *text, const char **names, int num_names, bool *enabled)
+{
+    for (int i = 0; i < num_names; ++i)
+    {
+        enabled[i] = false;
+    }
+    for (char *name = strtok(text, ","); name; name = strtok(NULL, ","))
+    {
+        int i = 0;
+        while (i < num_names && strcmp(name, names[i]))
+            ++i;
+        if (i == num_names)
+        {
+            fprintf(stderr, "Unknown name %s\n", name);
+            return false;
+        }
+        enabled[i] = true;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool run_generator[NUM_GENERATORS], run_stage[NUM_STAGES];
+    for (int i = 0; i < NUM_GENERATORS; ++i)
+        run_generator[i] = true;
+    for (int i = 0; i < NUM_STAGES; ++i)
+        run_stage[i] = true;
+    int sizes[MAX_GENERATOR_SIZES][2];
+    int num_sizes = num_default_sizes;
+    memcpy(sizes, default_sizes, sizeof(default_sizes));
+    unsigned int seed = 1;
+    double min_time = 0.1, budget = 5;
+    const char *output_path = 0;
+    bool texture = false;
+    int thread_counts[MAX_THREAD_COUNTS] = {0}, num_thread_counts = 1;
+    double tolerance = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-generators") && i + 1 < argc)
+        {
+            if (!GeneratorParseNames(argv[++i], generator_names, NUM_GENERATORS, run_generator))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "-stages") && i + 1 < argc)
+        {
+            if (!GeneratorParseNames(argv[++i], stage_names, NUM_STAGES, run_stage))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "-sizes") && i + 1 < argc)
+        {
+            num_sizes = 0;
+            for (char *size = strtok(argv[++i], ","); size; size = strtok(NULL, ","))
+            {
+                if (num_sizes == MAX_GENERATOR_SIZES || sscanf(size, "%dx%d", &sizes[num_sizes][0], &sizes[num_sizes][1]) != 2 || sizes[num_sizes][0] < 1 || sizes[num_sizes][1] < 1)
+                {
+                    fprintf(stderr, "Sizes must be up to %d WIDTHxHEIGHT pairs separated by commas\n", MAX_GENERATOR_SIZES);
+                    return -1;
+                }
+                ++num_sizes;
+            }
+        }
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+        {
+            seed = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "-time") && i + 1 < argc)
+        {
+            min_time = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-budget") && i + 1 < argc)
+        {
+            budget = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-tile") && i + 1 < argc)
+        {
+            tile_size = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            num_thread_counts = 0;
+            for (char *count = strtok(argv[++i], ","); count; count = strtok(NULL, ","))
+            {
+                if (num_thread_counts == MAX_THREAD_COUNTS)
+                {
+                    fprintf(stderr, "Threads must be up to %d counts separated by commas\n", MAX_THREAD_COUNTS);
+                    return -1;
+                }
+                thread_counts[num_thread_counts++] = atoi(count);
+            }
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-texture"))
+        {
+            texture = true;
+        }
+        else if (!strcmp(argv[i], "-tolerance") && i + 1 < argc)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    FILE *output = stdout;
+    if (output_path && !(output = fopen(output_path, "w")))
+    {
+        fprintf(stderr, "Failed to open %s\n", output_path);
+        return -1;
+    }
+    num_threads = thread_counts[0];
+    // The generators poll for events, which headless mode answers from an empty script
+    KP_Init(&platform, 16, 16, "Maze95 generator bench");
+
+    if (texture)
+    {
+        fprintf(output, "generator,width,height,cells,dead ends %%,straights %%,turns %%,junctions %%,crossings %%,difference\n");
+        int failures = 0;
+        for (int size = 0; size < num_sizes; ++size)
+        {
+            int w = sizes[size][0], h = sizes[size][1];
+            maze_t maze = {0};
+            double reference[NUM_SHAPES], shares[NUM_SHAPES];
+            srand(seed);
+            GeneratorGenerate(GENERATOR_REFERENCE_WALK, &maze, w, h);
+            MazeTexture(&maze, reference);
+            for (int generator = 0; generator < NUM_GENERATORS; ++generator)
+            {
+                if (!run_generator[generator])
+                    continue;
+                srand(seed);
+                GeneratorGenerate(generator, &maze, w, h);
+                MazeTexture(&maze, shares);
+                double difference = 0;
+                for (int i = 0; i < NUM_SHAPES; ++i)
+                    difference = Max(difference, fabs(shares[i] - reference[i]));
+                fprintf(output, "%s,%d,%d,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n", generator_names[generator], w, h, w * h, shares[SHAPE_DEAD_END], shares[SHAPE_STRAIGHT], shares[SHAPE_TURN],
+                        shares[SHAPE_JUNCTION], shares[SHAPE_CROSSING], difference);
+                fflush(output);
+                if ((generator == GENERATOR_PERSISTENT_WALK || generator == GENERATOR_TILED) && difference > tolerance + 150 / sqrt((double)w * h))
+                {
+                    fprintf(stderr, "%s %dx%d texture is %.2f points from reference-walk\n", generator_names[generator], w, h, difference);
+                    ++failures;
+                }
+            }
+            MazeFree(&maze);
+        }
+        if (output != stdout)
+            fclose(output);
+        if (failures)
+            fprintf(stderr, "%d textures differ from reference-walk by more than %g points\n", failures, tolerance);
+        else
+            fprintf(stderr, "Textures are within %g points of reference-walk\n", tolerance);
+        return failures ? 1 : 0;
+    }
+
+    fprintf(output, "generator,width,height,cells,stage,passes,best ms,ns/cell,peak KB,exponent,result,speedup,threads\n");
+    // The persistent walk's generate time at each size, which the tiled generator's speedup is measured against
+    double walk_seconds[MAX_GENERATOR_SIZES] = {0};
+
+    // Each generator runs once, except tiled, which runs once per thread count
+    int job_generators[NUM_GENERATORS + MAX_THREAD_COUNTS], job_threads[NUM_GENERATORS + MAX_THREAD_COUNTS], num_jobs = 0;
+    for (int generator = 0; generator < NUM_GENERATORS; ++generator)
+    {
+        for (int i = 0; run_generator[generator] && i < (generator == GENERATOR_TILED ? num_thread_counts : 1); ++i)
+        {
+            job_generators[num_jobs] = generator;
+            job_threads[num_jobs++] = thread_counts[i];
+        }
+    }
+
+    for (int job = 0; job < num_jobs; ++job)
+    {
+        int generator = job_generators[job];
+        num_threads = job_threads[job];
+        // The largest size each stage has run at so far, to predict the next one from
+        double last_cells[NUM_STAGES] = {0}, last_seconds[NUM_STAGES] = {0}, exponent[NUM_STAGES];
+        for (int stage = 0; stage < NUM_STAGES; ++stage)
+            exponent[stage] = 1;
+
+        for (int size = 0; size < num_sizes; ++size)
+        {
+            int w = sizes[size][0], h = sizes[size][1];
+            double cells = (double)w * h;
+            generator_run_t run = {0};
+            for (int stage = 0; stage < NUM_STAGES; ++stage)
+            {
+                // Later stages need the maze even when generation isn't being reported
+                bool needs_maze = stage == STAGE_GENERATE || run_stage[STAGE_WALLS] || run_stage[STAGE_SOLVE];
+                if (!run_stage[stage] && !(stage == STAGE_GENERATE && needs_maze))
+                    continue;
+                if (cells > last_cells[stage] && last_cells[stage])
+                {
+                    double predicted = last_seconds[stage] * pow(cells / last_cells[stage], Max(exponent[stage], 1));
+                    if (predicted > budget)
+                    {
+                        fprintf(stderr, "Skipping %s %dx%d %s, predicted %.1f s per pass\n", generator_names[generator], w, h, stage_names[stage], predicted);
+                        if (stage == STAGE_GENERATE)
+                            break;
+                        continue;
+                    }
+                }
+
+                uint64_t best_time = UINT64_MAX, total_time = 0;
+                int64_t peak = 0;
+                int passes = 0, result = 0;
+                for (;;)
+                {
+                    int64_t start_heap = heap_live;
+                    heap_peak = heap_live;
+                    uint64_t start = KP_ClockNs();
+                    result = GeneratorStage(stage, generator, &run, w, h, seed);
+                    uint64_t time = KP_ClockNs() - start;
+                    peak = Max(peak, heap_peak - start_heap);
+                    best_time = Min(best_time, time);
+                    total_time += time;
+                    ++passes;
+                    if (total_time >= min_time * 1e9 || time > budget * 1e9)
+                        break;
+                    GeneratorResetStage(stage, &run);
+                }
+                double seconds = Max(best_time, 1) / 1e9;
+
+                if (run_stage[stage])
+                {
+                    char exponent_text[16] = "", result_text[16] = "", speedup_text[16] = "", threads_text[16] = "";
+                    if (stage != STAGE_GENERATE)
+                        snprintf(result_text, sizeof(result_text), "%d", result);
+                    if (cells > last_cells[stage] && last_cells[stage])
+                    {
+                        exponent[stage] = log(seconds / last_seconds[stage]) / log(cells / last_cells[stage]);
+                        snprintf(exponent_text, sizeof(exponent_text), "%.2f", exponent[stage]);
+                    }
+                    if (stage == STAGE_GENERATE && generator == GENERATOR_PERSISTENT_WALK)
+                        walk_seconds[size] = seconds;
+                    else if (stage == STAGE_GENERATE && walk_seconds[size])
+                        snprintf(speedup_text, sizeof(speedup_text), "%.2f", walk_seconds[size] / seconds);
+                    if (generator == GENERATOR_TILED)
+                    {
+                        // The threads MazeGenerateTiled() actually starts, which is never more than there are tiles
+                        int tiles = ((w + Max(tile_size, 1) - 1) / Max(tile_size, 1)) * ((h + Max(tile_size, 1) - 1) / Max(tile_size, 1));
+                        long threads = num_threads > 0 ? num_threads : sysconf(_SC_NPROCESSORS_ONLN);
+                        snprintf(threads_text, sizeof(threads_text), "%ld", Min(Min(threads, tiles), KERO_MAZE_MAX_THREADS + 1));
+                    }
+                    fprintf(output, "%s,%d,%d,%.0f,%s,%d,%.4f,%.2f,%.1f,%s,%s,%s,%s\n", generator_names[generator], w, h, cells, stage_names[stage], passes, seconds * 1e3, seconds * 1e9 / cells,
+                            peak / 1024.0, exponent_text, result_text, speedup_text, threads_text);
+                    fflush(output);
+                }
+                if (cells > last_cells[stage])
+                {
+                    last_cells[stage] = cells;
+                    last_seconds[stage] = seconds;
+                }
+            }
+            GeneratorFree(&run);
+        }
+    }
+
+    if (output != stdout)
+        fclose(output);
+    return 0;
+}
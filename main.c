@@ -1,3 +1,4 @@
+#define KERO_SPRITE_THREADS
 #include "kero_software_3d.h"
 #include "kero_std.h"
 #include "kero_math.h"
@@ -7,6 +8,8 @@
 #include "kero_matrix.h"
 #include "kero_font.h"
 #include "kero_maze.h"
+#include "kero_capture.h"
+#include "kero_profile.h"
 
 #define CAM_SPEED 8.f
 #define CAM_ROT_SPEED 0.002f
@@ -15,6 +18,7 @@
 #define NEAR_Z 1.f
 #define FAR_Z 50.f
 #define MAX_FACES 100000
+#define MAX_MAZE_SIZE 150 // The options menu stops at 100, bigger mazes are only used by the benchmark
 #define NUM_GAME_TEXTURES 11
 #define MAX_TEXTURES 16
 #define AI_TIME_PER_MOVE 0.5f // In seconds
@@ -106,6 +110,19 @@ bool auto_launch_menu = true;
 bool game_running = true;
 bool menu_running = true;
 bool draw_profiles = false;
+bool draw_counters = false;
+#ifdef KERO_3D_DEBUG_OVERDRAW
+int overdraw_view = 0; // O cycles through 0 for off, then 1 + K3D_OVERDRAW_TESTS, PASSES or FETCHES shown as a heatmap
+const char *overdraw_view_names[K3D_NUM_OVERDRAW_COUNTERS] = {"Depth tests", "Overdraw", "Texel fetches"};
+#endif
+bool server_scaling = false; // Let the X server upscale render_frame instead of the CPU
+bool server_scaling_bilinear = false;
+bool async_present = false;
+bool input_thread = false;
+int unfocused_fps = 10; // Frame rate while the window is unfocused or hidden, 0 for unlimited
+bool background_throttled = false;
+const char *capture_path = 0; // -capture file.y4m records render_frame on a writer thread
+kcapture_t capture;
 ksprite_t frame_buffer;
 ksprite_t menu_frame;
 int internal_resolution_width = 320;
@@ -131,7 +148,7 @@ struct
         };
     };
     bool active;
-} dodecahedrons[333];
+} dodecahedrons[MAX_MAZE_SIZE * MAX_MAZE_SIZE / 30];
 unsigned int num_dodecahedrons;
 bool ai_control = false;
 
@@ -208,6 +225,15 @@ face_t cam_faces[MAX_FACES];
 int num_cam_faces;
 face_t view_faces[MAX_FACES];
 int num_view_faces;
+// What happened to faces on their way through the last RenderWorld(). k3d_stats has its spans and pixels.
+struct
+{
+    int backface_culled;
+    int near_culled;    // Entirely closer than NEAR_Z
+    int near_clipped_1; // Crossing NEAR_Z with one vertex in front, drawn as 1 triangle
+    int near_clipped_2; // Crossing NEAR_Z with two vertices in front, drawn as 2 triangles
+    int offscreen;      // View faces entirely outside the viewport
+} pipeline_counters;
 
 face_t end_board[2];
 
@@ -240,29 +266,21 @@ struct
 #define CONTROL_GRID 0b1000
 #define CONTROL_DOWN_MOVE 0b10000
 unsigned int control_mode = CONTROL_GRID | CONTROL_TURN90;
+bool raw_mouse_look = false; // Free look reads raw mouse motion instead of warping the pointer back every frame
 
 #define MAX_PROFILE_TIMES 16
 #define MAX_PROFILE_FRAMES 60
-double profile_times[MAX_PROFILE_TIMES];
-char profile_time_names[MAX_PROFILE_TIMES][64];
-int current_profile_time = 0;
 int current_profile_frame = 0;
 uint32_t profile_colours[MAX_PROFILE_TIMES];
-typedef struct
-{
-    int num_profiles;
-    double profiles[MAX_PROFILE_TIMES];
-} profile_frame_t;
-profile_frame_t profile_frames[MAX_PROFILE_FRAMES] = {0};
-profile_frame_t new_profile_frame = {0};
-void ProfileTime(char *name)
-{
-    if (current_profile_time >= MAX_PROFILE_TIMES)
-        return;
-    profile_times[current_profile_time] = KP_Clock();
-    strcpy(profile_time_names[current_profile_time], name);
-    ++current_profile_time;
-}
+kprof_frame_t profile_frames[MAX_PROFILE_FRAMES] = {0};
+bool perf_counters = false;  // -perf counts cycles, instructions and misses per zone
+uint64_t profile_pixels = 0; // Pixels tested during the frame KPROF_LastFrame() gives, for misses per pixel
+#define STEADY_STATE_FRAMES 60   // Frames after a maze restart or the menu before the game shouldn't allocate any more
+kprof_guard_t alloc_guard = KPROF_GUARD_OFF; // -alloc-guard or -alloc-guard-abort, for steady state frames
+int steady_frames = 0;
+const char *trace_path = "trace.json";
+kprof_stats_t frame_stats; // Every zone's duration, for percentiles on the overlay and in stats_path
+const char *stats_path = "frame_stats.csv";
 
 typedef struct
 {
@@ -299,6 +317,90 @@ void SortRays(int f, int l, float *ray_angles, vec2_t *rays)
     }
 }
 
+// The platform frame buffer moves on resize, and after every flip when presenting from a thread
+static inline void SyncFrameBuffer()
+{
+    frame_buffer.pixels = platform.frame_buffer.pixels;
+    frame_buffer.w = platform.frame_buffer.w;
+    frame_buffer.h = platform.frame_buffer.h;
+}
+
+// Letterboxed into the frame buffer on the CPU, when the X server isn't doing the scaling
+static inline void UpscaleRenderFrame()
+{
+    float frame_scale = Min((float)frame_buffer.h / (float)render_frame.h, (float)frame_buffer.w / (float)render_frame.w);
+    KS_BlitScaled(&render_frame, &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, frame_scale, frame_scale, render_frame.w / 2, render_frame.h / 2);
+}
+
+// A trace started with -trace and never saved with T is saved on exit
+void SaveTrace()
+{
+    if (KPROF_Capturing())
+    {
+        KPROF_CaptureWrite(trace_path);
+    }
+}
+
+void SaveFrameStats()
+{
+    // Runs at exit from whatever zone was open, and stdio buffers its file
+    KPROF_AllocGuard(KPROF_GUARD_OFF);
+    KPROF_StatsWriteCSV(&frame_stats, stats_path);
+}
+
+// Instructions per cycle during a zone, 0 without counters
+double ZoneIPC(kprof_zone_t *zone)
+{
+    return zone->counters[KPROF_COUNTER_CYCLES] ? (double)zone->counters[KPROF_COUNTER_INSTRUCTIONS] / zone->counters[KPROF_COUNTER_CYCLES] : 0;
+}
+
+double PerPixel(uint64_t count)
+{
+    return profile_pixels ? (double)count / profile_pixels : 0;
+}
+
+// Allocating is expected again until STEADY_STATE_FRAMES more frames have passed
+void SteadyStateReset()
+{
+    steady_frames = 0;
+    KPROF_AllocGuard(KPROF_GUARD_OFF);
+}
+
+// The platform makes a new frame buffer while it applies a resize, before the event reaches a handler that can call
+// SteadyStateReset(), so the guard is off while it reads events
+int GameEventsQueued()
+{
+    KPROF_AllocGuard(KPROF_GUARD_OFF);
+    int queued = KP_EventsQueued(&platform);
+    if (alloc_guard && steady_frames >= STEADY_STATE_FRAMES)
+    {
+        KPROF_AllocGuard(alloc_guard);
+    }
+    return queued;
+}
+
+void ShutdownPlatform()
+{
+    KP_Shutdown(&platform);
+}
+
+void StopCapture()
+{
+    KCAP_Stop(&capture);
+    printf("Captured %u frames, dropped %u\n", capture.frames_written, capture.frames_dropped);
+}
+
+// Drop to unfocused_fps while the window is unfocused or hidden and back to 60 when it returns
+static inline void UpdateBackgroundThrottle()
+{
+    bool throttle = !platform.focused || !platform.visible;
+    if (throttle != background_throttled)
+    {
+        background_throttled = throttle;
+        KP_SetTargetFramerate(&platform, throttle ? unfocused_fps : 60);
+    }
+}
+
 static inline void PlayerMessage(char *text)
 {
     if (top_message > 4)
@@ -318,9 +420,13 @@ static inline void PlayerMessage(char *text)
     ++top_message;
 }
 
+// render_frame and depth_buffer are allocated once at the largest internal resolution.
+// Resizing only changes the viewport; the renderer uses render_frame.w as the row stride.
+int render_frame_capacity;
+
 static inline void ResizeRenderFrame(int w, int h)
 {
-    if (w <= 0 || h <= 0)
+    if (w <= 0 || h <= 0 || w * h > render_frame_capacity)
     {
         PlayerMessage("Invalid resolution");
         return;
@@ -329,14 +435,80 @@ static inline void ResizeRenderFrame(int w, int h)
     internal_resolution_height = h;
     render_frame.w = internal_resolution_width;
     render_frame.h = internal_resolution_height;
-    render_frame.pixels = (uint32_t *)realloc(render_frame.pixels, sizeof(uint32_t) * internal_resolution_width * internal_resolution_height);
     aspect_ratio = (float)internal_resolution_width / (float)internal_resolution_height;
-    depth_buffer = (float *)realloc(depth_buffer, sizeof(float) * internal_resolution_width * internal_resolution_height);
-    KS_Clear(&frame_buffer);
+}
+
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.25f
+#define DYNAMIC_RESOLUTION_BUDGET 0.8f     // Fraction of the target frame time the render stages may use
+#define DYNAMIC_RESOLUTION_HIGH_WATER 1.f  // Scale down when over budget * this
+#define DYNAMIC_RESOLUTION_LOW_WATER 0.7f  // Scale up when under budget * this
+#define DYNAMIC_RESOLUTION_MAX_STEP_UP 1.1f
+#define DYNAMIC_RESOLUTION_COOLDOWN 15 // Frames to wait after a change before measuring again
+#define DYNAMIC_RESOLUTION_SMOOTHING 0.1f
+struct
+{
+    bool enabled;
+    float scale; // Applied to the selected internal resolution preset
+    double smoothed_time;
+    int cooldown;
+} dynamic_resolution = {false, 1.f, 0, 0};
+
+static inline void DynamicResolutionApply()
+{
+    int w = internal_resolutions[internal_resolution][0] * dynamic_resolution.scale;
+    int h = internal_resolutions[internal_resolution][1] * dynamic_resolution.scale;
+    ResizeRenderFrame(Max(w, 16), Max(h, 16));
+}
+
+static inline void DynamicResolutionReset()
+{
+    dynamic_resolution.scale = 1.f;
+    dynamic_resolution.smoothed_time = 0;
+    dynamic_resolution.cooldown = DYNAMIC_RESOLUTION_COOLDOWN;
+}
+
+// Takes the busy time in ms of the last frame (everything but the frame limiter's sleep)
+void DynamicResolutionUpdate(double render_time)
+{
+    if (!dynamic_resolution.enabled)
+        return;
+    if (dynamic_resolution.smoothed_time <= 0)
+    {
+        dynamic_resolution.smoothed_time = render_time;
+    }
+    else
+    {
+        dynamic_resolution.smoothed_time = Lerp(dynamic_resolution.smoothed_time, render_time, DYNAMIC_RESOLUTION_SMOOTHING);
+    }
+    if (dynamic_resolution.cooldown > 0)
+    {
+        --dynamic_resolution.cooldown;
+        return;
+    }
+    double target_frame_time = platform.target_frame_time ? (double)platform.target_frame_time / 1000000.0 : 1000.0 / 60.0;
+    double budget = target_frame_time * DYNAMIC_RESOLUTION_BUDGET;
+    // Raster cost is roughly proportional to pixel count, so the scale moves by the square root of the time ratio
+    float scale = dynamic_resolution.scale;
+    if (dynamic_resolution.smoothed_time > budget * DYNAMIC_RESOLUTION_HIGH_WATER)
+    {
+        scale *= sqrtf(budget / dynamic_resolution.smoothed_time);
+    }
+    else if (dynamic_resolution.smoothed_time < budget * DYNAMIC_RESOLUTION_LOW_WATER)
+    {
+        scale *= Min(DYNAMIC_RESOLUTION_MAX_STEP_UP, sqrtf(budget * (DYNAMIC_RESOLUTION_HIGH_WATER + DYNAMIC_RESOLUTION_LOW_WATER) / 2.f / dynamic_resolution.smoothed_time));
+    }
+    scale = Min(1.f, Max(DYNAMIC_RESOLUTION_MIN_SCALE, scale));
+    if (Absolute(scale - dynamic_resolution.scale) < 0.01f)
+        return;
+    dynamic_resolution.scale = scale;
+    dynamic_resolution.cooldown = DYNAMIC_RESOLUTION_COOLDOWN;
+    DynamicResolutionApply();
 }
 
 void RestartMaze()
 {
+    KPROF_Begin("RestartMaze");
+    SteadyStateReset();
     ai_control = false;
     MazeFree(&maze);
     MazeGeneratePersistentWalk(&maze, &walls, maze_size, maze_size, 5, 2, NULL, &platform);
@@ -568,12 +740,15 @@ void RestartMaze()
             dodecahedron[j].c = dodecahedron[i * 3].c;
         }
     }
+    KPROF_End();
 }
 
 static inline void MainMenuPlay()
 {
     menu_running = false;
     KP_ShowCursor(&platform, false);
+    // Don't turn by however far the mouse moved in the menu
+    KP_RawMouseDelta(&platform, NULL, NULL);
 }
 
 static inline void MainMenuOptions()
@@ -593,6 +768,7 @@ static inline void QuitGame()
 
 static inline void ToggleFullscreen()
 {
+    SteadyStateReset(); // The resize that follows makes a new frame buffer
     KP_Fullscreen(&platform, !platform.fullscreen);
     menus[MENU_OPTIONS].items[0].toggle = platform.fullscreen;
 }
@@ -601,6 +777,7 @@ static inline void ResetInternalResolution()
 {
     internal_resolution = 0;
     auto_launch_menu = true;
+    DynamicResolutionReset();
     ResizeRenderFrame(internal_resolutions[internal_resolution][0], internal_resolutions[internal_resolution][1]);
     MainMenuPlay();
 }
@@ -613,6 +790,7 @@ static inline void InternalResolutionDown()
         return;
     }
     auto_launch_menu = true;
+    DynamicResolutionReset();
     ResizeRenderFrame(internal_resolutions[internal_resolution][0], internal_resolutions[internal_resolution][1]);
     MainMenuPlay();
 }
@@ -625,6 +803,7 @@ static inline void InternalResolutionUp()
         return;
     }
     auto_launch_menu = true;
+    DynamicResolutionReset();
     ResizeRenderFrame(internal_resolutions[internal_resolution][0], internal_resolutions[internal_resolution][1]);
     MainMenuPlay();
 }
@@ -672,15 +851,79 @@ static inline void TitleStart()
     auto_launch_menu = true;
 }
 
-void Menu()
+#define MENU_MAX_DAMAGE_RECTS 8
+#define MENU_MESSAGE_HEIGHT 16
+
+// Parts of the menu that changed since the last present, in menu_frame pixels.
+// The menu only redraws and presents these, and sleeps on the X connection while there are none.
+struct
+{
+    struct
+    {
+        int left, top, right, bottom;
+    } rects[MENU_MAX_DAMAGE_RECTS];
+    int num_rects;
+    bool full;
+} menu_damage;
+
+static inline void MenuDamage(int left, int top, int right, int bottom)
+{
+    if (menu_damage.num_rects == MENU_MAX_DAMAGE_RECTS)
+    {
+        menu_damage.full = true;
+        return;
+    }
+    menu_damage.rects[menu_damage.num_rects].left = left;
+    menu_damage.rects[menu_damage.num_rects].top = top;
+    menu_damage.rects[menu_damage.num_rects].right = right;
+    menu_damage.rects[menu_damage.num_rects].bottom = bottom;
+    ++menu_damage.num_rects;
+}
+
+static inline void MenuDamageItem(int item)
+{
+    menu_item_t *o = &menus[active_menu].items[item];
+    // Item rectangles are drawn inclusive of their bottom right corner
+    MenuDamage(o->a.x, o->a.y, o->b.x + 1, o->b.y + 1);
+}
+
+static inline void MenuDamageMessages(int num_messages)
+{
+    MenuDamage(0, 0, menu_frame.w, num_messages * MENU_MESSAGE_HEIGHT);
+}
+
+// Rebuild the frame buffer inside the given rectangle from the game frame, the menu and the title
+static inline void MenuComposite(int left, int top, int right, int bottom, float frame_scale)
+{
+    float game_scale = Min((float)frame_buffer.h / (float)render_frame.h, (float)frame_buffer.w / (float)render_frame.w);
+    // The menu is blended on top, so the letterbox bars have to be reset as well
+    KS_DrawRectFilled(&frame_buffer, left, top, right - 1, bottom - 1, 0);
+    KS_BlitScaledClipped(&render_frame, &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, game_scale, game_scale, render_frame.w / 2, render_frame.h / 2, left, top, right, bottom);
+    KS_BlitScaledAlpha10Clipped(&menu_frame, &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, frame_scale, frame_scale, menu_frame.w / 2, menu_frame.h / 2, left, top, right, bottom);
+    if (active_menu == MENU_TITLE)
+    {
+        KS_BlitScaledAlpha10Clipped(&textures[14], &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2 - 80 * frame_scale, frame_scale, frame_scale, textures[14].w / 2, textures[14].h / 2, left, top, right, bottom);
+        KS_BlitScaledAlpha10Clipped(&textures[15], &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, frame_scale * 2.f, frame_scale * 2.f, textures[15].w / 2, 0, left, top, right, bottom);
+    }
+}
+
+static void MenuLoop()
 {
+    SteadyStateReset();
     KP_ShowCursor(&platform, true);
     menu_running = true;
     auto_launch_menu = false;
-    vec2_t mouse_pos;
+    vec2_t mouse_pos = {-1, -1};
+    menu_damage.full = true;
+    menu_damage.num_rects = 0;
+    double last_time = KP_Clock();
 
     while (menu_running)
     {
+        // Waiting for events isn't part of a menu frame, so hitches from items like RestartMaze stand out
+        KPROF_Begin("Menu frame");
+        int previous_menu = active_menu;
+        int previous_item = menus[active_menu].active_item;
         while (KP_EventsQueued(&platform))
         {
             kp_event_t *e = KP_NextEvent(&platform);
@@ -690,6 +933,7 @@ void Menu()
             {
                 if (active_menu == MENU_TITLE)
                 {
+                    KPROF_End();
                     TitleStart();
                     return;
                 }
@@ -710,7 +954,9 @@ void Menu()
                     }
                     else
                     {
+                        // Items can change their text, the resolution, the maze or post messages
                         menus[active_menu].items[menus[active_menu].active_item].func();
+                        menu_damage.full = true;
                     }
                 }
                 break;
@@ -757,6 +1003,7 @@ void Menu()
             {
                 if (active_menu == MENU_TITLE)
                 {
+                    KPROF_End();
                     TitleStart();
                     return;
                 }
@@ -769,6 +1016,7 @@ void Menu()
                         if (mouse_pos.x > menus[active_menu].items[i].a.x && mouse_pos.y > menus[active_menu].items[i].a.y && mouse_pos.x < menus[active_menu].items[i].b.x && mouse_pos.y < menus[active_menu].items[i].b.y)
                         {
                             menus[active_menu].items[i].func();
+                            menu_damage.full = true;
                             break;
                         }
                     }
@@ -779,10 +1027,13 @@ void Menu()
             break;
             case KP_EVENT_RESIZE:
             {
-                frame_buffer.pixels = platform.frame_buffer.pixels;
-                frame_buffer.w = platform.frame_buffer.w;
-                frame_buffer.h = platform.frame_buffer.h;
-                KS_SetAllPixels(&frame_buffer, 0x00000000);
+                SyncFrameBuffer();
+                menu_damage.full = true;
+            }
+            break;
+            case KP_EVENT_EXPOSE:
+            {
+                menu_damage.full = true;
             }
             break;
             case KP_EVENT_QUIT:
@@ -791,7 +1042,13 @@ void Menu()
             }
             break;
             }
-            KP_FreeEvent(e);
+        }
+
+        if (!menu_running)
+        {
+            // ESC or an item resumed the game, which draws the next frame itself
+            KPROF_End();
+            break;
         }
 
         float frame_scale = Min((float)frame_buffer.h / (float)menu_frame.h, (float)frame_buffer.w / (float)menu_frame.w);
@@ -800,28 +1057,35 @@ void Menu()
         mouse_pos.y = (platform.mouse.y - (frame_buffer.h - menu_frame.h * frame_scale) / 2) / frame_scale;
         bool mouse_moved = !Vec2Equals(mouse_pos, prev_mouse_pos);
 
-        KS_Clear(&menu_frame);
-        float game_scale = Min((float)frame_buffer.h / (float)render_frame.h, (float)frame_buffer.w / (float)render_frame.w);
-        KS_BlitScaled(&render_frame, &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, game_scale, game_scale, render_frame.w / 2, render_frame.h / 2);
-
-        for (int i = 0; i < menus[active_menu].num_items; ++i)
+        if (mouse_moved)
         {
-            uint32_t rect_col = menus[active_menu].items[i].color;
-            if (mouse_moved && menus[active_menu].items[i].color != menus[active_menu].items[i].highlight_color && mouse_pos.x > menus[active_menu].items[i].a.x && mouse_pos.y > menus[active_menu].items[i].a.y && mouse_pos.x < menus[active_menu].items[i].b.x && mouse_pos.y < menus[active_menu].items[i].b.y)
+            for (int i = 0; i < menus[active_menu].num_items; ++i)
             {
-                menus[active_menu].active_item = i;
-            }
-            if (menus[active_menu].items[i].toggle || i == menus[active_menu].active_item)
-            {
-                rect_col = menus[active_menu].items[i].highlight_color;
+                if (menus[active_menu].items[i].color != menus[active_menu].items[i].highlight_color && mouse_pos.x > menus[active_menu].items[i].a.x && mouse_pos.y > menus[active_menu].items[i].a.y && mouse_pos.x < menus[active_menu].items[i].b.x && mouse_pos.y < menus[active_menu].items[i].b.y)
+                {
+                    menus[active_menu].active_item = i;
+                }
             }
-            KS_DrawRectFilled(&menu_frame, menus[active_menu].items[i].a.x, menus[active_menu].items[i].a.y, menus[active_menu].items[i].b.x, menus[active_menu].items[i].b.y, rect_col);
-            KF_DrawAlpha10(&font, &menu_frame, menus[active_menu].items[i].text_pos.x, menus[active_menu].items[i].text_pos.y, menus[active_menu].items[i].text);
+        }
+        if (active_menu != previous_menu)
+        {
+            menu_damage.full = true;
+        }
+        else if (menus[active_menu].active_item != previous_item)
+        {
+            MenuDamageItem(previous_item);
+            MenuDamageItem(menus[active_menu].active_item);
         }
 
+        // Menu time only moves while messages are showing, so measure it here rather than relying on the frame limiter
+        double time = KP_Clock();
+        float delta = (time - last_time) / 1000.0;
+        last_time = time;
+        int num_messages = top_message;
+        float next_expiry = -1;
         for (int i = 0; i < top_message; ++i)
         {
-            player_messages[i].time -= platform.delta;
+            player_messages[i].time -= delta;
             if (player_messages[i].time < 0)
             {
                 --top_message;
@@ -832,24 +1096,86 @@ void Menu()
                         ;
                 }
             }
-            else
+            else if (next_expiry < 0 || player_messages[i].time < next_expiry)
             {
-                KF_Draw(&font, &menu_frame, 0, i * 16, player_messages[i].text);
+                next_expiry = player_messages[i].time;
             }
         }
+        if (top_message != num_messages)
+        {
+            MenuDamageMessages(num_messages);
+        }
 
-        KS_BlitScaledAlpha10(&menu_frame, &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, frame_scale, frame_scale, menu_frame.w / 2, menu_frame.h / 2);
+        if (!menu_damage.full && !menu_damage.num_rects)
+        {
+            // Nothing to draw until an event arrives or a message times out
+            KPROF_End();
+            KP_WaitForEvents(&platform, next_expiry < 0 ? -1 : (int)(next_expiry * 1000.f) + 1);
+            KP_ResetFrameTimer(&platform);
+            continue;
+        }
 
-        if (active_menu == MENU_TITLE)
+        // The menu frame is small, so it is always redrawn whole
+        KS_Clear(&menu_frame);
+        for (int i = 0; i < menus[active_menu].num_items; ++i)
+        {
+            uint32_t rect_col = menus[active_menu].items[i].color;
+            if (menus[active_menu].items[i].toggle || i == menus[active_menu].active_item)
+            {
+                rect_col = menus[active_menu].items[i].highlight_color;
+            }
+            KS_DrawRectFilled(&menu_frame, menus[active_menu].items[i].a.x, menus[active_menu].items[i].a.y, menus[active_menu].items[i].b.x, menus[active_menu].items[i].b.y, rect_col);
+            KF_DrawAlpha10(&font, &menu_frame, menus[active_menu].items[i].text_pos.x, menus[active_menu].items[i].text_pos.y, menus[active_menu].items[i].text);
+        }
+        for (int i = 0; i < top_message; ++i)
         {
-            KS_BlitScaledAlpha10(&textures[14], &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2 - 80 * frame_scale, frame_scale, frame_scale, textures[14].w / 2, textures[14].h / 2);
-            KS_BlitScaledAlpha10(&textures[15], &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, frame_scale * 2.f, frame_scale * 2.f, textures[15].w / 2, 0);
+            KF_Draw(&font, &menu_frame, 0, i * MENU_MESSAGE_HEIGHT, player_messages[i].text);
         }
 
-        KP_Flip(&platform);
+        // Each present from the thread moves to a buffer holding an older frame
+        if (menu_damage.full || async_present)
+        {
+            MenuComposite(0, 0, frame_buffer.w, frame_buffer.h, frame_scale);
+            KP_Present(&platform);
+        }
+        else
+        {
+            int menu_left = (frame_buffer.w - menu_frame.w * frame_scale) / 2;
+            int menu_top = (frame_buffer.h - menu_frame.h * frame_scale) / 2;
+            for (int i = 0; i < menu_damage.num_rects; ++i)
+            {
+                // Round outwards to whole frame buffer pixels
+                int left = menu_left + (int)(menu_damage.rects[i].left * frame_scale) - 1;
+                int top = menu_top + (int)(menu_damage.rects[i].top * frame_scale) - 1;
+                int right = menu_left + (int)(menu_damage.rects[i].right * frame_scale + 0.999f) + 1;
+                int bottom = menu_top + (int)(menu_damage.rects[i].bottom * frame_scale + 0.999f) + 1;
+                left = Max(left, 0);
+                top = Max(top, 0);
+                right = Min(right, (int)frame_buffer.w);
+                bottom = Min(bottom, (int)frame_buffer.h);
+                if (left < right && top < bottom)
+                {
+                    MenuComposite(left, top, right, bottom, frame_scale);
+                    KP_PresentRect(&platform, left, top, right - left, bottom - top);
+                }
+            }
+        }
+        menu_damage.full = false;
+        menu_damage.num_rects = 0;
+        KPROF_End();
+        KP_LimitFramerate(&platform);
+        SyncFrameBuffer();
     }
 }
 
+// Frames in the menu say nothing about the cost of rendering, so dynamic resolution starts again from full size
+void Menu()
+{
+    MenuLoop();
+    DynamicResolutionReset();
+    DynamicResolutionApply();
+}
+
 static inline void Win()
 {
     active_menu = MENU_WIN;
@@ -879,204 +1205,605 @@ void AITurnFrom(int previous)
     }
 }
 
-void AILoop()
+// Transform and draw everything in the maze to render_frame from cam. depth_buffer must already be cleared.
+void RenderWorld()
 {
-    uint8_t MAZE_CELL_VISITED = 0b10000000;
-    for (int i = 0; i < maze.w * maze.h; ++i)
+    memset(&pipeline_counters, 0, sizeof(pipeline_counters));
+    memset(&k3d_stats, 0, sizeof(k3d_stats));
+#ifdef KERO_3D_DEBUG_OVERDRAW
+    if (overdraw_view)
     {
-        maze.cells[i] &= ~MAZE_CELL_VISITED;
+        K3D_OverdrawStart(render_frame.w, render_frame.h);
     }
-    int *maze_stack = malloc(sizeof(int) * maze.w * maze.h);
-    int maze_stack_top = 0;
-    maze_stack[0] = target_pos.x + target_pos.z * maze.w;
-    maze.cells[target_pos.z * maze.w + target_pos.x] |= MAZE_CELL_VISITED;
-    int active_roll_target = roll_target;
-    while (ai_control && game_running)
+#endif
+    KPROF_Begin("Object->World");
+    int world_it = 0;
+    // Transform dodecahedron faces to world
+    for (int dodec_it = 0; dodec_it < num_dodecahedrons; ++dodec_it)
     {
-        while (KP_EventsQueued(&platform))
+        if (!dodecahedrons[dodec_it].active)
+            continue;
+        for (int f = 0; f < 36; ++f)
         {
-            kp_event_t *e = KP_NextEvent(&platform);
-            switch (e->type)
-            {
-            case KP_EVENT_KEY_PRESS:
+            world_faces[world_it] = K3D_TranslateRotate(dodecahedron[f], dodecahedrons[dodec_it].pos, dodecahedrons[dodec_it].rot);
+            ++world_it;
+        }
+    }
+    // Transform end board faces to world
+    for (int f = 0; f < 2; ++f)
+    {
+        world_faces[world_it] = K3D_TranslateRotate(end_board[f], Vec3Make((float)maze.end.x * maze.cell_size + maze.cell_size / 2, 2.5f, (float)maze.end.y * maze.cell_size + maze.cell_size / 2), Vec3Make(cam.pitch, cam.yaw + PI, 0));
+        ++world_it;
+    }
+    // Copy maze faces to world faces
+    // Copy all maze faces
+    for (int maze_it = 0; maze_it < num_maze_faces; ++maze_it)
+    {
+        world_faces[world_it].v0 = maze_faces[maze_it].v0;
+        world_faces[world_it].v1 = maze_faces[maze_it].v1;
+        world_faces[world_it].v2 = maze_faces[maze_it].v2;
+        world_faces[world_it].c = maze_faces[maze_it].c;
+        world_faces[world_it].flags = maze_faces[maze_it].flags;
+        world_faces[world_it].texture_index = maze_faces[maze_it].texture_index;
+        world_faces[world_it].uv[0].u = maze_faces[maze_it].uv[0].u;
+        world_faces[world_it].uv[1].u = maze_faces[maze_it].uv[1].u;
+        world_faces[world_it].uv[2].u = maze_faces[maze_it].uv[2].u;
+        world_faces[world_it].uv[0].v = maze_faces[maze_it].uv[0].v;
+        world_faces[world_it].uv[1].v = maze_faces[maze_it].uv[1].v;
+        world_faces[world_it].uv[2].v = maze_faces[maze_it].uv[2].v;
+        ++world_it;
+    }
+    /*// Only copy visible faces according to rays
+    for(int maze_it = 0; maze_it < num_maze_faces_to_render; ++maze_it) {
+        world_faces[world_it].v0 = maze_faces[maze_faces_to_render[maze_it]].v0;
+        world_faces[world_it].v1 = maze_faces[maze_faces_to_render[maze_it]].v1;
+        world_faces[world_it].v2 = maze_faces[maze_faces_to_render[maze_it]].v2;
+        world_faces[world_it].c = maze_faces[maze_faces_to_render[maze_it]].c;
+        world_faces[world_it].flags = maze_faces[maze_faces_to_render[maze_it]].flags;
+        world_faces[world_it].texture_index = maze_faces[maze_faces_to_render[maze_it]].texture_index;
+        world_faces[world_it].uv[0].u = maze_faces[maze_faces_to_render[maze_it]].uv[0].u;
+        world_faces[world_it].uv[1].u = maze_faces[maze_faces_to_render[maze_it]].uv[1].u;
+        world_faces[world_it].uv[2].u = maze_faces[maze_faces_to_render[maze_it]].uv[2].u;
+        world_faces[world_it].uv[0].v = maze_faces[maze_faces_to_render[maze_it]].uv[0].v;
+        world_faces[world_it].uv[1].v = maze_faces[maze_faces_to_render[maze_it]].uv[1].v;
+        world_faces[world_it].uv[2].v = maze_faces[maze_faces_to_render[maze_it]].uv[2].v;
+        ++world_it;
+    }*/
+    num_world_faces = world_it;
+    KPROF_End();
+
+    KPROF_Begin("World->Cam");
+    // transform world faces to view space
+    int cam_it = world_it = 0;
+    face_t world_face_trans, world_face_rot, world_face_clipped[2], temp;
+    vec3_t v[4];
+    int num_verts_to_clip, verts_to_clip;
+    for (; world_it < num_world_faces; ++world_it)
+    {
+        if (!world_faces[world_it].flags.double_sided)
+        {
+            // back-face culling
+            vec3_t n = Vec3Norm(Vec3Cross(Vec3AToB(world_faces[world_it].v0, world_faces[world_it].v1), Vec3AToB(world_faces[world_it].v0, world_faces[world_it].v2)));
+            vec3_t poly_to_cam = Vec3AToB(world_faces[world_it].v0, cam.pos);
+            float angle = Vec3Dot(n, poly_to_cam);
+            if (angle <= 0)
             {
-                switch (e->key)
-                {
-                case KEY_ENTER:
-                {
-                    if (platform.keyboard[KEY_RALT] || platform.keyboard[KEY_LALT])
-                    {
-                        ToggleFullscreen();
-                    }
-                }
-                break;
-                case KEY_ESCAPE:
-                {
-                    active_menu = MENU_MAIN;
-                    Menu();
-                    continue;
+                ++pipeline_counters.backface_culled;
+                continue;
+            }
+        }
+        world_face_rot = K3D_CameraTranslateRotate(world_faces[world_it], cam.pos, cam.rot);
+
+        if (world_face_rot.v0.z < NEAR_Z && world_face_rot.v1.z < NEAR_Z && world_face_rot.v2.z < NEAR_Z /* || world_face_rot.v0.z > FAR_Z && world_face_rot.v1.z > FAR_Z && world_face_rot.v2.z > FAR_Z*/)
+        {
+            ++pipeline_counters.near_culled;
+            continue;
+        }
+        // clip on NEAR_Z plane
+        num_verts_to_clip = verts_to_clip = 0;
+        if (world_face_rot.v0.z < NEAR_Z)
+        {
+            ++num_verts_to_clip;
+            verts_to_clip |= 0b1;
+        }
+        if (world_face_rot.v1.z < NEAR_Z)
+        {
+            ++num_verts_to_clip;
+            verts_to_clip |= 0b10;
+        }
+        if (world_face_rot.v2.z < NEAR_Z)
+        {
+            ++num_verts_to_clip;
+            verts_to_clip |= 0b100;
+        }
+        vec2_t uv[4] = {
+            world_face_rot.uv[0].u,
+            world_face_rot.uv[0].v,
+            world_face_rot.uv[1].u,
+            world_face_rot.uv[1].v,
+            world_face_rot.uv[2].u,
+            world_face_rot.uv[2].v,
+        };
+        if (num_verts_to_clip == 0)
+        {
+            // All verts are >= NEAR_Z. No clipping
+            cam_faces[cam_it++] = world_face_rot;
+        }
+        else if (num_verts_to_clip == 1)
+        {
+            ++pipeline_counters.near_clipped_2;
+            if (verts_to_clip == 0b1)
+            { // Clip v0
+                // Distance along v0->v1 where z == NEAR_Z
+                float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v1.z - world_face_rot.v0.z);
+                v[0].x = world_face_rot.v0.x + (world_face_rot.v1.x - world_face_rot.v0.x) * t;
+                v[0].y = world_face_rot.v0.y + (world_face_rot.v1.y - world_face_rot.v0.y) * t;
+                v[0].z = NEAR_Z;
+                uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[1].u - world_face_rot.uv[0].u) * t;
+                uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[1].v - world_face_rot.uv[0].v) * t;
+                // Distance along v0->v2 where z == NEAR_Z
+                t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v2.z - world_face_rot.v0.z);
+                v[3].x = world_face_rot.v0.x + (world_face_rot.v2.x - world_face_rot.v0.x) * t;
+                v[3].y = world_face_rot.v0.y + (world_face_rot.v2.y - world_face_rot.v0.y) * t;
+                v[3].z = NEAR_Z;
+                uv[3].u = world_face_rot.uv[0].u + (world_face_rot.uv[2].u - world_face_rot.uv[0].u) * t;
+                uv[3].v = world_face_rot.uv[0].v + (world_face_rot.uv[2].v - world_face_rot.uv[0].v) * t;
+                v[1] = world_face_rot.v1;
+                v[2] = world_face_rot.v2;
+            }
+            else if (verts_to_clip == 0b10)
+            { // Clip v1
+                // Distance along v1->v2 where z == NEAR_Z
+                float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v2.z - world_face_rot.v1.z);
+                v[0].x = world_face_rot.v1.x + (world_face_rot.v2.x - world_face_rot.v1.x) * t;
+                v[0].y = world_face_rot.v1.y + (world_face_rot.v2.y - world_face_rot.v1.y) * t;
+                v[0].z = NEAR_Z;
+                uv[0].u = world_face_rot.uv[1].u + (world_face_rot.uv[2].u - world_face_rot.uv[1].u) * t;
+                uv[0].v = world_face_rot.uv[1].v + (world_face_rot.uv[2].v - world_face_rot.uv[1].v) * t;
+                // Distance along v1->v0 where z == NEAR_Z
+                t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v0.z - world_face_rot.v1.z);
+                v[3].x = world_face_rot.v1.x + (world_face_rot.v0.x - world_face_rot.v1.x) * t;
+                v[3].y = world_face_rot.v1.y + (world_face_rot.v0.y - world_face_rot.v1.y) * t;
+                v[3].z = NEAR_Z;
+                uv[3].u = world_face_rot.uv[1].u + (world_face_rot.uv[0].u - world_face_rot.uv[1].u) * t;
+                uv[3].v = world_face_rot.uv[1].v + (world_face_rot.uv[0].v - world_face_rot.uv[1].v) * t;
+                v[1] = world_face_rot.v2;
+                v[2] = world_face_rot.v0;
+                uv[1].u = world_face_rot.uv[2].u;
+                uv[2].u = world_face_rot.uv[0].u;
+                uv[1].v = world_face_rot.uv[2].v;
+                uv[2].v = world_face_rot.uv[0].v;
+            }
+            else if (verts_to_clip == 0b100)
+            { // Clip v2
+                // Distance along v2->v0 where z == NEAR_Z
+                float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v0.z - world_face_rot.v2.z);
+                v[0].x = world_face_rot.v2.x + (world_face_rot.v0.x - world_face_rot.v2.x) * t;
+                v[0].y = world_face_rot.v2.y + (world_face_rot.v0.y - world_face_rot.v2.y) * t;
+                v[0].z = NEAR_Z;
+                uv[0].u = world_face_rot.uv[2].u + (world_face_rot.uv[0].u - world_face_rot.uv[2].u) * t;
+                uv[0].v = world_face_rot.uv[2].v + (world_face_rot.uv[0].v - world_face_rot.uv[2].v) * t;
+                // Distance along v2->v1 where z == NEAR_Z
+                t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v1.z - world_face_rot.v2.z);
+                v[3].x = world_face_rot.v2.x + (world_face_rot.v1.x - world_face_rot.v2.x) * t;
+                v[3].y = world_face_rot.v2.y + (world_face_rot.v1.y - world_face_rot.v2.y) * t;
+                v[3].z = NEAR_Z;
+                uv[3].u = world_face_rot.uv[2].u + (world_face_rot.uv[1].u - world_face_rot.uv[2].u) * t;
+                uv[3].v = world_face_rot.uv[2].v + (world_face_rot.uv[1].v - world_face_rot.uv[2].v) * t;
+                v[1] = world_face_rot.v0;
+                v[2] = world_face_rot.v1;
+                uv[1].u = world_face_rot.uv[0].u;
+                uv[2].u = world_face_rot.uv[1].u;
+                uv[1].v = world_face_rot.uv[0].v;
+                uv[2].v = world_face_rot.uv[1].v;
+            }
+            cam_faces[cam_it].c = cam_faces[cam_it + 1].c = world_face_rot.c;
+            cam_faces[cam_it].v0 = v[0];
+            cam_faces[cam_it].v1 = v[1];
+            cam_faces[cam_it].v2 = v[2];
+            cam_faces[cam_it].texture_index = world_face_rot.texture_index;
+            cam_faces[cam_it].c = world_face_rot.c;
+            cam_faces[cam_it].flags = world_face_rot.flags;
+            cam_faces[cam_it].uv[0].u = uv[0].u;
+            cam_faces[cam_it].uv[1].u = uv[1].u;
+            cam_faces[cam_it].uv[2].u = uv[2].u;
+            cam_faces[cam_it].uv[0].v = uv[0].v;
+            cam_faces[cam_it].uv[1].v = uv[1].v;
+            cam_faces[cam_it].uv[2].v = uv[2].v;
+            ++cam_it;
+            cam_faces[cam_it].v0 = v[0];
+            cam_faces[cam_it].v1 = v[2];
+            cam_faces[cam_it].v2 = v[3];
+            cam_faces[cam_it].texture_index = world_face_rot.texture_index;
+            cam_faces[cam_it].c = world_face_rot.c;
+            cam_faces[cam_it].flags = world_face_rot.flags;
+            cam_faces[cam_it].uv[0].u = uv[0].u;
+            cam_faces[cam_it].uv[1].u = uv[2].u;
+            cam_faces[cam_it].uv[2].u = uv[3].u;
+            cam_faces[cam_it].uv[0].v = uv[0].v;
+            cam_faces[cam_it].uv[1].v = uv[2].v;
+            cam_faces[cam_it].uv[2].v = uv[3].v;
+            ++cam_it;
+        }
+        else if (num_verts_to_clip == 2)
+        {
+            ++pipeline_counters.near_clipped_1;
+            if (verts_to_clip & 0b1)
+            { // Clip v0
+                if (verts_to_clip & 0b10)
+                {                                                                                           // v1 will be clipped so use v2
+                    float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v2.z - world_face_rot.v0.z); // Distance along v0->v2 where z == NEAR_Z
+                    v[0].x = world_face_rot.v0.x + (world_face_rot.v2.x - world_face_rot.v0.x) * t;
+                    v[0].y = world_face_rot.v0.y + (world_face_rot.v2.y - world_face_rot.v0.y) * t;
+                    v[0].z = NEAR_Z;
+                    uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[2].u - world_face_rot.uv[0].u) * t;
+                    uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[2].v - world_face_rot.uv[0].v) * t;
                 }
-                break;
+                else
+                {                                                                                           // v2 will be clipped so use v1
+                    float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v1.z - world_face_rot.v0.z); // Distance along v0->v1 where z == NEAR_Z
+                    v[0].x = world_face_rot.v0.x + (world_face_rot.v1.x - world_face_rot.v0.x) * t;
+                    v[0].y = world_face_rot.v0.y + (world_face_rot.v1.y - world_face_rot.v0.y) * t;
+                    v[0].z = NEAR_Z;
+                    uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[1].u - world_face_rot.uv[0].u) * t;
+                    uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[1].v - world_face_rot.uv[0].v) * t;
                 }
             }
-            break;
-            case KP_EVENT_RESIZE:
+            else
             {
-                frame_buffer.pixels = platform.frame_buffer.pixels;
-                frame_buffer.w = platform.frame_buffer.w;
-                frame_buffer.h = platform.frame_buffer.h;
-                KS_SetAllPixels(&frame_buffer, 0x00000000);
+                v[0] = world_face_rot.v0;
             }
-            break;
-            case KP_EVENT_QUIT:
+            if (verts_to_clip & 0b10)
+            { // Clip v1
+                if (verts_to_clip & 0b1)
+                {                                                                                           // v0 will be clipped so use v2
+                    float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v2.z - world_face_rot.v1.z); // Distance along v1->v2 where z == NEAR_Z
+                    v[1].x = world_face_rot.v1.x + (world_face_rot.v2.x - world_face_rot.v1.x) * t;
+                    v[1].y = world_face_rot.v1.y + (world_face_rot.v2.y - world_face_rot.v1.y) * t;
+                    v[1].z = NEAR_Z;
+                    uv[1].u = world_face_rot.uv[1].u + (world_face_rot.uv[2].u - world_face_rot.uv[1].u) * t;
+                    uv[1].v = world_face_rot.uv[1].v + (world_face_rot.uv[2].v - world_face_rot.uv[1].v) * t;
+                }
+                else
+                {                                                                                           // v2 will be clipped so use v0
+                    float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v0.z - world_face_rot.v1.z); // Distance along v1->v0 where z == NEAR_Z
+                    v[1].x = world_face_rot.v1.x + (world_face_rot.v0.x - world_face_rot.v1.x) * t;
+                    v[1].y = world_face_rot.v1.y + (world_face_rot.v0.y - world_face_rot.v1.y) * t;
+                    v[1].z = NEAR_Z;
+                    uv[1].u = world_face_rot.uv[1].u + (world_face_rot.uv[0].u - world_face_rot.uv[1].u) * t;
+                    uv[1].v = world_face_rot.uv[1].v + (world_face_rot.uv[0].v - world_face_rot.uv[1].v) * t;
+                }
+            }
+            else
             {
-                exit(0);
+                v[1] = world_face_rot.v1;
             }
-            break;
+            if (verts_to_clip & 0b100)
+            { // Clip v2
+                if (verts_to_clip & 0b1)
+                {                                                                                           // v0 will be clipped so use v1
+                    float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v1.z - world_face_rot.v2.z); // Distance along v2->v1 where z == NEAR_Z
+                    v[2].x = world_face_rot.v2.x + (world_face_rot.v1.x - world_face_rot.v2.x) * t;
+                    v[2].y = world_face_rot.v2.y + (world_face_rot.v1.y - world_face_rot.v2.y) * t;
+                    v[2].z = NEAR_Z;
+                    uv[2].u = world_face_rot.uv[2].u + (world_face_rot.uv[1].u - world_face_rot.uv[2].u) * t;
+                    uv[2].v = world_face_rot.uv[2].v + (world_face_rot.uv[1].v - world_face_rot.uv[2].v) * t;
+                }
+                else
+                {                                                                                           // v2 will be clipped so use v0
+                    float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v0.z - world_face_rot.v2.z); // Distance along v1->v0 where z == NEAR_Z
+                    v[2].x = world_face_rot.v2.x + (world_face_rot.v0.x - world_face_rot.v2.x) * t;
+                    v[2].y = world_face_rot.v2.y + (world_face_rot.v0.y - world_face_rot.v2.y) * t;
+                    v[2].z = NEAR_Z;
+                    uv[2].u = world_face_rot.uv[2].u + (world_face_rot.uv[0].u - world_face_rot.uv[2].u) * t;
+                    uv[2].v = world_face_rot.uv[2].v + (world_face_rot.uv[0].v - world_face_rot.uv[2].v) * t;
+                }
             }
-            KP_FreeEvent(e);
+            else
+            {
+                v[2] = world_face_rot.v2;
+            }
+            cam_faces[cam_it].v0 = v[0];
+            cam_faces[cam_it].v1 = v[1];
+            cam_faces[cam_it].v2 = v[2];
+            cam_faces[cam_it].c = world_face_rot.c;
+            cam_faces[cam_it].flags = world_face_rot.flags;
+            cam_faces[cam_it].texture_index = world_face_rot.texture_index;
+            cam_faces[cam_it].uv[0].u = uv[0].u;
+            cam_faces[cam_it].uv[1].u = uv[1].u;
+            cam_faces[cam_it].uv[2].u = uv[2].u;
+            cam_faces[cam_it].uv[0].v = uv[0].v;
+            cam_faces[cam_it].uv[1].v = uv[1].v;
+            cam_faces[cam_it].uv[2].v = uv[2].v;
+            ++cam_it;
         }
+        else
+        { // Should have already clipped this before so fail assertion.
+            assert(false);
+        }
+    }
+    num_cam_faces = cam_it;
+    KPROF_End();
 
-        if (Absolute(target_pos.x * maze.cell_size + maze.cell_size / 2.f - cam.pos.x) < 0.1f && Absolute(target_pos.z * maze.cell_size + maze.cell_size / 2.f - cam.pos.z) < 0.1f)
+    KPROF_Begin("Cam->View");
+    int view_it = cam_it = 0;
+    // transform view verts to screen space
+    for (; view_it < num_cam_faces; ++view_it, ++cam_it)
+    {
+        for (int v = 0; v < 3; ++v)
         {
-            if (target_pos.x == maze.end.x && target_pos.z == maze.end.y)
-            {
-                // Win
-                ai_control = false;
-                menus[MENU_MAIN].items[3].toggle = ai_control;
-                free(maze_stack);
-                Win();
-                return;
-            }
-            ai.time += AI_TIME_PER_MOVE;
-            bool moved = false;
-            float siny = sin((float)turn_target * HALFPI);
-            float cosy = cos((float)turn_target * HALFPI);
-            float rsiny = sin((float)(turn_target - 1) * HALFPI);
-            float rcosy = cos((float)(turn_target - 1) * HALFPI);
-
-            int dx = Absolute(cosy) > 0.1f ? Sign(cosy) : 0;
-            int dz = Absolute(siny) > 0.1f ? Sign(siny) : 0;
-            int rdx = Absolute(rcosy) > 0.1f ? Sign(rcosy) : 0;
-            int rdz = Absolute(rsiny) > 0.1f ? Sign(rsiny) : 0;
-
-            int current_cell = target_pos.x + target_pos.z * maze.w;
-            int right_cell = target_pos.x + 1 + target_pos.z * maze.w;
-            int forward_cell = target_pos.x + (target_pos.z + 1) * maze.w;
-            int left_cell = target_pos.x - 1 + target_pos.z * maze.w;
-            int back_cell = target_pos.x + (target_pos.z - 1) * maze.w;
-
-            bool cango_right = target_pos.x < maze.w - 1 && maze.cells[current_cell] & MAZE_RIGHT;
-            bool cango_left = target_pos.x > 0 && maze.cells[current_cell] & MAZE_LEFT;
-            bool cango_forward = target_pos.z < maze.h - 1 && maze.cells[current_cell] & MAZE_UP;
-            bool cango_back = target_pos.z > 0 && maze.cells[current_cell] & MAZE_DOWN;
-
-            int initial_turn_target = turn_target;
-            for (int direction_attempts = 0; !moved && direction_attempts < 4; ++direction_attempts)
-            {
-                turn_target = (initial_turn_target + direction_attempts) % 4;
-                switch (turn_target)
-                {
-                case 0:
-                { // Right
-                    if (cango_back && !(maze.cells[back_cell] & MAZE_CELL_VISITED))
-                    {
-                        moved = true;
-                        --target_pos.z;
-                        maze.cells[back_cell] |= MAZE_CELL_VISITED;
-                        turn_target = 1;
-                    }
-                    else if (cango_right && !(maze.cells[right_cell] & MAZE_CELL_VISITED))
-                    {
-                        moved = true;
-                        ++target_pos.x;
-                        maze.cells[right_cell] |= MAZE_CELL_VISITED;
-                    }
-                }
-                break;
-                case 1:
-                { // Back
-                    if (cango_left && !(maze.cells[left_cell] & MAZE_CELL_VISITED))
-                    {
-                        moved = true;
-                        --target_pos.x;
-                        maze.cells[left_cell] |= MAZE_CELL_VISITED;
-                        turn_target = 2;
-                    }
-                    else if (cango_back && !(maze.cells[back_cell] & MAZE_CELL_VISITED))
-                    {
-                        moved = true;
-                        --target_pos.z;
-                        maze.cells[back_cell] |= MAZE_CELL_VISITED;
-                    }
-                }
-                break;
-                case 2:
-                { // Left
-                    if (cango_forward && !(maze.cells[forward_cell] & MAZE_CELL_VISITED))
-                    {
-                        moved = true;
-                        ++target_pos.z;
-                        maze.cells[forward_cell] |= MAZE_CELL_VISITED;
-                        turn_target = 3;
-                    }
-                    else if (cango_left && !(maze.cells[left_cell] & MAZE_CELL_VISITED))
+            view_faces[view_it].v[v].x = (cam_faces[cam_it].v[v].x / cam_faces[cam_it].v[v].z + 1) * internal_resolution_width / 2;
+            view_faces[view_it].v[v].y = (aspect_ratio * -cam_faces[cam_it].v[v].y / cam_faces[cam_it].v[v].z + 1) * internal_resolution_height / 2;
+            view_faces[view_it].v[v].z = NEAR_Z / cam_faces[cam_it].v[v].z;
+        }
+        view_faces[view_it].c = cam_faces[cam_it].c;
+        view_faces[view_it].flags = cam_faces[cam_it].flags;
+        view_faces[view_it].texture_index = cam_faces[cam_it].texture_index;
+        view_faces[view_it].uv[0].u = cam_faces[cam_it].uv[0].u / cam_faces[cam_it].v0.z;
+        view_faces[view_it].uv[1].u = cam_faces[cam_it].uv[1].u / cam_faces[cam_it].v1.z;
+        view_faces[view_it].uv[2].u = cam_faces[cam_it].uv[2].u / cam_faces[cam_it].v2.z;
+        view_faces[view_it].uv[0].v = cam_faces[cam_it].uv[0].v / cam_faces[cam_it].v0.z;
+        view_faces[view_it].uv[1].v = cam_faces[cam_it].uv[1].v / cam_faces[cam_it].v1.z;
+        view_faces[view_it].uv[2].v = cam_faces[cam_it].uv[2].v / cam_faces[cam_it].v2.z;
+    }
+    num_view_faces = view_it;
+    KPROF_End();
+
+    KPROF_Begin("View->Screen");
+    // render wireframe to screen
+    for (int i = 0; i < num_view_faces; ++i)
+    {
+        // K3D_DrawTriangleWire(&frame_buffer, view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].c);
+        vec3_t *v = view_faces[i].v;
+        if (Max(v[0].x, Max(v[1].x, v[2].x)) < 0 || Min(v[0].x, Min(v[1].x, v[2].x)) >= internal_resolution_width || Max(v[0].y, Max(v[1].y, v[2].y)) < 0 || Min(v[0].y, Min(v[1].y, v[2].y)) >= internal_resolution_height)
+        {
+            ++pipeline_counters.offscreen;
+        }
+        if (view_faces[i].texture_index < MAX_TEXTURES)
+        {
+            K3D_DrawTriangleTextured(&render_frame, depth_buffer, &textures[view_faces[i].texture_index], view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].uv);
+        }
+        else
+        {
+            K3D_DrawTriangle(&render_frame, depth_buffer, view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].c);
+        }
+        // KS_DrawTriangle(&frame_buffer, view_faces[i].v0.x, view_faces[i].v0.y, view_faces[i].v1.x, view_faces[i].v1.y, view_faces[i].v2.x, view_faces[i].v2.y, view_faces[i].c);
+        // K3D_DrawTrianglef(&frame_buffer, view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].c);
+        /*KS_DrawLine(&frame_buffer, view_faces[i].v0.x, view_faces[i].v0.y, view_faces[i].v1.x, view_faces[i].v1.y, view_faces[i].c, KSSetPixel);
+        KS_DrawLine(&frame_buffer, view_faces[i].v1.x, view_faces[i].v1.y, view_faces[i].v2.x, view_faces[i].v2.y, view_faces[i].c, KSSetPixel);
+        KS_DrawLine(&frame_buffer, view_faces[i].v2.x, view_faces[i].v2.y, view_faces[i].v0.x, view_faces[i].v0.y, view_faces[i].c, KSSetPixel);*/
+    }
+    KPROF_End();
+#ifdef KERO_3D_DEBUG_OVERDRAW
+    if (overdraw_view)
+    {
+        K3D_OverdrawStop();
+        K3D_OverdrawHeatmap(&render_frame, overdraw_view - 1);
+    }
+#endif
+}
+
+// Move target_pos one cell along the AI's wall following walk, backtracking through maze_stack at dead ends
+void AIStep(int *maze_stack, int *maze_stack_top, uint64_t *visited)
+{
+    bool moved = false;
+    float siny = sin((float)turn_target * HALFPI);
+    float cosy = cos((float)turn_target * HALFPI);
+    float rsiny = sin((float)(turn_target - 1) * HALFPI);
+    float rcosy = cos((float)(turn_target - 1) * HALFPI);
+
+    int dx = Absolute(cosy) > 0.1f ? Sign(cosy) : 0;
+    int dz = Absolute(siny) > 0.1f ? Sign(siny) : 0;
+    int rdx = Absolute(rcosy) > 0.1f ? Sign(rcosy) : 0;
+    int rdz = Absolute(rsiny) > 0.1f ? Sign(rsiny) : 0;
+
+    int right_cell = target_pos.x + 1 + target_pos.z * maze.w;
+    int forward_cell = target_pos.x + (target_pos.z + 1) * maze.w;
+    int left_cell = target_pos.x - 1 + target_pos.z * maze.w;
+    int back_cell = target_pos.x + (target_pos.z - 1) * maze.w;
+
+    uint8_t current = MazeCell(&maze, target_pos.x, target_pos.z);
+    bool cango_right = target_pos.x < maze.w - 1 && current & MAZE_RIGHT;
+    bool cango_left = target_pos.x > 0 && current & MAZE_LEFT;
+    bool cango_forward = target_pos.z < maze.h - 1 && current & MAZE_UP;
+    bool cango_back = target_pos.z > 0 && current & MAZE_DOWN;
+
+    int initial_turn_target = turn_target;
+    for (int direction_attempts = 0; !moved && direction_attempts < 4; ++direction_attempts)
+    {
+        turn_target = (initial_turn_target + direction_attempts) % 4;
+        switch (turn_target)
+        {
+        case 0:
+        { // Right
+            if (cango_back && !MazeBitGet(visited, back_cell))
+            {
+                moved = true;
+                --target_pos.z;
+                MazeBitSet(visited, back_cell);
+                turn_target = 1;
+            }
+            else if (cango_right && !MazeBitGet(visited, right_cell))
+            {
+                moved = true;
+                ++target_pos.x;
+                MazeBitSet(visited, right_cell);
+            }
+        }
+        break;
+        case 1:
+        { // Back
+            if (cango_left && !MazeBitGet(visited, left_cell))
+            {
+                moved = true;
+                --target_pos.x;
+                MazeBitSet(visited, left_cell);
+                turn_target = 2;
+            }
+            else if (cango_back && !MazeBitGet(visited, back_cell))
+            {
+                moved = true;
+                --target_pos.z;
+                MazeBitSet(visited, back_cell);
+            }
+        }
+        break;
+        case 2:
+        { // Left
+            if (cango_forward && !MazeBitGet(visited, forward_cell))
+            {
+                moved = true;
+                ++target_pos.z;
+                MazeBitSet(visited, forward_cell);
+                turn_target = 3;
+            }
+            else if (cango_left && !MazeBitGet(visited, left_cell))
+            {
+                moved = true;
+                --target_pos.x;
+                MazeBitSet(visited, left_cell);
+            }
+        }
+        break;
+        case 3:
+        { // Forward
+            if (cango_right && !MazeBitGet(visited, right_cell))
+            {
+                moved = true;
+                ++target_pos.x;
+                MazeBitSet(visited, right_cell);
+                turn_target = 0;
+            }
+            else if (cango_forward && !MazeBitGet(visited, forward_cell))
+            {
+                moved = true;
+                ++target_pos.z;
+                MazeBitSet(visited, forward_cell);
+            }
+        }
+        break;
+        }
+    }
+    if (moved)
+    {
+        int new_cell = target_pos.x + target_pos.z * maze.w;
+        maze_stack[++*maze_stack_top] = new_cell;
+    }
+    else
+    {
+        --*maze_stack_top;
+        int oldx = target_pos.x;
+        int oldz = target_pos.z;
+        target_pos.z = maze_stack[*maze_stack_top] / maze.w;
+        target_pos.x = maze_stack[*maze_stack_top] - target_pos.z * maze.w;
+        if (oldx < target_pos.x)
+        {
+            turn_target = turn_target = 0;
+        }
+        else if (oldx > target_pos.x)
+        {
+            turn_target = turn_target = 2;
+        }
+        else if (oldz < target_pos.z)
+        {
+            turn_target = turn_target = 3;
+        }
+        else if (oldz > target_pos.z)
+        {
+            turn_target = turn_target = 1;
+        }
+    }
+    AITurnFrom(initial_turn_target);
+}
+
+// After the Frame zone of the main loop or AILoop() has closed
+void FrameEnd()
+{
+    profile_pixels = k3d_stats.pixels_tested;
+    if (++steady_frames == STEADY_STATE_FRAMES && alloc_guard)
+    {
+        KPROF_AllocGuard(alloc_guard);
+    }
+    current_profile_frame = (current_profile_frame + 1) % MAX_PROFILE_FRAMES;
+    kprof_frame_t frame;
+    if (KPROF_LastFrame(&frame) && frame.num_zones > 1)
+    {
+        // Everything up to the end of presenting, not the wait for the next frame
+        DynamicResolutionUpdate((frame.zones[frame.num_zones - 1].start - frame.zone.start) / 1e6);
+    }
+}
+
+void AILoop()
+{
+    uint64_t *visited = MazeBitsCreate(maze.w * maze.h);
+    int *maze_stack = malloc(sizeof(int) * maze.w * maze.h);
+    int maze_stack_top = 0;
+    maze_stack[0] = target_pos.x + target_pos.z * maze.w;
+    MazeBitSet(visited, maze_stack[0]);
+    int active_roll_target = roll_target;
+    bool won = false;
+    while (ai_control && game_running)
+    {
+        KPROF_Begin("Frame");
+        KPROF_Begin("Inputs");
+        // Once the menu is asked for, it reads the rest of the events itself
+        while (!auto_launch_menu && GameEventsQueued())
+        {
+            kp_event_t *e = KP_NextEvent(&platform);
+            switch (e->type)
+            {
+            case KP_EVENT_KEY_PRESS:
+            {
+                switch (e->key)
+                {
+                case KEY_ENTER:
+                {
+                    if (platform.keyboard[KEY_RALT] || platform.keyboard[KEY_LALT])
                     {
-                        moved = true;
-                        --target_pos.x;
-                        maze.cells[left_cell] |= MAZE_CELL_VISITED;
+                        ToggleFullscreen();
                     }
                 }
                 break;
-                case 3:
-                { // Forward
-                    if (cango_right && !(maze.cells[right_cell] & MAZE_CELL_VISITED))
-                    {
-                        moved = true;
-                        ++target_pos.x;
-                        maze.cells[right_cell] |= MAZE_CELL_VISITED;
-                        turn_target = 0;
-                    }
-                    else if (cango_forward && !(maze.cells[forward_cell] & MAZE_CELL_VISITED))
-                    {
-                        moved = true;
-                        ++target_pos.z;
-                        maze.cells[forward_cell] |= MAZE_CELL_VISITED;
-                    }
+                case KEY_ESCAPE:
+                {
+                    active_menu = MENU_MAIN;
+                    auto_launch_menu = true;
                 }
                 break;
                 }
             }
-            if (moved)
+            break;
+            case KP_EVENT_RESIZE:
             {
-                int new_cell = target_pos.x + target_pos.z * maze.w;
-                maze_stack[++maze_stack_top] = new_cell;
+                SteadyStateReset(); // Presenting may reallocate for the new size too
+                SyncFrameBuffer();
+                KS_SetAllPixels(&frame_buffer, 0x00000000);
+            }
+            break;
+            case KP_EVENT_QUIT:
+            {
+                exit(0);
+            }
+            break;
+            }
+        }
+
+        if (Absolute(target_pos.x * maze.cell_size + maze.cell_size / 2.f - cam.pos.x) < 0.1f && Absolute(target_pos.z * maze.cell_size + maze.cell_size / 2.f - cam.pos.z) < 0.1f)
+        {
+            if (target_pos.x == maze.end.x && target_pos.z == maze.end.y)
+            {
+                // Win, once this frame is finished
+                won = true;
+                ai_control = false;
+                menus[MENU_MAIN].items[3].toggle = ai_control;
+                active_menu = MENU_WIN;
+                auto_launch_menu = true;
             }
             else
             {
-                --maze_stack_top;
-                int oldx = target_pos.x;
-                int oldz = target_pos.z;
-                target_pos.z = maze_stack[maze_stack_top] / maze.w;
-                target_pos.x = maze_stack[maze_stack_top] - target_pos.z * maze.w;
-                if (oldx < target_pos.x)
-                {
-                    turn_target = turn_target = 0;
-                }
-                else if (oldx > target_pos.x)
-                {
-                    turn_target = turn_target = 2;
-                }
-                else if (oldz < target_pos.z)
-                {
-                    turn_target = turn_target = 3;
-                }
-                else if (oldz > target_pos.z)
-                {
-                    turn_target = turn_target = 1;
-                }
+                ai.time += AI_TIME_PER_MOVE;
+                AIStep(maze_stack, &maze_stack_top, visited);
             }
-            AITurnFrom(initial_turn_target);
         }
 
 #define AI_LERP 10.f
@@ -1137,334 +1864,38 @@ void AILoop()
             dodecahedrons[i].rot.V[i % 3] += platform.delta;
         }
 
-        KS_Clear(&frame_buffer);
-        memset(depth_buffer, 0, internal_resolution_width * internal_resolution_height * sizeof(float));
+        KPROF_End();
 
-        int world_it = 0;
-        // Transform dodecahedron faces to world
-        for (int dodec_it = 0; dodec_it < num_dodecahedrons; ++dodec_it)
+        UpdateBackgroundThrottle();
+        if (!platform.visible)
         {
-            if (!dodecahedrons[dodec_it].active)
-                continue;
-            for (int f = 0; f < 36; ++f)
+            // Nothing drawn would be seen, so just keep the AI walking
+            KPROF_End();
+            KP_LimitFramerate(&platform);
+            if (auto_launch_menu)
             {
-                world_faces[world_it] = K3D_TranslateRotate(dodecahedron[f], dodecahedrons[dodec_it].pos, dodecahedrons[dodec_it].rot);
-                ++world_it;
+                Menu();
             }
-        }
-        // Transform end board faces to world
-        for (int f = 0; f < 2; ++f)
-        {
-            if (end_board[f].texture_index > 15)
+            if (won)
             {
-                printf("end_board[%d].texture_index = %d\n", f, end_board[f].texture_index);
-                exit(-1);
+                break;
             }
-            world_faces[world_it] = K3D_TranslateRotate(end_board[f], Vec3Make((float)maze.end.x * maze.cell_size + maze.cell_size / 2, 2.5f, (float)maze.end.y * maze.cell_size + maze.cell_size / 2), Vec3Make(cam.pitch, cam.yaw + PI, 0));
-            ++world_it;
-        }
-        // Copy maze faces to world faces
-        // Copy all maze faces
-        for (int maze_it = 0; maze_it < num_maze_faces; ++maze_it)
-        {
-            if (maze_faces[maze_it].texture_index > 15)
-            {
-                printf("maze_faces[%d].texture_index = %d\n", maze_it, maze_faces[maze_it].texture_index);
-                exit(-1);
-            }
-            world_faces[world_it].v0 = maze_faces[maze_it].v0;
-            world_faces[world_it].v1 = maze_faces[maze_it].v1;
-            world_faces[world_it].v2 = maze_faces[maze_it].v2;
-            world_faces[world_it].c = maze_faces[maze_it].c;
-            world_faces[world_it].flags = maze_faces[maze_it].flags;
-            world_faces[world_it].texture_index = maze_faces[maze_it].texture_index;
-            world_faces[world_it].uv[0].u = maze_faces[maze_it].uv[0].u;
-            world_faces[world_it].uv[1].u = maze_faces[maze_it].uv[1].u;
-            world_faces[world_it].uv[2].u = maze_faces[maze_it].uv[2].u;
-            world_faces[world_it].uv[0].v = maze_faces[maze_it].uv[0].v;
-            world_faces[world_it].uv[1].v = maze_faces[maze_it].uv[1].v;
-            world_faces[world_it].uv[2].v = maze_faces[maze_it].uv[2].v;
-            ++world_it;
+            continue;
         }
-        num_world_faces = world_it;
-        ProfileTime("Object->World");
 
-        // transform world faces to view space
-        int cam_it = world_it = 0;
-        face_t world_face_trans, world_face_rot, world_face_clipped[2], temp;
-        vec3_t v[4];
-        int num_verts_to_clip, verts_to_clip;
-        for (; world_it < num_world_faces; ++world_it)
-        {
-            if (!world_faces[world_it].flags.double_sided)
-            {
-                // back-face culling
-                vec3_t n = Vec3Norm(Vec3Cross(Vec3AToB(world_faces[world_it].v0, world_faces[world_it].v1), Vec3AToB(world_faces[world_it].v0, world_faces[world_it].v2)));
-                vec3_t poly_to_cam = Vec3AToB(world_faces[world_it].v0, cam.pos);
-                float angle = Vec3Dot(n, poly_to_cam);
-                if (angle <= 0)
-                    continue;
-            }
-            world_face_rot = K3D_CameraTranslateRotate(world_faces[world_it], cam.pos, cam.rot);
-
-            if (world_face_rot.v0.z < NEAR_Z && world_face_rot.v1.z < NEAR_Z && world_face_rot.v2.z < NEAR_Z)
-                continue;
-            // clip on NEAR_Z plane
-            num_verts_to_clip = verts_to_clip = 0;
-            if (world_face_rot.v0.z < NEAR_Z)
-            {
-                ++num_verts_to_clip;
-                verts_to_clip |= 0b1;
-            }
-            if (world_face_rot.v1.z < NEAR_Z)
-            {
-                ++num_verts_to_clip;
-                verts_to_clip |= 0b10;
-            }
-            if (world_face_rot.v2.z < NEAR_Z)
-            {
-                ++num_verts_to_clip;
-                verts_to_clip |= 0b100;
-            }
-            vec2_t uv[4] = {
-                world_face_rot.uv[0].u, world_face_rot.uv[0].v, world_face_rot.uv[1].u, world_face_rot.uv[1].v, world_face_rot.uv[2].u, world_face_rot.uv[2].v,
-                0, 0};
-            if (num_verts_to_clip == 0)
-            {
-                // All verts are >= NEAR_Z. No clipping
-                cam_faces[cam_it++] = world_face_rot;
-            }
-            else if (num_verts_to_clip == 1)
-            {
-                if (verts_to_clip == 0b1)
-                { // Clip v0
-                    // Distance along v0->v1 where z == NEAR_Z
-                    float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v1.z - world_face_rot.v0.z);
-                    v[0].x = world_face_rot.v0.x + (world_face_rot.v1.x - world_face_rot.v0.x) * t;
-                    v[0].y = world_face_rot.v0.y + (world_face_rot.v1.y - world_face_rot.v0.y) * t;
-                    v[0].z = NEAR_Z;
-                    uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[1].u - world_face_rot.uv[0].u) * t;
-                    uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[1].v - world_face_rot.uv[0].v) * t;
-                    // Distance along v0->v2 where z == NEAR_Z
-                    t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v2.z - world_face_rot.v0.z);
-                    v[3].x = world_face_rot.v0.x + (world_face_rot.v2.x - world_face_rot.v0.x) * t;
-                    v[3].y = world_face_rot.v0.y + (world_face_rot.v2.y - world_face_rot.v0.y) * t;
-                    v[3].z = NEAR_Z;
-                    uv[3].u = world_face_rot.uv[0].u + (world_face_rot.uv[2].u - world_face_rot.uv[0].u) * t;
-                    uv[3].v = world_face_rot.uv[0].v + (world_face_rot.uv[2].v - world_face_rot.uv[0].v) * t;
-                    v[1] = world_face_rot.v1;
-                    v[2] = world_face_rot.v2;
-                }
-                else if (verts_to_clip == 0b10)
-                { // Clip v1
-                    // Distance along v1->v2 where z == NEAR_Z
-                    float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v2.z - world_face_rot.v1.z);
-                    v[0].x = world_face_rot.v1.x + (world_face_rot.v2.x - world_face_rot.v1.x) * t;
-                    v[0].y = world_face_rot.v1.y + (world_face_rot.v2.y - world_face_rot.v1.y) * t;
-                    v[0].z = NEAR_Z;
-                    uv[0].u = world_face_rot.uv[1].u + (world_face_rot.uv[2].u - world_face_rot.uv[1].u) * t;
-                    uv[0].v = world_face_rot.uv[1].v + (world_face_rot.uv[2].v - world_face_rot.uv[1].v) * t;
-                    // Distance along v1->v0 where z == NEAR_Z
-                    t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v0.z - world_face_rot.v1.z);
-                    v[3].x = world_face_rot.v1.x + (world_face_rot.v0.x - world_face_rot.v1.x) * t;
-                    v[3].y = world_face_rot.v1.y + (world_face_rot.v0.y - world_face_rot.v1.y) * t;
-                    v[3].z = NEAR_Z;
-                    uv[3].u = world_face_rot.uv[1].u + (world_face_rot.uv[0].u - world_face_rot.uv[1].u) * t;
-                    uv[3].v = world_face_rot.uv[1].v + (world_face_rot.uv[0].v - world_face_rot.uv[1].v) * t;
-                    v[1] = world_face_rot.v2;
-                    v[2] = world_face_rot.v0;
-                    uv[1].u = world_face_rot.uv[2].u;
-                    uv[2].u = world_face_rot.uv[0].u;
-                    uv[1].v = world_face_rot.uv[2].v;
-                    uv[2].v = world_face_rot.uv[0].v;
-                }
-                else if (verts_to_clip == 0b100)
-                { // Clip v2
-                    // Distance along v2->v0 where z == NEAR_Z
-                    float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v0.z - world_face_rot.v2.z);
-                    v[0].x = world_face_rot.v2.x + (world_face_rot.v0.x - world_face_rot.v2.x) * t;
-                    v[0].y = world_face_rot.v2.y + (world_face_rot.v0.y - world_face_rot.v2.y) * t;
-                    v[0].z = NEAR_Z;
-                    uv[0].u = world_face_rot.uv[2].u + (world_face_rot.uv[0].u - world_face_rot.uv[2].u) * t;
-                    uv[0].v = world_face_rot.uv[2].v + (world_face_rot.uv[0].v - world_face_rot.uv[2].v) * t;
-                    // Distance along v2->v1 where z == NEAR_Z
-                    t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v1.z - world_face_rot.v2.z);
-                    v[3].x = world_face_rot.v2.x + (world_face_rot.v1.x - world_face_rot.v2.x) * t;
-                    v[3].y = world_face_rot.v2.y + (world_face_rot.v1.y - world_face_rot.v2.y) * t;
-                    v[3].z = NEAR_Z;
-                    uv[3].u = world_face_rot.uv[2].u + (world_face_rot.uv[1].u - world_face_rot.uv[2].u) * t;
-                    uv[3].v = world_face_rot.uv[2].v + (world_face_rot.uv[1].v - world_face_rot.uv[2].v) * t;
-                    v[1] = world_face_rot.v0;
-                    v[2] = world_face_rot.v1;
-                    uv[1].u = world_face_rot.uv[0].u;
-                    uv[2].u = world_face_rot.uv[1].u;
-                    uv[1].v = world_face_rot.uv[0].v;
-                    uv[2].v = world_face_rot.uv[1].v;
-                }
-                cam_faces[cam_it].c = cam_faces[cam_it + 1].c = world_face_rot.c;
-                cam_faces[cam_it].v0 = v[0];
-                cam_faces[cam_it].v1 = v[1];
-                cam_faces[cam_it].v2 = v[2];
-                cam_faces[cam_it].texture_index = world_face_rot.texture_index;
-                cam_faces[cam_it].c = world_face_rot.c;
-                cam_faces[cam_it].flags = world_face_rot.flags;
-                cam_faces[cam_it].uv[0].u = uv[0].u;
-                cam_faces[cam_it].uv[1].u = uv[1].u;
-                cam_faces[cam_it].uv[2].u = uv[2].u;
-                cam_faces[cam_it].uv[0].v = uv[0].v;
-                cam_faces[cam_it].uv[1].v = uv[1].v;
-                cam_faces[cam_it].uv[2].v = uv[2].v;
-                ++cam_it;
-                cam_faces[cam_it].v0 = v[0];
-                cam_faces[cam_it].v1 = v[2];
-                cam_faces[cam_it].v2 = v[3];
-                cam_faces[cam_it].texture_index = world_face_rot.texture_index;
-                cam_faces[cam_it].c = world_face_rot.c;
-                cam_faces[cam_it].flags = world_face_rot.flags;
-                cam_faces[cam_it].uv[0].u = uv[0].u;
-                cam_faces[cam_it].uv[1].u = uv[2].u;
-                cam_faces[cam_it].uv[2].u = uv[3].u;
-                cam_faces[cam_it].uv[0].v = uv[0].v;
-                cam_faces[cam_it].uv[1].v = uv[2].v;
-                cam_faces[cam_it].uv[2].v = uv[3].v;
-                ++cam_it;
-            }
-            else if (num_verts_to_clip == 2)
-            {
-                if (verts_to_clip & 0b1)
-                { // Clip v0
-                    if (verts_to_clip & 0b10)
-                    {                                                                                           // v1 will be clipped so use v2
-                        float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v2.z - world_face_rot.v0.z); // Distance along v0->v2 where z == NEAR_Z
-                        v[0].x = world_face_rot.v0.x + (world_face_rot.v2.x - world_face_rot.v0.x) * t;
-                        v[0].y = world_face_rot.v0.y + (world_face_rot.v2.y - world_face_rot.v0.y) * t;
-                        v[0].z = NEAR_Z;
-                        uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[2].u - world_face_rot.uv[0].u) * t;
-                        uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[2].v - world_face_rot.uv[0].v) * t;
-                    }
-                    else
-                    {                                                                                           // v2 will be clipped so use v1
-                        float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v1.z - world_face_rot.v0.z); // Distance along v0->v1 where z == NEAR_Z
-                        v[0].x = world_face_rot.v0.x + (world_face_rot.v1.x - world_face_rot.v0.x) * t;
-                        v[0].y = world_face_rot.v0.y + (world_face_rot.v1.y - world_face_rot.v0.y) * t;
-                        v[0].z = NEAR_Z;
-                        uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[1].u - world_face_rot.uv[0].u) * t;
-                        uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[1].v - world_face_rot.uv[0].v) * t;
-                    }
-                }
-                else
-                {
-                    v[0] = world_face_rot.v0;
-                }
-                if (verts_to_clip & 0b10)
-                { // Clip v1
-                    if (verts_to_clip & 0b1)
-                    {                                                                                           // v0 will be clipped so use v2
-                        float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v2.z - world_face_rot.v1.z); // Distance along v1->v2 where z == NEAR_Z
-                        v[1].x = world_face_rot.v1.x + (world_face_rot.v2.x - world_face_rot.v1.x) * t;
-                        v[1].y = world_face_rot.v1.y + (world_face_rot.v2.y - world_face_rot.v1.y) * t;
-                        v[1].z = NEAR_Z;
-                        uv[1].u = world_face_rot.uv[1].u + (world_face_rot.uv[2].u - world_face_rot.uv[1].u) * t;
-                        uv[1].v = world_face_rot.uv[1].v + (world_face_rot.uv[2].v - world_face_rot.uv[1].v) * t;
-                    }
-                    else
-                    {                                                                                           // v2 will be clipped so use v0
-                        float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v0.z - world_face_rot.v1.z); // Distance along v1->v0 where z == NEAR_Z
-                        v[1].x = world_face_rot.v1.x + (world_face_rot.v0.x - world_face_rot.v1.x) * t;
-                        v[1].y = world_face_rot.v1.y + (world_face_rot.v0.y - world_face_rot.v1.y) * t;
-                        v[1].z = NEAR_Z;
-                        uv[1].u = world_face_rot.uv[1].u + (world_face_rot.uv[0].u - world_face_rot.uv[1].u) * t;
-                        uv[1].v = world_face_rot.uv[1].v + (world_face_rot.uv[0].v - world_face_rot.uv[1].v) * t;
-                    }
-                }
-                else
-                {
-                    v[1] = world_face_rot.v1;
-                }
-                if (verts_to_clip & 0b100)
-                { // Clip v2
-                    if (verts_to_clip & 0b1)
-                    {                                                                                           // v0 will be clipped so use v1
-                        float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v1.z - world_face_rot.v2.z); // Distance along v2->v1 where z == NEAR_Z
-                        v[2].x = world_face_rot.v2.x + (world_face_rot.v1.x - world_face_rot.v2.x) * t;
-                        v[2].y = world_face_rot.v2.y + (world_face_rot.v1.y - world_face_rot.v2.y) * t;
-                        v[2].z = NEAR_Z;
-                        uv[2].u = world_face_rot.uv[2].u + (world_face_rot.uv[1].u - world_face_rot.uv[2].u) * t;
-                        uv[2].v = world_face_rot.uv[2].v + (world_face_rot.uv[1].v - world_face_rot.uv[2].v) * t;
-                    }
-                    else
-                    {                                                                                           // v2 will be clipped so use v0
-                        float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v0.z - world_face_rot.v2.z); // Distance along v1->v0 where z == NEAR_Z
-                        v[2].x = world_face_rot.v2.x + (world_face_rot.v0.x - world_face_rot.v2.x) * t;
-                        v[2].y = world_face_rot.v2.y + (world_face_rot.v0.y - world_face_rot.v2.y) * t;
-                        v[2].z = NEAR_Z;
-                        uv[2].u = world_face_rot.uv[2].u + (world_face_rot.uv[0].u - world_face_rot.uv[2].u) * t;
-                        uv[2].v = world_face_rot.uv[2].v + (world_face_rot.uv[0].v - world_face_rot.uv[2].v) * t;
-                    }
-                }
-                else
-                {
-                    v[2] = world_face_rot.v2;
-                }
-                cam_faces[cam_it].v0 = v[0];
-                cam_faces[cam_it].v1 = v[1];
-                cam_faces[cam_it].v2 = v[2];
-                cam_faces[cam_it].c = world_face_rot.c;
-                cam_faces[cam_it].flags = world_face_rot.flags;
-                cam_faces[cam_it].texture_index = world_face_rot.texture_index;
-                cam_faces[cam_it].uv[0].u = uv[0].u;
-                cam_faces[cam_it].uv[1].u = uv[1].u;
-                cam_faces[cam_it].uv[2].u = uv[2].u;
-                cam_faces[cam_it].uv[0].v = uv[0].v;
-                cam_faces[cam_it].uv[1].v = uv[1].v;
-                cam_faces[cam_it].uv[2].v = uv[2].v;
-                ++cam_it;
-            }
-            else
-            { // Should have already clipped this before so fail assertion.
-                assert(false);
-            }
-        }
-        num_cam_faces = cam_it;
+        KPROF_Begin("Clear buffers");
+        KS_Clear(&frame_buffer);
+        memset(depth_buffer, 0, internal_resolution_width * internal_resolution_height * sizeof(float));
+        KPROF_End();
 
-        int view_it = cam_it = 0;
-        // transform view verts to screen space
-        for (; view_it < num_cam_faces; ++view_it, ++cam_it)
-        {
-            for (int v = 0; v < 3; ++v)
-            {
-                view_faces[view_it].v[v].x = (cam_faces[cam_it].v[v].x / cam_faces[cam_it].v[v].z + 1) * internal_resolution_width / 2;
-                view_faces[view_it].v[v].y = (aspect_ratio * -cam_faces[cam_it].v[v].y / cam_faces[cam_it].v[v].z + 1) * internal_resolution_height / 2;
-                view_faces[view_it].v[v].z = NEAR_Z / cam_faces[cam_it].v[v].z;
-            }
-            view_faces[view_it].c = cam_faces[cam_it].c;
-            view_faces[view_it].flags = cam_faces[cam_it].flags;
-            view_faces[view_it].texture_index = cam_faces[cam_it].texture_index;
-            view_faces[view_it].uv[0].u = cam_faces[cam_it].uv[0].u / cam_faces[cam_it].v0.z;
-            view_faces[view_it].uv[1].u = cam_faces[cam_it].uv[1].u / cam_faces[cam_it].v1.z;
-            view_faces[view_it].uv[2].u = cam_faces[cam_it].uv[2].u / cam_faces[cam_it].v2.z;
-            view_faces[view_it].uv[0].v = cam_faces[cam_it].uv[0].v / cam_faces[cam_it].v0.z;
-            view_faces[view_it].uv[1].v = cam_faces[cam_it].uv[1].v / cam_faces[cam_it].v1.z;
-            view_faces[view_it].uv[2].v = cam_faces[cam_it].uv[2].v / cam_faces[cam_it].v2.z;
-        }
-        num_view_faces = view_it;
+        RenderWorld();
 
-        // render wireframe to screen
-        for (int i = 0; i < num_view_faces; ++i)
+        KPROF_Begin("Upscale");
+        if (capture_path)
         {
-            if (view_faces[i].texture_index < MAX_TEXTURES)
-            {
-                // printf("%d ", view_faces[i].texture_index);
-                K3D_DrawTriangleTextured(&render_frame, depth_buffer, &textures[view_faces[i].texture_index], view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].uv);
-            }
-            else
-            {
-                K3D_DrawTriangle(&render_frame, depth_buffer, view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].c);
-            }
+            KCAP_Submit(&capture, render_frame.pixels, render_frame.w, render_frame.h);
         }
-
-        float frame_scale = Min((float)frame_buffer.h / (float)render_frame.h, (float)frame_buffer.w / (float)render_frame.w);
-        KS_BlitScaled(&render_frame, &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, frame_scale, frame_scale, render_frame.w / 2, render_frame.h / 2);
+        UpscaleRenderFrame();
 
         for (int i = 0; i < top_message; ++i)
         {
@@ -1492,15 +1923,31 @@ void AILoop()
             KS_DrawRectFilled(&frame_buffer, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5, (maze_sprite.h - 1) * 5 - cam.pos.z * 5, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5 + 5, (maze_sprite.h - 1) * 5 - cam.pos.z * 5 + 5, 0xff000000);
             KS_DrawLine(&frame_buffer, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5 + 2, (maze_sprite.h - 1) * 5 - cam.pos.z * 5 + 2, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5 + 2 + 5 * sin(-cam.yaw + 3.f * PI / 4.f) - 5 * cos(-cam.yaw + 3.f * PI / 4.f), (maze_sprite.h - 1) * 5 - cam.pos.z * 5 + 2 + 5 * cos(-cam.yaw + 3.f * PI / 4.f) + 5 * sin(-cam.yaw + 3.f * PI / 4.f), 0xffffffff);
         }
+        KPROF_End();
+
+        KPROF_Begin("Present");
+        KP_Present(&platform);
+        SyncFrameBuffer();
+        KPROF_End();
 
-        KP_Flip(&platform);
+        KPROF_Begin("Flip");
+        KP_LimitFramerate(&platform);
+        KPROF_End();
+        KPROF_End();
+        FrameEnd();
 
         if (auto_launch_menu)
         {
             Menu();
         }
+        // The main loop starts a new walk if the AI is turned back on from the win menu
+        if (won)
+        {
+            break;
+        }
     }
     free(maze_stack);
+    free(visited);
 }
 
 void ToggleAI()
@@ -1512,16 +1959,42 @@ void ToggleAI()
     active_menu = MENU_MAIN;
     ai.last_pos.x = target_pos.x;
     ai.last_pos.z = target_pos.z;
-    AILoop();
 }
 
+// Font and textures are loaded relative to the working directory
+bool LoadAssets()
+{
+    return KF_Load(&font, "font.png") &&
+           KS_Load(&textures[0], "textures/floor.png") &&
+           KS_Load(&textures[1], "textures/wall.png") &&
+           KS_Load(&textures[2], "textures/ceiling.png") &&
+           KS_Load(&textures[3], "textures/games/0.png") &&
+           KS_Load(&textures[4], "textures/games/1.png") &&
+           KS_Load(&textures[5], "textures/games/2.png") &&
+           KS_Load(&textures[6], "textures/games/3.png") &&
+           KS_Load(&textures[7], "textures/games/4.png") &&
+           KS_Load(&textures[8], "textures/games/5.png") &&
+           KS_Load(&textures[9], "textures/games/6.png") &&
+           KS_Load(&textures[10], "textures/games/7.png") &&
+           KS_Load(&textures[11], "textures/games/8.png") &&
+           KS_Load(&textures[12], "textures/games/9.png") &&
+           KS_Load(&textures[13], "textures/games/10.png") &&
+           KS_Load(&textures[14], "textures/title.png") &&
+           KS_Load(&textures[15], "textures/mazevr.png");
+}
+
+#ifndef MAZE_BENCH
 int main(int argc, char *argv[])
 {
     internal_resolution_width = internal_resolutions[0][0];
     internal_resolution_height = internal_resolutions[0][1];
     srand(time(0));
+    KPROF_ThreadName("Main");
+    KPROF_StatsAttach(&frame_stats);
+    atexit(SaveFrameStats);
 
     KP_Init(&platform, 1280, 960, "Maze95");
+    KS_ThreadsInit(0);
 
     KP_ShowCursor(&platform, false);
 
@@ -1532,42 +2005,102 @@ int main(int argc, char *argv[])
             printf("fullscreen\n");
             ToggleFullscreen();
         }
+        else if (!strcmp(argv[i], "-xrender"))
+        {
+            server_scaling = true;
+        }
+        else if (!strcmp(argv[i], "-xrender-bilinear"))
+        {
+            server_scaling = true;
+            server_scaling_bilinear = true;
+        }
+        else if (!strcmp(argv[i], "-async-present"))
+        {
+            async_present = true;
+        }
+        else if (!strcmp(argv[i], "-input-thread"))
+        {
+            input_thread = true;
+        }
+        else if (!strcmp(argv[i], "-unfocused-fps") && i + 1 < argc)
+        {
+            unfocused_fps = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-spin"))
+        {
+            // Busy-wait the last 0.3ms of each frame instead of trusting the scheduler to wake on time
+            platform.pacer_spin_time = 300000;
+        }
+        else if (!strcmp(argv[i], "-capture") && i + 1 < argc)
+        {
+            capture_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-trace") && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+            KPROF_CaptureStart();
+            atexit(SaveTrace);
+        }
+        else if (!strcmp(argv[i], "-stats") && i + 1 < argc)
+        {
+            stats_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-perf"))
+        {
+            perf_counters = KPROF_PerfStart();
+        }
+        else if (!strcmp(argv[i], "-alloc-guard") || !strcmp(argv[i], "-alloc-guard-abort"))
+        {
+            alloc_guard = strcmp(argv[i], "-alloc-guard") ? KPROF_GUARD_ABORT : KPROF_GUARD_REPORT;
+            if (!KPROF_AllocGuard(KPROF_GUARD_OFF))
+            {
+                fprintf(stderr, "%s needs a build with -DKERO_PROFILE_ALLOCATIONS\n", argv[i]);
+                alloc_guard = KPROF_GUARD_OFF;
+            }
+        }
     }
+    // The present thread and server side scaling both draw to the window, so only one is used
+    if (async_present)
+    {
+        async_present = !server_scaling && KP_StartPresentThread(&platform, 3, false);
+    }
+    if (input_thread)
+    {
+        input_thread = KP_StartInputThread(&platform);
+    }
+    atexit(ShutdownPlatform);
 
-    KS_Create(&render_frame, internal_resolution_width, internal_resolution_height);
+    render_frame_capacity = 0;
+    for (int i = 0; i < num_internal_resolutions; ++i)
+    {
+        render_frame_capacity = Max(render_frame_capacity, internal_resolutions[i][0] * internal_resolutions[i][1]);
+    }
+    render_frame.pixels = (uint32_t *)malloc(sizeof(uint32_t) * render_frame_capacity);
+    render_frame.w = internal_resolution_width;
+    render_frame.h = internal_resolution_height;
     KS_Create(&menu_frame, 320, 240);
+    // Smaller internal resolutions are scaled up to the starting one by the writer thread
+    if (capture_path)
+    {
+        if (KCAP_Start(&capture, capture_path, internal_resolution_width, internal_resolution_height, 60, render_frame_capacity, 8))
+        {
+            atexit(StopCapture);
+        }
+        else
+        {
+            capture_path = 0;
+        }
+    }
 
-    frame_buffer.pixels = platform.frame_buffer.pixels;
-    frame_buffer.w = platform.frame_buffer.w;
-    frame_buffer.h = platform.frame_buffer.h;
+    SyncFrameBuffer();
     // aspect_ratio = (float)frame_buffer.w / (float)frame_buffer.h;
     // depth_buffer = (float*)malloc(frame_buffer.w*frame_buffer.h*sizeof(float));
     aspect_ratio = (float)internal_resolution_width / (float)internal_resolution_height;
-    depth_buffer = (float *)malloc(internal_resolution_width * internal_resolution_height * sizeof(float));
+    depth_buffer = (float *)malloc(render_frame_capacity * sizeof(float));
 
     RestartMaze();
 
-    if (!(
-            KF_Load(&font, "font.png") &&
-
-            KS_Load(&textures[0], "textures/floor.png") &&
-            KS_Load(&textures[1], "textures/wall.png") &&
-            KS_Load(&textures[2], "textures/ceiling.png") &&
-
-            KS_Load(&textures[3], "textures/games/0.png") &&
-            KS_Load(&textures[4], "textures/games/1.png") &&
-            KS_Load(&textures[5], "textures/games/2.png") &&
-            KS_Load(&textures[6], "textures/games/3.png") &&
-            KS_Load(&textures[7], "textures/games/4.png") &&
-            KS_Load(&textures[8], "textures/games/5.png") &&
-            KS_Load(&textures[9], "textures/games/6.png") &&
-            KS_Load(&textures[10], "textures/games/7.png") &&
-            KS_Load(&textures[11], "textures/games/8.png") &&
-            KS_Load(&textures[12], "textures/games/9.png") &&
-            KS_Load(&textures[13], "textures/games/10.png") &&
-
-            KS_Load(&textures[14], "textures/title.png") &&
-            KS_Load(&textures[15], "textures/mazevr.png")))
+    if (!LoadAssets())
     {
         printf("Failed to load textures.\n");
         return -1;
@@ -1624,9 +2157,11 @@ int main(int argc, char *argv[])
     KP_SetCursorPos(&platform, frame_buffer.w / 2, frame_buffer.h / 2, NULL, NULL);
     while (game_running)
     {
-        ProfileTime("Frame start");
+        KPROF_Begin("Frame");
+        KPROF_Begin("Inputs");
 
-        while (KP_EventsQueued(&platform))
+        // Once the menu is asked for, it reads the rest of the events itself
+        while (!auto_launch_menu && GameEventsQueued())
         {
             kp_event_t *e = KP_NextEvent(&platform);
             switch (e->type)
@@ -1639,20 +2174,21 @@ int main(int argc, char *argv[])
                 {
                     if (platform.keyboard[KEY_RALT] || platform.keyboard[KEY_LALT])
                     {
-                        KP_Fullscreen(&platform, !platform.fullscreen);
+                        ToggleFullscreen();
                     }
                 }
                 break;
                 case KEY_ESCAPE:
                 {
                     active_menu = MENU_MAIN;
-                    Menu();
-                    continue;
+                    auto_launch_menu = true;
                 }
                 break;
                 case KEY_1:
                 {
                     control_mode = CONTROL_GRID | CONTROL_TURN90;
+                    KP_SetRawMouse(&platform, false);
+                    raw_mouse_look = false;
                     target_pos.x = cam.pos.x / maze.cell_size;
                     target_pos.z = cam.pos.z / maze.cell_size;
                     turn_target = cam.yaw / HALFPI;
@@ -1662,6 +2198,7 @@ int main(int argc, char *argv[])
                 case KEY_2:
                 {
                     control_mode = CONTROL_WASD | CONTROL_MOUSE;
+                    raw_mouse_look = KP_SetRawMouse(&platform, true);
                     PlayerMessage("Free movement");
                 }
                 break;
@@ -1691,11 +2228,57 @@ int main(int argc, char *argv[])
                     }
                 }
                 break;
+                case KEY_5:
+                {
+                    dynamic_resolution.enabled = !dynamic_resolution.enabled;
+                    DynamicResolutionReset();
+                    DynamicResolutionApply();
+                    if (dynamic_resolution.enabled)
+                    {
+                        PlayerMessage("Dynamic resolution on");
+                    }
+                    else
+                    {
+                        PlayerMessage("Dynamic resolution off");
+                    }
+                }
+                break;
                 case KEY_P:
                 {
                     draw_profiles = !draw_profiles;
                 }
                 break;
+                case KEY_C:
+                {
+                    draw_counters = !draw_counters;
+                }
+                break;
+#ifdef KERO_3D_DEBUG_OVERDRAW
+                case KEY_O:
+                {
+                    overdraw_view = (overdraw_view + 1) % (K3D_NUM_OVERDRAW_COUNTERS + 1);
+                    SteadyStateReset(); // The counter buffer is allocated the first time it is shown
+                    char message[128];
+                    snprintf(message, sizeof(message), "%s heatmap", overdraw_view ? overdraw_view_names[overdraw_view - 1] : "No");
+                    PlayerMessage(message);
+                }
+                break;
+#endif
+                case KEY_T:
+                {
+                    if (KPROF_Capturing())
+                    {
+                        char message[128];
+                        snprintf(message, sizeof(message), KPROF_CaptureWrite(trace_path) ? "Trace saved to %s" : "Failed to save %s", trace_path);
+                        PlayerMessage(message);
+                    }
+                    else
+                    {
+                        KPROF_CaptureStart();
+                        PlayerMessage("Tracing, press T to save");
+                    }
+                }
+                break;
                 case KEY_LEFT:
                 case KEY_A:
                 {
@@ -1759,7 +2342,7 @@ int main(int argc, char *argv[])
                         {
                             if (target_pos.x < maze.w - 1)
                             {
-                                if (!(maze.cells[target_pos.z * maze.w + target_pos.x] & MAZE_RIGHT))
+                                if (!(MazeCell(&maze, target_pos.x, target_pos.z) & MAZE_RIGHT))
                                 {
                                     dx = 0;
                                 }
@@ -1773,7 +2356,7 @@ int main(int argc, char *argv[])
                         {
                             if (target_pos.x > 0)
                             {
-                                if (!(maze.cells[target_pos.z * maze.w + target_pos.x] & MAZE_LEFT))
+                                if (!(MazeCell(&maze, target_pos.x, target_pos.z) & MAZE_LEFT))
                                 {
                                     dx = 0;
                                 }
@@ -1787,7 +2370,7 @@ int main(int argc, char *argv[])
                         {
                             if (target_pos.z < maze.h - 1)
                             {
-                                if (!(maze.cells[target_pos.z * maze.w + target_pos.x] & MAZE_UP))
+                                if (!(MazeCell(&maze, target_pos.x, target_pos.z) & MAZE_UP))
                                 {
                                     dz = 0;
                                 }
@@ -1801,7 +2384,7 @@ int main(int argc, char *argv[])
                         {
                             if (target_pos.z > 0)
                             {
-                                if (!(maze.cells[target_pos.z * maze.w + target_pos.x] & MAZE_DOWN))
+                                if (!(MazeCell(&maze, target_pos.x, target_pos.z) & MAZE_DOWN))
                                 {
                                     dz = 0;
                                 }
@@ -1853,9 +2436,8 @@ int main(int argc, char *argv[])
             break;
             case KP_EVENT_RESIZE:
             {
-                frame_buffer.pixels = platform.frame_buffer.pixels;
-                frame_buffer.w = platform.frame_buffer.w;
-                frame_buffer.h = platform.frame_buffer.h;
+                SteadyStateReset(); // Presenting may reallocate for the new size too
+                SyncFrameBuffer();
                 KS_SetAllPixels(&frame_buffer, 0x00000000);
                 // aspect_ratio = (float)frame_buffer.w / (float)frame_buffer.h;
                 // depth_buffer = (float*)realloc(depth_buffer, sizeof(float)*frame_buffer.w*frame_buffer.h);
@@ -1867,10 +2449,16 @@ int main(int argc, char *argv[])
             }
             break;
             }
-            KP_FreeEvent(e);
         }
 
-        if (control_mode & CONTROL_MOUSE)
+        if ((control_mode & CONTROL_MOUSE) && raw_mouse_look)
+        {
+            double dx, dy;
+            KP_RawMouseDelta(&platform, &dx, &dy);
+            cam.yaw -= (float)dx * CAM_ROT_SPEED;
+            cam.pitch -= (float)dy * CAM_ROT_SPEED;
+        }
+        else if (control_mode & CONTROL_MOUSE)
         {
             int dx, dy;
             KP_SetCursorPos(&platform, frame_buffer.w / 2, frame_buffer.h / 2, &dx, &dy);
@@ -1994,14 +2582,32 @@ int main(int argc, char *argv[])
             }
         }
 
-        ProfileTime("Inputs");
+        KPROF_End();
 
         for (int i = 0; i < num_dodecahedrons; ++i)
         {
             dodecahedrons[i].rot.V[i % 3] += platform.delta;
         }
 
+        UpdateBackgroundThrottle();
+        if (!platform.visible)
+        {
+            // Nothing drawn would be seen, so skip rasterising and presenting
+            KPROF_End();
+            KP_LimitFramerate(&platform);
+            if (auto_launch_menu)
+            {
+                Menu();
+            }
+            if (ai_control)
+            {
+                AILoop();
+            }
+            continue;
+        }
+
 #if 0
+        KPROF_Begin("Cast rays");
         vec2_t* rays = NULL;
         vec2_t vec_player_pos = Vec2Make(cam.pos.x, cam.pos.z);
         unsigned int maze_faces_to_render[MAX_FACES] = { 0, 1, 2, 3 };
@@ -2093,399 +2699,140 @@ int main(int argc, char *argv[])
                 }
             }
         }
-        ProfileTime("Cast rays");
+        KPROF_End();
 #endif
 
-        KS_Clear(&frame_buffer);
+        KPROF_Begin("Clear buffers");
+        if (!server_scaling)
+        {
+            KS_Clear(&frame_buffer);
+        }
         // KS_SetAllPixels(&frame_buffer, 0x00000000);
         // memset(depth_buffer, 0, frame_buffer.w*frame_buffer.h*sizeof(float));
         // KS_SetAllPixels(&render_frame, 0x00000000);
         memset(depth_buffer, 0, internal_resolution_width * internal_resolution_height * sizeof(float));
-        ProfileTime("Clear buffers");
+        KPROF_End();
 
         /*for(int i = 0; i < NUM_CUBES; ++i) {
         cube_rot[i].y += platform.delta/(i+1);
         }*/
 
-        // transform cube vertices to world space
-        int world_it = 0;
-        // Transform dodecahedron faces to world
-        for (int dodec_it = 0; dodec_it < num_dodecahedrons; ++dodec_it)
-        {
-            if (!dodecahedrons[dodec_it].active)
-                continue;
-            for (int f = 0; f < 36; ++f)
-            {
-                world_faces[world_it] = K3D_TranslateRotate(dodecahedron[f], dodecahedrons[dodec_it].pos, dodecahedrons[dodec_it].rot);
-                ++world_it;
-            }
-        }
-        // Transform end board faces to world
-        for (int f = 0; f < 2; ++f)
-        {
-            world_faces[world_it] = K3D_TranslateRotate(end_board[f], Vec3Make((float)maze.end.x * maze.cell_size + maze.cell_size / 2, 2.5f, (float)maze.end.y * maze.cell_size + maze.cell_size / 2), Vec3Make(cam.pitch, cam.yaw + PI, 0));
-            ++world_it;
-        }
-        // Copy maze faces to world faces
-        // Copy all maze faces
-        for (int maze_it = 0; maze_it < num_maze_faces; ++maze_it)
-        {
-            world_faces[world_it].v0 = maze_faces[maze_it].v0;
-            world_faces[world_it].v1 = maze_faces[maze_it].v1;
-            world_faces[world_it].v2 = maze_faces[maze_it].v2;
-            world_faces[world_it].c = maze_faces[maze_it].c;
-            world_faces[world_it].flags = maze_faces[maze_it].flags;
-            world_faces[world_it].texture_index = maze_faces[maze_it].texture_index;
-            world_faces[world_it].uv[0].u = maze_faces[maze_it].uv[0].u;
-            world_faces[world_it].uv[1].u = maze_faces[maze_it].uv[1].u;
-            world_faces[world_it].uv[2].u = maze_faces[maze_it].uv[2].u;
-            world_faces[world_it].uv[0].v = maze_faces[maze_it].uv[0].v;
-            world_faces[world_it].uv[1].v = maze_faces[maze_it].uv[1].v;
-            world_faces[world_it].uv[2].v = maze_faces[maze_it].uv[2].v;
-            ++world_it;
-        }
-        /*// Only copy visible faces according to rays
-        for(int maze_it = 0; maze_it < num_maze_faces_to_render; ++maze_it) {
-            world_faces[world_it].v0 = maze_faces[maze_faces_to_render[maze_it]].v0;
-            world_faces[world_it].v1 = maze_faces[maze_faces_to_render[maze_it]].v1;
-            world_faces[world_it].v2 = maze_faces[maze_faces_to_render[maze_it]].v2;
-            world_faces[world_it].c = maze_faces[maze_faces_to_render[maze_it]].c;
-            world_faces[world_it].flags = maze_faces[maze_faces_to_render[maze_it]].flags;
-            world_faces[world_it].texture_index = maze_faces[maze_faces_to_render[maze_it]].texture_index;
-            world_faces[world_it].uv[0].u = maze_faces[maze_faces_to_render[maze_it]].uv[0].u;
-            world_faces[world_it].uv[1].u = maze_faces[maze_faces_to_render[maze_it]].uv[1].u;
-            world_faces[world_it].uv[2].u = maze_faces[maze_faces_to_render[maze_it]].uv[2].u;
-            world_faces[world_it].uv[0].v = maze_faces[maze_faces_to_render[maze_it]].uv[0].v;
-            world_faces[world_it].uv[1].v = maze_faces[maze_faces_to_render[maze_it]].uv[1].v;
-            world_faces[world_it].uv[2].v = maze_faces[maze_faces_to_render[maze_it]].uv[2].v;
-            ++world_it;
-        }*/
-        num_world_faces = world_it;
-        ProfileTime("Object->World");
-
-        // transform world faces to view space
-        int cam_it = world_it = 0;
-        face_t world_face_trans, world_face_rot, world_face_clipped[2], temp;
-        vec3_t v[4];
-        int num_verts_to_clip, verts_to_clip;
-        for (; world_it < num_world_faces; ++world_it)
-        {
-            if (!world_faces[world_it].flags.double_sided)
-            {
-                // back-face culling
-                vec3_t n = Vec3Norm(Vec3Cross(Vec3AToB(world_faces[world_it].v0, world_faces[world_it].v1), Vec3AToB(world_faces[world_it].v0, world_faces[world_it].v2)));
-                vec3_t poly_to_cam = Vec3AToB(world_faces[world_it].v0, cam.pos);
-                float angle = Vec3Dot(n, poly_to_cam);
-                if (angle <= 0)
-                    continue;
-            }
-            world_face_rot = K3D_CameraTranslateRotate(world_faces[world_it], cam.pos, cam.rot);
-
-            if (world_face_rot.v0.z < NEAR_Z && world_face_rot.v1.z < NEAR_Z && world_face_rot.v2.z < NEAR_Z /* || world_face_rot.v0.z > FAR_Z && world_face_rot.v1.z > FAR_Z && world_face_rot.v2.z > FAR_Z*/)
-                continue;
-            // clip on NEAR_Z plane
-            num_verts_to_clip = verts_to_clip = 0;
-            if (world_face_rot.v0.z < NEAR_Z)
-            {
-                ++num_verts_to_clip;
-                verts_to_clip |= 0b1;
-            }
-            if (world_face_rot.v1.z < NEAR_Z)
-            {
-                ++num_verts_to_clip;
-                verts_to_clip |= 0b10;
-            }
-            if (world_face_rot.v2.z < NEAR_Z)
-            {
-                ++num_verts_to_clip;
-                verts_to_clip |= 0b100;
-            }
-            vec2_t uv[4] = {
-                world_face_rot.uv[0].u,
-                world_face_rot.uv[0].v,
-                world_face_rot.uv[1].u,
-                world_face_rot.uv[1].v,
-                world_face_rot.uv[2].u,
-                world_face_rot.uv[2].v,
-            };
-            if (num_verts_to_clip == 0)
-            {
-                // All verts are >= NEAR_Z. No clipping
-                cam_faces[cam_it++] = world_face_rot;
-            }
-            else if (num_verts_to_clip == 1)
-            {
-                if (verts_to_clip == 0b1)
-                { // Clip v0
-                    // Distance along v0->v1 where z == NEAR_Z
-                    float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v1.z - world_face_rot.v0.z);
-                    v[0].x = world_face_rot.v0.x + (world_face_rot.v1.x - world_face_rot.v0.x) * t;
-                    v[0].y = world_face_rot.v0.y + (world_face_rot.v1.y - world_face_rot.v0.y) * t;
-                    v[0].z = NEAR_Z;
-                    uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[1].u - world_face_rot.uv[0].u) * t;
-                    uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[1].v - world_face_rot.uv[0].v) * t;
-                    // Distance along v0->v2 where z == NEAR_Z
-                    t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v2.z - world_face_rot.v0.z);
-                    v[3].x = world_face_rot.v0.x + (world_face_rot.v2.x - world_face_rot.v0.x) * t;
-                    v[3].y = world_face_rot.v0.y + (world_face_rot.v2.y - world_face_rot.v0.y) * t;
-                    v[3].z = NEAR_Z;
-                    uv[3].u = world_face_rot.uv[0].u + (world_face_rot.uv[2].u - world_face_rot.uv[0].u) * t;
-                    uv[3].v = world_face_rot.uv[0].v + (world_face_rot.uv[2].v - world_face_rot.uv[0].v) * t;
-                    v[1] = world_face_rot.v1;
-                    v[2] = world_face_rot.v2;
-                }
-                else if (verts_to_clip == 0b10)
-                { // Clip v1
-                    // Distance along v1->v2 where z == NEAR_Z
-                    float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v2.z - world_face_rot.v1.z);
-                    v[0].x = world_face_rot.v1.x + (world_face_rot.v2.x - world_face_rot.v1.x) * t;
-                    v[0].y = world_face_rot.v1.y + (world_face_rot.v2.y - world_face_rot.v1.y) * t;
-                    v[0].z = NEAR_Z;
-                    uv[0].u = world_face_rot.uv[1].u + (world_face_rot.uv[2].u - world_face_rot.uv[1].u) * t;
-                    uv[0].v = world_face_rot.uv[1].v + (world_face_rot.uv[2].v - world_face_rot.uv[1].v) * t;
-                    // Distance along v1->v0 where z == NEAR_Z
-                    t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v0.z - world_face_rot.v1.z);
-                    v[3].x = world_face_rot.v1.x + (world_face_rot.v0.x - world_face_rot.v1.x) * t;
-                    v[3].y = world_face_rot.v1.y + (world_face_rot.v0.y - world_face_rot.v1.y) * t;
-                    v[3].z = NEAR_Z;
-                    uv[3].u = world_face_rot.uv[1].u + (world_face_rot.uv[0].u - world_face_rot.uv[1].u) * t;
-                    uv[3].v = world_face_rot.uv[1].v + (world_face_rot.uv[0].v - world_face_rot.uv[1].v) * t;
-                    v[1] = world_face_rot.v2;
-                    v[2] = world_face_rot.v0;
-                    uv[1].u = world_face_rot.uv[2].u;
-                    uv[2].u = world_face_rot.uv[0].u;
-                    uv[1].v = world_face_rot.uv[2].v;
-                    uv[2].v = world_face_rot.uv[0].v;
-                }
-                else if (verts_to_clip == 0b100)
-                { // Clip v2
-                    // Distance along v2->v0 where z == NEAR_Z
-                    float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v0.z - world_face_rot.v2.z);
-                    v[0].x = world_face_rot.v2.x + (world_face_rot.v0.x - world_face_rot.v2.x) * t;
-                    v[0].y = world_face_rot.v2.y + (world_face_rot.v0.y - world_face_rot.v2.y) * t;
-                    v[0].z = NEAR_Z;
-                    uv[0].u = world_face_rot.uv[2].u + (world_face_rot.uv[0].u - world_face_rot.uv[2].u) * t;
-                    uv[0].v = world_face_rot.uv[2].v + (world_face_rot.uv[0].v - world_face_rot.uv[2].v) * t;
-                    // Distance along v2->v1 where z == NEAR_Z
-                    t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v1.z - world_face_rot.v2.z);
-                    v[3].x = world_face_rot.v2.x + (world_face_rot.v1.x - world_face_rot.v2.x) * t;
-                    v[3].y = world_face_rot.v2.y + (world_face_rot.v1.y - world_face_rot.v2.y) * t;
-                    v[3].z = NEAR_Z;
-                    uv[3].u = world_face_rot.uv[2].u + (world_face_rot.uv[1].u - world_face_rot.uv[2].u) * t;
-                    uv[3].v = world_face_rot.uv[2].v + (world_face_rot.uv[1].v - world_face_rot.uv[2].v) * t;
-                    v[1] = world_face_rot.v0;
-                    v[2] = world_face_rot.v1;
-                    uv[1].u = world_face_rot.uv[0].u;
-                    uv[2].u = world_face_rot.uv[1].u;
-                    uv[1].v = world_face_rot.uv[0].v;
-                    uv[2].v = world_face_rot.uv[1].v;
-                }
-                cam_faces[cam_it].c = cam_faces[cam_it + 1].c = world_face_rot.c;
-                cam_faces[cam_it].v0 = v[0];
-                cam_faces[cam_it].v1 = v[1];
-                cam_faces[cam_it].v2 = v[2];
-                cam_faces[cam_it].texture_index = world_face_rot.texture_index;
-                cam_faces[cam_it].c = world_face_rot.c;
-                cam_faces[cam_it].flags = world_face_rot.flags;
-                cam_faces[cam_it].uv[0].u = uv[0].u;
-                cam_faces[cam_it].uv[1].u = uv[1].u;
-                cam_faces[cam_it].uv[2].u = uv[2].u;
-                cam_faces[cam_it].uv[0].v = uv[0].v;
-                cam_faces[cam_it].uv[1].v = uv[1].v;
-                cam_faces[cam_it].uv[2].v = uv[2].v;
-                ++cam_it;
-                cam_faces[cam_it].v0 = v[0];
-                cam_faces[cam_it].v1 = v[2];
-                cam_faces[cam_it].v2 = v[3];
-                cam_faces[cam_it].texture_index = world_face_rot.texture_index;
-                cam_faces[cam_it].c = world_face_rot.c;
-                cam_faces[cam_it].flags = world_face_rot.flags;
-                cam_faces[cam_it].uv[0].u = uv[0].u;
-                cam_faces[cam_it].uv[1].u = uv[2].u;
-                cam_faces[cam_it].uv[2].u = uv[3].u;
-                cam_faces[cam_it].uv[0].v = uv[0].v;
-                cam_faces[cam_it].uv[1].v = uv[2].v;
-                cam_faces[cam_it].uv[2].v = uv[3].v;
-                ++cam_it;
-            }
-            else if (num_verts_to_clip == 2)
-            {
-                if (verts_to_clip & 0b1)
-                { // Clip v0
-                    if (verts_to_clip & 0b10)
-                    {                                                                                           // v1 will be clipped so use v2
-                        float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v2.z - world_face_rot.v0.z); // Distance along v0->v2 where z == NEAR_Z
-                        v[0].x = world_face_rot.v0.x + (world_face_rot.v2.x - world_face_rot.v0.x) * t;
-                        v[0].y = world_face_rot.v0.y + (world_face_rot.v2.y - world_face_rot.v0.y) * t;
-                        v[0].z = NEAR_Z;
-                        uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[2].u - world_face_rot.uv[0].u) * t;
-                        uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[2].v - world_face_rot.uv[0].v) * t;
-                    }
-                    else
-                    {                                                                                           // v2 will be clipped so use v1
-                        float t = (NEAR_Z - world_face_rot.v0.z) / (world_face_rot.v1.z - world_face_rot.v0.z); // Distance along v0->v1 where z == NEAR_Z
-                        v[0].x = world_face_rot.v0.x + (world_face_rot.v1.x - world_face_rot.v0.x) * t;
-                        v[0].y = world_face_rot.v0.y + (world_face_rot.v1.y - world_face_rot.v0.y) * t;
-                        v[0].z = NEAR_Z;
-                        uv[0].u = world_face_rot.uv[0].u + (world_face_rot.uv[1].u - world_face_rot.uv[0].u) * t;
-                        uv[0].v = world_face_rot.uv[0].v + (world_face_rot.uv[1].v - world_face_rot.uv[0].v) * t;
-                    }
-                }
-                else
-                {
-                    v[0] = world_face_rot.v0;
-                }
-                if (verts_to_clip & 0b10)
-                { // Clip v1
-                    if (verts_to_clip & 0b1)
-                    {                                                                                           // v0 will be clipped so use v2
-                        float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v2.z - world_face_rot.v1.z); // Distance along v1->v2 where z == NEAR_Z
-                        v[1].x = world_face_rot.v1.x + (world_face_rot.v2.x - world_face_rot.v1.x) * t;
-                        v[1].y = world_face_rot.v1.y + (world_face_rot.v2.y - world_face_rot.v1.y) * t;
-                        v[1].z = NEAR_Z;
-                        uv[1].u = world_face_rot.uv[1].u + (world_face_rot.uv[2].u - world_face_rot.uv[1].u) * t;
-                        uv[1].v = world_face_rot.uv[1].v + (world_face_rot.uv[2].v - world_face_rot.uv[1].v) * t;
-                    }
-                    else
-                    {                                                                                           // v2 will be clipped so use v0
-                        float t = (NEAR_Z - world_face_rot.v1.z) / (world_face_rot.v0.z - world_face_rot.v1.z); // Distance along v1->v0 where z == NEAR_Z
-                        v[1].x = world_face_rot.v1.x + (world_face_rot.v0.x - world_face_rot.v1.x) * t;
-                        v[1].y = world_face_rot.v1.y + (world_face_rot.v0.y - world_face_rot.v1.y) * t;
-                        v[1].z = NEAR_Z;
-                        uv[1].u = world_face_rot.uv[1].u + (world_face_rot.uv[0].u - world_face_rot.uv[1].u) * t;
-                        uv[1].v = world_face_rot.uv[1].v + (world_face_rot.uv[0].v - world_face_rot.uv[1].v) * t;
-                    }
-                }
-                else
-                {
-                    v[1] = world_face_rot.v1;
-                }
-                if (verts_to_clip & 0b100)
-                { // Clip v2
-                    if (verts_to_clip & 0b1)
-                    {                                                                                           // v0 will be clipped so use v1
-                        float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v1.z - world_face_rot.v2.z); // Distance along v2->v1 where z == NEAR_Z
-                        v[2].x = world_face_rot.v2.x + (world_face_rot.v1.x - world_face_rot.v2.x) * t;
-                        v[2].y = world_face_rot.v2.y + (world_face_rot.v1.y - world_face_rot.v2.y) * t;
-                        v[2].z = NEAR_Z;
-                        uv[2].u = world_face_rot.uv[2].u + (world_face_rot.uv[1].u - world_face_rot.uv[2].u) * t;
-                        uv[2].v = world_face_rot.uv[2].v + (world_face_rot.uv[1].v - world_face_rot.uv[2].v) * t;
-                    }
-                    else
-                    {                                                                                           // v2 will be clipped so use v0
-                        float t = (NEAR_Z - world_face_rot.v2.z) / (world_face_rot.v0.z - world_face_rot.v2.z); // Distance along v1->v0 where z == NEAR_Z
-                        v[2].x = world_face_rot.v2.x + (world_face_rot.v0.x - world_face_rot.v2.x) * t;
-                        v[2].y = world_face_rot.v2.y + (world_face_rot.v0.y - world_face_rot.v2.y) * t;
-                        v[2].z = NEAR_Z;
-                        uv[2].u = world_face_rot.uv[2].u + (world_face_rot.uv[0].u - world_face_rot.uv[2].u) * t;
-                        uv[2].v = world_face_rot.uv[2].v + (world_face_rot.uv[0].v - world_face_rot.uv[2].v) * t;
-                    }
-                }
-                else
-                {
-                    v[2] = world_face_rot.v2;
-                }
-                cam_faces[cam_it].v0 = v[0];
-                cam_faces[cam_it].v1 = v[1];
-                cam_faces[cam_it].v2 = v[2];
-                cam_faces[cam_it].c = world_face_rot.c;
-                cam_faces[cam_it].flags = world_face_rot.flags;
-                cam_faces[cam_it].texture_index = world_face_rot.texture_index;
-                cam_faces[cam_it].uv[0].u = uv[0].u;
-                cam_faces[cam_it].uv[1].u = uv[1].u;
-                cam_faces[cam_it].uv[2].u = uv[2].u;
-                cam_faces[cam_it].uv[0].v = uv[0].v;
-                cam_faces[cam_it].uv[1].v = uv[1].v;
-                cam_faces[cam_it].uv[2].v = uv[2].v;
-                ++cam_it;
-            }
-            else
-            { // Should have already clipped this before so fail assertion.
-                assert(false);
-            }
-        }
-        num_cam_faces = cam_it;
-        ProfileTime("World->Cam");
-
-        int view_it = cam_it = 0;
-        // transform view verts to screen space
-        for (; view_it < num_cam_faces; ++view_it, ++cam_it)
-        {
-            for (int v = 0; v < 3; ++v)
-            {
-                view_faces[view_it].v[v].x = (cam_faces[cam_it].v[v].x / cam_faces[cam_it].v[v].z + 1) * internal_resolution_width / 2;
-                view_faces[view_it].v[v].y = (aspect_ratio * -cam_faces[cam_it].v[v].y / cam_faces[cam_it].v[v].z + 1) * internal_resolution_height / 2;
-                view_faces[view_it].v[v].z = NEAR_Z / cam_faces[cam_it].v[v].z;
-            }
-            view_faces[view_it].c = cam_faces[cam_it].c;
-            view_faces[view_it].flags = cam_faces[cam_it].flags;
-            view_faces[view_it].texture_index = cam_faces[cam_it].texture_index;
-            view_faces[view_it].uv[0].u = cam_faces[cam_it].uv[0].u / cam_faces[cam_it].v0.z;
-            view_faces[view_it].uv[1].u = cam_faces[cam_it].uv[1].u / cam_faces[cam_it].v1.z;
-            view_faces[view_it].uv[2].u = cam_faces[cam_it].uv[2].u / cam_faces[cam_it].v2.z;
-            view_faces[view_it].uv[0].v = cam_faces[cam_it].uv[0].v / cam_faces[cam_it].v0.z;
-            view_faces[view_it].uv[1].v = cam_faces[cam_it].uv[1].v / cam_faces[cam_it].v1.z;
-            view_faces[view_it].uv[2].v = cam_faces[cam_it].uv[2].v / cam_faces[cam_it].v2.z;
-        }
-        num_view_faces = view_it;
-        ProfileTime("Cam->View");
-
-        // render wireframe to screen
-        for (int i = 0; i < num_view_faces; ++i)
-        {
-            // K3D_DrawTriangleWire(&frame_buffer, view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].c);
-            if (view_faces[i].texture_index < MAX_TEXTURES)
-            {
-                K3D_DrawTriangleTextured(&render_frame, depth_buffer, &textures[view_faces[i].texture_index], view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].uv);
-            }
-            else
-            {
-                K3D_DrawTriangle(&render_frame, depth_buffer, view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].c);
-            }
-            // KS_DrawTriangle(&frame_buffer, view_faces[i].v0.x, view_faces[i].v0.y, view_faces[i].v1.x, view_faces[i].v1.y, view_faces[i].v2.x, view_faces[i].v2.y, view_faces[i].c);
-            // K3D_DrawTrianglef(&frame_buffer, view_faces[i].v0, view_faces[i].v1, view_faces[i].v2, view_faces[i].c);
-            /*KS_DrawLine(&frame_buffer, view_faces[i].v0.x, view_faces[i].v0.y, view_faces[i].v1.x, view_faces[i].v1.y, view_faces[i].c, KSSetPixel);
-            KS_DrawLine(&frame_buffer, view_faces[i].v1.x, view_faces[i].v1.y, view_faces[i].v2.x, view_faces[i].v2.y, view_faces[i].c, KSSetPixel);
-            KS_DrawLine(&frame_buffer, view_faces[i].v2.x, view_faces[i].v2.y, view_faces[i].v0.x, view_faces[i].v0.y, view_faces[i].c, KSSetPixel);*/
-        }
-        ProfileTime("View->Screen");
+        RenderWorld();
 
+        // With server side scaling the frame buffer is never sent, so the HUD goes on the render frame
+        ksprite_t *hud_frame = server_scaling ? &render_frame : &frame_buffer;
         if (draw_minimap)
         {
-            KS_BlitScaledSafe(&maze_sprite, &frame_buffer, frame_buffer.w - maze_sprite.w * 5, 0, 5, 5, 0, 0);
+            KPROF_Begin("Draw minimap");
+            int s = server_scaling ? 1 : 5;
+            KS_BlitScaledSafe(&maze_sprite, hud_frame, hud_frame->w - maze_sprite.w * s, 0, s, s, 0, 0);
             // Draw player on minimap
-            KS_DrawRectFilled(&frame_buffer, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5, (maze_sprite.h - 1) * 5 - cam.pos.z * 5, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5 + 5, (maze_sprite.h - 1) * 5 - cam.pos.z * 5 + 5, 0xff000000);
-            KS_DrawLine(&frame_buffer, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5 + 2, (maze_sprite.h - 1) * 5 - cam.pos.z * 5 + 2, cam.pos.x * 5 + frame_buffer.w - maze_sprite.w * 5 + 2 + 5 * sin(-cam.yaw + 3.f * PI / 4.f) - 5 * cos(-cam.yaw + 3.f * PI / 4.f), (maze_sprite.h - 1) * 5 - cam.pos.z * 5 + 2 + 5 * cos(-cam.yaw + 3.f * PI / 4.f) + 5 * sin(-cam.yaw + 3.f * PI / 4.f), 0xffffffff);
-            ProfileTime("Draw minimap");
+            KS_DrawRectFilled(hud_frame, cam.pos.x * s + hud_frame->w - maze_sprite.w * s, (maze_sprite.h - 1) * s - cam.pos.z * s, cam.pos.x * s + hud_frame->w - maze_sprite.w * s + s, (maze_sprite.h - 1) * s - cam.pos.z * s + s, 0xff000000);
+            KS_DrawLineSafe(hud_frame, cam.pos.x * s + hud_frame->w - maze_sprite.w * s + 2, (maze_sprite.h - 1) * s - cam.pos.z * s + 2, cam.pos.x * s + hud_frame->w - maze_sprite.w * s + 2 + 5 * sin(-cam.yaw + 3.f * PI / 4.f) - 5 * cos(-cam.yaw + 3.f * PI / 4.f), (maze_sprite.h - 1) * s - cam.pos.z * s + 2 + 5 * cos(-cam.yaw + 3.f * PI / 4.f) + 5 * sin(-cam.yaw + 3.f * PI / 4.f), 0xffffffff);
+            KPROF_End();
         }
 
         if (draw_profiles)
         {
-            profile_frames[current_profile_frame].num_profiles = new_profile_frame.num_profiles;
-            for (int profile_it = 0; profile_it < new_profile_frame.num_profiles; ++profile_it)
+            KPROF_Begin("Draw profiles");
+            kprof_frame_t *frame = &profile_frames[current_profile_frame];
+            if (!KPROF_LastFrame(frame))
             {
-                profile_frames[current_profile_frame].profiles[profile_it] = new_profile_frame.profiles[profile_it];
+                frame->num_zones = 0;
             }
-            double start_time = new_profile_frame.profiles[0];
-            for (int profile_it = 0; profile_it < profile_frames[current_profile_frame].num_profiles; ++profile_it)
+            for (int zone_it = 0; zone_it < frame->num_zones; ++zone_it)
             {
                 char final_string[128];
-                sprintf(final_string, "%.2f %s", profile_frames[current_profile_frame].profiles[profile_it] - (profile_it > 0 ? profile_frames[current_profile_frame].profiles[profile_it - 1] : start_time), profile_time_names[profile_it]);
-                KF_DrawColored(&font, &render_frame, MAX_PROFILE_FRAMES * 2, profile_it * 16, final_string, profile_colours[profile_it]);
+                int length = sprintf(final_string, "%.2f %s", (frame->zones[zone_it].end - frame->zones[zone_it].start) / 1e6, frame->zones[zone_it].name);
+                if (perf_counters)
+                {
+                    sprintf(final_string + length, " %.2f IPC %.2f L1D/px", ZoneIPC(&frame->zones[zone_it]), PerPixel(frame->zones[zone_it].counters[KPROF_COUNTER_L1D_MISSES]));
+                }
+                KF_DrawColored(&font, &render_frame, MAX_PROFILE_FRAMES * 2, zone_it * 16, final_string, profile_colours[(zone_it + 1) % MAX_PROFILE_TIMES]);
             }
             char final_string[128];
-            sprintf(final_string, "%.2f %s", profile_frames[current_profile_frame].profiles[profile_frames[current_profile_frame].num_profiles - 1] - profile_frames[current_profile_frame].profiles[0], "Frame time");
-            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, profile_frames[current_profile_frame].num_profiles * 16, final_string);
+            sprintf(final_string, "%.2f %s", (frame->zone.end - frame->zone.start) / 1e6, "Frame time");
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, frame->num_zones * 16, final_string);
+            kprof_series_t *frame_series = KPROF_StatsSeries(&frame_stats, "Frame");
+            if (frame_series)
+            {
+                kprof_histogram_t *window = &frame_series->window;
+                sprintf(final_string, "%.2f/%.2f/%.2f/%.2f/%.2f p50/90/99/99.9/max", KPROF_HistogramPercentile(window, 50) / 1e6, KPROF_HistogramPercentile(window, 90) / 1e6, KPROF_HistogramPercentile(window, 99) / 1e6, KPROF_HistogramPercentile(window, 99.9) / 1e6, KPROF_SeriesWindowMax(frame_series) / 1e6);
+                KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 1) * 16, final_string);
+            }
+            sprintf(final_string, "%dx%d %s", render_frame.w, render_frame.h, server_scaling ? "XRender" : platform.shm ? "SHM" : "XPutImage");
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 2) * 16, final_string);
+            sprintf(final_string, "%.2f Present latency, queue %d", platform.present_latency, platform.present_queue_depth);
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 3) * 16, final_string);
+            sprintf(final_string, "%.2f Jitter, avg %.2f max %.2f missed %u", platform.jitter.last, platform.jitter.average, platform.jitter.max, platform.jitter.missed);
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 4) * 16, final_string);
+            sprintf(final_string, "%.2f Input latency, avg %.2f max %.2f%s", platform.input_latency.last, platform.input_latency.average, platform.input_latency.max, input_thread ? " (thread)" : "");
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 5) * 16, final_string);
+            if (capture_path)
+            {
+                sprintf(final_string, "Capture %u written, %u dropped", capture.frames_written, capture.frames_dropped);
+                KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 6) * 16, final_string);
+            }
+#ifdef KERO_PROFILE_ALLOCATIONS
+            sprintf(final_string, "%lu allocations, %lu bytes", frame->zone.allocations, frame->zone.allocated_bytes);
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 7) * 16, final_string);
+#endif
+            if (perf_counters)
+            {
+                uint64_t *counters = frame->zone.counters;
+                sprintf(final_string, "%.2f IPC, %.2f %s, %.3f %s, %.3f %s per px", ZoneIPC(&frame->zone), PerPixel(counters[KPROF_COUNTER_L1D_MISSES]), kprof_counter_names[KPROF_COUNTER_L1D_MISSES], PerPixel(counters[KPROF_COUNTER_LLC_MISSES]), kprof_counter_names[KPROF_COUNTER_LLC_MISSES], PerPixel(counters[KPROF_COUNTER_BRANCH_MISSES]), kprof_counter_names[KPROF_COUNTER_BRANCH_MISSES]);
+                KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (frame->num_zones + 8) * 16, final_string);
+            }
             for (int profile_frame_it = 0; profile_frame_it < MAX_PROFILE_FRAMES; ++profile_frame_it)
             {
-                double start_time = profile_frames[profile_frame_it].profiles[0];
-                for (int profile_frame_profile_it = 1; profile_frame_profile_it < profile_frames[profile_frame_it].num_profiles; ++profile_frame_profile_it)
+                kprof_frame_t *old_frame = &profile_frames[profile_frame_it];
+                for (int zone_it = 0; zone_it < old_frame->num_zones; ++zone_it)
                 {
-                    KS_DrawLineVerticalSafe(&render_frame, profile_frame_it * 2, (profile_frames[profile_frame_it].profiles[profile_frame_profile_it - 1] - start_time) * 10, (profile_frames[profile_frame_it].profiles[profile_frame_profile_it] - start_time) * 10, profile_colours[profile_frame_profile_it]);
+                    KS_DrawLineVerticalSafe(&render_frame, profile_frame_it * 2, (old_frame->zones[zone_it].start - old_frame->zone.start) / 1e5, (old_frame->zones[zone_it].end - old_frame->zone.start) / 1e5, profile_colours[(zone_it + 1) % MAX_PROFILE_TIMES]);
                 }
             }
-            ProfileTime("Draw profiles");
+            KPROF_End();
+        }
+        if (draw_counters)
+        {
+            // Bottom left, under the profile graph
+            KPROF_Begin("Draw counters");
+            char lines[10][64];
+            int num_lines = 0;
+            sprintf(lines[num_lines++], "%d World faces", num_world_faces);
+            sprintf(lines[num_lines++], "%d Backface culled", pipeline_counters.backface_culled);
+            sprintf(lines[num_lines++], "%d Near culled", pipeline_counters.near_culled);
+            sprintf(lines[num_lines++], "%d/%d Near clipped to 1/2", pipeline_counters.near_clipped_1, pipeline_counters.near_clipped_2);
+            sprintf(lines[num_lines++], "%d Cam faces", num_cam_faces);
+            sprintf(lines[num_lines++], "%d View faces", num_view_faces);
+            sprintf(lines[num_lines++], "%d Off screen", pipeline_counters.offscreen);
+            sprintf(lines[num_lines++], "%lu Spans", k3d_stats.spans);
+            sprintf(lines[num_lines++], "%lu Pixels tested", k3d_stats.pixels_tested);
+            sprintf(lines[num_lines++], "%lu Pixels written", k3d_stats.pixels_written);
+            for (int line = 0; line < num_lines; ++line)
+            {
+                KF_Draw(&font, &render_frame, 0, render_frame.h - (num_lines - line) * 16, lines[line]);
+            }
+            KPROF_End();
+        }
+#ifdef KERO_3D_DEBUG_OVERDRAW
+        if (overdraw_view)
+        {
+            // Below the profiler overlay when it's shown
+            int row = draw_profiles ? profile_frames[current_profile_frame].num_zones + 9 : 0;
+            k3d_overdraw_summary_t summary;
+            K3D_OverdrawSummarise(&summary);
+            char final_string[128];
+            sprintf(final_string, "%s heatmap, black 0 to white 8+", overdraw_view_names[overdraw_view - 1]);
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, row * 16, final_string);
+            sprintf(final_string, "Overdraw avg %.2f max %d", summary.average[K3D_OVERDRAW_PASSES], summary.max[K3D_OVERDRAW_PASSES]);
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (row + 1) * 16, final_string);
+            sprintf(final_string, "Depth tests avg %.2f max %d", summary.average[K3D_OVERDRAW_TESTS], summary.max[K3D_OVERDRAW_TESTS]);
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (row + 2) * 16, final_string);
+            sprintf(final_string, "Texel fetches avg %.2f max %d", summary.average[K3D_OVERDRAW_FETCHES], summary.max[K3D_OVERDRAW_FETCHES]);
+            KF_Draw(&font, &render_frame, MAX_PROFILE_FRAMES * 2, (row + 3) * 16, final_string);
         }
+#endif
 
 #if 0
         char str[256];
@@ -2493,14 +2840,21 @@ int main(int argc, char *argv[])
         KF_Draw(&font, &render_frame, 0, 0, str);
 #endif
 
-        float frame_scale = Min((float)frame_buffer.h / (float)render_frame.h, (float)frame_buffer.w / (float)render_frame.w);
-        KS_BlitScaled(&render_frame, &frame_buffer, frame_buffer.w / 2, frame_buffer.h / 2, frame_scale, frame_scale, render_frame.w / 2, render_frame.h / 2);
+        KPROF_Begin("Upscale");
+        if (capture_path)
+        {
+            KCAP_Submit(&capture, render_frame.pixels, render_frame.w, render_frame.h);
+        }
+        if (!server_scaling)
+        {
+            UpscaleRenderFrame();
+        }
 
         if (draw_framerate)
         {
             char str[256];
             sprintf(str, "%.0f", 1.f / platform.delta);
-            KF_Draw(&font, &frame_buffer, frame_buffer.w - 48, 0, str);
+            KF_Draw(&font, hud_frame, hud_frame->w - 48, 0, str);
         }
 
         for (int i = 0; i < top_message; ++i)
@@ -2518,26 +2872,44 @@ int main(int argc, char *argv[])
             }
             else
             {
-                KF_Draw(&font, &frame_buffer, 0, i * 16, player_messages[i].text);
+                KF_Draw(&font, hud_frame, 0, i * 16, player_messages[i].text);
             }
         }
+        KPROF_End();
 
-        KP_Flip(&platform);
+        KPROF_Begin("Present");
+        if (server_scaling && !KP_PresentScaled(&platform, render_frame.pixels, render_frame.w, render_frame.h, server_scaling_bilinear))
+        {
+            server_scaling = false;
+            PlayerMessage("Server scaling unavailable");
+            // The frame buffer was neither cleared nor drawn this frame. The HUD is already on the render frame.
+            KS_Clear(&frame_buffer);
+            UpscaleRenderFrame();
+        }
+        if (!server_scaling)
+        {
+            KP_Present(&platform);
+            SyncFrameBuffer();
+        }
+        KPROF_End();
+
+        KPROF_Begin("Flip");
+        KP_LimitFramerate(&platform);
+        KPROF_End();
+        KPROF_End();
+        FrameEnd();
 
+        // Outside the Frame zone, so time spent in the menu or under AI control isn't counted as a game frame
         if (auto_launch_menu)
         {
             Menu();
         }
-
-        ProfileTime("Flip");
-        new_profile_frame.num_profiles = current_profile_time;
-        for (int profile_it = 0; profile_it < current_profile_time; ++profile_it)
+        if (ai_control)
         {
-            new_profile_frame.profiles[profile_it] = profile_times[profile_it];
+            AILoop();
         }
-        current_profile_frame = (current_profile_frame + 1) % MAX_PROFILE_FRAMES;
-        current_profile_time = 0;
     }
 
     return 0;
 }
+#endif
@@ -0,0 +1,718 @@
+// Rasterizer microbenchmark. Build with build-raster-bench.sh.
+// Drives K3D_DrawTriangle, K3D_DrawTriangleTextured and the scanline kernels with synthetic triangles and spans from a fixed seed,
+// at every internal resolution the game offers, so rasterizer changes can be measured without the rest of the renderer.
+//
+// raster-bench [-kernels flat,textured,alpha,scanline,scanline-textured,scanline-alpha] [-workloads tiny,thin,large,screen,wall,floor,spans]
+//              [-resolution WxH] [-seed 1] [-time 0.25] [-o results.csv] [-verify]
+//
+// Writes one CSV row per resolution, kernel and workload. Triangle kernels run the triangle workloads and scanline kernels run the spans.
+// pixels is the number of pixels the kernel visits per pass, whether or not they pass the depth and alpha tests.
+// Throughput comes from the fastest pass. Cycles are time stamp counter ticks, which run at a fixed rate rather than the core clock.
+//
+// -verify draws every workload with the library kernels and with the reference kernels below instead of timing them,
+// and reports every pixel and depth value that differs. Exits with 1 if any do.
+#include "kero_software_3d.h"
+#include "kero_math.h"
+#include "kero_platform.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum
+{
+    KERNEL_FLAT,
+    KERNEL_TEXTURED,
+    KERNEL_ALPHA,
+    KERNEL_SCANLINE,
+    KERNEL_SCANLINE_TEXTURED,
+    KERNEL_SCANLINE_ALPHA,
+    NUM_KERNELS
+};
+const char *kernel_names[NUM_KERNELS] = {"flat", "textured", "alpha", "scanline", "scanline-textured", "scanline-alpha"};
+
+enum
+{
+    WORKLOAD_TINY,
+    WORKLOAD_THIN,
+    WORKLOAD_LARGE,
+    WORKLOAD_SCREEN,
+    WORKLOAD_WALL,
+    WORKLOAD_FLOOR,
+    WORKLOAD_SPANS,
+    NUM_WORKLOADS
+};
+const char *workload_names[NUM_WORKLOADS] = {"tiny", "thin", "large", "screen", "wall", "floor", "spans"};
+
+// Same list as the game's options menu
+int internal_resolutions[][2] = {
+    {320, 240},
+    {640, 480},
+    {800, 600},
+    {1024, 768},
+    {1280, 1024},
+    {320, 180},
+    {640, 360},
+    {1280, 720},
+    {1920, 1080},
+};
+int num_internal_resolutions = 9;
+
+typedef struct
+{
+    vec3_t v[3]; // Screen space x and y, z is 1/distance like the renderer's view faces
+    vec2_t uv[3]; // Already divided by distance
+    uint32_t c;
+} raster_triangle_t;
+
+typedef struct
+{
+    int y, x0, x1;
+    float z0, z1, u0, u1, v0, v1;
+    uint32_t c;
+} raster_span_t;
+
+typedef struct
+{
+    int num_triangles;
+    raster_triangle_t *triangles;
+    int num_spans;
+    raster_span_t *spans;
+} raster_workload_t;
+
+ksprite_t opaque_texture, alpha_texture;
+
+// ----- Reference kernels -----
+// Straight copies of the library kernels as they were when this benchmark was written.
+// An optimised kernel has to draw exactly what these do, which -verify checks.
+
+void RefScanLine(ksprite_t *dest, float *depth_buffer, int y, int x0, float z0, int x1, float z1, uint32_t pixel)
+{
+    if (x0 > x1)
+    {
+        KS_Swap(int, x0, x1);
+        KS_Swap(float, z0, z1);
+    }
+    if (x1 < 0 || x0 > dest->w - 1)
+        return;
+    int left = Max(0, x0);
+    int right = Min(dest->w - 1, x1);
+    for (int x = left; x <= right; ++x)
+    {
+        float z = z0 + (z1 - z0) * (((float)x - x0) / (x1 - x0 + 0.0001f));
+        if (z > depth_buffer[x + y * dest->w])
+        {
+            dest->pixels[x + y * dest->w] = pixel;
+            depth_buffer[x + y * dest->w] = z;
+        }
+    }
+}
+
+void RefScanLineTextured(ksprite_t *dest, float *depth_buffer, ksprite_t *texture, int y, int x0, float z0, int x1, float z1, float u0, float u1, float v0, float v1)
+{
+    if (y < 0 || y > dest->h - 1)
+        return;
+    if (x0 > x1)
+    {
+        KS_Swap(int, x0, x1);
+        if (x1 < 0 || x0 > dest->w - 1)
+            return;
+        KS_Swap(float, z0, z1);
+        KS_Swap(float, u0, u1);
+        KS_Swap(float, v0, v1);
+    }
+    int left = Max(0, x0);
+    int right = Min(dest->w - 1, x1);
+    float skip = left - x0;
+    float xfrac = 1.f / (x1 - x0 + 0.0001f);
+    float zstep = (z1 - z0) * xfrac;
+    float ustep = (u1 - u0) * xfrac;
+    float vstep = (v1 - v0) * xfrac;
+    float z = z0 + zstep * skip;
+    float u = u0 + ustep * skip;
+    float v = v0 + vstep * skip;
+    for (int x = left; x <= right; ++x)
+    {
+        uint32_t pixel = KS_SampleWrapped(texture, u / z, v / z);
+        if ((pixel >> 24) > 0 && z > depth_buffer[x + y * dest->w])
+        {
+            dest->pixels[x + y * dest->w] = pixel;
+            depth_buffer[x + y * dest->w] = z;
+        }
+        z += zstep;
+        u += ustep;
+        v += vstep;
+    }
+}
+
+void RefDrawTriangle(ksprite_t *dest, float *depth_buffer, vec3_t a, vec3_t b, vec3_t c, uint32_t color)
+{
+    if (a.y > b.y)
+        KS_Swap(vec3_t, a, b);
+    if (b.y > c.y)
+        KS_Swap(vec3_t, b, c);
+    if (a.y > b.y)
+        KS_Swap(vec3_t, a, b);
+    if (b.y > a.y)
+    {
+        for (int y = KS_Max(a.y, 0); y <= KS_Min(b.y, dest->h - 1); ++y)
+        {
+            float fracb = ((KS_Max((float)y, a.y) - a.y) / (b.y - a.y));
+            float fracc = ((KS_Max((float)y, a.y) - a.y) / (c.y - a.y));
+            RefScanLine(dest, depth_buffer, y, a.x + (b.x - a.x) * fracb, a.z + (b.z - a.z) * fracb, a.x + (c.x - a.x) * fracc, a.z + (c.z - a.z) * fracc, color);
+        }
+    }
+    if (c.y > b.y)
+    {
+        for (int y = KS_Max(b.y, 0); y <= KS_Min(c.y, dest->h - 1); ++y)
+        {
+            float fraca = ((KS_Max((float)y, b.y) - a.y) / (c.y - a.y));
+            float fracb = ((KS_Max((float)y, b.y) - b.y) / (c.y - b.y));
+            RefScanLine(dest, depth_buffer, y, a.x + (c.x - a.x) * fraca, a.z + (c.z - a.z) * fraca, b.x + (c.x - b.x) * fracb, b.z + (c.z - b.z) * fracb, color);
+        }
+    }
+}
+
+void RefDrawTriangleTextured(ksprite_t *dest, float *depth_buffer, ksprite_t *texture, vec3_t a, vec3_t b, vec3_t c, vec2_t uv[3])
+{
+    if (a.y > b.y)
+    {
+        KS_Swap(vec3_t, a, b);
+        KS_Swap(vec2_t, uv[0], uv[1]);
+    }
+    if (b.y > c.y)
+    {
+        KS_Swap(vec3_t, b, c);
+        KS_Swap(vec2_t, uv[1], uv[2]);
+    }
+    if (a.y > b.y)
+    {
+        KS_Swap(vec3_t, a, b);
+        KS_Swap(vec2_t, uv[0], uv[1]);
+    }
+    if (b.y > a.y)
+    {
+        int y2 = KS_Min(b.y, dest->h - 1);
+        for (int y = KS_Max(a.y, 0); y <= y2; ++y)
+        {
+            float fracab = (KS_Max(y, a.y) - a.y) / (b.y - a.y), fracac = (KS_Max(y, a.y) - a.y) / (c.y - a.y);
+            RefScanLineTextured(dest, depth_buffer, texture, y, a.x + (b.x - a.x) * fracab, a.z + (b.z - a.z) * fracab, a.x + (c.x - a.x) * fracac, a.z + (c.z - a.z) * fracac,
+                                uv[0].u + (uv[1].u - uv[0].u) * fracab, uv[0].u + (uv[2].u - uv[0].u) * fracac, uv[0].v + (uv[1].v - uv[0].v) * fracab, uv[0].v + (uv[2].v - uv[0].v) * fracac);
+        }
+    }
+    if (c.y > b.y)
+    {
+        int y2 = KS_Min(c.y, dest->h);
+        for (int y = KS_Max(b.y, 0); y < y2; ++y)
+        {
+            float fracac = (KS_Max(y, b.y) - a.y) / (c.y - a.y), fracbc = (KS_Max(y, b.y) - b.y) / (c.y - b.y);
+            RefScanLineTextured(dest, depth_buffer, texture, y, a.x + (c.x - a.x) * fracac, a.z + (c.z - a.z) * fracac, b.x + (c.x - b.x) * fracbc, b.z + (c.z - b.z) * fracbc,
+                                uv[0].u + (uv[2].u - uv[0].u) * fracac, uv[1].u + (uv[2].u - uv[1].u) * fracbc, uv[0].v + (uv[2].v - uv[0].v) * fracac, uv[1].v + (uv[2].v - uv[1].v) * fracbc);
+        }
+    }
+}
+
+// ----- Workloads -----
+
+float RasterRandom(float min, float max)
+{
+    return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+uint32_t RasterRandomColour()
+{
+    return 0xff000000 | ((rand() & 0xff) << 16) | ((rand() & 0xff) << 8) | (rand() & 0xff);
+}
+
+// distance is how far away the vertex would be from the camera, like the renderer's NEAR_Z to FAR_Z
+void RasterVertex(raster_triangle_t *triangle, int i, float x, float y, float distance, float u, float v)
+{
+    triangle->v[i] = Vec3Make(x, y, 1.f / distance);
+    triangle->uv[i].u = u / distance;
+    triangle->uv[i].v = v / distance;
+}
+
+raster_triangle_t *RasterAddTriangle(raster_workload_t *workload)
+{
+    raster_triangle_t *triangle = &workload->triangles[workload->num_triangles++];
+    triangle->c = RasterRandomColour();
+    return triangle;
+}
+
+// Two triangles from corners given clockwise, each with its own distance
+void RasterAddQuad(raster_workload_t *workload, vec2_t p[4], float distance[4])
+{
+    const float u[4] = {0, 1, 1, 0}, v[4] = {0, 0, 1, 1};
+    const int corners[2][3] = {{0, 1, 2}, {0, 2, 3}};
+    uint32_t c = RasterRandomColour();
+    for (int t = 0; t < 2; ++t)
+    {
+        raster_triangle_t *triangle = RasterAddTriangle(workload);
+        triangle->c = c;
+        for (int i = 0; i < 3; ++i)
+        {
+            int corner = corners[t][i];
+            RasterVertex(triangle, i, p[corner].x, p[corner].y, distance[corner], u[corner], v[corner]);
+        }
+    }
+}
+
+void RasterCreateWorkload(raster_workload_t *workload, int type, int w, int h)
+{
+    const int capacities[NUM_WORKLOADS] = {20000, 4000, 200, 16, 800, 400, 0};
+    workload->num_triangles = workload->num_spans = 0;
+    workload->triangles = malloc(sizeof(raster_triangle_t) * Max(1, capacities[type]));
+    workload->spans = 0;
+    switch (type)
+    {
+    case WORKLOAD_TINY:
+    {
+        // A few pixels across, like distant geometry
+        while (workload->num_triangles < capacities[type])
+        {
+            raster_triangle_t *triangle = RasterAddTriangle(workload);
+            float x = RasterRandom(0, w), y = RasterRandom(0, h), distance = RasterRandom(20, 50);
+            for (int i = 0; i < 3; ++i)
+            {
+                RasterVertex(triangle, i, x + RasterRandom(-2, 2), y + RasterRandom(-2, 2), distance + RasterRandom(-1, 1), RasterRandom(0, 1), RasterRandom(0, 1));
+            }
+        }
+    }
+    break;
+    case WORKLOAD_THIN:
+    {
+        // Slivers up to half the screen long and one or two pixels wide, at every angle
+        while (workload->num_triangles < capacities[type])
+        {
+            raster_triangle_t *triangle = RasterAddTriangle(workload);
+            float x = RasterRandom(0, w), y = RasterRandom(0, h), angle = RasterRandom(0, TWOPI);
+            float length = RasterRandom(0.1f, 0.5f) * w, width = RasterRandom(0.5f, 2.f);
+            float dx = cosf(angle), dy = sinf(angle);
+            RasterVertex(triangle, 0, x, y, RasterRandom(1, 50), 0, 0);
+            RasterVertex(triangle, 1, x + dx * length, y + dy * length, RasterRandom(1, 50), 1, 0);
+            RasterVertex(triangle, 2, x - dy * width, y + dx * width, RasterRandom(1, 50), 0, 1);
+        }
+    }
+    break;
+    case WORKLOAD_LARGE:
+    {
+        // Corners anywhere on screen
+        while (workload->num_triangles < capacities[type])
+        {
+            raster_triangle_t *triangle = RasterAddTriangle(workload);
+            for (int i = 0; i < 3; ++i)
+            {
+                RasterVertex(triangle, i, RasterRandom(0, w), RasterRandom(0, h), RasterRandom(1, 50), RasterRandom(0, 4), RasterRandom(0, 4));
+            }
+        }
+    }
+    break;
+    case WORKLOAD_SCREEN:
+    {
+        // Quads a little bigger than the screen so every edge is clipped, like standing right up against a wall
+        while (workload->num_triangles < capacities[type])
+        {
+            vec2_t p[4] = {Vec2Make(-0.1f * w, -0.1f * h), Vec2Make(1.1f * w, -0.1f * h), Vec2Make(1.1f * w, 1.1f * h), Vec2Make(-0.1f * w, 1.1f * h)};
+            float distance[4];
+            for (int i = 0; i < 4; ++i)
+            {
+                distance[i] = RasterRandom(1, 3);
+            }
+            RasterAddQuad(workload, p, distance);
+        }
+    }
+    break;
+    case WORKLOAD_WALL:
+    {
+        // Vertical edges whose height shrinks with distance, centred on the horizon like the maze walls
+        while (workload->num_triangles < capacities[type])
+        {
+            float x0 = RasterRandom(-0.2f * w, w), x1 = x0 + RasterRandom(0.02f, 0.5f) * w;
+            float distance[4];
+            distance[0] = distance[3] = RasterRandom(1, 30);
+            distance[1] = distance[2] = RasterRandom(1, 30);
+            float half0 = h / distance[0], half1 = h / distance[1];
+            vec2_t p[4] = {Vec2Make(x0, h / 2.f - half0), Vec2Make(x1, h / 2.f - half1), Vec2Make(x1, h / 2.f + half1), Vec2Make(x0, h / 2.f + half0)};
+            RasterAddQuad(workload, p, distance);
+        }
+    }
+    break;
+    case WORKLOAD_FLOOR:
+    {
+        // Horizontal edges below the horizon that narrow with distance, like the floor of a corridor
+        while (workload->num_triangles < capacities[type])
+        {
+            float centre = RasterRandom(0, w);
+            float distance[4];
+            distance[0] = distance[1] = RasterRandom(1, 10);
+            distance[2] = distance[3] = distance[0] + RasterRandom(1, 10);
+            float near_y = h / 2.f + h / distance[0], far_y = h / 2.f + h / distance[2];
+            float near_half = w / distance[0], far_half = w / distance[2];
+            vec2_t p[4] = {Vec2Make(centre - near_half, near_y), Vec2Make(centre + near_half, near_y), Vec2Make(centre + far_half, far_y), Vec2Make(centre - far_half, far_y)};
+            RasterAddQuad(workload, p, distance);
+        }
+    }
+    break;
+    case WORKLOAD_SPANS:
+    {
+        // Half short spans, half up to the screen width, some hanging off either side
+        workload->num_spans = 4 * h;
+        workload->spans = malloc(sizeof(raster_span_t) * workload->num_spans);
+        for (int i = 0; i < workload->num_spans; ++i)
+        {
+            raster_span_t *span = &workload->spans[i];
+            float length = i % 2 ? RasterRandom(1, 16) : RasterRandom(16, w);
+            float z0 = 1.f / RasterRandom(1, 50), z1 = 1.f / RasterRandom(1, 50);
+            span->y = rand() % h;
+            span->x0 = RasterRandom(-0.1f * w, w);
+            span->x1 = span->x0 + length;
+            if (rand() % 2)
+            {
+                KS_Swap(int, span->x0, span->x1);
+            }
+            span->z0 = z0;
+            span->z1 = z1;
+            span->u0 = 0;
+            span->u1 = length / 16.f * z1;
+            span->v0 = RasterRandom(0, 1) * z0;
+            span->v1 = RasterRandom(0, 1) * z1;
+            span->c = RasterRandomColour();
+        }
+    }
+    break;
+    }
+}
+
+// ----- Running -----
+
+bool KernelUsesSpans(int kernel)
+{
+    return kernel >= KERNEL_SCANLINE;
+}
+
+ksprite_t *KernelTexture(int kernel)
+{
+    return kernel == KERNEL_ALPHA || kernel == KERNEL_SCANLINE_ALPHA ? &alpha_texture : &opaque_texture;
+}
+
+// Draw the whole workload with one kernel. Triangle uvs are copied because the textured kernels reorder them.
+void RasterDraw(int kernel, bool reference, raster_workload_t *workload, ksprite_t *dest, float *depth_buffer)
+{
+    ksprite_t *texture = KernelTexture(kernel);
+    switch (kernel)
+    {
+    case KERNEL_FLAT:
+    {
+        for (int i = 0; i < workload->num_triangles; ++i)
+        {
+            raster_triangle_t *t = &workload->triangles[i];
+            if (reference)
+                RefDrawTriangle(dest, depth_buffer, t->v[0], t->v[1], t->v[2], t->c);
+            else
+                K3D_DrawTriangle(dest, depth_buffer, t->v[0], t->v[1], t->v[2], t->c);
+        }
+    }
+    break;
+    case KERNEL_TEXTURED:
+    case KERNEL_ALPHA:
+    {
+        for (int i = 0; i < workload->num_triangles; ++i)
+        {
+            raster_triangle_t *t = &workload->triangles[i];
+            vec2_t uv[3] = {t->uv[0], t->uv[1], t->uv[2]};
+            if (reference)
+                RefDrawTriangleTextured(dest, depth_buffer, texture, t->v[0], t->v[1], t->v[2], uv);
+            else
+                K3D_DrawTriangleTextured(dest, depth_buffer, texture, t->v[0], t->v[1], t->v[2], uv);
+        }
+    }
+    break;
+    case KERNEL_SCANLINE:
+    {
+        for (int i = 0; i < workload->num_spans; ++i)
+        {
+            raster_span_t *s = &workload->spans[i];
+            if (reference)
+                RefScanLine(dest, depth_buffer, s->y, s->x0, s->z0, s->x1, s->z1, s->c);
+            else
+                K3D_ScanLine(dest, depth_buffer, s->y, s->x0, s->z0, s->x1, s->z1, s->c);
+        }
+    }
+    break;
+    case KERNEL_SCANLINE_TEXTURED:
+    case KERNEL_SCANLINE_ALPHA:
+    {
+        for (int i = 0; i < workload->num_spans; ++i)
+        {
+            raster_span_t *s = &workload->spans[i];
+            if (reference)
+                RefScanLineTextured(dest, depth_buffer, texture, s->y, s->x0, s->z0, s->x1, s->z1, s->u0, s->u1, s->v0, s->v1);
+            else
+                K3D_ScanLineTextured(dest, depth_buffer, texture, s->y, s->x0, s->z0, s->x1, s->z1, s->u0, s->u1, s->v0, s->v1);
+        }
+    }
+    break;
+    }
+}
+
+// Pixels visited by one pass. Each triangle is drawn alone onto a clear depth buffer, where every visited pixel passes the depth test,
+// and the opaque texture stands in for the alpha tested one so no pixel is skipped.
+uint64_t RasterCountPixels(int kernel, raster_workload_t *workload, ksprite_t *dest, float *depth_buffer)
+{
+    uint64_t pixels = 0;
+    if (KernelUsesSpans(kernel))
+    {
+        for (int i = 0; i < workload->num_spans; ++i)
+        {
+            raster_span_t *s = &workload->spans[i];
+            int left = Max(0, Min(s->x0, s->x1)), right = Min(dest->w - 1, Max(s->x0, s->x1));
+            pixels += Max(0, right - left + 1);
+        }
+        return pixels;
+    }
+    memset(depth_buffer, 0, sizeof(float) * dest->w * dest->h);
+    for (int i = 0; i < workload->num_triangles; ++i)
+    {
+        raster_triangle_t *t = &workload->triangles[i];
+        vec2_t uv[3] = {t->uv[0], t->uv[1], t->uv[2]};
+        if (kernel == KERNEL_FLAT)
+            K3D_DrawTriangle(dest, depth_buffer, t->v[0], t->v[1], t->v[2], t->c);
+        else
+            K3D_DrawTriangleTextured(dest, depth_buffer, &opaque_texture, t->v[0], t->v[1], t->v[2], uv);
+        // Only the triangle's bounding box, plus a pixel for rounding, can have been touched
+        int left = Max(0, (int)floorf(Min(t->v[0].x, Min(t->v[1].x, t->v[2].x))) - 1);
+        int right = Min(dest->w - 1, (int)ceilf(Max(t->v[0].x, Max(t->v[1].x, t->v[2].x))) + 1);
+        int top = Max(0, (int)floorf(Min(t->v[0].y, Min(t->v[1].y, t->v[2].y))) - 1);
+        int bottom = Min(dest->h - 1, (int)ceilf(Max(t->v[0].y, Max(t->v[1].y, t->v[2].y))) + 1);
+        for (int y = top; y <= bottom; ++y)
+        {
+            for (int x = left; x <= right; ++x)
+            {
+                pixels += depth_buffer[x + y * dest->w] != 0;
+                depth_buffer[x + y * dest->w] = 0;
+            }
+        }
+    }
+    return pixels;
+}
+
+uint64_t RasterCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void RasterClear(ksprite_t *dest, float *depth_buffer)
+{
+    memset(dest->pixels, 0, sizeof(uint32_t) * dest->w * dest->h);
+    memset(depth_buffer, 0, sizeof(float) * dest->w * dest->h);
+}
+
+// Draw with the library and reference kernels and count the pixels whose colour or depth differ
+uint64_t RasterVerify(int kernel, int type, raster_workload_t *workload, ksprite_t *dest, float *depth_buffer, ksprite_t *reference, float *reference_depth)
+{
+    RasterClear(dest, depth_buffer);
+    RasterClear(reference, reference_depth);
+    RasterDraw(kernel, false, workload, dest, depth_buffer);
+    RasterDraw(kernel, true, workload, reference, reference_depth);
+    uint64_t mismatches = 0;
+    for (int i = 0; i < dest->w * dest->h; ++i)
+    {
+        // Depth is compared bit for bit, kernels have to round the same way too
+        if (dest->pixels[i] != reference->pixels[i] || memcmp(&depth_buffer[i], &reference_depth[i], sizeof(float)))
+        {
+            if (!mismatches)
+            {
+                fprintf(stderr, "%dx%d %s %s: first mismatch at %d,%d colour %08x expected %08x depth %g expected %g\n", dest->w, dest->h, kernel_names[kernel], workload_names[type], i % dest->w, i / dest->w,
+                        dest->pixels[i], reference->pixels[i], depth_buffer[i], reference_depth[i]);
+            }
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Procedural textures so the benchmark doesn't depend on the working directory. Every other 8x8 block of the alpha texture is transparent.
+void RasterCreateTextures()
+{
+    KS_Create(&opaque_texture, 64, 64);
+    KS_Create(&alpha_texture, 64, 64);
+    for (int y = 0; y < 64; ++y)
+    {
+        for (int x = 0; x < 64; ++x)
+        {
+            uint32_t colour = 0xff000000 | ((x * 4) << 16) | ((y * 4) << 8) | ((x ^ y) * 4 & 0xff);
+            opaque_texture.pixels[x + y * 64] = colour;
+            alpha_texture.pixels[x + y * 64] = ((x / 8 + y / 8) % 2) ? colour & 0x00ffffff : colour;
+        }
+    }
+}
+
+bool RasterParseNames(char *text, const char **names, int num_names, bool *enabled)
+{
+    for (int i = 0; i < num_names; ++i)
+    {
+        enabled[i] = false;
+    }
+    for (char *name = strtok(text, ","); name; name = strtok(NULL, ","))
+    {
+        int i = 0;
+        while (i < num_names && strcmp(name, names[i]))
+            ++i;
+        if (i == num_names)
+        {
+            fprintf(stderr, "Unknown name %s\n", name);
+            return false;
+        }
+        enabled[i] = true;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool run_kernel[NUM_KERNELS], run_workload[NUM_WORKLOADS];
+    for (int i = 0; i < NUM_KERNELS; ++i)
+        run_kernel[i] = true;
+    for (int i = 0; i < NUM_WORKLOADS; ++i)
+        run_workload[i] = true;
+    int resolutions[1][2];
+    int (*run_resolutions)[2] = internal_resolutions;
+    int num_resolutions = num_internal_resolutions;
+    unsigned int seed = 1;
+    double min_time = 0.25;
+    bool verify = false;
+    const char *output_path = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "-kernels") && i + 1 < argc)
+        {
+            if (!RasterParseNames(argv[++i], kernel_names, NUM_KERNELS, run_kernel))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "-workloads") && i + 1 < argc)
+        {
+            if (!RasterParseNames(argv[++i], workload_names, NUM_WORKLOADS, run_workload))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "-resolution") && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &resolutions[0][0], &resolutions[0][1]) != 2 || resolutions[0][0] < 1 || resolutions[0][1] < 1)
+            {
+                fprintf(stderr, "Resolution must be given as WIDTHxHEIGHT\n");
+                return -1;
+            }
+            run_resolutions = resolutions;
+            num_resolutions = 1;
+        }
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+        {
+            seed = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "-time") && i + 1 < argc)
+        {
+            min_time = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+        {
+            output_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-verify"))
+        {
+            verify = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    FILE *output = stdout;
+    if (output_path && !(output = fopen(output_path, "w")))
+    {
+        fprintf(stderr, "Failed to open %s\n", output_path);
+        return -1;
+    }
+    RasterCreateTextures();
+    if (verify)
+        fprintf(output, "width,height,kernel,workload,pixels,mismatches\n");
+    else
+        fprintf(output, "width,height,kernel,workload,primitives,pixels,passes,best ms,Mpixels/s,Mprimitives/s,cycles/pixel\n");
+
+    uint64_t total_mismatches = 0;
+    for (int resolution = 0; resolution < num_resolutions; ++resolution)
+    {
+        int w = run_resolutions[resolution][0], h = run_resolutions[resolution][1];
+        ksprite_t dest, reference;
+        KS_Create(&dest, w, h);
+        KS_Create(&reference, w, h);
+        float *depth_buffer = malloc(sizeof(float) * w * h);
+        float *reference_depth = malloc(sizeof(float) * w * h);
+
+        for (int type = 0; type < NUM_WORKLOADS; ++type)
+        {
+            if (!run_workload[type])
+                continue;
+            // Seeded per resolution and workload so running a subset draws the same triangles
+            srand(seed);
+            raster_workload_t workload;
+            RasterCreateWorkload(&workload, type, w, h);
+
+            for (int kernel = 0; kernel < NUM_KERNELS; ++kernel)
+            {
+                if (!run_kernel[kernel] || KernelUsesSpans(kernel) != (type == WORKLOAD_SPANS))
+                    continue;
+                uint64_t pixels = RasterCountPixels(kernel, &workload, &dest, depth_buffer);
+                int primitives = KernelUsesSpans(kernel) ? workload.num_spans : workload.num_triangles;
+                if (verify)
+                {
+                    uint64_t mismatches = RasterVerify(kernel, type, &workload, &dest, depth_buffer, &reference, reference_depth);
+                    fprintf(output, "%d,%d,%s,%s,%lu,%lu\n", w, h, kernel_names[kernel], workload_names[type], pixels, mismatches);
+                    total_mismatches += mismatches;
+                    continue;
+                }
+
+                // Passes start from clear buffers, so each one draws exactly the same pixels
+                uint64_t best_time = UINT64_MAX, best_cycles = 0, total_time = 0;
+                int passes = 0;
+                while (passes < 3 || total_time < min_time * 1e9)
+                {
+                    RasterClear(&dest, depth_buffer);
+                    uint64_t start = KP_ClockNs(), start_cycles = RasterCycles();
+                    RasterDraw(kernel, false, &workload, &dest, depth_buffer);
+                    uint64_t cycles = RasterCycles() - start_cycles, time = KP_ClockNs() - start;
+                    if (time < best_time)
+                    {
+                        best_time = time;
+                        best_cycles = cycles;
+                    }
+                    total_time += time;
+                    ++passes;
+                }
+                double seconds = Max(best_time, 1) / 1e9;
+                fprintf(output, "%d,%d,%s,%s,%d,%lu,%d,%.4f,%.2f,%.4f,%.2f\n", w, h, kernel_names[kernel], workload_names[type], primitives, pixels, passes, seconds * 1e3, pixels / seconds / 1e6,
+                        primitives / seconds / 1e6, pixels ? (double)best_cycles / pixels : 0.0);
+                fflush(output);
+            }
+            free(workload.triangles);
+            free(workload.spans);
+        }
+        KS_Free(&dest);
+        KS_Free(&reference);
+        free(depth_buffer);
+        free(reference_depth);
+    }
+
+    if (output != stdout)
+        fclose(output);
+    if (verify)
+    {
+        fprintf(stderr, total_mismatches ? "%lu pixels differ from the reference kernels\n" : "All kernels match the reference kernels\n", total_mismatches);
+        return total_mismatches ? 1 : 0;
+    }
+    return 0;
+}